@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "zep/glyph_iterator.h"
+
+namespace Zep {
+
+struct TextStorage;
+struct BracketIndexNode;
+
+// The brackets in the code of a buffer, leaving out the ones in strings and comments, for finding the pairs around
+// a location.  Strings and comments follow the rules of the syntax highlighter, except that a quote only starts a
+// string after something that isn't part of a word, and never in a Lisp, where it quotes the form after it.
+// Each type of bracket nests on its own, as the rainbow brackets do.
+// The brackets are kept in a treap by offset.  Each node holds, for each type of bracket, the net change in depth
+// over its subtree, the lowest it dips from the start and the highest it rises back from the end, so the pair of a
+// bracket, or the ones around a location, are found on one walk down the tree.
+// An edit moves the brackets after it with a lazy shift.  The text it touched is scanned again when the index is
+// next asked for, until the scan reaches a bracket it had before, in code; the rest was found from the same state.
+class ZepBracketIndex {
+public:
+    ZepBracketIndex() = default;
+    ZepBracketIndex(const ZepBracketIndex &) = delete;
+    ZepBracketIndex &operator=(const ZepBracketIndex &) = delete;
+    ~ZepBracketIndex();
+
+    // Keep in step with the edits to the text
+    void Insert(ByteIndex start, ByteIndex length);
+    void Erase(ByteIndex start, ByteIndex end);
+    void Changed(ByteIndex start, ByteIndex end);
+    void Reset();
+
+    // Scan what was edited since the last update.  The rules for comments are the Lisp ones if 'lilike'
+    void Update(const TextStorage &text, bool lilike);
+
+    // The offsets of the brackets, in order
+    std::vector<ByteIndex> GetBrackets() const;
+
+    // The first bracket at or after the offset, or -1
+    ByteIndex FindNext(ByteIndex offset) const;
+
+    // The bracket which pairs with the one at the offset, or -1
+    ByteIndex FindPair(ByteIndex offset) const;
+
+    // The innermost pair of the type of 'ch' around the offset, as the offsets of its brackets; the close is -1 if
+    // it is never closed, unless 'matched' passes over those.  A bracket is inside its own pair
+    ByteRange FindEnclosing(ByteIndex offset, uint8_t ch, bool matched = false) const;
+
+    // The outermost matched pair of the type around the offset, or -1s
+    ByteRange FindTopLevel(ByteIndex offset, uint8_t ch) const;
+
+    // For an offset outside the pairs of the type, the ones either side of it which start or end closest to it
+    ByteRange FindNearestTopLevel(ByteIndex offset, uint8_t ch) const;
+
+    static bool IsOpen(uint8_t ch) { return ch == '(' || ch == '[' || ch == '{'; }
+    static bool IsClose(uint8_t ch) { return ch == ')' || ch == ']' || ch == '}'; }
+
+    // How many brackets some code leaves open, as the repl checks a form; negative if some close nothing
+    static int FormDepth(const std::string &text, bool lilike);
+
+private:
+    ByteIndex FindOpen(ByteIndex limit, int type, int level) const;
+    ByteIndex FindClose(ByteIndex open, int type) const;
+
+    BracketIndexNode *m_pRoot = nullptr;
+    uint32_t m_random = 0x9E3779B9;
+    ByteIndex m_dirtyStart = 0; // The edited text to scan again is in [m_dirtyStart, m_dirtyEnd)
+    ByteIndex m_dirtyEnd = 0;
+    bool m_lilike = false;
+};
+
+} // namespace Zep
@@ -10,14 +10,17 @@
 
 #include "zep/glyph_iterator.h"
 
+#include "zep/bracket_index.h"
 #include "zep/editor.h"
 #include "zep/range_markers.h"
+#include "zep/text_storage.h"
 
 #include "../../../lib/imgui/imgui.h"
 
 namespace Zep {
 
 struct ZepSyntax;
+struct ZepBufferSearch;
 struct ZepTheme;
 struct ZepMode;
 enum class ThemeColor;
@@ -88,12 +91,43 @@ struct ChangeRecord {
     }
 };
 
+// The byte offset just past the end of each line.
+// An edit shifts every line end after it; the shift is held as a step and applied lazily as later edits
+// move through the lines, so edits close to each other don't touch the rest of the file.
+struct LineIndex {
+    long Count() const { return long(m_ends.size()); }
+    ByteIndex operator[](long line) const { return m_ends[line] + (line >= m_stepLine ? m_stepBytes : 0); }
+
+    void Clear();
+    void PushBack(ByteIndex end);
+
+    // Replace all the line ends; quicker than pushing them one at a time, which grows the gap each time it fills
+    void Assign(const std::vector<ByteIndex> &ends);
+
+    // The first line ending after this byte, i.e. the line holding it (Count() if past the last line)
+    long FindLine(ByteIndex index) const;
+
+    // Shift the lines after 'index' along by 'count' bytes, then add the ends of any new lines in the inserted text
+    void Insert(ByteIndex index, ByteIndex count, const std::vector<ByteIndex> &newEnds);
+
+    // Remove the line ends in (begin, end] and shift the lines after them back
+    void Erase(ByteIndex begin, ByteIndex end);
+
+private:
+    void MoveStep(long line);
+
+    GapBuffer<ByteIndex> m_ends;
+    long m_stepLine = 0;     // Lines from here on have not had the step added to their end
+    ByteIndex m_stepBytes = 0;
+};
+
 struct ZepBuffer : public ZepComponent {
     ZepBuffer(ZepEditor &editor, std::string strName);
     ZepBuffer(ZepEditor &editor, const ZepPath &path);
 
     void Clear();
     void SetText(const std::string &strText, bool initFromFile = false);
+    void SetText(const uint8_t *pBegin, const uint8_t *pEnd, bool initFromFile = false);
     void Load(const ZepPath &path);
     bool Save(int64_t &size);
 
@@ -157,6 +191,7 @@ struct ZepBuffer : public ZepComponent {
     void ClearRangeMarkers(uint32_t types);
     tRangeMarkers GetRangeMarkers(uint32_t types) const;
     tRangeMarkers GetRangeMarkersOnLine(uint32_t types, long line) const;
+    LineRangeMarkers GetRangeMarkersOnLines(uint32_t types, long firstLine, long lastLine) const;
     void HideMarkers(uint32_t markerType) const;
     void ShowMarkers(uint32_t markerType, uint32_t displayType) const;
 
@@ -173,6 +208,11 @@ struct ZepBuffer : public ZepComponent {
     void SetFileFlags(uint32_t flags, bool set = true);
     void ToggleFileFlag(uint32_t flags);
 
+    // The brackets of the code, brought up to date with the text
+    const ZepBracketIndex &GetBracketIndex() const;
+
+    // The pair of brackets around the location; the innermost one, or the one at the top level.  Only the brackets
+    // (){}[] are indexed, so the others in 'beginExpression' and 'endExpression' are left out
     GlyphRange GetExpression(ExpressionType expressionType, const GlyphIterator &location, const std::vector<char> &beginExpression, const std::vector<char> &endExpression) const;
     std::string GetBufferText(const GlyphIterator &start, const GlyphIterator &end) const;
 
@@ -183,14 +223,15 @@ struct ZepBuffer : public ZepComponent {
     signal<void(ZepBuffer &buffer, const GlyphIterator &, const GlyphIterator &)> sigPreDelete;
 
     std::string name;
-    GapBuffer<uint8_t> workingBuffer; // Buffer & record of the line end locations
-    std::vector<ByteIndex> lineEnds;
+    TextStorage workingBuffer; // Buffer & record of the line end locations
+    LineIndex lineEnds;
 
     ZepPath filePath;
     uint64_t updateCount = 0;
     GlyphIterator lastEditLocation;
 
     std::shared_ptr<ZepSyntax> syntax;
+    std::shared_ptr<ZepBufferSearch> search; // The last '/' search, made when first needed
 
     GlyphRange selection;
 
@@ -199,11 +240,15 @@ struct ZepBuffer : public ZepComponent {
 
     uint32_t fileFlags = 0;
     SyntaxProvider syntaxProvider;
-    tRangeMarkers rangeMarkers;
+    RangeMarkerTree rangeMarkers;
     std::shared_ptr<ZepMode> mode;
 
 private:
     void MarkUpdate();
+    void UpdateMarkers(ByteIndex start, ByteIndex shiftFrom, ByteIndex distance);
+    void FindMarkers(uint32_t types, ByteIndex first, ByteIndex last, std::vector<std::pair<std::shared_ptr<RangeMarker>, ByteRange>> &found) const;
+
+    mutable ZepBracketIndex m_bracketIndex; // Scanned again after an edit when it is next asked for
 };
 
 // Notification payload
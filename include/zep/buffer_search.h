@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "zep/buffer.h"
+
+namespace Zep {
+
+struct SearchMatch {
+    ByteIndex begin = 0;
+    ByteIndex end = 0;
+};
+
+// Find every copy of 'literal' in the text, overlapping ones included.  'offset' is added to the matches.
+// Candidates are found by comparing the first and last bytes of the literal 16 or 32 bytes at a time where SSE2/AVX2 is available
+void FindLiteral(const uint8_t *pBegin, const uint8_t *pEnd, const std::string &literal, std::vector<SearchMatch> &matches, ByteIndex offset = 0);
+
+// The same, using Horspool's skip table
+void FindLiteralScalar(const uint8_t *pBegin, const uint8_t *pEnd, const std::string &literal, std::vector<SearchMatch> &matches, ByteIndex offset = 0);
+
+// Turn a Vim 'magic' pattern into an ECMAScript one; \( \) \| \+ \? \{ \< \> are operators and ( ) | + ? { are not.
+// \c anywhere makes the search ignore case
+std::string VimPatternToRegex(const std::string &pattern, bool &ignoreCase);
+
+// A pattern as typed after '/', compiled.  It is taken literally unless it holds one of \ . * [ ^ $, and can be
+// shared between threads
+struct SearchPattern {
+    SearchPattern() = default;
+    explicit SearchPattern(const std::string &pattern);
+
+    bool Empty() const { return m_literal.empty() && !m_regex; }
+    const std::string &GetPattern() const { return m_pattern; }
+
+    // Set if the pattern isn't a valid regular expression
+    const std::string &GetError() const { return m_error; }
+
+    // Find the matches in text made of whole lines; 'offset' is added to them.  Matches don't run over line ends
+    void Find(const uint8_t *pBegin, const uint8_t *pEnd, std::vector<SearchMatch> &matches, ByteIndex offset = 0) const;
+
+private:
+    std::string m_pattern;
+    std::string m_literal;
+    std::shared_ptr<const std::regex> m_regex;
+    std::string m_required; // A literal every match of the regex holds
+    std::string m_error;
+};
+
+// The matches of a search in buffer order.  An edit shifts all the matches after it; as with LineIndex
+// the shift is stored as a step which is applied lazily as later edits move through the matches
+struct SearchMatches {
+    long Count() const { return long(m_matches.size()); }
+    SearchMatch operator[](long index) const;
+
+    void Clear();
+
+    // The first match starting at or after this byte (Count() if none)
+    long LowerBound(ByteIndex index) const;
+
+    // Shift the matches starting at or after 'index' along by 'count' bytes
+    void Insert(ByteIndex index, ByteIndex count);
+
+    // Remove the matches starting in [begin, end) and shift the ones after them back
+    void Erase(ByteIndex begin, ByteIndex end);
+
+    // Swap the matches starting in [begin, end) for new ones, which must be in that range and in order
+    void Replace(ByteIndex begin, ByteIndex end, const std::vector<SearchMatch> &matches);
+
+private:
+    void MoveStep(long index);
+
+    GapBuffer<SearchMatch> m_matches;
+    long m_stepIndex = 0; // Matches from here on have not had the step added
+    ByteIndex m_stepBytes = 0;
+};
+
+// A search of a buffer, as typed after '/' or '?'.  Every match is kept, and kept up to date as the buffer is edited by
+// searching the edited lines again; matches don't run over line ends.  Nothing is allocated per match, and windows
+// only look up the matches on the lines they draw
+struct ZepBufferSearch : public ZepComponent {
+    explicit ZepBufferSearch(ZepBuffer &buffer);
+
+    // Search the whole buffer
+    void SetPattern(const std::string &pattern);
+    const std::string &GetPattern() const { return m_pattern.GetPattern(); }
+    const std::string &GetError() const { return m_pattern.GetError(); }
+
+    const SearchMatches &GetMatches() const { return m_matches; }
+    long Count() const { return m_matches.Count(); }
+
+    // The first match after (or before) 'location', wrapping around the buffer; -1 if there are no matches
+    long FindNext(ByteIndex location, Direction dir) const;
+
+    // The first match which ends after this byte
+    long FindFirstEndingAfter(ByteIndex index) const;
+
+    void Notify(const std::shared_ptr<ZepMessage> &message) override;
+
+    bool visible = true; // Windows highlight the matches
+    long current = -1;   // The match the cursor was last moved to; highlighted differently
+
+private:
+    void SearchRange(ByteIndex begin, ByteIndex end, std::vector<SearchMatch> &matches) const;
+    void SearchLines(ByteIndex begin, ByteIndex end);
+    void SearchAll();
+
+    ZepBuffer &m_buffer;
+    SearchPattern m_pattern;
+    SearchMatches m_matches;
+    ByteIndex m_size = 0; // The buffer size the matches are for
+};
+
+} // namespace Zep
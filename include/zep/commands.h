@@ -1,6 +1,7 @@
 #pragma once
 
 #include "zep/buffer.h"
+#include "zep/undo_journal.h"
 
 namespace Zep {
 
@@ -10,8 +11,9 @@ struct ZepCommand {
 
     virtual ~ZepCommand() = default;
 
+    // Make the change, then write down what it did
     virtual void Redo() = 0;
-    virtual void Undo() = 0;
+    virtual void Record(ZepUndoJournal &journal) const = 0;
 
     GlyphIterator cursorBefore;
     GlyphIterator cursorAfter;
@@ -20,18 +22,12 @@ struct ZepCommand {
     ChangeRecord changeRecord;
 };
 
-struct ZepCommand_GroupMarker : public ZepCommand {
-    explicit ZepCommand_GroupMarker(ZepBuffer &currentMode) : ZepCommand(currentMode) {}
-    void Redo() override {};
-    void Undo() override {};
-};
-
 struct ZepCommand_DeleteRange : public ZepCommand {
     ZepCommand_DeleteRange(ZepBuffer &buffer, const GlyphIterator &startIndex, const GlyphIterator &endIndex, const GlyphIterator &cursor = GlyphIterator(), const GlyphIterator &cursorAfter = GlyphIterator());
     ~ZepCommand_DeleteRange() override = default;
 
     void Redo() override;
-    void Undo() override;
+    void Record(ZepUndoJournal &journal) const override;
 
     GlyphIterator startIndex;
     GlyphIterator endIndex;
@@ -43,7 +39,7 @@ struct ZepCommand_ReplaceRange : public ZepCommand {
     ~ZepCommand_ReplaceRange() override = default;
 
     void Redo() override;
-    void Undo() override;
+    void Record(ZepUndoJournal &journal) const override;
 
     GlyphIterator startIndex;
     GlyphIterator endIndex;
@@ -57,7 +53,7 @@ struct ZepCommand_Insert : public ZepCommand {
     ~ZepCommand_Insert() override = default;
 
     void Redo() override;
-    void Undo() override;
+    void Record(ZepUndoJournal &journal) const override;
 
     GlyphIterator startIndex;
     std::string insert;
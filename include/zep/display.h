@@ -40,6 +40,14 @@ protected:
     ZepDisplay &m_display;
 };
 
+// A run of glyphs which are drawn together, in one color
+struct ZepTextRun {
+    NVec2f pos;
+    NVec4f color;
+    const uint8_t *pBegin = nullptr;
+    const uint8_t *pEnd = nullptr;
+};
+
 struct ZepDisplay {
     virtual ~ZepDisplay() = default;
     ZepDisplay();
@@ -53,6 +61,10 @@ struct ZepDisplay {
 
     virtual void DrawRect(const NRectf &rc, const NVec4f &col = NVec4f(1.0f)) const;
 
+    // Draw a batch of runs in the same font.
+    // The default calls DrawChars for each run; override it to submit the whole batch at once
+    virtual void DrawCharRuns(ZepFont &font, const std::vector<ZepTextRun> &runs) const;
+
     virtual void SetFont(ZepTextType type, std::shared_ptr<ZepFont> font);
     virtual ZepFont &GetFont(ZepTextType type) = 0;
 
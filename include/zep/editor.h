@@ -142,6 +142,8 @@ struct EditorConfig {
     bool autoHideCommandRegion = false;
     bool showNormalModeKeyStrokes = false;
     bool searchGitRoot = true;
+    uint32_t virtualLayoutLines = 100000; // Buffers with at least this many lines only measure the text in view; 0 to disable
+    uint32_t undoMemoryMB = 0; // The oldest undo history is dropped to keep within this; 0 for no limit
     float backgroundFadeTime = 60.0f;
     float backgroundFadeWait = 60.0f;
 };
@@ -220,6 +222,9 @@ struct ZepEditor {
     void RemoveTabWindow(ZepTabWindow *pTabWindow);
     ZepWindow *GetActiveWindow() const;
 
+    // The project indexer; nullptr unless `IMPLEMENTED_INDEXER` is defined
+    Indexer *GetIndexer() const { return m_indexer.get(); }
+
     void UpdateTabs() const;
 
     ZepWindow *AddSearch();
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
 #include <memory>
 #include <map>
 #include <string>
@@ -12,12 +14,56 @@ enum ZepFileSystemFlags {
     SearchGitRoot = (1 << 0)
 };
 
+// The bytes of a file, for reading.  Memory mapped where the platform supports it, so the file isn't copied
+// until it is used; otherwise it is read in.
+struct ZepFileView {
+    ZepFileView() = default;
+    ~ZepFileView();
+    ZepFileView(const ZepFileView &) = delete;
+    ZepFileView &operator=(const ZepFileView &) = delete;
+
+    const uint8_t *begin() const { return m_pData; }
+    const uint8_t *end() const { return m_pData + m_size; }
+    size_t size() const { return m_size; }
+
+private:
+    friend struct ZepFileSystem;
+    const uint8_t *m_pData = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::string m_contents; // If not mapped
+};
+
+// Writes a file through a temporary file beside it, which replaces the file on Commit.  A failed or
+// interrupted save leaves the old file as it was.
+struct ZepFileWriter {
+    explicit ZepFileWriter(const ZepPath &filePath);
+    ~ZepFileWriter(); // Removes the temporary file if it wasn't committed
+    ZepFileWriter(const ZepFileWriter &) = delete;
+    ZepFileWriter &operator=(const ZepFileWriter &) = delete;
+
+    bool IsOpen() const { return m_pFile != nullptr; }
+
+    // Buffered, so small writes are cheap; once a write fails the rest are ignored and Commit fails
+    void Write(const void *pData, size_t size);
+    bool Commit();
+
+private:
+    void Close();
+
+    std::string m_path;
+    std::string m_tempPath;
+    FILE *m_pFile = nullptr;
+    bool m_failed = false;
+};
+
 // A generic file system using cross-platform `fs::` and `tinydir` for searches.
 // This is typically the only one that is used for normal desktop usage.
 // But you could make your own if your files were stored in a compressed folder, or the target system didn't have a traditional file system...
 struct ZepFileSystem {
     explicit ZepFileSystem(const ZepPath &configPath);
     static std::string Read(const ZepPath &filePathstatic);
+    static std::unique_ptr<ZepFileView> Map(const ZepPath &filePath);
     static bool Write(const ZepPath &filePath, const void *pData, size_t size);
     // A callback API for scannistatic ng
     static bool MakeDirectories(const ZepPath &path);
@@ -25,6 +71,8 @@ struct ZepFileSystem {
     ZepPath GetSearchRoot(const ZepPath &start, bool &foundGit) const;
     static bool IsDirectory(const ZepPath &path);
     static bool IsReadOnly(const ZepPath &path);
+    // The last write time (in the platform's ticks) and size of a file, to tell when it has changed
+    static bool GetFileStamp(const ZepPath &path, int64_t &modified, int64_t &size);
     // Equivalent means 'the same file'
     static bool Equivalent(const ZepPath &path1, const ZepPath &path2);
     static ZepPath Canonical(const ZepPath &path);
@@ -37,6 +85,8 @@ struct ZepFileSystem {
     uint32_t flags = ZepFileSystemFlags::SearchGitRoot;
 
     static void ScanDirectory(const ZepPath &path, const std::function<bool(const ZepPath &path, bool &dont_recurse)> &fnScan);
+    // The names in one directory, without going into those below it; links to directories aren't reported as directories
+    static void ListDirectory(const ZepPath &path, const std::function<void(const std::string &name, bool isDirectory)> &fnEntry);
     static bool Exists(const ZepPath &path);
 };
 
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zep/indexer.h"
+
+namespace Zep {
+
+// A candidate which holds the query, and how well it matches
+struct FuzzyResult {
+    uint32_t index = 0; // In the file list
+    int score = 0;
+    uint32_t length = 0;
+};
+
+// Score a candidate against a query whose chars must all appear in it, in order.  'pText' is what is matched
+// (the lower case path for a lower case query) and 'pOriginal' the path as it is, for the word boundaries.
+// The match ending first is taken, pulled back to its shortest span, and scored: a char matched at the start of
+// a path part or word, or in the file name, or just after another, scores more; gaps between matches score less.
+// The query chars are looked for 16 or 32 bytes at a time where SSE2/AVX2 is available.
+bool FuzzyScore(const char *pText, const char *pOriginal, size_t length, const std::string &query, int &score);
+
+// The same, a byte at a time
+bool FuzzyScoreScalar(const char *pText, const char *pOriginal, size_t length, const std::string &query, int &score);
+
+// The result of matching a query against the file list
+struct FuzzyMatches {
+    std::string query;
+    std::vector<uint32_t> candidates; // All which matched, in file order; a longer query need only look at these
+    std::vector<FuzzyResult> best;    // The highest scoring, best first
+};
+
+// Match a query (case sensitive if it has capitals) against the files, or the candidates of a shorter query it starts
+// with.  The list is split into chunks, scored by the pool's threads and this one together, each keeping only its best
+// 'maxResults' in a heap.  Returns when all are scored; a thread held up elsewhere only means this one does more.
+std::shared_ptr<FuzzyMatches> FuzzyMatch(ThreadPool &threadPool, const std::shared_ptr<FileIndexResult> &files, const std::shared_ptr<FuzzyMatches> &previous, const std::string &query, size_t maxResults);
+
+} // namespace Zep
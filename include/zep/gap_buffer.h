@@ -10,7 +10,7 @@
 #include <limits>
 
 #ifdef _DEBUG
-#define DEBUG_FILL_GAP for (auto* pCh = m_pGapStart; pCh < m_pGapEnd; pCh++) { *pCh = '@'; }
+#define DEBUG_FILL_GAP memset((void *) m_pGapStart, '@', (m_pGapEnd - m_pGapStart) * sizeof(T))
 #else
 #define DEBUG_FILL_GAP
 #endif
@@ -644,7 +644,8 @@ private:
         MoveGap(p);
 
         if ((m_pGapEnd - m_pGapStart) < int64_t(size)) {
-            resizeGap(size + m_defaultGap);
+            // Grow with the buffer, so filling it a piece at a time costs a copy per doubling rather than per default gap
+            resizeGap(size + std::max(m_defaultGap, this->size() / 2));
         }
     }
 
@@ -696,14 +697,14 @@ private:
         // Move gap towards the left 
         if (pPos < m_pGapStart) {
             // Move the gap start over by gapsize.        
-            memmove(pPos + (m_pGapEnd - m_pGapStart), pPos, m_pGapStart - pPos);
+            memmove(pPos + (m_pGapEnd - m_pGapStart), pPos, (m_pGapStart - pPos) * sizeof(T));
             m_pGapEnd -= (m_pGapStart - pPos);
             m_pGapStart = pPos;
         } else {
             // Since we are moving after the gap, find distance
             // between m_pGapEnd and target and that's how
             // much we move from m_pGapEnd to m_pGapStart.
-            memmove(m_pGapStart, m_pGapEnd, pPos - m_pGapEnd);
+            memmove(m_pGapStart, m_pGapEnd, (pPos - m_pGapEnd) * sizeof(T));
             m_pGapStart += pPos - m_pGapEnd;
             m_pGapEnd = pPos;
         }
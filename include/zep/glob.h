@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Zep {
+
+// A list of patterns matched as fnmatch(pattern, path, 0) would (so '*' matches '/' too), compiled once to be matched
+// against many paths.  Patterns without wildcards are looked up in a set, and '*' then a literal ("*.cpp") in a table by
+// the extension they end in.  Only the rest go to fnmatch, and only for paths which start with their literal prefix.
+struct ZepGlobSet {
+    ZepGlobSet() = default;
+    explicit ZepGlobSet(const std::vector<std::string> &patterns);
+
+    bool Empty() const;
+    bool Match(const std::string &path) const;
+
+    // True if everything below the directory 'path' matches, as 'build/*' does for 'build', so it needn't be walked
+    bool MatchesAllBelow(const std::string &path) const;
+
+private:
+    struct Wildcard {
+        std::string prefix;
+        std::string pattern;
+    };
+
+    std::unordered_set<std::string> m_literals;
+    std::unordered_map<std::string, std::vector<std::string>> m_suffixes; // By the extension they end with, without its '.'
+    std::vector<std::string> m_plainSuffixes;                              // Those without a '.'
+    std::vector<Wildcard> m_wildcards;
+    std::vector<Wildcard> m_directories; // 'build' for 'build/*'
+};
+
+// Match a path against a pattern as git does: '*' and '?' don't match '/', and a '**' between slashes (or at either end)
+// matches any number of directories
+bool GlobMatchPath(const char *pattern, const char *path);
+
+// The rules of a .gitignore or .ignore file, for the paths below the directory it is in.  A later rule overrides an earlier
+// one, so a '!' rule can keep what an earlier one ignored; a rule ending in '/' is for directories only.  Rules without a
+// '/' match the name at any depth, and are looked up by name or extension where they can be; the rest are matched against
+// the path from the file's directory
+struct ZepIgnoreRules {
+    enum class Result {
+        None,
+        Ignored,
+        Kept
+    };
+
+    void Add(const std::string &text);
+    bool Empty() const { return m_rules.empty(); }
+
+    // 'path' is relative to the directory of the file, and ends in 'name'
+    Result Match(const std::string &path, const std::string &name, bool isDirectory) const;
+
+private:
+    struct Rule {
+        std::string pattern;
+        bool keep = false;
+        bool directoryOnly = false;
+    };
+
+    void Check(int rule, const std::string &text, bool isDirectory, int &best) const;
+
+    std::vector<Rule> m_rules;
+    std::unordered_map<std::string, std::vector<int>> m_names;
+    std::unordered_map<std::string, std::vector<int>> m_suffixes; // '*' and then a literal, by the extension it ends with
+    std::vector<int> m_nameWildcards;
+    std::vector<int> m_pathRules;
+};
+
+} // namespace Zep
@@ -6,6 +6,7 @@
 #include <thread>
 
 #include "zep/editor.h"
+#include "zep/symbol_index.h"
 
 namespace Zep {
 
@@ -19,26 +20,80 @@ struct FileIndexResult {
     std::string errors;
 };
 
+struct FileWalkState;
+
+// A walk of the files below a folder, a task per directory on the thread pool.  Paths are built up from the names
+// listed, and matched against the ignore and include patterns compiled once, and the rules of the .gitignore and
+// .ignore files found on the way; a directory which is ignored, or whose contents all would be (as with 'build/*'),
+// isn't gone into.  The files can be taken in batches as they are found, so a file list can be shown before the walk
+// is done.  Destroying the walk stops it
+struct ZepFileWalk {
+    ZepFileWalk(ThreadPool &threadPool, const ZepPath &root, const std::vector<std::string> &ignorePatterns, const std::vector<std::string> &includePatterns, TaskPriority priority = TaskPriority::Interactive);
+    ~ZepFileWalk();
+
+    const ZepPath &GetRoot() const;
+    bool Finished() const;
+
+    // Move the files found since the last call onto the end of 'result'; false if there weren't any
+    bool TakeFiles(FileIndexResult &result);
+
+private:
+    std::shared_ptr<FileWalkState> m_state;
+};
+
 struct Indexer : public ZepComponent {
     explicit Indexer(ZepEditor &editor);
 
     void Notify(const std::shared_ptr<ZepMessage> &message) override;
 
+    // Load the project's symbol index, then bring it up to date in the background
     bool StartIndexing();
-    void StartSymbolSearch();
+
+    // Look for changed files again, as after a save
+    void UpdateSymbols();
+
+    // The last index loaded or built; nullptr until there is one
+    std::shared_ptr<ZepSymbolIndex> GetSymbols() const { return m_symbols; }
+
+    // The root the symbols' paths are relative to
+    const ZepPath &GetSearchRoot() const { return m_searchRoot; }
 
     static void GetSearchPaths(ZepEditor &editor, const ZepPath &path, std::vector<std::string> &ignore_patterns, std::vector<std::string> &include_patterns, std::string &errors);
-    static std::future<std::shared_ptr<FileIndexResult>> IndexPaths(ZepEditor &editor, const ZepPath &startPath);
+    // Every file in the project, in path order, once the walk is done
+    static std::future<std::shared_ptr<FileIndexResult>> IndexPaths(ZepEditor &editor, const ZepPath &startPath, TaskPriority priority = TaskPriority::Background);
+
+    // The same files, to be taken as they are found; nullptr with 'errors' set if the project config is bad
+    static std::unique_ptr<ZepFileWalk> WalkPaths(ZepEditor &editor, const ZepPath &startPath, std::string &errors);
 
 private:
     bool m_fileSearchActive = false;
     std::future<std::shared_ptr<FileIndexResult>> m_indexResult;
     std::shared_ptr<FileIndexResult> m_filePaths;
 
-    std::mutex m_queueMutex;
-    std::deque<ZepPath> m_searchQueue;
+    void StartSymbolBuild();
+
+    bool m_symbolsPending = false;
+    bool m_symbolBuildActive = false;
+    std::future<std::shared_ptr<ZepSymbolIndex>> m_symbolResult;
+    std::shared_ptr<ZepSymbolIndex> m_symbols;
 
     ZepPath m_searchRoot;
 };
 
+// :tag [word] jumps to where a word is defined, from the project's symbol index; the word under the cursor if none
+// is given.  Running it again for the same word steps on to its next definition.  Without an indexer, the index the
+// last one wrote is read
+struct ZepTagExCommand : public ZepExCommand {
+    explicit ZepTagExCommand(ZepEditor &editor);
+
+    static void Register(ZepEditor &editor);
+
+    void Run(const std::vector<std::string> &tokens) override;
+    const char *ExCommandName() const override { return "tag"; }
+
+private:
+    std::string m_word;
+    size_t m_nextDefinition = 0;
+};
+
 } // Zep
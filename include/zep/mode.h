@@ -107,6 +107,9 @@ struct ZepMode : public ZepComponent {
     void Undo();
     void Redo();
 
+    // Take the limit on the undo history from the editor's config
+    void UpdateUndoMemoryLimit();
+
     virtual CursorType GetCursorType() const;
 
     virtual void SwitchMode(EditorMode editorMode);
@@ -128,6 +131,7 @@ protected:
     void HandleMappedInput(const std::string &input);
 
     void AddCommand(const std::shared_ptr<ZepCommand> &cmd);
+    void AddUndoGroup();
 
     bool GetCommand(CommandContext &context);
     void ResetCommand();
@@ -143,13 +147,14 @@ protected:
 
     void ClampCursorForMode() const;
     bool HandleExCommand(std::string strCommand);
+    bool MoveToSearchMatch(ZepWindow &window, const GlyphIterator &from, Direction dir);
+    void ShowSearchCount(ZepBuffer &buffer);
     static std::string ConvertInputToMapString(ImGuiKey key, ImGuiModFlags modifierFlags);
 
     virtual bool HandleIgnoredInput(CommandContext &) { return false; };
 
 protected:
-    std::stack<std::shared_ptr<ZepCommand>> m_undoStack;
-    std::stack<std::shared_ptr<ZepCommand>> m_redoStack;
+    ZepUndoJournal m_undoJournal;
     bool m_lineWise = false;
     GlyphIterator m_visualBegin;
     GlyphIterator m_visualEnd;
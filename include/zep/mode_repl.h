@@ -20,7 +20,13 @@ enum class ReplParseType {
 struct IZepReplProvider {
     virtual std::string ReplParse(ZepBuffer &text, const GlyphIterator &cursorOffset, ReplParseType type) = 0;
     virtual std::string ReplParse(const std::string &text) = 0;
-    virtual bool ReplIsFormComplete(const std::string &input, int &depth) = 0;
+
+    // By default a form is complete when its brackets balance, read as Lisp.  'depth' is how many are left open, or
+    // negative if there are too many closed
+    virtual bool ReplIsFormComplete(const std::string &input, int &depth);
+
+    // The text that ReplParse evaluates at the cursor, found with the buffer's bracket index
+    static GlyphRange ReplRange(ZepBuffer &buffer, const GlyphIterator &cursorOffset, ReplParseType type);
 };
 
 struct ZepReplExCommand : public ZepExCommand {
@@ -3,8 +3,8 @@
 #include "mode.h"
 #include <future>
 #include <memory>
-#include <regex>
 
+#include <zep/fuzzy_match.h>
 #include <zep/indexer.h>
 
 namespace Zep {
@@ -24,10 +24,15 @@ struct ZepMode_Search : public ZepMode {
 
     CursorType GetCursorType() const override;
 
+    // Only the best matches are listed; the window's layout then draws only those it shows
+    static constexpr size_t MaxResults = 500;
+
 private:
-    void InitSearchTree();
-    void ShowTreeResult();
-    void UpdateTree();
+    void UpdateMatches();
+    void ShowResults();
+    void ShowStatus();
+    long GetResultCount() const;
+    uint32_t GetResult(long line) const;
 
     enum class OpenType {
         Replace,
@@ -38,34 +43,18 @@ private:
     void OpenSelection(OpenType type);
 
 private:
-
-    // List of lines in the file result, with last found char
-    struct SearchResult {
-        uint32_t index = 0;
-        uint32_t location = 0;
-    };
-
-    // A mapping from character distance to a list of lines
-    using IndexSet = std::multimap<uint32_t, SearchResult>;
-
-    bool fileSearchActive = false;
-    bool treeSearchActive = false;
-
-    // Results of the file search and the indexing threads
-    std::future<std::shared_ptr<FileIndexResult>> m_indexResult;
-    std::future<std::shared_ptr<IndexSet>> m_searchResult;
+    // The walk of the project, until it is done; the files are added to the list as they are found
+    std::unique_ptr<ZepFileWalk> m_fileWalk;
 
     // All files that can potentially match
     std::shared_ptr<FileIndexResult> m_filePaths;
 
-    // A hierarchy of index results.
-    // The 'top' of the tree is the narrowest finding from a set of 'n' characters
-    // index a,b,c -> index b,c -> index c
-    std::vector<std::shared_ptr<IndexSet>> m_indexTree;
+    // The matches of ever longer parts of the search term, each found among those of the one before.
+    // Backspace goes back to the last which still fits
+    std::vector<std::shared_ptr<FuzzyMatches>> m_matches;
 
-    // What we are searching for 
+    // What we are searching for
     std::string m_searchTerm;
-    bool m_caseImportant = false;
 
     ZepWindow &m_launchWindow;
     ZepWindow &m_window;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "zep/buffer_search.h"
+#include "zep/indexer.h"
+
+namespace Zep {
+
+// A line of a file with a match on it
+struct ProjectSearchResult {
+    uint32_t file = 0;     // In the file list searched
+    long line = 0;         // From 0
+    ByteIndex column = 0;  // Of the first match on the line
+    std::string text;      // The line, without its line end
+};
+
+// A search of the contents of a project's files, spread over the thread pool.  Each chunk of the file list is
+// a task of its own, so the workers share them out, a worker held up by a large file doesn't hold up the others,
+// and other interactive work, such as highlighting the text being typed, runs between the chunks.  Results are queued per chunk for the main thread to collect while the search runs.
+// Destroying the search (as a new one starts) cancels it, and waits for the workers to stop.
+struct ZepProjectSearch {
+    ZepProjectSearch(ThreadPool &threadPool, std::shared_ptr<FileIndexResult> files, const std::string &pattern);
+    ~ZepProjectSearch();
+
+    const SearchPattern &GetPattern() const { return m_pattern; }
+    const FileIndexResult &GetFiles() const { return *m_files; }
+
+    void Cancel() { m_workers.Cancel(); }
+    bool Finished() const;
+
+    // Move the results found since the last call onto the end of 'results'.  Each chunk's results are in
+    // file order, but the chunks arrive in the order they finish
+    void TakeResults(std::vector<ProjectSearchResult> &results);
+
+    long FilesSearched() const { return m_filesSearched; }
+    long ResultCount() const { return m_resultCount; }
+
+    static const long ChunkSize = 32;
+
+private:
+    void SearchChunk(long first, long last);
+    void SearchFile(uint32_t file, std::vector<SearchMatch> &matches, std::vector<ProjectSearchResult> &results) const;
+
+    std::shared_ptr<FileIndexResult> m_files;
+    SearchPattern m_pattern;
+
+    TaskGroup m_workers;
+    std::atomic<long> m_filesSearched{0};
+    std::atomic<long> m_resultCount{0};
+
+    std::mutex m_resultsMutex;
+    std::vector<ProjectSearchResult> m_results;
+};
+
+// :grep <pattern> searches the files of the project for a pattern, as '/' would, and lists the matching lines
+// in a 'Grep' buffer as path:line:column: text.  A new :grep cancels the one running
+struct ZepGrepExCommand : public ZepExCommand {
+    explicit ZepGrepExCommand(ZepEditor &editor);
+
+    static void Register(ZepEditor &editor);
+
+    void Run(const std::vector<std::string> &tokens) override;
+    void Notify(const std::shared_ptr<ZepMessage> &message) override;
+    const char *ExCommandName() const override { return "grep"; }
+
+private:
+    bool HasResultsBuffer() const;
+    void StartSearch();
+    void ShowResults();
+
+    std::string m_pattern;
+    std::future<std::shared_ptr<FileIndexResult>> m_indexResult;
+    std::unique_ptr<ZepProjectSearch> m_search;
+    ZepBuffer *m_pResultsBuffer = nullptr;
+    std::vector<ProjectSearchResult> m_newResults;
+};
+
+} // namespace Zep
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <functional>
 #include <set>
 #include <map>
+#include <vector>
 
 #include "timer.h"
 #include "zep/signals.h"
@@ -52,20 +54,54 @@ enum class ToolTipPos {
     Count = 3
 };
 
+struct RangeMarker;
+struct RangeMarkerNode;
+
+// The markers of a buffer, in a treap ordered by where they start.  A node's range doesn't include the shifts still
+// to be passed down from above it, so moving every marker after an edit is one walk down the tree, and each node
+// also holds the furthest end below it, so a range query skips the subtrees which end before the range starts.
+struct RangeMarkerTree {
+    RangeMarkerTree() = default;
+    ~RangeMarkerTree(); // The markers keep their ranges, and are no longer in the tree
+
+    RangeMarkerTree(const RangeMarkerTree &) = delete;
+    RangeMarkerTree &operator=(const RangeMarkerTree &) = delete;
+
+    void Insert(const std::shared_ptr<RangeMarker> &marker);
+    void Erase(RangeMarker &marker);
+    bool Empty() const { return m_pRoot == nullptr; }
+    size_t Size() const { return m_size; }
+
+    // Markers starting at or after 'shiftFrom' move by 'distance'; those before it which reach 'start' are
+    // taken out and returned, as the edit was inside them
+    void Edit(ByteIndex start, ByteIndex shiftFrom, ByteIndex distance, std::vector<std::shared_ptr<RangeMarker>> &removed);
+
+    // The markers overlapping [first, last] (both inclusive), in the order they start; false from 'fn' stops
+    void ForEach(ByteIndex first, ByteIndex last, const std::function<bool(const std::shared_ptr<RangeMarker> &, const ByteRange &)> &fn) const;
+    void ForEachReverse(const std::function<bool(const std::shared_ptr<RangeMarker> &)> &fn) const;
+
+    static ByteRange GetRange(const RangeMarkerNode &node);
+
+private:
+    RangeMarkerNode *m_pRoot = nullptr;
+    size_t m_size = 0;
+    uint32_t m_random = 0x9E3779B9;
+};
+
 struct RangeMarker : std::enable_shared_from_this<RangeMarker> {
     explicit RangeMarker(ZepBuffer &buffer);
 
     bool ContainsLocation(const GlyphIterator &loc) const;
     bool IntersectsRange(const ByteRange &i) const;
 
+    // Where the marker is now; it moves with the text while it is in the buffer
+    ByteRange GetRange() const;
+    bool InBuffer() const { return m_pNode != nullptr; }
     void SetRange(ByteRange range);
     void SetBackgroundColor(ThemeColor color);
     void SetColors(ThemeColor back = ThemeColor::None, ThemeColor text = ThemeColor::Text, ThemeColor highlight = ThemeColor::Text);
     void SetAlpha(float a);
 
-    void HandleBufferInsert(ZepBuffer &buffer, const GlyphIterator &itrStart, const std::string &str);
-    void HandleBufferDelete(ZepBuffer &buffer, const GlyphIterator &itr, const GlyphIterator &itrEnd);
-
     ZepBuffer &buffer;
     std::string name;
     std::string description;
@@ -82,12 +118,28 @@ struct RangeMarker : std::enable_shared_from_this<RangeMarker> {
     bool enabled = true;
     Timer timer;
 
-    ByteRange range;
-
-protected:
-    scoped_connection onPreBufferInsert;
+private:
+    friend struct RangeMarkerTree;
+    ByteRange m_range;                    // When it isn't in the tree
+    RangeMarkerNode *m_pNode = nullptr;   // When it is
 };
 
+// The markers found by a query, by where they start
 using tRangeMarkers = std::map<ByteIndex, std::set<std::shared_ptr<RangeMarker>>>;
 
+// The markers found by one query over a run of buffer lines, bucketed by line.  A marker over several lines is in
+// the bucket of each; a bucket is in the order ForEachMarker gives its markers
+struct LineRangeMarkers {
+    long firstLine = 0;
+    std::vector<std::vector<std::shared_ptr<RangeMarker>>> lines;
+
+    bool HasLine(long line) const { return line >= firstLine && line - firstLine < long(lines.size()); }
+
+    // None for a line outside the run
+    const std::vector<std::shared_ptr<RangeMarker>> &OnLine(long line) const {
+        static const std::vector<std::shared_ptr<RangeMarker>> none;
+        return HasLine(line) ? lines[line - firstLine] : none;
+    }
+};
+
 }; // Zep
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "zep/filesystem.h"
+
+namespace Zep {
+
+// Where a word is defined
+struct SymbolLocation {
+    ZepPath path; // Relative to the indexed root
+    long line = 0;
+};
+
+// The words in the files of a project, and where the ones which look like definitions are: the word after
+// 'struct', 'class', 'define', 'fn' and the like, or a word followed by '(' on a line which isn't indented.
+// Stored in .zep/indexdb as a single block, mapped and queried where it lies, so a warm start reads almost nothing.
+//
+// The block is a header, then tables of the files, the words (sorted, with their definitions) and the definitions,
+// then the strings, then each file's word ids.  Files are recorded with the size and time they were read at, and the
+// next build takes the words of unchanged files from here instead of reading them.  Numbers are in the native byte
+// order; an index from another machine is rejected by its header and rebuilt.
+struct ZepSymbolIndex {
+    // Map an index written before; nullptr if there isn't one, or it is of another version or damaged
+    static std::shared_ptr<ZepSymbolIndex> Load(const ZepPath &indexPath);
+
+    // Index the files under 'root', reading only those which are new or have changed since 'pPrevious'
+    static std::shared_ptr<ZepSymbolIndex> Build(const ZepPath &root, const std::vector<ZepPath> &paths, const ZepSymbolIndex *pPrevious);
+
+    bool Write(const ZepPath &indexPath) const;
+
+    long FileCount() const { return long(GetHeader().fileCount); }
+    long WordCount() const { return long(GetHeader().wordCount); }
+    ZepPath GetFilePath(long file) const;
+
+    // How many files the build which made this index had to read
+    long FilesRead() const { return m_filesRead; }
+
+    std::vector<SymbolLocation> FindDefinitions(const std::string &word) const;
+
+    // The words starting with 'prefix', in order
+    std::vector<std::string> Complete(const std::string &prefix, size_t maxWords = 100) const;
+
+private:
+    static const uint32_t Magic = 0x5844495a; // 'ZIDX'
+    static const uint32_t Version = 1;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t fileCount;
+        uint32_t wordCount;
+        uint32_t definitionCount;
+        uint32_t reserved;
+        uint64_t stringsSize;
+        uint64_t fileWordsSize;
+    };
+
+    struct FileEntry {
+        uint32_t pathOffset;
+        uint32_t pathLength;
+        int64_t modified;
+        int64_t size;
+        uint64_t wordsOffset; // Of the ids of the file's words, ascending and delta coded as varints
+        uint64_t wordCount;
+    };
+
+    struct WordEntry {
+        uint32_t offset;
+        uint32_t length;
+        uint32_t firstDefinition;
+        uint32_t definitionCount;
+    };
+
+    struct Definition {
+        uint32_t file;
+        uint32_t line;
+    };
+
+    bool Validate() const;
+
+    const Header &GetHeader() const { return *(const Header *) m_pData; }
+    const FileEntry *GetFiles() const { return (const FileEntry *) (m_pData + sizeof(Header)); }
+    const WordEntry *GetWords() const { return (const WordEntry *) (GetFiles() + GetHeader().fileCount); }
+    const Definition *GetDefinitions() const { return (const Definition *) (GetWords() + GetHeader().wordCount); }
+    const char *GetStrings() const { return (const char *) (GetDefinitions() + GetHeader().definitionCount); }
+    const uint8_t *GetFileWords() const { return (const uint8_t *) GetStrings() + GetHeader().stringsSize; }
+    std::string GetWord(uint32_t word) const;
+
+    const uint8_t *m_pData = nullptr;
+    size_t m_size = 0;
+    std::unique_ptr<ZepFileView> m_view; // If loaded
+    std::vector<uint64_t> m_image;       // If built; 64 bit for the alignment
+    long m_filesRead = 0;
+};
+
+} // namespace Zep
@@ -1,10 +1,13 @@
 #pragma once
 
 #include "buffer.h"
+#include "syntax_matcher.h"
+#include "threadpool.h"
 
 #include <atomic>
-#include <future>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <unordered_set>
 #include <vector>
 
@@ -27,6 +30,78 @@ struct SyntaxData {
     ThemeColor foreground = ThemeColor::Normal;
     ThemeColor background = ThemeColor::None;
     bool underline = false;
+
+    bool operator==(const SyntaxData &rhs) const { return foreground == rhs.foreground && background == rhs.background && underline == rhs.underline; }
+};
+
+struct SyntaxRun {
+    ByteIndex start = 0;
+    SyntaxData data;
+};
+
+// The syntax of the buffer, stored as runs of bytes with the same style.
+// An edit shifts every run after it; that shift is stored as a step which is applied lazily as
+// later edits move through the runs, so edits close to each other are cheap.
+struct SyntaxRuns {
+    // Walks the runs in buffer order
+    struct const_iterator {
+        const SyntaxRuns *runs = nullptr;
+        long index = 0;
+
+        ByteIndex Begin() const { return runs->RunStart(index); }
+        ByteIndex End() const { return runs->RunStart(index + 1); }
+        const SyntaxData &Data() const { return runs->m_runs[index].data; }
+
+        const_iterator &operator++() {
+            index++;
+            return *this;
+        }
+        bool operator==(const const_iterator &rhs) const { return index == rhs.index; }
+        bool operator!=(const const_iterator &rhs) const { return index != rhs.index; }
+    };
+
+    ByteIndex Size() const { return m_size; }
+    long RunCount() const { return long(m_runs.size()); }
+
+    // New bytes have the default syntax
+    void Resize(ByteIndex size);
+    void Insert(ByteIndex index, ByteIndex count);
+    void Erase(ByteIndex begin, ByteIndex end);
+    void Fill(ByteIndex begin, ByteIndex end, const SyntaxData &data);
+
+    const SyntaxData &At(ByteIndex index) const;
+    const_iterator Find(ByteIndex index) const;
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, RunCount()}; }
+
+private:
+    ByteIndex RunStart(long run) const;
+    long FindRun(ByteIndex index) const;
+    void SplitAt(ByteIndex index);
+    void InsertRun(long run, ByteIndex start, const SyntaxData &data);
+    void EraseRuns(long first, long last);
+    void MoveStep(long run);
+
+    GapBuffer<SyntaxRun> m_runs;
+    long m_stepRun = 0;          // Runs from here on have not had the step added to their start
+    ByteIndex m_stepBytes = 0;
+    ByteIndex m_size = 0;
+    mutable long m_lastRun = 0;  // Lookups are usually in order, so try the last run found first
+};
+
+// Where a line starts in the lexer; a line is lexed again when the state coming into it changes
+enum class SyntaxLexMode : uint8_t {
+    Normal,
+    BlockComment,
+    String // Continued onto the next line
+};
+
+struct SyntaxLineState {
+    SyntaxLexMode mode = SyntaxLexMode::Normal;
+    uint8_t quote = 0; // Closes the open string
+
+    bool operator==(const SyntaxLineState &rhs) const { return mode == rhs.mode && quote == rhs.quote; }
+    bool operator!=(const SyntaxLineState &rhs) const { return !(*this == rhs); }
 };
 
 struct SyntaxResult : SyntaxData {
@@ -43,9 +118,16 @@ struct ZepSyntax : public ZepComponent {
 
     explicit ZepSyntax(ZepBuffer &buffer, uint32_t flags);
 
+    // Share a language's compiled keywords between its buffers
+    ZepSyntax(ZepBuffer &buffer, std::shared_ptr<const ZepSyntaxMatcher> matcher, uint32_t flags = 0);
+
     ~ZepSyntax() override;
 
     virtual SyntaxResult GetSyntaxAt(const GlyphIterator &index) const;
+
+    // The styled run holding this location, for walking the runs.  Adornments are not included.
+    // Waits for the highlighter, since the runs can't change while they are walked
+    SyntaxRuns::const_iterator GetSyntaxRunAt(const GlyphIterator &index) const;
     virtual void UpdateSyntax();
     virtual void Interrupt();
     virtual void Wait() const;
@@ -56,20 +138,54 @@ struct ZepSyntax : public ZepComponent {
     const NVec4f &ToForegroundColor(const SyntaxResult &res) const;
 
     void IgnoreLineHighlight() { m_flags |= ZepSyntaxFlags::IgnoreLineHighlight; }
+    uint32_t GetFlags() const { return m_flags; }
 
 private:
+    friend struct SyntaxCursor;
+
     void QueueUpdateSyntax(const GlyphIterator &startLocation, const GlyphIterator &endLocation);
+    void UpdateSnapshot(BufferMessageType type, ByteIndex start, ByteIndex end);
+    void InsertLines(ByteIndex start, ByteIndex end);
+    void EraseLines(ByteIndex start, ByteIndex end);
+    void ResetLines();
 
 protected:
+    // Mark the line [begin, end) of the snapshot, which starts in 'state'; returns the state the next line starts in.
+    // UpdateSyntax lexes from the first edited line, and stops once a line after the edit hands on the state the next line already had
+    virtual SyntaxLineState LexLine(ByteIndex begin, ByteIndex end, SyntaxLineState state);
+
+    // Used by UpdateSyntax to mark a region.  Marks are held back until PublishSyntax makes them visible
+    void MarkSyntax(ByteIndex begin, ByteIndex end, const SyntaxData &data);
+
+    // Apply the held marks and move m_processedChar to 'processed', once a chunk of text has been marked (or always if forced)
+    void PublishSyntax(ByteIndex processed, bool force = false);
+
+    struct SyntaxMark {
+        ByteIndex begin;
+        ByteIndex end;
+        SyntaxData data;
+    };
+
     ZepBuffer &m_buffer;
-    std::vector<SyntaxData> m_syntax;
-    std::future<void> m_syntaxResult;
+    GapBuffer<uint8_t> m_snapshot; // Copy of the buffer text which UpdateSyntax reads, kept in step with the edits
+    SyntaxRuns m_syntax;
+    mutable std::mutex m_syntaxMutex; // Guards m_syntax while UpdateSyntax runs on the thread pool
+    std::vector<SyntaxMark> m_pendingMarks;
+    // The highlight pass queued on the thread pool.  Interrupting drops a pass which hasn't started, and only
+    // waits for one which is reading the snapshot
+    struct SyntaxTask {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool started = false;
+        bool finished = false;
+    };
+    std::shared_ptr<SyntaxTask> m_syntaxTask;
+    CancelToken m_syntaxToken;
     std::atomic<long> m_processedChar = {0};
     std::atomic<long> m_targetChar = {0};
-    std::vector<uint32_t> m_multiCommentStarts;
-    std::vector<uint32_t> m_multiCommentEnds;
-    std::unordered_set<std::string> m_keywords;
-    std::unordered_set<std::string> m_identifiers;
+    LineIndex m_lines;                       // The line ends of the snapshot
+    GapBuffer<SyntaxLineState> m_lineStates; // The lexer state at the start of each line
+    std::shared_ptr<const ZepSyntaxMatcher> m_matcher;
     std::atomic<bool> m_stop = false;
     std::vector<std::shared_ptr<ZepSyntaxAdorn>> m_adornments;
     uint32_t m_flags;
@@ -79,8 +195,29 @@ struct ZepSyntaxAdorn : public ZepComponent {
     ZepSyntaxAdorn(ZepSyntax &syntax, ZepBuffer &buffer) : ZepComponent(syntax.editor), m_buffer(buffer) {}
     virtual SyntaxResult GetSyntaxAt(const GlyphIterator &offset, bool &found) const = 0;
 
+    // The first location at or after 'offset' which may be adorned.  By default any may be
+    virtual ByteIndex NextAdornment(ByteIndex offset) const { return offset; }
+
 protected:
     ZepBuffer &m_buffer;
 };
 
+// Walks the styles along [begin, end) in order, for drawing a line.  The styled runs are copied once, under the
+// lock, rather than looked up for each glyph, and the adornments are only asked about the locations they adorn
+struct SyntaxCursor {
+    SyntaxCursor(const ZepSyntax &syntax, ByteIndex begin, ByteIndex end);
+
+    // The style at 'offset', which must not be before the last one asked for
+    SyntaxResult At(const GlyphIterator &offset);
+
+private:
+    const ZepSyntax &m_syntax;
+    ByteIndex m_begin = 0;
+    ByteIndex m_end = 0;
+    ByteIndex m_styledEnd = 0;     // The highlighter hasn't reached the text from here on
+    std::vector<SyntaxRun> m_runs; // The styled runs of the line, clipped to it
+    size_t m_run = 0;
+    std::vector<ByteIndex> m_nextAdornments;
+};
+
 } // namespace Zep
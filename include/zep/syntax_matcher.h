@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace Zep {
+
+enum class SyntaxWord : uint8_t {
+    None,
+    Keyword,
+    Identifier
+};
+
+// The keywords and identifiers of a language, compiled into one open addressed hash table.
+// Tokens are looked up straight from the text, folding their case as they are hashed, so classifying
+// a token doesn't allocate.  Build one for a language and share it between the buffers using it.
+struct ZepSyntaxMatcher {
+    ZepSyntaxMatcher(const std::unordered_set<std::string> &keywords, const std::unordered_set<std::string> &identifiers, bool caseInsensitive = false);
+
+    // Any iterator over the bytes of the token; it is read twice if the hash matches
+    template<class Itr>
+    SyntaxWord Find(Itr begin, Itr end) const {
+        if (m_entries.empty()) return SyntaxWord::None;
+
+        uint32_t hash = HashSeed;
+        uint32_t length = 0;
+        for (auto itr = begin; itr != end; ++itr) {
+            if (++length > m_maxLength) return SyntaxWord::None;
+            hash = (hash ^ m_fold[uint8_t(*itr)]) * HashPrime;
+        }
+
+        for (auto slot = hash & m_mask;; slot = (slot + 1) & m_mask) {
+            auto &entry = m_entries[slot];
+            if (entry.word == SyntaxWord::None) return SyntaxWord::None;
+            if (entry.hash != hash || entry.length != length) continue;
+
+            auto pWord = m_words.data() + entry.offset;
+            auto itr = begin;
+            while (itr != end && m_fold[uint8_t(*itr)] == uint8_t(*pWord)) {
+                ++itr;
+                ++pWord;
+            }
+            if (itr == end) return entry.word;
+        }
+    }
+
+    SyntaxWord Find(const std::string &token) const { return Find(token.begin(), token.end()); }
+
+private:
+    static const uint32_t HashSeed = 2166136261u; // FNV-1a
+    static const uint32_t HashPrime = 16777619u;
+
+    struct Entry {
+        uint32_t hash = 0;
+        uint32_t offset = 0; // Of the (folded) word in m_words
+        uint32_t length = 0;
+        SyntaxWord word = SyntaxWord::None;
+    };
+
+    void Add(const std::string &word, SyntaxWord type);
+
+    std::vector<Entry> m_entries; // A power of two, at most half full
+    std::string m_words;
+    uint32_t m_mask = 0;
+    uint32_t m_maxLength = 0;
+    uint8_t m_fold[256];          // Folds the case of a byte, or leaves it
+};
+
+} // namespace Zep
@@ -7,32 +7,28 @@
 
 namespace Zep {
 
+struct BracketNode;
+
+// Colors each bracket by how deeply it is nested among the brackets of its type, and shows the ones which don't
+// match as errors.
+// The brackets are kept in a treap by offset.  Each node holds, for each type of bracket, the net change in depth
+// over its subtree and the lowest the depth dips in it, so a bracket's depth is found on the way down to it, when it
+// is drawn, rather than for every bracket on each edit.  An edit moves the brackets after it with a lazy shift.
 struct ZepSyntaxAdorn_RainbowBrackets : public ZepSyntaxAdorn {
     ZepSyntaxAdorn_RainbowBrackets(ZepSyntax &syntax, ZepBuffer &buffer);
+    ~ZepSyntaxAdorn_RainbowBrackets() override;
 
     void Notify(const std::shared_ptr<ZepMessage> &message) override;
     SyntaxResult GetSyntaxAt(const GlyphIterator &offset, bool &found) const override;
+    ByteIndex NextAdornment(ByteIndex offset) const override;
 
     void Clear(const GlyphIterator &start, const GlyphIterator &end);
     void Insert(const GlyphIterator &start, const GlyphIterator &end);
     void Update(const GlyphIterator &start, const GlyphIterator &end);
 
 private:
-    void RefreshBrackets();
-    enum class BracketType {
-        Bracket = 0,
-        Brace = 1,
-        Group = 2,
-        Max = 3
-    };
-
-    struct Bracket {
-        int32_t indent{};
-        BracketType type{};
-        bool is_open = false;
-        bool valid = true;
-    };
-    std::map<long, Bracket> m_brackets;
+    BracketNode *m_pRoot = nullptr;
+    uint32_t m_random = 0x9E3779B9;
 };
 
 } // namespace Zep
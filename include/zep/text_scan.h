@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "zep/glyph_iterator.h"
+
+namespace Zep {
+
+// What ScanText found in some text
+struct TextScan {
+    std::vector<ByteIndex> lineEnds; // Just after each '\n'
+    bool hasCR = false;
+    bool hasTabs = false;
+    bool hasSpaceTabs = false;       // Two spaces together, as in a space indent
+};
+
+// Find the line ends and whitespace in one pass, 16 or 32 bytes at a time where SSE2/AVX2 is available.
+// 'offset' is added to the line ends, for text being inserted into a buffer.
+void ScanText(const uint8_t *pBegin, const uint8_t *pEnd, TextScan &scan, ByteIndex offset = 0);
+
+// The same, a byte at a time
+void ScanTextScalar(const uint8_t *pBegin, const uint8_t *pEnd, TextScan &scan, ByteIndex offset = 0);
+
+} // namespace Zep
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "zep/gap_buffer.h"
+#include "zep/glyph_iterator.h"
+
+namespace Zep {
+
+// The text as a list of pieces, each a slice of an append only store.  The loaded text goes in first, and
+// inserted text is added to the end; edits split and remove pieces rather than moving the text.
+// Like SyntaxRuns, an edit shifts the pieces after it by a step which is applied lazily, so an edit
+// costs the number of pieces between it and the last edit rather than the bytes.
+struct PieceTable {
+    long size() const { return long(m_size); }
+    long PieceCount() const { return long(m_pieces.size()); }
+
+    const uint8_t &operator[](long index) const { return m_store[At(index)]; }
+    uint8_t &operator[](long index) { return m_store[At(index)]; }
+
+    void clear();
+    void assign(const uint8_t *pBegin, const uint8_t *pEnd);
+    void insert(long index, const uint8_t *pBegin, const uint8_t *pEnd);
+    void erase(long begin, long end);
+
+    // Each piece's text, in order
+    void ForEachSpan(const std::function<void(const uint8_t *pBegin, const uint8_t *pEnd)> &fnSpan) const;
+
+private:
+    struct Piece {
+        ByteIndex start = 0;  // In the text
+        ByteIndex source = 0; // In the store
+    };
+
+    ByteIndex PieceStart(long piece) const;
+    long FindPiece(ByteIndex index) const;
+    ByteIndex At(ByteIndex index) const;
+    void SplitAt(ByteIndex index);
+    void InsertPiece(long piece, ByteIndex start, ByteIndex source);
+    void ErasePieces(long first, long last);
+    void MoveStep(long piece);
+
+    std::vector<uint8_t> m_store;
+    GapBuffer<Piece> m_pieces;
+    long m_stepPiece = 0;          // Pieces from here on have not had the step added to their start
+    ByteIndex m_stepBytes = 0;
+    ByteIndex m_size = 0;
+    mutable long m_lastPiece = 0;  // Reads are usually in order, so try the last piece found first
+};
+
+enum class TextStorageType {
+    GapBuffer,  // Fastest when edits are close together
+    PieceTable  // For edits spread around the text, such as replacing through a whole file
+};
+
+// The text of a buffer, stored in one of the TextStorageTypes.
+// Reads are per byte, so this switches on the type rather than calling through a virtual.
+struct TextStorage {
+    struct const_iterator {
+        using difference_type = long;
+        using value_type = uint8_t;
+        using pointer = const uint8_t *;
+        using reference = const uint8_t &;
+        using iterator_category = std::random_access_iterator_tag;
+
+        const TextStorage *storage = nullptr;
+        long p = 0;
+
+        reference operator*() const { return (*storage)[p]; }
+        reference operator[](long distance) const { return (*storage)[p + distance]; }
+
+        const_iterator &operator++() {
+            p++;
+            return *this;
+        }
+        const_iterator operator++(int) { return {storage, p++}; }
+        const_iterator &operator--() {
+            p--;
+            return *this;
+        }
+        const_iterator operator--(int) { return {storage, p--}; }
+        const_iterator &operator+=(long rhs) {
+            p += rhs;
+            return *this;
+        }
+        const_iterator &operator-=(long rhs) {
+            p -= rhs;
+            return *this;
+        }
+        const_iterator operator+(long rhs) const { return {storage, p + rhs}; }
+        const_iterator operator-(long rhs) const { return {storage, p - rhs}; }
+        difference_type operator-(const const_iterator &rhs) const { return p - rhs.p; }
+
+        bool operator==(const const_iterator &rhs) const { return p == rhs.p; }
+        bool operator!=(const const_iterator &rhs) const { return p != rhs.p; }
+        bool operator<(const const_iterator &rhs) const { return p < rhs.p; }
+        bool operator>(const const_iterator &rhs) const { return p > rhs.p; }
+        bool operator<=(const const_iterator &rhs) const { return p <= rhs.p; }
+        bool operator>=(const const_iterator &rhs) const { return p >= rhs.p; }
+    };
+
+    TextStorageType GetType() const { return m_type; }
+
+    // Move the text to another type of storage
+    void SetType(TextStorageType type);
+
+    size_t size() const { return m_type == TextStorageType::GapBuffer ? m_gapBuffer.size() : size_t(m_pieceTable.size()); }
+    bool empty() const { return size() == 0; }
+
+    const uint8_t &operator[](long index) const { return m_type == TextStorageType::GapBuffer ? m_gapBuffer[index] : m_pieceTable[index]; }
+    uint8_t &operator[](long index) { return m_type == TextStorageType::GapBuffer ? m_gapBuffer[index] : m_pieceTable[index]; }
+
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, long(size())}; }
+
+    void clear();
+    void push_back(uint8_t ch);
+    void assign(const uint8_t *pBegin, const uint8_t *pEnd);
+    void insert(long index, const std::string &str);
+    void erase(long begin, long end);
+
+    // The text in order as a few runs of contiguous bytes, for writing it out without a copy;
+    // the two sides of the gap, or each piece
+    void ForEachSpan(const std::function<void(const uint8_t *pBegin, const uint8_t *pEnd)> &fnSpan) const;
+
+    // All of the text
+    std::string string() const;
+
+private:
+    TextStorageType m_type = TextStorageType::GapBuffer;
+    GapBuffer<uint8_t> m_gapBuffer;
+    PieceTable m_pieceTable;
+};
+
+} // namespace Zep
@@ -1,133 +1,127 @@
-/*
-Copyright (c) 2012 Jakob Progsch, Václav Zeman
+#pragma once
 
-This software is provided 'as-is', without any express or implied
-warranty. In no event will the authors be held liable for any damages
-arising from the use of this software.
-
-Permission is granted to anyone to use this software for any purpose,
-including commercial applications, and to alter it and redistribute it
-freely, subject to the following restrictions:
-
-   1. The origin of this software must not be misrepresented; you must not
-   claim that you wrote the original software. If you use this software
-   in a product, an acknowledgment in the product documentation would be
-   appreciated but is not required.
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
-   2. Altered source versions must be plainly marked as such, and must not be
-   misrepresented as being the original software.
+namespace Zep {
 
-   3. This notice may not be removed or altered from any source
-   distribution.
-*/
+// Which queued work is started first.  Interactive is work someone is waiting to see (highlighting, the file
+// finder, :grep); Background is work they aren't (the project index)
+enum class TaskPriority {
+    Interactive,
+    Background,
+    Count
+};
 
-/*
-CM: Note: Modified from the original to support query of the threads available on the machine,
-and fallback to using single threaded if not possible.
-Original here: https://github.com/progschj/ThreadPool
-*/
+// Shared by the tasks of a job which may stop being wanted.  Copies share the flag.  Tasks queued with a token
+// which is cancelled before they start are dropped; those running look at it now and then, and stop early
+struct CancelToken {
+    CancelToken() : m_cancelled(std::make_shared<std::atomic<bool>>(false)) {}
 
-#ifndef THREAD_POOL_HPP
-#define THREAD_POOL_HPP
+    void Cancel() const { *m_cancelled = true; }
+    bool IsCancelled() const { return *m_cancelled; }
 
-// containers
-#include <vector>
-#include <queue>
-// threading
-#include <thread>
-#include <mutex>
-#include <condition_variable>
-#include <atomic>
-#include <future>
-// utility wrappers
-#include <memory>
-#include <functional>
-// exceptions
-#include <stdexcept>
+private:
+    friend struct ThreadPool;
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
 
-// std::thread pool for resources recycling
+// A work stealing scheduler.  Each worker has its own deque for each priority: a task queued by a worker goes on the
+// back of its own, and it takes its next from there too, so a task which splits its work (a directory walk) keeps it
+// close.  A worker with nothing of its own takes the oldest task queued from outside the pool, then steals the oldest
+// from another worker.  Each deque has its own lock, so workers only meet when one steals.  All the Interactive
+// tasks anywhere are started before a Background one.
+// A pool of 0 or 1 threads has no workers, and runs each task as it is queued.
 struct ThreadPool {
-    // the constructor just launches some amount of workers
-    explicit ThreadPool(size_t threads_n = std::thread::hardware_concurrency()) : stop(false) {
-        // If not enough threads, the pool will just execute all tasks immediately
-        if (threads_n > 1) {
-            this->workers.reserve(threads_n);
-            for (; threads_n; --threads_n)
-                this->workers.emplace_back(
-                    [this] {
-                        while (true) {
-                            std::function<void()> task;
-
-                            {
-                                std::unique_lock<std::mutex> lock(this->queue_mutex);
-                                this->condition.wait(lock,
-                                    [this] { return this->stop || !this->tasks.empty(); });
-                                if (this->stop && this->tasks.empty())
-                                    return;
-                                task = std::move(this->tasks.front());
-                                this->tasks.pop();
-                            }
-
-                            task();
-                        }
-                    }
-                );
-        }
-    }
-    // deleted copy&move ctors&assignments
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool(); // Runs the tasks still queued, then stops the workers
+
     ThreadPool(const ThreadPool &) = delete;
     ThreadPool &operator=(const ThreadPool &) = delete;
-    ThreadPool(ThreadPool &&) = delete;
-    ThreadPool &operator=(ThreadPool &&) = delete;
-    // add new work item to the pool
-    template<class F, class... Args>
-#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
-    std::future<typename std::invoke_result<F, Args...>::type> enqueue(F &&f, Args &&... args)
-#else
-    std::future<typename std::result_of<F(Args...)>::type> enqueue(F&& f, Args&&... args)
-#endif
-    {
-#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
-        using packaged_task_t = std::packaged_task<typename std::invoke_result<F, Args...>::type()>;
-#else
-        using packaged_task_t = std::packaged_task<typename std::result_of<F(Args...)>::type ()>;
-#endif
-
-        std::shared_ptr<packaged_task_t> task(new packaged_task_t(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        ));
-
-        // If there are no works, just run the task in the main thread and return
-        if (workers.empty()) {
-            (*task)();
-            return task->get_future();
-        }
-        auto res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(this->queue_mutex);
-            this->tasks.emplace([task]() { (*task)(); });
-        }
-        this->condition.notify_one();
-        return res;
+
+    // 0 when the tasks are run inline
+    size_t GetThreadCount() const { return m_threads.size(); }
+
+    void Run(std::function<void()> fn, TaskPriority priority = TaskPriority::Interactive);
+    void Run(std::function<void()> fn, TaskPriority priority, const CancelToken &token);
+
+    // Run a task whose result is wanted later
+    template<class F>
+    std::future<std::invoke_result_t<F>> Async(TaskPriority priority, F &&fn) {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(fn));
+        auto future = task->get_future();
+        Run([task]() { (*task)(); }, priority);
+        return future;
     }
-    // the destructor joins all threads
-    virtual ~ThreadPool() {
-        this->stop = true;
-        this->condition.notify_all();
-        for (std::thread &worker: this->workers)
-            worker.join();
+
+    template<class F, class... Args>
+    std::future<std::invoke_result_t<F, Args...>> enqueue(F &&fn, Args &&... args) {
+        return Async(TaskPriority::Interactive, std::bind(std::forward<F>(fn), std::forward<Args>(args)...));
     }
+
 private:
-    // need to keep track of threads so we can join them
-    std::vector<std::thread> workers;
-    // the task queue
-    std::queue<std::function<void()> > tasks;
-
-    // synchronization
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    // workers finalization flag
-    std::atomic_bool stop;
+    struct Task {
+        std::function<void()> fn;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks[size_t(TaskPriority::Count)];
+    };
+
+    void Push(Task &&task, TaskPriority priority);
+    bool Pop(size_t worker, Task &task);
+    void WorkerThread(size_t worker);
+
+    // One per worker, then the one for the threads outside the pool
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    // Tasks in the queues; a worker sleeps when there are none
+    std::atomic<size_t> m_queued{0};
+    std::atomic<size_t> m_sleeping{0};
+    std::atomic<bool> m_stop{false};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+};
+
+// Tasks run together and waited for together.  Waiting runs the group's tasks which no worker has started yet on
+// the waiting thread, so a worker can wait on a group without holding the pool up, and a group finishes even if
+// every worker is busy elsewhere.  Cancelling the group (or its token) skips the tasks not yet started
+struct TaskGroup {
+    explicit TaskGroup(ThreadPool &threadPool, TaskPriority priority = TaskPriority::Interactive, const CancelToken &token = CancelToken());
+    ~TaskGroup(); // Waits
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    // May be called from the group's own tasks
+    void Run(std::function<void()> fn);
+    void Wait();
+    bool Finished() const;
+
+    void Cancel() const { m_token.Cancel(); }
+    bool IsCancelled() const { return m_token.IsCancelled(); }
+    const CancelToken &GetToken() const { return m_token; }
+
+private:
+    struct GroupTask;
+    struct State;
+
+    ThreadPool &m_threadPool;
+    TaskPriority m_priority;
+    CancelToken m_token;
+    std::shared_ptr<State> m_state;
 };
 
-#endif // THREAD_POOL_HPP
+} // namespace Zep
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "zep/glyph_iterator.h"
+
+namespace Zep {
+
+enum class ReplaceRangeMode;
+
+enum class UndoRecordType : uint8_t {
+    Group, // Starts a run of edits which are undone together
+    Insert,
+    Delete,
+    Replace,
+    Fill
+};
+
+// One edit: at 'start', the deleted text was swapped for the inserted text.  Both are in the journal's text,
+// one after the other, from 'text'
+struct UndoRecord {
+    UndoRecordType type = UndoRecordType::Group;
+    ZepBuffer *pBuffer = nullptr;
+    ByteIndex start = 0;
+    ByteIndex cursorBefore = -1;
+    ByteIndex cursorAfter = -1;
+    size_t text = 0;
+    size_t deletedLength = 0;
+    size_t insertedLength = 0;
+};
+
+// The edits which can be undone and redone, in the order they were made.
+// The records sit in one array and their text in one string, with the ones that can be redone after the ones
+// that can be undone, so an edit only appends to them, and undoing a group walks back along them.
+// Typing or deleting next to the last edit of the group grows that edit instead of adding another.
+// The oldest groups are dropped to keep the journal within a memory limit; the last one is always kept.
+class ZepUndoJournal {
+public:
+    // Start a group; nothing happens if the last one has no edits yet
+    void AddGroup();
+
+    // Record an edit which has just been made
+    void AddInsert(ZepBuffer &buffer, ByteIndex start, const std::string &inserted, ByteIndex cursorBefore, ByteIndex cursorAfter);
+    void AddDelete(ZepBuffer &buffer, ByteIndex start, const std::string &deleted, ByteIndex cursorBefore, ByteIndex cursorAfter);
+    void AddReplace(ZepBuffer &buffer, ReplaceRangeMode mode, ByteIndex start, const std::string &deleted, const std::string &inserted, ByteIndex cursorBefore, ByteIndex cursorAfter);
+
+    // Undo or redo the edits of a group, returning where the cursor goes (invalid if nothing says)
+    GlyphIterator Undo();
+    GlyphIterator Redo();
+
+    bool CanUndo() const;
+    bool CanRedo() const;
+
+    // The most bytes to keep, or 0 for no limit
+    void SetMemoryLimit(size_t bytes);
+    size_t MemoryUsed() const;
+
+    void Clear();
+
+private:
+    void Add(UndoRecordType type, ZepBuffer *pBuffer, ByteIndex start, const std::string &deleted, const std::string &inserted, ByteIndex cursorBefore, ByteIndex cursorAfter);
+    UndoRecord *LastEdit(ZepBuffer &buffer, UndoRecordType type);
+    void Extend(UndoRecord &record, ByteIndex cursorBefore, ByteIndex cursorAfter);
+    void DropRedo();
+    void Trim();
+
+    std::vector<UndoRecord> m_records;
+    std::string m_text;
+    size_t m_first = 0; // The records and text before these have been dropped
+    size_t m_firstText = 0;
+    size_t m_end = 0; // The records from here on have been undone
+    size_t m_memoryLimit = 0;
+};
+
+} // namespace Zep
@@ -5,6 +5,7 @@
 #include <unordered_map>
 
 #include "buffer.h"
+#include "display.h"
 
 namespace Zep {
 
@@ -33,6 +34,7 @@ struct SpanInfo {
     NVec2f padding = NVec2f(1.0f, 1.0f);           // Padding above and below the line
     NVec2f lineWidgetHeights;
     ZepFont *pFont = nullptr;
+    bool estimated = false;                        // A whole buffer line with a guessed size; not yet measured or split into wrapped spans
 
     float FullLineHeightPx() const { return padding.x + padding.y + lineTextSizePx.y; }
     // The byte length, not code point length
@@ -45,6 +47,18 @@ inline bool operator<(const SpanInfo &lhs, const SpanInfo &rhs) {
     return lhs.lineByteRange.first != rhs.lineByteRange.first ? lhs.lineByteRange.first < rhs.lineByteRange.first : lhs.lineByteRange.second < rhs.lineByteRange.second;
 }
 
+// After an incremental layout, the spans following the edit are not touched; they are shifted
+// lazily as they are visited.  Every span at or after 'fromSpan' still needs these deltas applied.
+struct SpanShift {
+    long fromSpan = 0;
+    ByteIndex bytes = 0;
+    long bufferLines = 0;
+    long spanLines = 0;
+    float yPx = 0.0f;
+
+    bool Empty() const { return bytes == 0 && bufferLines == 0 && spanLines == 0 && yPx == 0.0f; }
+};
+
 enum class CursorType {
     None,
     Normal,
@@ -109,6 +123,9 @@ struct ZepWindow : public ZepComponent {
     void MoveCursorY(int yDistance, LineLocation clampLocation = LineLocation::LineLastNonCR);
     NVec2i BufferToDisplay();
 
+    // The glyph under a point in the window, for mouse clicks
+    GlyphIterator DisplayToBuffer(const NVec2f &pos);
+
     // Flags
     void SetWindowFlags(uint32_t windowFlags);
     uint32_t GetWindowFlags() const;
@@ -132,6 +149,14 @@ private:
     void UpdateAirline();
     void UpdateScrollers();
     void UpdateLineSpans();
+    bool UpdateEditedLineSpans();
+    float ReplaceSpans(long firstSpan, long lastSpan, long lastLine, ByteIndex byteDelta, bool estimate);
+    void LayoutBufferLine(long bufferLine, bool isMarkdown, const std::vector<std::shared_ptr<RangeMarker>> &markersOnLine, long &spanLine, float &bufferPosYPx, std::vector<SpanInfo *> &spans);
+    void EstimateBufferLine(long bufferLine, long &spanLine, float &bufferPosYPx, std::vector<SpanInfo *> &spans);
+    void BuildSpanCodePoints(SpanInfo &span);
+    void MeasureSpan(long index);
+    void FindVisibleLineRange();
+    void UpdateVirtualSpans();
     void EnsureCursorVisible();
     void UpdateVisibleLineRange();
 
@@ -149,6 +174,15 @@ private:
     void GetCharPointer(const GlyphIterator &loc, const uint8_t *&pBegin, const uint8_t *&pEnd, SpecialChar &specialChar) const;
     const SpanInfo &GetCursorLineInfo(long y);
 
+    // Span access; applies any pending shift to the span before returning it
+    SpanInfo &GetSpan(long index);
+    long GetSpanIndex(ByteIndex index) const;
+    long GetSpanIndexAtY(float yPx) const;
+    static long GetCodePointIndex(const SpanInfo &span, ByteIndex index);
+    long GetMeasuredSpanIndex(ByteIndex index);
+    void MoveSpanShift(long toSpan);
+    static void ShiftSpan(SpanInfo &span, const SpanShift &shift, long sign);
+
     float ToWindowY(float pos) const;
     float TipBoxShadowWidth() const;
 
@@ -159,6 +193,8 @@ private:
     void DisplayScrollers();
     void DisplayGridMarkers();
     void DisplayLineNumbers();
+    void UpdateVisibleMarkers();
+    std::vector<std::shared_ptr<RangeMarker>> GetSpanMarkers(const SpanInfo &lineInfo, uint32_t markerTypes) const;
 
     void DisableToolTipTillMove();
 
@@ -167,7 +203,7 @@ private:
 
     void PlaceToolTip(const NVec2f &pos, ToolTipPos location, uint32_t lineGap, const std::shared_ptr<RangeMarker> &marker);
 
-    NVec2f ArrangeLineMarkers(tRangeMarkers &markers);
+    NVec2f ArrangeLineMarkers(const std::vector<std::shared_ptr<RangeMarker>> &markers);
 
     bool IsActiveWindow() const;
 
@@ -190,6 +226,7 @@ private:
     // the text scroll; which isn't a big deal, but a work item.
     // TODO Use flags instead
     bool m_layoutDirty = true;
+    uint32_t m_layoutFlags = 0;             // Window flags the spans were last built with
     bool m_scrollVisibilityChanged = true;
     bool m_cursorMoved = true;
     uint32_t m_windowFlags = WindowFlags::ShowWhiteSpace | WindowFlags::ShowIndicators | WindowFlags::ShowLineNumbers | WindowFlags::WrapText;
@@ -198,19 +235,27 @@ private:
     GlyphIterator m_bufferCursor;                   // Location in buffer coordinates.  Each window has a different buffer cursor
     long m_lastCursorColumn = 0;                    // The last cursor column (could be removed and recalculated)
     NVec2f m_mousePos;                              // Current mouse location
-    GlyphIterator m_mouseIterator;                  // Current iterator for the mouse cursor
 
     // Visual stuff
     std::vector<std::string> m_statusLines; // Status information, shown under the buffer
 
     // Setup of displayed lines
     std::vector<SpanInfo *> m_windowLines;   // Information about the currently displayed lines
+    SpanShift m_spanShift;                   // Pending shift of the spans beyond the last incremental layout
+    bool m_textDirty = false;                // Text edited since the spans were built
+    ByteIndex m_editFirst = 0;               // First byte that may differ from the laid out text
+    ByteIndex m_editTail = 0;                // Count of bytes at the end of the buffer which are unchanged
+    ByteIndex m_layoutBufferSize = 0;        // Size of the buffer the spans were built for
+    bool m_virtualLayout = false;            // Only measure the spans in view; the rest are estimated
+    std::vector<SpanInfo *> m_glyphSpans;    // Spans with code points, for a virtual layout
     float m_textOffsetPx = 0.0f;         // The Scroll position within the text
     NVec2f m_textSizePx;                    // The calculated size of the buffer text, containing just the text
     NVec2i m_visibleLineIndices = {0, 0};   // Index of the line spans that are visible 
     long m_maxDisplayLines = 0;
     int m_defaultLineSize = 0;
     float m_xPad = 0.0f;
+    std::vector<ZepTextRun> m_textRuns;     // Text runs for the line being drawn
+    LineRangeMarkers m_visibleMarkers;      // Markers on the buffer lines in view, found once for each display
 
     // Tooltips
     Timer m_toolTipTimer;                // Timer for when the tip is shown
@@ -0,0 +1,614 @@
+#include "zep/bracket_index.h"
+#include "zep/text_storage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+namespace Zep {
+
+namespace {
+
+enum BracketType {
+    Bracket,
+    Group,
+    Brace,
+    Max
+};
+
+int TypeOf(uint8_t ch) {
+    switch (ch) {
+        case '(':
+        case ')': return Bracket;
+        case '[':
+        case ']': return Group;
+        case '{':
+        case '}': return Brace;
+        default: return Max;
+    }
+}
+
+// The depth of each type of bracket over a run of them, from where the run starts
+struct NestDepths {
+    int32_t change[Max] = {};
+    int32_t lowest[Max] = {};  // The lowest it gets; 0 or less
+    int32_t highest[Max] = {}; // The most it rises over a run to the end; 0 or more
+    int32_t count[Max] = {};
+
+    // Follow this run with another
+    void Append(const NestDepths &after) {
+        for (int type = 0; type < Max; type++) {
+            lowest[type] = std::min(lowest[type], change[type] + after.lowest[type]);
+            highest[type] = std::max(after.highest[type], highest[type] + after.change[type]);
+            change[type] += after.change[type];
+            count[type] += after.count[type];
+        }
+    }
+};
+
+} // namespace
+
+struct BracketIndexNode {
+    ByteIndex offset = 0;
+    ByteIndex shift = 0; // Still to be added to everything below
+    uint8_t ch = 0;
+    uint32_t priority = 0;
+    NestDepths depths; // Over this subtree
+    BracketIndexNode *pLeft = nullptr;
+    BracketIndexNode *pRight = nullptr;
+};
+
+namespace {
+
+using Node = BracketIndexNode;
+
+const ByteIndex Unbounded = std::numeric_limits<ByteIndex>::max();
+
+enum class ScanMode {
+    Code,
+    String,
+    LineComment,
+    BlockComment
+};
+
+bool IsWordChar(uint8_t ch) {
+    return ch >= 0x80 || ch == '_' || (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+// Walks the text a span at a time, handing back the brackets in the code until told to stop
+struct BracketScanner {
+    bool lilike = false;
+    ScanMode mode = ScanMode::Code;
+    uint8_t quote = 0;
+    uint8_t prev = 0; // The byte before, or 0 where it can't join with the next one, as after a comment
+    bool escaped = false;
+
+    template <typename T>
+    bool Scan(const uint8_t *pBegin, const uint8_t *pEnd, ByteIndex offset, const T &fnBracket) {
+        for (auto p = pBegin; p < pEnd; p++) {
+            auto ch = *p;
+            switch (mode) {
+                case ScanMode::Code:
+                    if (TypeOf(ch) != Max) {
+                        if (!fnBracket(offset + ByteIndex(p - pBegin), ch)) return false;
+                    } else if (ch == '\"' || (ch == '\'' && !lilike && !IsWordChar(prev))) {
+                        mode = ScanMode::String;
+                        quote = ch;
+                    } else if (lilike ? (ch == ';' || ch == '#') : (prev == '/' && ch == '/')) {
+                        mode = ScanMode::LineComment;
+                    } else if (!lilike && prev == '/' && ch == '*') {
+                        mode = ScanMode::BlockComment;
+                        ch = 0;
+                    }
+                    break;
+                case ScanMode::String:
+                    // Lisp strings run over lines; elsewhere only an escaped line end carries a string on
+                    if (escaped) escaped = false;
+                    else if (ch == '\\') escaped = true;
+                    else if (ch == quote || (ch == '\n' && !lilike)) mode = ScanMode::Code;
+                    break;
+                case ScanMode::LineComment:
+                    if (ch == '\n') mode = ScanMode::Code;
+                    break;
+                case ScanMode::BlockComment:
+                    if (prev == '*' && ch == '/') {
+                        mode = ScanMode::Code;
+                        ch = 0;
+                    }
+                    break;
+            }
+            prev = ch;
+        }
+        return true;
+    }
+};
+
+int32_t Step(const Node &node, int type) {
+    if (TypeOf(node.ch) != type) return 0;
+    return ZepBracketIndex::IsOpen(node.ch) ? 1 : -1;
+}
+
+// The depths over the bracket on its own
+NestDepths NodeDepths(const Node &node) {
+    NestDepths depths;
+    auto type = TypeOf(node.ch);
+    auto step = Step(node, type);
+    depths.change[type] = step;
+    depths.lowest[type] = std::min(0, step);
+    depths.highest[type] = std::max(0, step);
+    depths.count[type] = 1;
+    return depths;
+}
+
+void Shift(Node *pNode, ByteIndex distance) {
+    if (!pNode) return;
+    pNode->offset += distance;
+    pNode->shift += distance;
+}
+
+void PushShift(Node *pNode) {
+    if (pNode->shift == 0) return;
+    Shift(pNode->pLeft, pNode->shift);
+    Shift(pNode->pRight, pNode->shift);
+    pNode->shift = 0;
+}
+
+void UpdateDepths(Node *pNode) {
+    NestDepths depths;
+    if (pNode->pLeft) depths = pNode->pLeft->depths;
+    depths.Append(NodeDepths(*pNode));
+    if (pNode->pRight) depths.Append(pNode->pRight->depths);
+    pNode->depths = depths;
+}
+
+// Those before 'offset' on the left, the rest on the right
+void Split(Node *pNode, ByteIndex offset, Node *&pLeft, Node *&pRight) {
+    if (!pNode) {
+        pLeft = pRight = nullptr;
+        return;
+    }
+
+    PushShift(pNode);
+    if (pNode->offset < offset) {
+        Split(pNode->pRight, offset, pNode->pRight, pRight);
+        pLeft = pNode;
+    } else {
+        Split(pNode->pLeft, offset, pLeft, pNode->pLeft);
+        pRight = pNode;
+    }
+    UpdateDepths(pNode);
+}
+
+Node *Merge(Node *pLeft, Node *pRight) {
+    if (!pLeft || !pRight) return pLeft ? pLeft : pRight;
+
+    if (pLeft->priority > pRight->priority) {
+        PushShift(pLeft);
+        pLeft->pRight = Merge(pLeft->pRight, pRight);
+        UpdateDepths(pLeft);
+        return pLeft;
+    }
+    PushShift(pRight);
+    pRight->pLeft = Merge(pLeft, pRight->pLeft);
+    UpdateDepths(pRight);
+    return pRight;
+}
+
+void DeleteNodes(Node *pRoot) {
+    std::vector<Node *> nodes;
+    if (pRoot) nodes.push_back(pRoot);
+    while (!nodes.empty()) {
+        auto pNode = nodes.back();
+        nodes.pop_back();
+        if (pNode->pLeft) nodes.push_back(pNode->pLeft);
+        if (pNode->pRight) nodes.push_back(pNode->pRight);
+        delete pNode;
+    }
+}
+
+// The node at the offset
+const Node *FindNode(const Node *pNode, ByteIndex offset) {
+    ByteIndex shift = 0;
+    while (pNode && pNode->offset + shift != offset) {
+        auto childShift = shift + pNode->shift;
+        pNode = offset < pNode->offset + shift ? pNode->pLeft : pNode->pRight;
+        shift = childShift;
+    }
+    return pNode;
+}
+
+// The depths over the brackets up to and including the limit
+NestDepths DepthsTo(const Node *pNode, ByteIndex limit) {
+    NestDepths depths;
+    ByteIndex shift = 0;
+    while (pNode) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->offset + shift > limit) {
+            pNode = pNode->pLeft;
+        } else {
+            if (pNode->pLeft) depths.Append(pNode->pLeft->depths);
+            depths.Append(NodeDepths(*pNode));
+            pNode = pNode->pRight;
+        }
+        shift = childShift;
+    }
+    return depths;
+}
+
+// The last open bracket of the type in the subtree from which the depth rises by 'level' to the end, given the rise
+// after the subtree in 'after'.  If there isn't one, 'after' gains the change over the subtree
+ByteIndex LastRise(const Node *pNode, ByteIndex shift, int type, int32_t level, int32_t &after) {
+    if (!pNode || pNode->depths.highest[type] + after < level) {
+        if (pNode) after += pNode->depths.change[type];
+        return -1;
+    }
+
+    for (;;) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->pRight && pNode->pRight->depths.highest[type] + after >= level) {
+            pNode = pNode->pRight;
+            shift = childShift;
+            continue;
+        }
+        if (pNode->pRight) after += pNode->pRight->depths.change[type];
+
+        // The depth moves a step at a time, so the first bracket to reach the level opens
+        after += Step(*pNode, type);
+        if (after >= level) return pNode->offset + shift;
+        pNode = pNode->pLeft;
+        shift = childShift;
+    }
+}
+
+// The same, over the brackets up to and including the limit
+ByteIndex LastRiseTo(const Node *pNode, ByteIndex shift, ByteIndex limit, int type, int32_t level, int32_t &after) {
+    if (!pNode) return -1;
+
+    auto childShift = shift + pNode->shift;
+    if (pNode->offset + shift > limit) return LastRiseTo(pNode->pLeft, childShift, limit, type, level, after);
+
+    auto found = LastRiseTo(pNode->pRight, childShift, limit, type, level, after);
+    if (found != -1) return found;
+
+    after += Step(*pNode, type);
+    if (after >= level) return pNode->offset + shift;
+
+    // All of the left is before the limit
+    return LastRise(pNode->pLeft, childShift, type, level, after);
+}
+
+// The first close bracket of the type in the subtree which takes the depth below where it started, given the change
+// before the subtree in 'before'.  If there isn't one, 'before' gains the change over the subtree
+ByteIndex FirstFall(const Node *pNode, ByteIndex shift, int type, int32_t &before) {
+    if (!pNode || pNode->depths.lowest[type] + before > -1) {
+        if (pNode) before += pNode->depths.change[type];
+        return -1;
+    }
+
+    for (;;) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->pLeft && pNode->pLeft->depths.lowest[type] + before <= -1) {
+            pNode = pNode->pLeft;
+            shift = childShift;
+            continue;
+        }
+        if (pNode->pLeft) before += pNode->pLeft->depths.change[type];
+
+        before += Step(*pNode, type);
+        if (before <= -1) return pNode->offset + shift;
+        pNode = pNode->pRight;
+        shift = childShift;
+    }
+}
+
+// The same, over the brackets after 'from'
+ByteIndex FirstFallAfter(const Node *pNode, ByteIndex shift, ByteIndex from, int type, int32_t &before) {
+    if (!pNode) return -1;
+
+    auto childShift = shift + pNode->shift;
+    if (pNode->offset + shift <= from) return FirstFallAfter(pNode->pRight, childShift, from, type, before);
+
+    auto found = FirstFallAfter(pNode->pLeft, childShift, from, type, before);
+    if (found != -1) return found;
+
+    before += Step(*pNode, type);
+    if (before <= -1) return pNode->offset + shift;
+
+    // All of the right is after 'from'
+    return FirstFall(pNode->pRight, childShift, type, before);
+}
+
+// The last bracket of the type at or before the limit
+const Node *LastOfType(const Node *pNode, ByteIndex limit, int type, ByteIndex &offset) {
+    const Node *pFound = nullptr;
+    ByteIndex shift = 0;
+    while (pNode && pNode->depths.count[type] > 0) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->offset + shift > limit) {
+            pNode = pNode->pLeft;
+        } else {
+            // The ones on the right are later, if they are before the limit
+            if (TypeOf(pNode->ch) == type) {
+                pFound = pNode;
+                offset = pNode->offset + shift;
+            }
+            pNode = pNode->pRight;
+        }
+        shift = childShift;
+    }
+    return pFound;
+}
+
+// The first bracket of the type after 'from'
+const Node *FirstOfType(const Node *pNode, ByteIndex from, int type, ByteIndex &offset) {
+    const Node *pFound = nullptr;
+    ByteIndex shift = 0;
+    while (pNode && pNode->depths.count[type] > 0) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->offset + shift <= from) {
+            pNode = pNode->pRight;
+        } else {
+            if (TypeOf(pNode->ch) == type) {
+                pFound = pNode;
+                offset = pNode->offset + shift;
+            }
+            pNode = pNode->pLeft;
+        }
+        shift = childShift;
+    }
+    return pFound;
+}
+
+} // namespace
+
+ZepBracketIndex::~ZepBracketIndex() {
+    DeleteNodes(m_pRoot);
+}
+
+void ZepBracketIndex::Insert(ByteIndex start, ByteIndex length) {
+    // Adjust all the brackets after us by the same distance
+    Node *pLeft, *pRight;
+    Split(m_pRoot, start, pLeft, pRight);
+    Shift(pRight, length);
+    m_pRoot = Merge(pLeft, pRight);
+
+    if (m_dirtyEnd != Unbounded && m_dirtyEnd >= start) m_dirtyEnd += length;
+    Changed(start, start + length);
+}
+
+void ZepBracketIndex::Erase(ByteIndex start, ByteIndex end) {
+    // Remove brackets in the erased section, and move the ones after it back
+    Node *pLeft, *pErased, *pRight;
+    Split(m_pRoot, start, pLeft, pErased);
+    Split(pErased, end, pErased, pRight);
+    DeleteNodes(pErased);
+    Shift(pRight, start - end);
+    m_pRoot = Merge(pLeft, pRight);
+
+    if (m_dirtyEnd != Unbounded && m_dirtyEnd >= start) m_dirtyEnd = std::max(start, m_dirtyEnd - (std::min(m_dirtyEnd, end) - start));
+    Changed(start, start);
+}
+
+void ZepBracketIndex::Changed(ByteIndex start, ByteIndex end) {
+    if (m_dirtyStart == Unbounded) {
+        m_dirtyStart = start;
+        m_dirtyEnd = end;
+        return;
+    }
+    m_dirtyStart = std::min(m_dirtyStart, start);
+    m_dirtyEnd = std::max(m_dirtyEnd, end);
+}
+
+void ZepBracketIndex::Reset() {
+    DeleteNodes(m_pRoot);
+    m_pRoot = nullptr;
+    m_dirtyStart = 0;
+    m_dirtyEnd = Unbounded;
+}
+
+void ZepBracketIndex::Update(const TextStorage &text, bool lilike) {
+    if (lilike != m_lilike) {
+        m_lilike = lilike;
+        Reset();
+    }
+    if (m_dirtyStart == Unbounded) return;
+
+    // The brackets before the edits are still in code, so the scan starts in code just after the last of them
+    Node *pLeft, *pOld;
+    Split(m_pRoot, m_dirtyStart, pLeft, pOld);
+
+    ByteIndex start = 0;
+    for (auto pNode = pLeft; pNode; pNode = pNode->pRight) {
+        PushShift(pNode);
+        if (!pNode->pRight) start = pNode->offset + 1;
+    }
+
+    BracketScanner scanner;
+    scanner.lilike = lilike;
+    if (start > 0) scanner.prev = text[start - 1];
+
+    // Scan until a bracket is found where it was before the edits, which were all before it.  The new brackets come
+    // in order, so they are built into a tree on the way, keeping the nodes down its right side
+    std::vector<Node *> rightSide;
+    Node *pKept = nullptr;
+    bool scanning = true;
+    ByteIndex spanStart = 0;
+    text.ForEachSpan([&](const uint8_t *pBegin, const uint8_t *pEnd) {
+        auto spanEnd = spanStart + ByteIndex(pEnd - pBegin);
+        if (scanning && spanEnd > start) {
+            auto skip = std::max(0l, start - spanStart);
+            scanning = scanner.Scan(pBegin + skip, pEnd, spanStart + skip, [&](ByteIndex offset, uint8_t ch) {
+                if (offset >= m_dirtyEnd && FindNode(pOld, offset)) {
+                    Node *pStale;
+                    Split(pOld, offset, pStale, pKept);
+                    DeleteNodes(pStale);
+                    pOld = nullptr;
+                    return false;
+                }
+
+                auto pNode = new Node();
+                pNode->offset = offset;
+                pNode->ch = ch;
+
+                // xorshift; only the balance of the tree depends on it
+                m_random ^= m_random << 13;
+                m_random ^= m_random >> 17;
+                m_random ^= m_random << 5;
+                pNode->priority = m_random;
+
+                Node *pBelow = nullptr;
+                while (!rightSide.empty() && rightSide.back()->priority < pNode->priority) {
+                    pBelow = rightSide.back();
+                    rightSide.pop_back();
+                    UpdateDepths(pBelow);
+                }
+                pNode->pLeft = pBelow;
+                if (!rightSide.empty()) rightSide.back()->pRight = pNode;
+                rightSide.push_back(pNode);
+                return true;
+            });
+        }
+        spanStart = spanEnd;
+    });
+
+    for (auto itr = rightSide.rbegin(); itr != rightSide.rend(); itr++) UpdateDepths(*itr);
+    auto pNew = rightSide.empty() ? nullptr : rightSide.front();
+
+    DeleteNodes(pOld);
+    m_pRoot = Merge(Merge(pLeft, pNew), pKept);
+    m_dirtyStart = Unbounded;
+}
+
+std::vector<ByteIndex> ZepBracketIndex::GetBrackets() const {
+    std::vector<ByteIndex> offsets;
+    std::vector<std::pair<const Node *, ByteIndex>> path;
+    const Node *pNode = m_pRoot;
+    ByteIndex shift = 0;
+    while (pNode || !path.empty()) {
+        for (; pNode; pNode = pNode->pLeft) {
+            path.emplace_back(pNode, shift);
+            shift += pNode->shift;
+        }
+        pNode = path.back().first;
+        shift = path.back().second;
+        path.pop_back();
+        offsets.push_back(pNode->offset + shift);
+        shift += pNode->shift;
+        pNode = pNode->pRight;
+    }
+    return offsets;
+}
+
+ByteIndex ZepBracketIndex::FindNext(ByteIndex offset) const {
+    ByteIndex found = -1;
+    ByteIndex shift = 0;
+    for (auto pNode = m_pRoot; pNode;) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->offset + shift >= offset) {
+            found = pNode->offset + shift;
+            pNode = pNode->pLeft;
+        } else {
+            pNode = pNode->pRight;
+        }
+        shift = childShift;
+    }
+    return found;
+}
+
+ByteIndex ZepBracketIndex::FindPair(ByteIndex offset) const {
+    auto pNode = FindNode(m_pRoot, offset);
+    if (!pNode) return -1;
+    if (IsOpen(pNode->ch)) return FindClose(offset, TypeOf(pNode->ch));
+    return FindOpen(offset - 1, TypeOf(pNode->ch), 1);
+}
+
+// The open bracket of the type which is 'level' out from the limit, and not closed by it
+ByteIndex ZepBracketIndex::FindOpen(ByteIndex limit, int type, int level) const {
+    int32_t after = 0;
+    return LastRiseTo(m_pRoot, 0, limit, type, level, after);
+}
+
+ByteIndex ZepBracketIndex::FindClose(ByteIndex open, int type) const {
+    int32_t before = 0;
+    return FirstFallAfter(m_pRoot, 0, open, type, before);
+}
+
+ByteRange ZepBracketIndex::FindEnclosing(ByteIndex offset, uint8_t ch, bool matched) const {
+    auto type = TypeOf(ch);
+    if (type == Max) return ByteRange(-1, -1);
+
+    // On a close bracket, it's the pair it closes
+    auto pNode = FindNode(m_pRoot, offset);
+    auto limit = pNode && TypeOf(pNode->ch) == type && IsClose(pNode->ch) ? offset - 1 : offset;
+
+    for (int level = 1;; level++) {
+        auto open = FindOpen(limit, type, level);
+        if (open == -1) return ByteRange(-1, -1);
+
+        auto close = FindClose(open, type);
+        if (close != -1 || !matched) return ByteRange(open, close);
+    }
+}
+
+ByteRange ZepBracketIndex::FindTopLevel(ByteIndex offset, uint8_t ch) const {
+    auto type = TypeOf(ch);
+    if (type == Max) return ByteRange(-1, -1);
+
+    auto pNode = FindNode(m_pRoot, offset);
+    auto limit = pNode && TypeOf(pNode->ch) == type && IsClose(pNode->ch) ? offset - 1 : offset;
+
+    // The depth rises most from the outermost open bracket, unless it is never closed
+    for (auto level = DepthsTo(m_pRoot, limit).highest[type]; level > 0; level--) {
+        auto open = FindOpen(limit, type, level);
+        auto close = FindClose(open, type);
+        if (close != -1) return ByteRange(open, close);
+    }
+    return ByteRange(-1, -1);
+}
+
+ByteRange ZepBracketIndex::FindNearestTopLevel(ByteIndex offset, uint8_t ch) const {
+    auto type = TypeOf(ch);
+    if (type == Max) return ByteRange(-1, -1);
+
+    // Outside the pairs, the last bracket before closes one at the top level, and the next opens one
+    ByteRange found(-1, -1);
+    auto distance = Unbounded;
+    auto consider = [&](ByteIndex open, ByteIndex close) {
+        if (open == -1 || close == -1) return;
+        auto closest = std::min(std::abs(open - offset), std::abs(offset - (close + 1)));
+        if (closest < distance) {
+            found = ByteRange(open, close);
+            distance = closest;
+        }
+    };
+
+    ByteIndex before = -1;
+    auto pBefore = LastOfType(m_pRoot, offset, type, before);
+    if (pBefore && IsClose(pBefore->ch)) consider(FindOpen(before - 1, type, 1), before);
+
+    ByteIndex after = -1;
+    auto pAfter = FirstOfType(m_pRoot, offset, type, after);
+    if (pAfter && IsOpen(pAfter->ch)) consider(after, FindClose(after, type));
+    return found;
+}
+
+int ZepBracketIndex::FormDepth(const std::string &text, bool lilike) {
+    BracketScanner scanner;
+    scanner.lilike = lilike;
+
+    int32_t depths[Max] = {};
+    int unmatched = 0;
+    auto pText = (const uint8_t *) text.data();
+    scanner.Scan(pText, pText + text.size(), 0, [&](ByteIndex, uint8_t ch) {
+        auto &depth = depths[TypeOf(ch)];
+        if (IsOpen(ch)) depth++;
+        else if (depth > 0) depth--;
+        else unmatched++;
+        return true;
+    });
+
+    if (unmatched > 0) return -unmatched;
+    return depths[Bracket] + depths[Group] + depths[Brace];
+}
+
+} // namespace Zep
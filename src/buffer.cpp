@@ -2,6 +2,7 @@
 #include <cctype>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <regex>
 
 #include "zep/buffer.h"
@@ -10,6 +11,8 @@
 
 #include "zep/path.h"
 #include "zep/stringutils.h"
+#include "zep/syntax.h"
+#include "zep/text_scan.h"
 
 namespace Zep {
 
@@ -48,6 +51,66 @@ inline bool IsSpaceOrTerminal(const char c) {
 
 } // namespace
 
+void LineIndex::Clear() {
+    m_ends.clear();
+    m_stepLine = 0;
+    m_stepBytes = 0;
+}
+
+void LineIndex::PushBack(ByteIndex end) {
+    // The new line is after the step
+    m_ends.push_back(end - m_stepBytes);
+}
+
+void LineIndex::Assign(const std::vector<ByteIndex> &ends) {
+    Clear();
+    m_ends.assign(ends.begin(), ends.end());
+}
+
+long LineIndex::FindLine(ByteIndex index) const {
+    long low = 0;
+    long high = Count();
+    while (low < high) {
+        auto mid = (low + high) / 2;
+        if ((*this)[mid] <= index) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Move the step to this line, adding or removing it from the lines it passes over
+void LineIndex::MoveStep(long line) {
+    if (m_stepBytes != 0) {
+        for (; m_stepLine < line; m_stepLine++) m_ends[m_stepLine] += m_stepBytes;
+        for (; m_stepLine > line; m_stepLine--) m_ends[m_stepLine - 1] -= m_stepBytes;
+    }
+    m_stepLine = line;
+}
+
+void LineIndex::Insert(ByteIndex index, ByteIndex count, const std::vector<ByteIndex> &newEnds) {
+    auto line = FindLine(index);
+    MoveStep(line);
+    m_stepBytes += count;
+
+    // New lines go before the step, so they are stored as they are
+    if (!newEnds.empty()) {
+        m_ends.insert(m_ends.begin() + line, newEnds.begin(), newEnds.end());
+        m_stepLine += long(newEnds.size());
+    }
+}
+
+void LineIndex::Erase(ByteIndex begin, ByteIndex end) {
+    auto first = FindLine(begin);
+    auto last = FindLine(end);
+    MoveStep(last);
+
+    if (first != last) {
+        m_ends.erase(m_ends.begin() + first, m_ends.begin() + last);
+        m_stepLine = first;
+    }
+    m_stepBytes -= (end - begin);
+}
+
 ZepBuffer::ZepBuffer(ZepEditor &editor, std::string strName) : ZepComponent(editor), name(std::move(strName)) {
     Clear();
 }
@@ -66,11 +129,7 @@ long ZepBuffer::GetBufferColumn(const GlyphIterator &location) const {
 
 // Find the location inside the list of line ends
 long ZepBuffer::GetBufferLine(const GlyphIterator &location) const {
-    auto itrLine = std::lower_bound(lineEnds.begin(), lineEnds.end(), location.index);
-    if (itrLine != lineEnds.end() && location.index >= *itrLine) {
-        itrLine++;
-    }
-    long line = std::min(std::max(0l, long(itrLine - lineEnds.begin())), long(lineEnds.size()) - 1);
+    long line = std::min(std::max(0l, lineEnds.FindLine(location.index)), lineEnds.Count() - 1);
     return line;
 }
 
@@ -293,24 +352,18 @@ GlyphIterator ZepBuffer::FindOnLineMotion(GlyphIterator start, const uint8_t *pC
 }
 
 std::pair<GlyphIterator, GlyphIterator> ZepBuffer::FindMatchingPair(GlyphIterator start, const uint8_t ch) const {
-    std::string delims;
-    switch (ch) {
-        case '(':
-        case ')':delims = "()";
-            break;
-        case '[':
-        case ']':delims = "[]";
-            break;
-        case '{':
-        case '}':delims = "{}";
-            break;
-        default:
-            // Matching same char at both ends
-            delims = std::string(2, ch);
-            break;
+    std::pair<GlyphIterator, GlyphIterator> ret;
+
+    // Brackets come from the index
+    if (ZepBracketIndex::IsOpen(ch) || ZepBracketIndex::IsClose(ch)) {
+        auto found = GetBracketIndex().FindEnclosing(start.index, ch);
+        if (found.first != -1) ret.first = GlyphIterator(this, found.first);
+        if (found.second != -1) ret.second = GlyphIterator(this, found.second);
+        return ret;
     }
 
-    std::pair<GlyphIterator, GlyphIterator> ret;
+    // Matching same char at both ends
+    std::string delims = std::string(2, ch);
     Direction dir = Direction::Backward;
 
     auto search = [&](GlyphIterator loc, Direction dir) {
@@ -478,7 +531,7 @@ GlyphIterator ZepBuffer::ClampToVisibleLine(GlyphIterator in) const {
 // Method for querying the beginning and end of a line
 bool ZepBuffer::GetLineOffsets(const long line, ByteRange &range) const {
     // Not valid
-    if (long(lineEnds.size()) <= line) {
+    if (lineEnds.Count() <= line) {
         range.first = 0;
         range.second = 0;
         return false;
@@ -515,11 +568,12 @@ void ZepBuffer::Load(const ZepPath &path) {
 
     if (Zep::ZepFileSystem::Exists(path)) {
         filePath = Zep::ZepFileSystem::Canonical(path);
-        auto read = Zep::ZepFileSystem::Read(path);
+        auto file = Zep::ZepFileSystem::Map(path);
 
         // Always set text, to ensure we prepare the buffer with 0 terminator,
         // even if string is empty
-        SetText(read, true);
+        if (file) SetText(file->begin(), file->end(), true);
+        else SetText(std::string(), true);
     } else {
         // Can't canonicalize a non-existent path.
         // But we may have a path we haven't save to yet!
@@ -531,25 +585,45 @@ void ZepBuffer::Load(const ZepPath &path) {
 bool ZepBuffer::Save(int64_t &size) {
     if ((fileFlags & FileFlags::Locked) || (fileFlags & FileFlags::ReadOnly)) return false;
 
-    auto str = workingBuffer.string();
+    // Remove the appended 0 if necessary
+    auto remaining = long(workingBuffer.size());
+    if (fileFlags & FileFlags::TerminatedWithZero) remaining--;
+
+    size = 0;
+    if (remaining <= 0) return true;
 
     // Put back /r/n if necessary while writing the file
     // At the moment, Zep removes /r/n and just uses /n while modifying text.
     // It replaces the /r on files that had it afterwards
     // Alternatively we could manage them 'in place', but that would make parsing more complex.
     // And then what do you do if there are 2 different styles in the file.
-    if (fileFlags & FileFlags::StrippedCR) {
-        // TODO: faster way to replace newlines
-        string_replace_in_place(str, "\n", "\r\n");
-    }
+    auto restoreCR = (fileFlags & FileFlags::StrippedCR) != 0;
+
+    // Stream the text straight from the buffer, without making a copy of it
+    ZepFileWriter writer(filePath);
+    workingBuffer.ForEachSpan([&](const uint8_t *pBegin, const uint8_t *pEnd) {
+        pEnd = std::min(pEnd, pBegin + remaining);
+        remaining -= long(pEnd - pBegin);
+        if (!restoreCR) {
+            writer.Write(pBegin, pEnd - pBegin);
+            size += pEnd - pBegin;
+            return;
+        }
 
-    // Remove the appended 0 if necessary
-    size = (int64_t) str.size();
-    if (fileFlags & FileFlags::TerminatedWithZero) size--;
+        for (auto p = pBegin; p < pEnd;) {
+            auto pLineEnd = (const uint8_t *) memchr(p, '\n', pEnd - p);
+            auto pWriteEnd = pLineEnd ? pLineEnd : pEnd;
+            writer.Write(p, pWriteEnd - p);
+            size += pWriteEnd - p;
+            if (!pLineEnd) break;
 
-    if (size <= 0) return true;
+            writer.Write("\r\n", 2);
+            size += 2;
+            p = pLineEnd + 1;
+        }
+    });
 
-    if (Zep::ZepFileSystem::Write(filePath, &str[0], (size_t) size)) {
+    if (writer.Commit()) {
         fileFlags = ZClearFlags(fileFlags, FileFlags::Dirty);
         if (Zep::ZepFileSystem::Exists(filePath)) {
             filePath = Zep::ZepFileSystem::Canonical(filePath);
@@ -592,9 +666,10 @@ void ZepBuffer::Clear() {
     if (workingBuffer.size() <= 1) {
         workingBuffer.clear();
         workingBuffer.push_back(0);
-        lineEnds.clear();
+        m_bracketIndex.Reset();
+        lineEnds.Clear();
         fileFlags = ZSetFlags(fileFlags, FileFlags::TerminatedWithZero);
-        lineEnds.push_back(End().index + 1);
+        lineEnds.PushBack(End().index + 1);
         return;
     }
 
@@ -603,9 +678,10 @@ void ZepBuffer::Clear() {
 
     workingBuffer.clear();
     workingBuffer.push_back(0);
-    lineEnds.clear();
+    m_bracketIndex.Reset();
+    lineEnds.Clear();
     fileFlags = ZSetFlags(fileFlags, FileFlags::TerminatedWithZero);
-    lineEnds.push_back(End().index + 1);
+    lineEnds.PushBack(End().index + 1);
 
     {
         MarkUpdate();
@@ -615,39 +691,39 @@ void ZepBuffer::Clear() {
 
 // Replace the buffer with the text
 void ZepBuffer::SetText(const std::string &text, bool initFromFile) {
+    SetText((const uint8_t *) text.data(), (const uint8_t *) text.data() + text.size(), initFromFile);
+}
+
+void ZepBuffer::SetText(const uint8_t *pBegin, const uint8_t *pEnd, bool initFromFile) {
     // First, clear it
     Clear();
 
-    bool lastWasSpace = false;
-    if (!text.empty()) {
-        // Since incremental insertion of a big file into a gap buffer gives us worst case performance,
-        // We build the buffer in a separate array and assign it.  Much faster.
-        std::vector<uint8_t> input;
+    // Find the line ends and whitespace in one pass
+    TextScan scan;
+    ScanText(pBegin, pEnd, scan);
+
+    // We remove \r, we only care about \n.  Most files have none, and are copied straight into the buffer
+    std::vector<uint8_t> stripped;
+    if (scan.hasCR) {
+        fileFlags |= FileFlags::StrippedCR;
+        stripped.reserve(pEnd - pBegin);
+        for (auto p = pBegin; p < pEnd;) {
+            auto pCR = (const uint8_t *) memchr(p, '\r', pEnd - p);
+            stripped.insert(stripped.end(), p, pCR ? pCR : pEnd);
+            if (!pCR) break;
+            p = pCR + 1;
+        }
+        pBegin = stripped.data();
+        pEnd = pBegin + stripped.size();
+        ScanText(pBegin, pEnd, scan);
+    }
 
-        lineEnds.clear();
+    if (scan.hasTabs) fileFlags |= FileFlags::HasTabs;
+    if (scan.hasSpaceTabs) fileFlags |= FileFlags::HasSpaceTabs;
 
-        // Update the gap buffer with the text
-        // We remove \r, we only care about \n
-        for (auto &ch: text) {
-            if (ch == '\r') {
-                fileFlags |= FileFlags::StrippedCR;
-            } else {
-                input.push_back(ch);
-                if (ch == '\n') {
-                    lineEnds.push_back(ByteIndex(input.size()));
-                    lastWasSpace = false;
-                } else if (ch == '\t') {
-                    fileFlags |= FileFlags::HasTabs;
-                    lastWasSpace = false;
-                } else if (ch == ' ') {
-                    if (lastWasSpace) fileFlags |= FileFlags::HasSpaceTabs;
-                    lastWasSpace = true;
-                } else {
-                    lastWasSpace = false;
-                }
-            }
-        }
-        workingBuffer.assign(input.begin(), input.end());
+    if (pBegin != pEnd) {
+        lineEnds.Assign(scan.lineEnds);
+        workingBuffer.assign(pBegin, pEnd);
     }
 
     // If file is only tabs, then force tab mode
@@ -663,7 +739,7 @@ void ZepBuffer::SetText(const std::string &text, bool initFromFile) {
     // TODO: Why is a line end needed always?
     // TODO: Line ends 1 beyond, or just for end?  Can't remember this detail:
     // understand it, then write a unit test to ensure it.
-    lineEnds.push_back(End().index + 1);
+    lineEnds.PushBack(End().index + 1);
 
     MarkUpdate();
 
@@ -795,50 +871,24 @@ bool ZepBuffer::Insert(const GlyphIterator &startIndex, const std::string &str,
     GlyphIterator endIndex(this, startIndex.index + long(str.length()));
 
     sigPreInsert(*this, startIndex, str);
+    UpdateMarkers(startIndex.index, startIndex.index + long(str.length()) - 1, long(str.length()));
 
     // We are about to modify this range
     // TODO: Is this correct, and/or useful in any way??
     // We aren't changing this range at all; we are shifting those characters forward and replacing the area
     editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::PreBufferChange, startIndex, endIndex));
 
-    // abcdef\r\nabc<insert>dfdf\r\n
-    auto itrLine = std::lower_bound(lineEnds.begin(), lineEnds.end(), startIndex.index);;
-    if (itrLine != lineEnds.end() && *itrLine <= startIndex.index) {
-        itrLine++;
-    }
-
-    auto itrEnd = str.end();
-    auto itrBegin = str.begin();
-    auto itr = str.begin();
-
     // Make a list of lines to 'insert'
-    std::vector<long> lines;
-    std::string lineEndSymbols("\n");
-    while (itr != itrEnd) {
-        // Get to first point after "\n"
-        // That's the point just after the end of the current line
-        itr = std::find_first_of(itr, itrEnd, lineEndSymbols.begin(), lineEndSymbols.end());
-        if (itr != itrEnd) {
-            if (itr != itrEnd && *itr == '\n') itr++;
-            lines.push_back(long(itr - itrBegin) + startIndex.index);
-        }
-    }
+    TextScan scan;
+    auto pStr = (const uint8_t *) str.data();
+    ScanText(pStr, pStr + str.size(), scan, startIndex.index);
 
-    // Increment the rest of the line ends
-    // We make all the remaning line ends bigger by the fixed_size of the insertion
-    auto itrAdd = itrLine;
-    while (itrAdd != lineEnds.end()) {
-        *itrAdd += long(str.length());
-        itrAdd++;
-    }
-
-    if (!lines.empty()) {
-        // Update the atomic line counter so clients can see where we are up to.
-        lineEnds.insert(itrLine, lines.begin(), lines.end());
-    }
+    // We make all the remaining line ends bigger by the size of the insertion, and add the new ones
+    lineEnds.Insert(startIndex.index, long(str.length()), scan.lineEnds);
 
     changeRecord.strInserted = str;
-    workingBuffer.insert(workingBuffer.begin() + startIndex.index, str.begin(), str.end());
+    workingBuffer.insert(startIndex.index, str);
+    m_bracketIndex.Insert(startIndex.index, long(str.length()));
 
     MarkUpdate();
 
@@ -872,6 +922,7 @@ bool ZepBuffer::Replace(const GlyphIterator &startIndex, const GlyphIterator &en
         // TODO: (0) Broken now we support utf8
         workingBuffer[loc.index] = str[0];
     }
+    m_bracketIndex.Changed(startIndex.index, endIndex.index);
 
     MarkUpdate();
 
@@ -900,27 +951,15 @@ bool ZepBuffer::Delete(const GlyphIterator &startIndex, const GlyphIterator &end
     changeRecord.strDeleted = GetBufferText(startIndex, endIndex);
 
     sigPreDelete(*this, startIndex, endIndex);
+    UpdateMarkers(startIndex.index, endIndex.index, startIndex.index - endIndex.index);
 
-    auto itrLine = std::lower_bound(lineEnds.begin(), lineEnds.end(), startIndex.index);
-    if (itrLine == lineEnds.end()) return false;
+    if (lineEnds[lineEnds.Count() - 1] < startIndex.index) return false;
 
-    auto itrLastLine = std::upper_bound(itrLine, lineEnds.end(), endIndex.index);
-    auto offsetDiff = endIndex.index - startIndex.index;
+    // Remove the deleted line ends, and adjust all line offsets beyond us
+    lineEnds.Erase(startIndex.index, endIndex.index);
 
-    if (*itrLine <= startIndex.index) {
-        itrLine++;
-    }
-
-    // Adjust all line offsets beyond us
-    for (auto itr = itrLastLine; itr != lineEnds.end(); itr++) {
-        *itr -= offsetDiff;
-    }
-
-    if (itrLine != itrLastLine) {
-        lineEnds.erase(itrLine, itrLastLine);
-    }
-
-    workingBuffer.erase(workingBuffer.begin() + startIndex.index, workingBuffer.begin() + endIndex.index);
+    workingBuffer.erase(startIndex.index, endIndex.index);
+    m_bracketIndex.Erase(startIndex.index, endIndex.index);
     assert(!workingBuffer.empty() && workingBuffer[workingBuffer.size() - 1] == 0);
 
     MarkUpdate();
@@ -948,78 +987,101 @@ void ZepBuffer::SetSelection(const GlyphRange &sel) {
 }
 
 void ZepBuffer::AddRangeMarker(const std::shared_ptr<RangeMarker> &marker) {
-    rangeMarkers[marker->range.first].insert(marker);
+    rangeMarkers.Insert(marker);
 
-    // TODO: Why is this necessary; marks the whole buffer
-    editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::MarkersChanged, Begin(), End()));
+    auto range = marker->GetRange();
+    editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::MarkersChanged, GlyphIterator(this, range.first), GlyphIterator(this, range.second)));
 }
 
 void ZepBuffer::ClearRangeMarker(const std::shared_ptr<RangeMarker> &marker) {
-    auto itr = rangeMarkers.find(marker->range.first);
-    if (itr != rangeMarkers.end()) {
-        itr->second.erase(marker);
-        if (itr->second.empty()) {
-            rangeMarkers.erase(marker->range.first);
-        }
-    }
+    if (&marker->buffer != this || !marker->InBuffer()) return;
 
-    // TODO: Why is this necessary; marks the whole buffer
-    editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::MarkersChanged, Begin(), End()));
+    rangeMarkers.Erase(*marker);
+
+    auto range = marker->GetRange();
+    editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::MarkersChanged, GlyphIterator(this, range.first), GlyphIterator(this, range.second)));
 }
 
 void ZepBuffer::ClearRangeMarkers(uint32_t markerType) {
-    std::set<std::shared_ptr<RangeMarker>> markers;
+    std::vector<std::shared_ptr<RangeMarker>> markers;
     ForEachMarker(markerType, Direction::Forward, Begin(), End(), [&](const std::shared_ptr<RangeMarker> &pMarker) {
         // Timed ones will expire on their own; TODO: Add a cleaner mechanism for selection here
         if (!(pMarker->displayType & RangeMarkerDisplayType::Timed)) {
-            markers.insert(pMarker);
+            markers.push_back(pMarker);
         }
         return true;
     });
+    if (markers.empty()) return;
 
     for (auto &victim: markers) {
-        ClearRangeMarker(victim);
+        rangeMarkers.Erase(*victim);
     }
 
     editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::MarkersChanged, Begin(), End()));
 }
 
-bool OverlapInclusive(ByteRange r1, ByteRange r2) {
-    // -----aaaaa----
-    // ---bbbbbbbbb-------
-    return r1.first <= r2.second && r2.first <= r1.second;
+// By Default Markers will:
+// - Move down if text is inserted before them.
+// - Move up if text is deleted before them.
+// - Remove themselves from the buffer if text is edited _inside_ them.
+// It's up to marker owners to update this behavior if necessary.
+// Markers do not act inside the undo/redo system.  They live on the buffer but are not stored with it.  They are adornments that
+// must be managed externally.
+// The markers after the edit are moved together, and those it was inside are taken out with one message for them all
+void ZepBuffer::UpdateMarkers(ByteIndex start, ByteIndex shiftFrom, ByteIndex distance) {
+    if (rangeMarkers.Empty()) return;
+
+    std::vector<std::shared_ptr<RangeMarker>> removed;
+    rangeMarkers.Edit(start, shiftFrom, distance, removed);
+    if (removed.empty()) return;
+
+    ByteRange changed(std::numeric_limits<ByteIndex>::max(), 0);
+    for (auto &marker: removed) {
+        marker->enabled = false;
+        auto range = marker->GetRange();
+        changed.first = std::min(changed.first, range.first);
+        changed.second = std::max(changed.second, range.second);
+    }
+    editor.Broadcast(std::make_shared<BufferMessage>(this, BufferMessageType::MarkersChanged, GlyphIterator(this, changed.first), GlyphIterator(this, changed.second)));
 }
 
-void ZepBuffer::ForEachMarker(uint32_t markerType, Direction dir, const GlyphIterator &begin, const GlyphIterator &end, const std::function<bool(const std::shared_ptr<RangeMarker> &)> &fnCB) const {
-    ByteRange inclusive = ByteRange(begin.index, end.Peek(-1).index);
-    if (dir == Direction::Forward) {
-        for (const auto &m_rangeMarker: rangeMarkers) {
-            for (int pass = 0; pass < 2; pass++) {
-                for (auto &markerItem: m_rangeMarker.second) {
-                    if ((markerItem->markerType & markerType) == 0) continue;
-
-                    // Enumerate timed markers after all others, because these are effects that should happen last
-                    if (pass == 0) {
-                        if (markerItem->displayType & RangeMarkerDisplayType::Timed) continue;
-                    } else if (!(markerItem->displayType & RangeMarkerDisplayType::Timed)) continue;
+// The markers over [first, last] in the order they start, with the ranges the tree found them at
+void ZepBuffer::FindMarkers(uint32_t markerType, ByteIndex first, ByteIndex last, std::vector<std::pair<std::shared_ptr<RangeMarker>, ByteRange>> &found) const {
+    rangeMarkers.ForEach(first, last, [&](const std::shared_ptr<RangeMarker> &marker, const ByteRange &range) {
+        if (marker->markerType & markerType) found.emplace_back(marker, range);
+        return true;
+    });
 
-                    auto markerInclusive = ByteRange(markerItem->range.first, std::max(0l, markerItem->range.second - 1));
-                    if (!OverlapInclusive(inclusive, markerInclusive)) continue;
+    // Enumerate timed markers after the others which start at the same place, because these are effects that should happen last
+    for (size_t group = 0; group < found.size();) {
+        auto groupEnd = group;
+        while (groupEnd < found.size() && found[groupEnd].second.first == found[group].second.first) groupEnd++;
+        std::stable_partition(found.begin() + group, found.begin() + groupEnd, [](const std::pair<std::shared_ptr<RangeMarker>, ByteRange> &marker) {
+            return !(marker.first->displayType & RangeMarkerDisplayType::Timed);
+        });
+        group = groupEnd;
+    }
+}
 
-                    if (!fnCB(markerItem)) return;
-                }
-            }
+void ZepBuffer::ForEachMarker(uint32_t markerType, Direction dir, const GlyphIterator &begin, const GlyphIterator &end, const std::function<bool(const std::shared_ptr<RangeMarker> &)> &fnCB) const {
+    // Found first, so the callback is free to change the markers
+    if (dir == Direction::Forward) {
+        std::vector<std::pair<std::shared_ptr<RangeMarker>, ByteRange>> found;
+        FindMarkers(markerType, begin.index, end.Peek(-1).index, found);
+        for (auto &marker: found) {
+            if (!fnCB(marker.first)) return;
         }
-    } else {
-        auto itrREnd = std::make_reverse_iterator(rangeMarkers.begin());
-        auto itrRStart = std::make_reverse_iterator(rangeMarkers.end());
+        return;
+    }
 
-        for (auto itr = itrRStart; itr != itrREnd; itr++) {
-            for (auto &markerItem: itr->second) {
-                if ((markerItem->markerType & markerType) == 0) continue;
-                if (!fnCB(markerItem)) return;
-            }
-        }
+    std::vector<std::shared_ptr<RangeMarker>> markers;
+    rangeMarkers.ForEachReverse([&](const std::shared_ptr<RangeMarker> &marker) {
+        if (marker->markerType & markerType) markers.push_back(marker);
+        return true;
+    });
+
+    for (auto &marker: markers) {
+        if (!fnCB(marker)) return;
     }
 }
 
@@ -1045,7 +1107,7 @@ tRangeMarkers ZepBuffer::GetRangeMarkers(uint32_t markerType) const {
     tRangeMarkers markers;
     ForEachMarker(markerType, Direction::Forward, Begin(), End(), [&](const std::shared_ptr<RangeMarker> &marker) {
         if ((marker->markerType & markerType) != 0) {
-            markers[marker->range.first].insert(marker);
+            markers[marker->GetRange().first].insert(marker);
         }
         return true;
     });
@@ -1059,8 +1121,8 @@ std::shared_ptr<RangeMarker> ZepBuffer::FindNextMarker(GlyphIterator start, Dire
     auto search = [&]() {
         ForEachMarker(markerType, dir, Begin(), End(), [&](const std::shared_ptr<RangeMarker> &marker) {
             if (dir == Direction::Forward) {
-                if (marker->range.first <= start.index) return true;
-            } else if (marker->range.first >= start.index) return true;
+                if (marker->GetRange().first <= start.index) return true;
+            } else if (marker->GetRange().first >= start.index) return true;
 
             found = marker;
             return false;
@@ -1092,12 +1154,48 @@ tRangeMarkers ZepBuffer::GetRangeMarkersOnLine(uint32_t markerTypes, long line)
         Direction::Forward,
         GlyphIterator(this, range.first), GlyphIterator(this, range.second),
         [&](const std::shared_ptr<RangeMarker> &marker) {
-            rangeMarkersOnLine[marker->range.first].insert(marker);
+            rangeMarkersOnLine[marker->GetRange().first].insert(marker);
             return true;
         });
     return rangeMarkersOnLine;
 }
 
+// The markers on each of the lines, from one walk of the markers over them rather than a query for each line
+LineRangeMarkers ZepBuffer::GetRangeMarkersOnLines(uint32_t markerTypes, long firstLine, long lastLine) const {
+    LineRangeMarkers markersOnLines;
+    firstLine = std::max(0l, firstLine);
+    lastLine = std::min(lastLine, lineEnds.Count() - 1);
+    markersOnLines.firstLine = firstLine;
+    if (lastLine < firstLine) return markersOnLines;
+    markersOnLines.lines.resize(lastLine - firstLine + 1);
+
+    ByteRange firstRange, lastRange;
+    GetLineOffsets(firstLine, firstRange);
+    GetLineOffsets(lastLine, lastRange);
+
+    std::vector<std::pair<std::shared_ptr<RangeMarker>, ByteRange>> found;
+    FindMarkers(markerTypes, firstRange.first, GlyphIterator(this, lastRange.second).Peek(-1).index, found);
+
+    // The markers come in the order they start, so the line of the start only moves on
+    auto startLine = firstLine;
+    for (auto &[marker, range]: found) {
+        // The lines from the one holding its first byte to the one holding its last, as GetRangeMarkersOnLine finds it
+        while (startLine < lastLine && lineEnds[startLine] <= range.first) startLine++;
+        auto lastByte = std::max(0l, range.second - 1);
+        auto endLine = startLine;
+        while (endLine < lastLine && lineEnds[endLine] <= lastByte) endLine++;
+
+        // An empty marker at the start of a line is over neither it nor the line before
+        if (startLine > 0 && lineEnds[startLine - 1] > lastByte) continue;
+
+        for (auto line = startLine; line < endLine; line++) {
+            markersOnLines.lines[line - firstLine].push_back(marker);
+        }
+        markersOnLines.lines[endLine - firstLine].push_back(std::move(marker));
+    }
+    return markersOnLines;
+}
+
 bool ZepBuffer::IsHidden() const {
     auto windows = editor.FindBufferWindows(this);
     return windows.empty();
@@ -1114,85 +1212,42 @@ void ZepBuffer::ToggleFileFlag(uint32_t flags) {
     fileFlags = ZSetFlags(fileFlags, flags, !(fileFlags & flags));
 }
 
-GlyphRange ZepBuffer::GetExpression(ExpressionType expressionType, const GlyphIterator &location, const std::vector<char> &beginExpression, const std::vector<char> &endExpression) const {
-    GlyphIterator itr = Begin();
-    GlyphIterator itrEnd = End();
-
-    int maxDepth = -1;
-    struct Expression {
-        int depth = 0;
-        GlyphRange range;
-        std::vector<std::shared_ptr<Expression>> children;
-        Expression *pParent = nullptr;
-    };
-
-    std::vector<std::shared_ptr<Expression>> topLevel;
-
-    Expression *pCurrent = nullptr;
-    Expression *pInner = nullptr;
-
-    while (itr != itrEnd) {
-        auto ch = itr.Char();
-
-        for (auto &exp: beginExpression) {
-            if (exp == ch) {
-                auto child = std::make_shared<Expression>();
-                if (pCurrent) {
-                    pCurrent->children.push_back(child);
-                    child->pParent = pCurrent;
-                    child->depth = pCurrent->depth + 1;
-                } else {
-                    topLevel.push_back(child);
-                }
-                pCurrent = child.get();
-                pCurrent->range.first = itr;
-            }
-        }
+const ZepBracketIndex &ZepBuffer::GetBracketIndex() const {
+    m_bracketIndex.Update(workingBuffer, syntax && (syntax->GetFlags() & ZepSyntaxFlags::Lilike));
+    return m_bracketIndex;
+}
 
-        for (auto &exp: endExpression) {
-            if (exp == ch) {
-                if (pCurrent) {
-                    pCurrent->range.second = itr.Peek(1);
-
-                    // Check the sub exp
-                    if ((pCurrent->range.first <= location) && (pCurrent->range.second > location)) {
-                        if (pCurrent->depth > maxDepth) {
-                            maxDepth = pCurrent->depth;
-                            pInner = pCurrent;
-                        }
-                    }
-                    pCurrent = pCurrent->pParent;
-                }
-            }
-        }
+GlyphRange ZepBuffer::GetExpression(ExpressionType expressionType, const GlyphIterator &location, const std::vector<char> &beginExpression, const std::vector<char> &endExpression) const {
+    const auto &index = GetBracketIndex();
 
-        itr.Move(1);
+    // Each type of bracket asked for nests on its own; the innermost or outermost of them wins
+    std::vector<char> types;
+    for (auto ch: beginExpression) {
+        auto close = ch == '(' ? ')' : ch == '[' ? ']' : ch == '{' ? '}' : 0;
+        if (close && std::find(endExpression.begin(), endExpression.end(), close) != endExpression.end()) types.push_back(ch);
     }
 
-    if (expressionType == ExpressionType::Inner) {
-        if (pInner) return pInner->range;
-        return {Begin(), Begin()};
+    ByteRange found(-1, -1);
+    for (auto ch: types) {
+        auto range = expressionType == ExpressionType::Inner ? index.FindEnclosing(location.index, ch, true) : index.FindTopLevel(location.index, ch);
+        if (range.first == -1) continue;
+        if (found.first == -1 || (expressionType == ExpressionType::Inner ? range.first > found.first : range.first < found.first)) found = range;
     }
-
-    Expression *pBest = nullptr;
-    int dist = std::numeric_limits<int>::max();
-
-    for (auto &outer: topLevel) {
-        if (location >= outer->range.first && location < outer->range.second) return outer->range;
-
-        auto leftDist = std::abs(outer->range.first.index - location.index);
-        auto rightDist = std::abs(location.index - outer->range.second.index);
-        if (leftDist < dist) {
-            pBest = outer.get();
-            dist = leftDist;
-        }
-        if (rightDist < dist) {
-            pBest = outer.get();
-            dist = rightDist;
+    if (found.first != -1) return {GlyphIterator(this, found.first), GlyphIterator(this, found.second + 1)};
+    if (expressionType == ExpressionType::Inner) return {Begin(), Begin()};
+
+    // Not inside one, so the closest at the top level
+    auto distance = std::numeric_limits<ByteIndex>::max();
+    for (auto ch: types) {
+        auto range = index.FindNearestTopLevel(location.index, ch);
+        if (range.first == -1) continue;
+        auto closest = std::min(std::abs(range.first - location.index), std::abs(location.index - (range.second + 1)));
+        if (closest < distance || (closest == distance && range.first < found.first)) {
+            found = range;
+            distance = closest;
         }
     }
-
-    if (pBest) return pBest->range;
+    if (found.first != -1) return {GlyphIterator(this, found.first), GlyphIterator(this, found.second + 1)};
     return {Begin(), Begin()};
 }
 
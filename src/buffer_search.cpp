@@ -0,0 +1,486 @@
+#include "zep/buffer_search.h"
+
+#include <cstring>
+#include <functional>
+
+#include "simd.h"
+
+namespace Zep {
+
+namespace {
+
+// Check each place a match could start, from p on
+void FindLiteralBytes(const uint8_t *p, const uint8_t *pBegin, const uint8_t *pEnd, const std::string &literal, std::vector<SearchMatch> &matches, ByteIndex offset) {
+    auto length = long(literal.size());
+    for (; pEnd - p >= length; p++) {
+        if (*p == uint8_t(literal[0]) && memcmp(p, literal.data(), length) == 0) {
+            auto begin = offset + ByteIndex(p - pBegin);
+            matches.push_back({begin, begin + length});
+        }
+    }
+}
+
+#if defined(ZEP_SIMD_AVX2) || defined(ZEP_SIMD_SSE2)
+
+// One bit for each place in the block where the first and last bytes of the literal both match
+#if defined(ZEP_SIMD_AVX2)
+const long BlockSize = 32;
+
+uint32_t MatchBlock(const uint8_t *p, long length, uint8_t first, uint8_t last) {
+    auto firsts = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), _mm256_set1_epi8(char(first)));
+    auto lasts = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + length - 1)), _mm256_set1_epi8(char(last)));
+    return uint32_t(_mm256_movemask_epi8(_mm256_and_si256(firsts, lasts)));
+}
+#else
+const long BlockSize = 16;
+
+uint32_t MatchBlock(const uint8_t *p, long length, uint8_t first, uint8_t last) {
+    auto firsts = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), _mm_set1_epi8(char(first)));
+    auto lasts = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + length - 1)), _mm_set1_epi8(char(last)));
+    return uint32_t(_mm_movemask_epi8(_mm_and_si128(firsts, lasts)));
+}
+#endif
+
+#endif
+
+// Call back with runs of whole lines of the text in [begin, end), each one contiguous in memory.
+// A line split between spans of the storage is copied out, so only the lines across the gap of a gap buffer
+// (or between pieces of a piece table) are copied
+void ForEachLineRun(const TextStorage &text, ByteIndex begin, ByteIndex end, const std::function<void(const uint8_t *, const uint8_t *, ByteIndex)> &fnLines) {
+    std::string carry;
+    ByteIndex carryOffset = 0;
+    ByteIndex spanEnd = 0;
+    text.ForEachSpan([&](const uint8_t *pSpanBegin, const uint8_t *pSpanEnd) {
+        auto spanBegin = spanEnd;
+        spanEnd += ByteIndex(pSpanEnd - pSpanBegin);
+        if (spanEnd <= begin || spanBegin >= end) return;
+
+        auto p = pSpanBegin + std::max(ByteIndex(0), begin - spanBegin);
+        auto pEnd = pSpanEnd - std::max(ByteIndex(0), spanEnd - end);
+
+        // Finish the line carried from the last span
+        if (!carry.empty()) {
+            auto pNewline = (const uint8_t *) memchr(p, '\n', pEnd - p);
+            if (!pNewline) {
+                carry.append(p, pEnd);
+                return;
+            }
+            carry.append(p, pNewline + 1);
+            fnLines((const uint8_t *) carry.data(), (const uint8_t *) carry.data() + carry.size(), carryOffset);
+            carry.clear();
+            p = pNewline + 1;
+        }
+
+        auto pLast = pEnd;
+        while (pLast > p && *(pLast - 1) != '\n') pLast--;
+        if (pLast > p) fnLines(p, pLast, spanBegin + ByteIndex(p - pSpanBegin));
+
+        if (pLast < pEnd) {
+            carry.assign(pLast, pEnd);
+            carryOffset = spanBegin + ByteIndex(pLast - pSpanBegin);
+        }
+    });
+
+    if (!carry.empty()) {
+        fnLines((const uint8_t *) carry.data(), (const uint8_t *) carry.data() + carry.size(), carryOffset);
+    }
+}
+
+// The longest run of plain chars which every match of a Vim pattern holds, or "" where that isn't simple to tell
+std::string RequiredLiteral(const std::string &pattern) {
+    if (pattern.find("\\|") != std::string::npos || pattern.find("\\(") != std::string::npos || pattern.find("\\{") != std::string::npos || pattern.find("\\c") != std::string::npos) {
+        return "";
+    }
+
+    std::string best;
+    std::string run;
+    auto endRun = [&]() {
+        if (run.size() > best.size()) best = run;
+        run.clear();
+    };
+
+    for (size_t i = 0; i < pattern.size(); i++) {
+        auto ch = pattern[i];
+        if (ch == '\\') {
+            endRun();
+            i++;
+            continue;
+        }
+        if (ch == '[') {
+            endRun();
+            auto start = i + 1;
+            if (start < pattern.size() && pattern[start] == '^') start++;
+            auto end = pattern.find(']', start + 1);
+            if (end == std::string::npos) return "";
+            i = end;
+            continue;
+        }
+        if (std::strchr(".]^$*~", ch)) {
+            endRun();
+            continue;
+        }
+
+        // A char the next one makes optional isn't needed; one it repeats is, but what follows needn't come straight after
+        auto next = i + 1 < pattern.size() ? pattern[i + 1] : 0;
+        auto nextEscaped = next == '\\' && i + 2 < pattern.size() ? pattern[i + 2] : 0;
+        if (next == '*' || nextEscaped == '?' || nextEscaped == '=') {
+            endRun();
+            continue;
+        }
+        run += ch;
+        if (nextEscaped == '+') endRun();
+    }
+    endRun();
+    return best;
+}
+
+} // namespace
+
+void FindLiteral(const uint8_t *pBegin, const uint8_t *pEnd, const std::string &literal, std::vector<SearchMatch> &matches, ByteIndex offset) {
+    auto length = long(literal.size());
+    if (length == 0) return;
+
+    auto p = pBegin;
+#if defined(ZEP_SIMD_AVX2) || defined(ZEP_SIMD_SSE2)
+    auto first = uint8_t(literal[0]);
+    auto last = uint8_t(literal[length - 1]);
+    for (; pEnd - p >= BlockSize + length - 1; p += BlockSize) {
+        for (auto mask = MatchBlock(p, length, first, last); mask != 0; mask &= mask - 1) {
+            auto pMatch = p + LowestBit(mask);
+            if (length <= 2 || memcmp(pMatch + 1, literal.data() + 1, length - 2) == 0) {
+                auto begin = offset + ByteIndex(pMatch - pBegin);
+                matches.push_back({begin, begin + length});
+            }
+        }
+    }
+#endif
+    FindLiteralBytes(p, pBegin, pEnd, literal, matches, offset);
+}
+
+void FindLiteralScalar(const uint8_t *pBegin, const uint8_t *pEnd, const std::string &literal, std::vector<SearchMatch> &matches, ByteIndex offset) {
+    auto length = long(literal.size());
+    if (length == 0) return;
+
+    // How far the literal can move on, given the byte under its last char.  No match is skipped, even an overlapping one
+    long skip[256];
+    for (auto &s: skip) s = length;
+    for (long i = 0; i < length - 1; i++) skip[uint8_t(literal[i])] = length - 1 - i;
+
+    for (auto p = pBegin; pEnd - p >= length; p += skip[p[length - 1]]) {
+        if (p[length - 1] == uint8_t(literal[length - 1]) && memcmp(p, literal.data(), length - 1) == 0) {
+            auto begin = offset + ByteIndex(p - pBegin);
+            matches.push_back({begin, begin + length});
+        }
+    }
+}
+
+std::string VimPatternToRegex(const std::string &pattern, bool &ignoreCase) {
+    std::string regex;
+    bool inCount = false;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        auto ch = pattern[i];
+        if (ch == '\\' && i + 1 < pattern.size()) {
+            auto next = pattern[++i];
+            switch (next) {
+                case '(':
+                case ')':
+                case '|':
+                case '+':
+                case '?':
+                    regex += next;
+                    break;
+                case '=':
+                    regex += '?';
+                    break;
+                case '{':
+                    regex += '{';
+                    inCount = true;
+                    break;
+                case '}':
+                    regex += '}';
+                    inCount = false;
+                    break;
+                case '<':
+                case '>':
+                    regex += "\\b";
+                    break;
+                case 'c':
+                    ignoreCase = true;
+                    break;
+                case 'C':
+                    ignoreCase = false;
+                    break;
+                case '/':
+                    regex += '/';
+                    break;
+                default:
+                    regex += '\\';
+                    regex += next;
+                    break;
+            }
+        } else if (ch == '[') {
+            // Copy a set as it is; a ']' straight after the '[' (or '[^') is part of it
+            auto start = i + 1;
+            if (start < pattern.size() && pattern[start] == '^') start++;
+            auto end = pattern.find(']', start < pattern.size() && pattern[start] == ']' ? start + 1 : start);
+            if (end == std::string::npos) {
+                regex += "\\[";
+            } else {
+                regex += pattern.substr(i, start - i);
+                if (pattern[start] == ']') {
+                    regex += "\\]";
+                    start++;
+                }
+                regex += pattern.substr(start, end - start + 1);
+                i = end;
+            }
+        } else if (ch == '}' && inCount) {
+            regex += '}';
+            inCount = false;
+        } else if (std::strchr("()|+?{}", ch)) {
+            regex += '\\';
+            regex += ch;
+        } else {
+            regex += ch;
+        }
+    }
+    return regex;
+}
+
+SearchPattern::SearchPattern(const std::string &pattern) : m_pattern(pattern) {
+    if (pattern.find_first_of("\\.*[^$") == std::string::npos) {
+        m_literal = pattern;
+        return;
+    }
+
+    bool ignoreCase = false;
+    auto regex = VimPatternToRegex(pattern, ignoreCase);
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    if (ignoreCase) flags |= std::regex::icase;
+    try {
+        m_regex = std::make_shared<std::regex>(regex, flags);
+    } catch (std::regex_error &err) {
+        m_error = err.what();
+    }
+    m_required = RequiredLiteral(pattern);
+}
+
+void SearchPattern::Find(const uint8_t *pBegin, const uint8_t *pEnd, std::vector<SearchMatch> &matches, ByteIndex offset) const {
+    if (!m_literal.empty()) {
+        FindLiteral(pBegin, pEnd, m_literal, matches, offset);
+        return;
+    }
+    if (!m_regex) return;
+
+    // A line at a time, so ^ and $ match at the line ends
+    auto findInLine = [&](const uint8_t *pLine, const uint8_t *pLineEnd) {
+        std::cregex_iterator itr((const char *) pLine, (const char *) pLineEnd, *m_regex), itrEnd;
+        for (; itr != itrEnd; ++itr) {
+            if (itr->length() == 0) continue;
+            auto matchBegin = offset + ByteIndex(pLine - pBegin) + ByteIndex(itr->position());
+            matches.push_back({matchBegin, matchBegin + ByteIndex(itr->length())});
+        }
+    };
+
+    if (m_required.empty()) {
+        for (auto pLine = pBegin; pLine < pEnd;) {
+            auto pLineEnd = (const uint8_t *) memchr(pLine, '\n', pEnd - pLine);
+            if (!pLineEnd) pLineEnd = pEnd;
+            findInLine(pLine, pLineEnd);
+            pLine = pLineEnd + 1;
+        }
+        return;
+    }
+
+    // The regex is only run on the lines holding the literal its matches need, which are found as a literal search would
+    std::vector<SearchMatch> candidates;
+    FindLiteral(pBegin, pEnd, m_required, candidates);
+
+    auto pSearched = pBegin;
+    for (auto &candidate: candidates) {
+        auto pCandidate = pBegin + candidate.begin;
+        if (pCandidate < pSearched) continue;
+
+        auto pLine = pCandidate;
+        while (pLine > pSearched && *(pLine - 1) != '\n') pLine--;
+        auto pLineEnd = (const uint8_t *) memchr(pCandidate, '\n', pEnd - pCandidate);
+        if (!pLineEnd) pLineEnd = pEnd;
+
+        findInLine(pLine, pLineEnd);
+        pSearched = pLineEnd + 1;
+    }
+}
+
+SearchMatch SearchMatches::operator[](long index) const {
+    auto match = m_matches[index];
+    if (index >= m_stepIndex) {
+        match.begin += m_stepBytes;
+        match.end += m_stepBytes;
+    }
+    return match;
+}
+
+void SearchMatches::Clear() {
+    m_matches.clear();
+    m_stepIndex = 0;
+    m_stepBytes = 0;
+}
+
+long SearchMatches::LowerBound(ByteIndex index) const {
+    long low = 0;
+    long high = Count();
+    while (low < high) {
+        auto mid = (low + high) / 2;
+        if ((*this)[mid].begin < index) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Move the step to this match, adding or removing it from the matches it passes over
+void SearchMatches::MoveStep(long index) {
+    if (m_stepBytes != 0) {
+        for (; m_stepIndex < index; m_stepIndex++) {
+            m_matches[m_stepIndex].begin += m_stepBytes;
+            m_matches[m_stepIndex].end += m_stepBytes;
+        }
+        for (; m_stepIndex > index; m_stepIndex--) {
+            m_matches[m_stepIndex - 1].begin -= m_stepBytes;
+            m_matches[m_stepIndex - 1].end -= m_stepBytes;
+        }
+    }
+    m_stepIndex = index;
+}
+
+void SearchMatches::Insert(ByteIndex index, ByteIndex count) {
+    MoveStep(LowerBound(index));
+    m_stepBytes += count;
+}
+
+void SearchMatches::Erase(ByteIndex begin, ByteIndex end) {
+    auto first = LowerBound(begin);
+    auto last = LowerBound(end);
+    MoveStep(last);
+
+    if (first != last) {
+        m_matches.erase(m_matches.begin() + first, m_matches.begin() + last);
+        m_stepIndex = first;
+    }
+    m_stepBytes -= (end - begin);
+}
+
+void SearchMatches::Replace(ByteIndex begin, ByteIndex end, const std::vector<SearchMatch> &matches) {
+    auto first = LowerBound(begin);
+    auto last = LowerBound(end);
+    MoveStep(last);
+
+    // New matches go before the step, so they are stored as they are
+    if (first != last) m_matches.erase(m_matches.begin() + first, m_matches.begin() + last);
+    if (!matches.empty()) m_matches.insert(m_matches.begin() + first, matches.begin(), matches.end());
+    m_stepIndex = first + long(matches.size());
+}
+
+ZepBufferSearch::ZepBufferSearch(ZepBuffer &buffer) : ZepComponent(buffer.editor), m_buffer(buffer) {}
+
+void ZepBufferSearch::SetPattern(const std::string &pattern) {
+    m_pattern = SearchPattern(pattern);
+    SearchAll();
+}
+
+void ZepBufferSearch::SearchRange(ByteIndex begin, ByteIndex end, std::vector<SearchMatch> &matches) const {
+    if (m_pattern.Empty()) return;
+
+    ForEachLineRun(m_buffer.workingBuffer, begin, end, [&](const uint8_t *pBegin, const uint8_t *pEnd, ByteIndex offset) {
+        m_pattern.Find(pBegin, pEnd, matches, offset);
+    });
+}
+
+// Search the lines holding [begin, end] again
+void ZepBufferSearch::SearchLines(ByteIndex begin, ByteIndex end) {
+    auto &lineEnds = m_buffer.lineEnds;
+    auto firstLine = std::min(lineEnds.FindLine(begin), lineEnds.Count() - 1);
+    auto lastLine = std::min(lineEnds.FindLine(end), lineEnds.Count() - 1);
+    auto linesBegin = firstLine > 0 ? lineEnds[firstLine - 1] : 0;
+    auto linesEnd = std::min(lineEnds[lastLine], m_buffer.End().index);
+
+    std::vector<SearchMatch> matches;
+    SearchRange(linesBegin, linesEnd, matches);
+    m_matches.Replace(linesBegin, linesEnd, matches);
+}
+
+void ZepBufferSearch::SearchAll() {
+    std::vector<SearchMatch> matches;
+    SearchRange(0, m_buffer.End().index, matches);
+
+    m_matches.Clear();
+    m_matches.Replace(0, 0, matches);
+    m_size = long(m_buffer.workingBuffer.size());
+    current = -1;
+    editor.RequestRefresh();
+}
+
+long ZepBufferSearch::FindNext(ByteIndex location, Direction dir) const {
+    if (Count() == 0) return -1;
+
+    if (dir == Direction::Forward) {
+        auto index = m_matches.LowerBound(location + 1);
+        return index < Count() ? index : 0;
+    }
+    auto index = m_matches.LowerBound(location);
+    return index > 0 ? index - 1 : Count() - 1;
+}
+
+long ZepBufferSearch::FindFirstEndingAfter(ByteIndex index) const {
+    // Matches are no longer than their lines, and the ones on a line don't overlap (or are all the same length), so the ends are in order too
+    long low = 0;
+    long high = Count();
+    while (low < high) {
+        auto mid = (low + high) / 2;
+        if (m_matches[mid].end <= index) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Keep the matches in step with the edits, searching the edited lines again
+void ZepBufferSearch::Notify(const std::shared_ptr<ZepMessage> &msg) {
+    if (msg->messageId != Msg::Buffer) return;
+
+    auto bufferMsg = std::static_pointer_cast<BufferMessage>(msg);
+    if (bufferMsg->buffer != &m_buffer) return;
+
+    auto size = long(m_buffer.workingBuffer.size());
+    auto start = bufferMsg->startLocation.index;
+    auto end = bufferMsg->endLocation.index;
+    switch (bufferMsg->type) {
+        case BufferMessageType::TextAdded:
+            if (start >= 0 && end - start == size - m_size) {
+                m_matches.Insert(start, end - start);
+                m_size = size;
+                SearchLines(start, end);
+            } else {
+                SearchAll();
+            }
+            break;
+        case BufferMessageType::TextDeleted:
+            if (start >= 0 && start < end && end - start == m_size - size) {
+                m_matches.Erase(start, end);
+                m_size = size;
+                SearchLines(start, start);
+            } else {
+                SearchAll();
+            }
+            break;
+        case BufferMessageType::TextChanged:
+            SearchLines(start, end);
+            break;
+        case BufferMessageType::Loaded:
+            SearchAll();
+            break;
+        default:
+            return;
+    }
+    current = -1;
+}
+
+} // namespace Zep
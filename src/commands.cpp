@@ -2,6 +2,15 @@
 
 namespace Zep {
 
+namespace {
+
+// Where a cursor was, or -1; it is checked against the text when it is put back
+ByteIndex CursorIndex(const GlyphIterator &cursor) {
+    return cursor.buffer ? cursor.index : -1;
+}
+
+} // namespace
+
 // Delete Range of chars
 ZepCommand_DeleteRange::ZepCommand_DeleteRange(ZepBuffer &buffer, const GlyphIterator &start, const GlyphIterator &end, const GlyphIterator &cursor, const GlyphIterator &cursorAfter)
     : ZepCommand(buffer, cursor, cursorAfter.Valid() ? cursorAfter : start), startIndex(start), endIndex(end) {
@@ -20,11 +29,8 @@ void ZepCommand_DeleteRange::Redo() {
     }
 }
 
-void ZepCommand_DeleteRange::Undo() {
-    if (changeRecord.strDeleted.empty()) return;
-
-    ChangeRecord tempRecord;
-    buffer.Insert(startIndex, changeRecord.strDeleted, tempRecord);
+void ZepCommand_DeleteRange::Record(ZepUndoJournal &journal) const {
+    journal.AddDelete(buffer, startIndex.index, changeRecord.strDeleted, CursorIndex(cursorBefore), CursorIndex(cursorAfter));
 }
 
 // Insert a string
@@ -41,10 +47,9 @@ void ZepCommand_Insert::Redo() {
     else endIndexInserted.Invalidate();
 }
 
-void ZepCommand_Insert::Undo() {
+void ZepCommand_Insert::Record(ZepUndoJournal &journal) const {
     if (endIndexInserted.Valid()) {
-        ChangeRecord tempRecord;
-        buffer.Delete(startIndex, endIndexInserted, tempRecord);
+        journal.AddInsert(buffer, startIndex.index, insert, CursorIndex(cursorBefore), CursorIndex(cursorAfter));
     }
 }
 
@@ -62,11 +67,9 @@ void ZepCommand_ReplaceRange::Redo() {
     }
 }
 
-void ZepCommand_ReplaceRange::Undo() {
+void ZepCommand_ReplaceRange::Record(ZepUndoJournal &journal) const {
     if (startIndex != endIndex) {
-        // Replace the range we replaced previously with the old thing
-        ChangeRecord temp;
-        buffer.Replace(startIndex, mode == ReplaceRangeMode::Fill ? endIndex : startIndex.PeekByteOffset((long) replace.length()), changeRecord.strDeleted, ReplaceRangeMode::Replace, temp);
+        journal.AddReplace(buffer, mode, startIndex.index, changeRecord.strDeleted, replace, CursorIndex(cursorBefore), CursorIndex(cursorAfter));
     }
 }
 
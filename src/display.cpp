@@ -61,6 +61,12 @@ void ZepDisplay::DrawRect(const NRectf &rc, const NVec4f &col) const {
     DrawLine(rc.BottomLeft(), rc.bottomRightPx, col);
 }
 
+void ZepDisplay::DrawCharRuns(ZepFont &font, const std::vector<ZepTextRun> &runs) const {
+    for (auto &run: runs) {
+        DrawChars(font, run.pos, run.color, run.pBegin, run.pEnd);
+    }
+}
+
 void ZepDisplay::SetFont(ZepTextType type, std::shared_ptr<ZepFont> font) {
     fonts[(int) type] = std::move(font);
 }
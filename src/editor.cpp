@@ -1,8 +1,10 @@
 #include "zep/editor.h"
 #include "zep/filesystem.h"
+#include "zep/indexer.h"
 #include "zep/mode_search.h"
 #include "zep/mode_standard.h"
 #include "zep/mode_vim.h"
+#include "zep/project_search.h"
 #include "zep/regress.h"
 #include "zep/syntax.h"
 #include "zep/syntax_providers.h"
@@ -37,12 +39,20 @@ void ZepEditor::RegisterSyntaxProvider(const std::vector<std::string> &mappings,
 }
 
 void ZepEditor::RegisterSyntaxProviders() {
-    RegisterSyntaxProvider({".dsp"}, {"faust", ([](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, faust_keywords, faust_identifiers); })});
-    RegisterSyntaxProvider({".scenegraph"}, {"scenegraph", ([](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, scenegraph_keywords, scenegraph_identifiers); })});
-    RegisterSyntaxProvider({".vert", ".frag", ".geom"}, {"gl_shader", ([](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, glsl_keywords, glsl_identifiers); })});
-    RegisterSyntaxProvider({".hlsl", ".hlsli", ".vs", ".ps", ".gs"}, {"hlsl_shader", ([](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, hlsl_keywords, hlsl_identifiers); })});
-    RegisterSyntaxProvider({".cpp", ".cxx", ".h", ".c"}, {"cpp", ([](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, cpp_keywords, cpp_identifiers); })});
-    RegisterSyntaxProvider({".toml"}, {"cpp", ([](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, toml_keywords, toml_identifiers, ZepSyntaxFlags::CaseInsensitive); })});
+    // The keywords are compiled once here, and shared by every buffer of the language
+    auto faust = std::make_shared<ZepSyntaxMatcher>(faust_keywords, faust_identifiers);
+    auto scenegraph = std::make_shared<ZepSyntaxMatcher>(scenegraph_keywords, scenegraph_identifiers);
+    auto glsl = std::make_shared<ZepSyntaxMatcher>(glsl_keywords, glsl_identifiers);
+    auto hlsl = std::make_shared<ZepSyntaxMatcher>(hlsl_keywords, hlsl_identifiers);
+    auto cpp = std::make_shared<ZepSyntaxMatcher>(cpp_keywords, cpp_identifiers);
+    auto toml = std::make_shared<ZepSyntaxMatcher>(toml_keywords, toml_identifiers, true);
+
+    RegisterSyntaxProvider({".dsp"}, {"faust", ([faust](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, faust); })});
+    RegisterSyntaxProvider({".scenegraph"}, {"scenegraph", ([scenegraph](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, scenegraph); })});
+    RegisterSyntaxProvider({".vert", ".frag", ".geom"}, {"gl_shader", ([glsl](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, glsl); })});
+    RegisterSyntaxProvider({".hlsl", ".hlsli", ".vs", ".ps", ".gs"}, {"hlsl_shader", ([hlsl](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, hlsl); })});
+    RegisterSyntaxProvider({".cpp", ".cxx", ".h", ".c"}, {"cpp", ([cpp](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, cpp); })});
+    RegisterSyntaxProvider({".toml"}, {"cpp", ([toml](auto *buffer) { return std::make_shared<ZepSyntax>(*buffer, toml, ZepSyntaxFlags::CaseInsensitive); })});
     RegisterSyntaxProvider({".tree"}, {"tree", ([](auto *buffer) { return std::make_shared<ZepSyntax_Tree>(*buffer, ZepSyntaxFlags::CaseInsensitive); })});
     RegisterSyntaxProvider({".md", ".markdown"}, {"markdown", ([](auto *buffer) { return std::make_shared<ZepSyntax_Markdown>(*buffer, ZepSyntaxFlags::CaseInsensitive); })});
 }
@@ -63,6 +73,9 @@ ZepEditor::ZepEditor(ZepDisplay *display, const ZepPath &configRoot, uint32_t fl
     RegisterGlobalMode(std::make_shared<ZepMode_Standard>(*this));
     SetGlobalMode(ZepMode_Vim::StaticName());
 
+    ZepGrepExCommand::Register(*this);
+    ZepTagExCommand::Register(*this);
+
     timer_restart(m_cursorTimer);
     timer_restart(m_lastEditTimer);
     commandLines.emplace_back("");
@@ -128,6 +141,8 @@ void ZepEditor::LoadConfig(const std::shared_ptr<cpptoml::table> &newConfig) {
         config.backgroundFadeTime = (float) newConfig->get_qualified_as<double>("editor.background_fade_time").value_or(60.0f);
         config.backgroundFadeWait = (float) newConfig->get_qualified_as<double>("editor.background_fade_wait").value_or(60.0f);
         config.showScrollBar = newConfig->get_qualified_as<uint32_t>("editor.show_scrollbar").value_or(1);
+        config.virtualLayoutLines = newConfig->get_qualified_as<uint32_t>("editor.virtual_layout_lines").value_or(100000);
+        config.undoMemoryMB = newConfig->get_qualified_as<uint32_t>("editor.undo_memory_mb").value_or(0);
         config.lineMargins.x = (float) newConfig->get_qualified_as<double>("editor.line_margin_top").value_or(1);
         config.lineMargins.y = (float) newConfig->get_qualified_as<double>("editor.line_margin_bottom").value_or(1);
         config.widgetMargins.x = (float) newConfig->get_qualified_as<double>("editor.widget_margin_top").value_or(1);
@@ -143,6 +158,14 @@ void ZepEditor::LoadConfig(const std::shared_ptr<cpptoml::table> &newConfig) {
 
         // Forward settings to file system
         fileSystem->flags = config.searchGitRoot ? ZepFileSystemFlags::SearchGitRoot : 0;
+
+        // And to the modes, which keep the undo history
+        for (auto &[name, mode]: m_mapGlobalModes) {
+            mode->UpdateUndoMemoryLimit();
+        }
+        for (auto &buffer: buffers) {
+            if (buffer->mode) buffer->mode->UpdateUndoMemoryLimit();
+        }
     } catch (...) {}
 }
 
@@ -157,7 +180,10 @@ void ZepEditor::SaveBuffer(ZepBuffer &buffer) {
     else {
         int64_t size;
         if (!buffer.Save(size)) text << "Failed to save: " << buffer.GetDisplayName() << " at: " << buffer.filePath.string();
-        else text << "Wrote " << buffer.filePath.string() << ", " << size << " bytes";
+        else {
+            text << "Wrote " << buffer.filePath.string() << ", " << size << " bytes";
+            if (m_indexer) m_indexer->UpdateSymbols();
+        }
     }
     SetCommandText(text.str());
 }
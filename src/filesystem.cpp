@@ -4,6 +4,15 @@
 
 #include <filesystem>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
 namespace cpp_fs = std::filesystem;
 
 namespace Zep {
@@ -27,6 +36,30 @@ bool ZepFileSystem::IsReadOnly(const ZepPath &path) {
     return (perms & cpp_fs::perms::owner_write) == cpp_fs::perms::owner_write ? false : true;
 }
 
+bool ZepFileSystem::GetFileStamp(const ZepPath &path, int64_t &modified, int64_t &size) {
+#ifndef _WIN32
+    // One stat, where the std::filesystem calls would make one each
+    struct stat status{};
+    if (stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) return false;
+#if defined(__APPLE__)
+    modified = int64_t(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+    modified = int64_t(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+    size = int64_t(status.st_size);
+    return true;
+#else
+    std::error_code ec;
+    auto time = cpp_fs::last_write_time(path.string(), ec);
+    if (ec) return false;
+    auto fileSize = cpp_fs::file_size(path.string(), ec);
+    if (ec) return false;
+    modified = int64_t(time.time_since_epoch().count());
+    size = int64_t(fileSize);
+    return true;
+#endif
+}
+
 std::string ZepFileSystem::Read(const ZepPath &fileName) {
     std::ifstream in(fileName, std::ios::in | std::ios::binary);
     if (in) {
@@ -43,14 +76,115 @@ std::string ZepFileSystem::Read(const ZepPath &fileName) {
     return {};
 }
 
-bool ZepFileSystem::Write(const ZepPath &fileName, const void *pData, size_t size) {
-    FILE *file = fopen(fileName.string().c_str(), "wb");
-    if (!file) return false;
+ZepFileView::~ZepFileView() {
+#ifndef _WIN32
+    if (m_mapped) munmap((void *) m_pData, m_size);
+#endif
+}
 
-    fwrite(pData, sizeof(uint8_t), size, file);
-    fclose(file);
+std::unique_ptr<ZepFileView> ZepFileSystem::Map(const ZepPath &fileName) {
+    auto view = std::make_unique<ZepFileView>();
 
-    return true;
+#ifndef _WIN32
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file >= 0) {
+        struct stat status{};
+        if (fstat(file, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+            auto pData = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+            if (pData != MAP_FAILED) {
+                // The file is read front to back to find the lines, then copied
+                madvise(pData, size_t(status.st_size), MADV_SEQUENTIAL);
+                view->m_pData = (const uint8_t *) pData;
+                view->m_size = size_t(status.st_size);
+                view->m_mapped = true;
+            }
+        }
+        close(file);
+        if (view->m_mapped) return view;
+    }
+#endif
+
+    // Not mapped (or empty); read it in
+    if (!Exists(fileName)) {
+        ZLOG(ERROR, "File Not Found: " << fileName.string());
+        return nullptr;
+    }
+    view->m_contents = Read(fileName);
+    view->m_pData = (const uint8_t *) view->m_contents.data();
+    view->m_size = view->m_contents.size();
+    return view;
+}
+
+ZepFileWriter::ZepFileWriter(const ZepPath &fileName) {
+    // Replace the file a link points to, rather than the link
+    std::error_code ec;
+    auto path = cpp_fs::path(fileName.string());
+    if (cpp_fs::is_symlink(path, ec)) {
+        auto target = cpp_fs::canonical(path, ec);
+        if (!ec) path = target;
+    }
+
+    m_path = path.string();
+    m_tempPath = m_path + ".zep-save";
+    m_pFile = fopen(m_tempPath.c_str(), "wb");
+    if (!m_pFile) {
+        ZLOG(ERROR, "Could not write: " << m_tempPath);
+        return;
+    }
+
+    // Writes from the buffer are a few large spans and many small line ends
+    setvbuf(m_pFile, nullptr, _IOFBF, 64 * 1024);
+}
+
+ZepFileWriter::~ZepFileWriter() {
+    if (m_pFile) {
+        Close();
+        std::error_code ec;
+        cpp_fs::remove(m_tempPath, ec);
+    }
+}
+
+void ZepFileWriter::Close() {
+    if (fclose(m_pFile) != 0) m_failed = true;
+    m_pFile = nullptr;
+}
+
+void ZepFileWriter::Write(const void *pData, size_t size) {
+    if (!m_pFile || m_failed || size == 0) return;
+    if (fwrite(pData, sizeof(uint8_t), size, m_pFile) != size) m_failed = true;
+}
+
+bool ZepFileWriter::Commit() {
+    if (!m_pFile) return false;
+
+    // Make sure the new file is on the disk before it replaces the old one
+    if (fflush(m_pFile) != 0) m_failed = true;
+#ifdef _WIN32
+    if (_commit(_fileno(m_pFile)) != 0) m_failed = true;
+#else
+    if (fsync(fileno(m_pFile)) != 0) m_failed = true;
+#endif
+    Close();
+
+    std::error_code ec;
+    if (!m_failed) {
+        // Keep the permissions of the file we are replacing
+        auto status = cpp_fs::status(m_path, ec);
+        if (!ec && cpp_fs::exists(status)) cpp_fs::permissions(m_tempPath, status.permissions(), ec);
+
+        cpp_fs::rename(m_tempPath, m_path, ec);
+        if (!ec) return true;
+        ZLOG(ERROR, "Could not replace: " << m_path << ", " << ec.message());
+    }
+
+    cpp_fs::remove(m_tempPath, ec);
+    return false;
+}
+
+bool ZepFileSystem::Write(const ZepPath &fileName, const void *pData, size_t size) {
+    ZepFileWriter writer(fileName);
+    writer.Write(pData, size);
+    return writer.Commit();
 }
 
 bool ZepFileSystem::Equivalent(const ZepPath &path1, const ZepPath &path2) {
@@ -131,6 +265,16 @@ void ZepFileSystem::ScanDirectory(const ZepPath &path, const std::function<bool(
     }
 }
 
+void ZepFileSystem::ListDirectory(const ZepPath &path, const std::function<void(const std::string &name, bool isDirectory)> &fnEntry) {
+    // The entry types come from the directory itself where the platform has them, without a stat per file
+    std::error_code ec;
+    for (auto itr = cpp_fs::directory_iterator(path.string(), ec); !ec && itr != cpp_fs::directory_iterator(); itr.increment(ec)) {
+        std::error_code typeError;
+        bool isDirectory = !itr->is_symlink(typeError) && itr->is_directory(typeError);
+        fnEntry(itr->path().filename().string(), isDirectory);
+    }
+}
+
 bool ZepFileSystem::Exists(const ZepPath &path) {
     try {
         return cpp_fs::exists(path.string());
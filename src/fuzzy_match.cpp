@@ -0,0 +1,214 @@
+#include "zep/fuzzy_match.h"
+#include "zep/stringutils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "simd.h"
+
+namespace Zep {
+
+namespace {
+
+const int ScoreMatch = 16;
+const int BonusPathStart = 10;    // After a '/', or at the start
+const int BonusBoundary = 8;      // After a '_', '-', '.' or space
+const int BonusCamel = 7;         // An upper case letter after a lower case one
+const int BonusConsecutive = 4;   // At least, for a match just after another; a run keeps the bonus it started with
+const int BonusFileName = 2;      // In the last part of the path
+const int BonusFirstMultiplier = 2;
+const int PenaltyGapStart = -3;
+const int PenaltyGapExtension = -1;
+
+// Candidates are handed out to the threads this many at a time
+const size_t ChunkSize = 4096;
+
+const char *FindCharScalar(const char *p, const char *pEnd, char ch) {
+    for (; p < pEnd; p++) {
+        if (*p == ch) return p;
+    }
+    return nullptr;
+}
+
+const char *FindChar(const char *p, const char *pEnd, char ch) {
+#if defined(ZEP_SIMD_AVX2)
+    auto needle = _mm256_set1_epi8(ch);
+    for (; pEnd - p >= 32; p += 32) {
+        auto mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), needle)));
+        if (mask) return p + LowestBit(mask);
+    }
+#elif defined(ZEP_SIMD_SSE2)
+    auto needle = _mm_set1_epi8(ch);
+    for (; pEnd - p >= 16; p += 16) {
+        auto mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), needle)));
+        if (mask) return p + LowestBit(mask);
+    }
+#endif
+    return FindCharScalar(p, pEnd, ch);
+}
+
+int BoundaryBonus(const char *pOriginal, size_t pos) {
+    if (pos == 0) return BonusPathStart;
+
+    auto prev = pOriginal[pos - 1];
+    auto ch = pOriginal[pos];
+    if (prev == '/' || prev == '\\') return BonusPathStart;
+    if (prev == '_' || prev == '-' || prev == '.' || prev == ' ') return BonusBoundary;
+    if (prev >= 'a' && prev <= 'z' && ch >= 'A' && ch <= 'Z') return BonusCamel;
+    return 0;
+}
+
+template<typename Find>
+bool Score(const char *pText, const char *pOriginal, size_t length, const std::string &query, int &score, Find find) {
+    score = 0;
+    if (query.empty()) return true;
+
+    // The first place the query ends
+    auto pEnd = pText + length;
+    auto p = pText;
+    for (auto ch: query) {
+        p = find(p, pEnd, ch);
+        if (!p) return false;
+        p++;
+    }
+    auto end = size_t(p - pText);
+
+    // The last place it can start and still end there, which is never before the text
+    auto start = end;
+    for (auto q = query.size(); q-- > 0;) {
+        while (pText[--start] != query[q]) {}
+    }
+
+    auto fileName = length;
+    while (fileName > 0 && pOriginal[fileName - 1] != '/' && pOriginal[fileName - 1] != '\\') fileName--;
+
+    size_t q = 0;
+    bool lastMatched = false;
+    int runBonus = 0;
+    for (auto pos = start; q < query.size(); pos++) {
+        if (pText[pos] != query[q]) {
+            score += lastMatched ? PenaltyGapStart : PenaltyGapExtension;
+            lastMatched = false;
+            continue;
+        }
+
+        auto bonus = BoundaryBonus(pOriginal, pos);
+        if (lastMatched) bonus = std::max({bonus, runBonus, BonusConsecutive});
+        runBonus = bonus;
+        if (q == 0) bonus *= BonusFirstMultiplier;
+        score += ScoreMatch + bonus + (pos >= fileName ? BonusFileName : 0);
+        lastMatched = true;
+        q++;
+    }
+    return true;
+}
+
+// Higher scores first, then shorter paths, then the file order
+bool IsBetter(const FuzzyResult &a, const FuzzyResult &b) {
+    if (a.score != b.score) return a.score > b.score;
+    if (a.length != b.length) return a.length < b.length;
+    return a.index < b.index;
+}
+
+// A heap of the best results with the worst of them on top, so it is the one to go
+void AddBest(std::vector<FuzzyResult> &best, const FuzzyResult &result, size_t maxResults) {
+    if (best.size() < maxResults) {
+        best.push_back(result);
+        std::push_heap(best.begin(), best.end(), IsBetter);
+    } else if (!best.empty() && IsBetter(result, best.front())) {
+        std::pop_heap(best.begin(), best.end(), IsBetter);
+        best.back() = result;
+        std::push_heap(best.begin(), best.end(), IsBetter);
+    }
+}
+
+// Shared by the threads scoring a query
+struct FuzzyJob {
+    std::shared_ptr<FileIndexResult> files;
+    std::shared_ptr<FuzzyMatches> previous;
+    std::string query;
+    bool caseSensitive = false;
+    size_t maxResults = 0;
+    size_t count = 0;
+    size_t chunks = 0;
+
+    std::atomic<size_t> nextChunk{0};
+
+    std::mutex mutex;
+    std::vector<std::vector<uint32_t>> chunkCandidates;
+    std::vector<FuzzyResult> best;
+
+    void Run() {
+        std::vector<uint32_t> candidates;
+        std::vector<FuzzyResult> chunkBest;
+        for (;;) {
+            auto chunk = nextChunk++;
+            if (chunk >= chunks) return;
+
+            candidates.clear();
+            chunkBest.clear();
+            auto last = std::min(count, (chunk + 1) * ChunkSize);
+            for (auto candidate = chunk * ChunkSize; candidate < last; candidate++) {
+                auto index = previous ? previous->candidates[candidate] : uint32_t(candidate);
+
+                // The lower case path is the same length, a byte at a time
+                auto &lowerPath = files->lowerPaths[index];
+                auto pOriginal = files->paths[index].c_str();
+                int score;
+                if (!FuzzyScore(caseSensitive ? pOriginal : lowerPath.c_str(), pOriginal, lowerPath.size(), query, score)) continue;
+
+                candidates.push_back(index);
+                AddBest(chunkBest, {index, score, uint32_t(lowerPath.size())}, maxResults);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            chunkCandidates[chunk] = candidates;
+            for (auto &result: chunkBest) AddBest(best, result, maxResults);
+        }
+    }
+};
+
+} // namespace
+
+bool FuzzyScore(const char *pText, const char *pOriginal, size_t length, const std::string &query, int &score) {
+    return Score(pText, pOriginal, length, query, score, FindChar);
+}
+
+bool FuzzyScoreScalar(const char *pText, const char *pOriginal, size_t length, const std::string &query, int &score) {
+    return Score(pText, pOriginal, length, query, score, FindCharScalar);
+}
+
+std::shared_ptr<FuzzyMatches> FuzzyMatch(ThreadPool &threadPool, const std::shared_ptr<FileIndexResult> &files, const std::shared_ptr<FuzzyMatches> &previous, const std::string &query, size_t maxResults) {
+    auto job = std::make_shared<FuzzyJob>();
+    job->files = files;
+    if (previous && query.compare(0, previous->query.size(), previous->query) == 0) job->previous = previous;
+    job->query = query;
+    job->caseSensitive = string_tolower(query) != query;
+    job->maxResults = maxResults;
+    job->count = job->previous ? job->previous->candidates.size() : files->paths.size();
+    job->chunks = (job->count + ChunkSize - 1) / ChunkSize;
+    job->chunkCandidates.resize(job->chunks);
+
+    // Helpers which haven't started when the chunks are gone are run here, and find nothing to do
+    {
+        TaskGroup group(threadPool, TaskPriority::Interactive);
+        auto helpers = std::min(job->chunks, std::max(size_t(1), threadPool.GetThreadCount())) - (job->chunks ? 1 : 0);
+        for (size_t helper = 0; helper < helpers; helper++) {
+            group.Run([job]() { job->Run(); });
+        }
+        job->Run();
+        group.Wait();
+    }
+
+    auto matches = std::make_shared<FuzzyMatches>();
+    matches->query = query;
+    for (auto &candidates: job->chunkCandidates) {
+        matches->candidates.insert(matches->candidates.end(), candidates.begin(), candidates.end());
+    }
+    matches->best = std::move(job->best);
+    std::sort_heap(matches->best.begin(), matches->best.end(), IsBetter);
+    return matches;
+}
+
+} // namespace Zep
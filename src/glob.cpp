@@ -0,0 +1,229 @@
+#include "zep/glob.h"
+#include "zep/file/fnmatch.h"
+#include "zep/stringutils.h"
+
+namespace Zep {
+
+namespace {
+
+size_t FindWildcard(const std::string &pattern, size_t start = 0) {
+    return pattern.find_first_of("*?[\\", start);
+}
+
+// The extension a path or suffix ends with, which a suffix must share with the paths it matches
+std::string GetExtension(const std::string &path) {
+    auto dot = path.find_last_of('.');
+    return dot == std::string::npos ? std::string() : path.substr(dot + 1);
+}
+
+bool EndsWith(const std::string &path, const std::string &suffix) {
+    return path.size() >= suffix.size() && path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// A bracket expression at 'p' (just after the '['), against 'ch'; the end of it, or nullptr if it doesn't match
+const char *MatchClass(const char *p, char ch) {
+    bool negate = *p == '!' || *p == '^';
+    if (negate) p++;
+
+    bool matched = false;
+    bool first = true;
+    for (; *p && (*p != ']' || first); first = false) {
+        auto low = *p++;
+        if (low == '\\' && *p) low = *p++;
+        auto high = low;
+        if (p[0] == '-' && p[1] && p[1] != ']') {
+            high = p[1];
+            p += 2;
+            if (high == '\\' && *p) high = *p++;
+        }
+        if ((unsigned char) low <= (unsigned char) ch && (unsigned char) ch <= (unsigned char) high) matched = true;
+    }
+    if (*p != ']') return nullptr;
+    return matched != negate ? p + 1 : nullptr;
+}
+
+} // namespace
+
+bool GlobMatchPath(const char *pattern, const char *path) {
+    for (auto pStart = pattern;; ) {
+        switch (*pattern) {
+            case 0:
+                return *path == 0;
+            case '*': {
+                // '**' as a whole part of the path
+                if (pattern[1] == '*' && (pattern == pStart || pattern[-1] == '/') && (pattern[2] == '/' || pattern[2] == 0)) {
+                    if (pattern[2] == 0) return true;
+                    for (auto p = path;; p++) {
+                        if ((p == path || p[-1] == '/') && GlobMatchPath(pattern + 3, p)) return true;
+                        if (*p == 0) return false;
+                    }
+                }
+
+                while (*pattern == '*') pattern++;
+                for (auto p = path;; p++) {
+                    if (GlobMatchPath(pattern, p)) return true;
+                    if (*p == 0 || *p == '/') return false;
+                }
+            }
+            case '?':
+                if (*path == 0 || *path == '/') return false;
+                pattern++;
+                path++;
+                break;
+            case '[': {
+                if (*path == 0 || *path == '/') return false;
+                auto pEnd = MatchClass(pattern + 1, *path);
+                if (!pEnd) return false;
+                pattern = pEnd;
+                path++;
+                break;
+            }
+            case '\\':
+                if (pattern[1]) pattern++;
+                // fall through
+            default:
+                if (*pattern != *path) return false;
+                pattern++;
+                path++;
+                break;
+        }
+    }
+}
+
+void ZepIgnoreRules::Add(const std::string &text) {
+    std::vector<std::string> lines;
+    string_split(text, "\r\n", lines);
+    for (auto line: lines) {
+        if (line.empty() || line[0] == '#') continue;
+
+        // Trailing spaces go, unless escaped
+        auto end = line.find_last_not_of(' ');
+        if (end == std::string::npos) continue;
+        if (end + 1 < line.size() && line[end] == '\\') end++;
+        line.resize(end + 1);
+
+        Rule rule;
+        if (line[0] == '!') {
+            rule.keep = true;
+            line = line.substr(1);
+        } else if (line[0] == '\\' && line.size() > 1 && (line[1] == '!' || line[1] == '#')) {
+            line = line.substr(1);
+        }
+
+        if (!line.empty() && line.back() == '/') {
+            rule.directoryOnly = true;
+            line.pop_back();
+        }
+        if (line.empty()) continue;
+
+        auto index = int(m_rules.size());
+        if (line.find('/') != std::string::npos) {
+            rule.pattern = line[0] == '/' ? line.substr(1) : line;
+            m_pathRules.push_back(index);
+        } else {
+            rule.pattern = line;
+            auto wildcard = FindWildcard(line);
+            if (wildcard == std::string::npos) {
+                m_names[line].push_back(index);
+            } else if (line[0] == '*' && line.find('.') != std::string::npos && FindWildcard(line, line.find_first_not_of('*')) == std::string::npos) {
+                m_suffixes[GetExtension(line)].push_back(index);
+            } else {
+                m_nameWildcards.push_back(index);
+            }
+        }
+        m_rules.push_back(rule);
+    }
+}
+
+void ZepIgnoreRules::Check(int rule, const std::string &text, bool isDirectory, int &best) const {
+    if (rule <= best || (m_rules[rule].directoryOnly && !isDirectory)) return;
+    if (GlobMatchPath(m_rules[rule].pattern.c_str(), text.c_str())) best = rule;
+}
+
+ZepIgnoreRules::Result ZepIgnoreRules::Match(const std::string &path, const std::string &name, bool isDirectory) const {
+    // The last rule which matches decides
+    int best = -1;
+    if (!m_names.empty()) {
+        auto itr = m_names.find(name);
+        if (itr != m_names.end()) {
+            for (auto rule: itr->second) Check(rule, name, isDirectory, best);
+        }
+    }
+    if (!m_suffixes.empty()) {
+        auto itr = m_suffixes.find(GetExtension(name));
+        if (itr != m_suffixes.end()) {
+            for (auto rule: itr->second) Check(rule, name, isDirectory, best);
+        }
+    }
+    for (auto rule: m_nameWildcards) Check(rule, name, isDirectory, best);
+    for (auto rule: m_pathRules) Check(rule, path, isDirectory, best);
+
+    if (best < 0) return Result::None;
+    return m_rules[best].keep ? Result::Kept : Result::Ignored;
+}
+
+ZepGlobSet::ZepGlobSet(const std::vector<std::string> &patterns) {
+    for (auto &pattern: patterns) {
+        auto wildcard = FindWildcard(pattern);
+        if (wildcard == std::string::npos) {
+            m_literals.insert(pattern);
+            continue;
+        }
+
+        if (pattern[0] == '*') {
+            auto start = pattern.find_first_not_of('*');
+            if (start == std::string::npos || FindWildcard(pattern, start) == std::string::npos) {
+                auto suffix = start == std::string::npos ? std::string() : pattern.substr(start);
+                if (suffix.find('.') != std::string::npos) {
+                    m_suffixes[GetExtension(suffix)].push_back(suffix);
+                } else {
+                    m_plainSuffixes.push_back(suffix);
+                }
+                continue;
+            }
+        }
+        m_wildcards.push_back({pattern.substr(0, wildcard), pattern});
+
+        // A '/' and then only stars matches anything at all below what comes before it
+        auto stars = pattern.find_last_not_of('*');
+        if (stars != std::string::npos && stars + 1 < pattern.size() && pattern[stars] == '/' && stars > 0 && pattern[stars - 1] != '\\') {
+            auto directory = pattern.substr(0, stars);
+            m_directories.push_back({directory.substr(0, FindWildcard(directory)), directory});
+        }
+    }
+}
+
+bool ZepGlobSet::Empty() const {
+    return m_literals.empty() && m_suffixes.empty() && m_plainSuffixes.empty() && m_wildcards.empty();
+}
+
+bool ZepGlobSet::Match(const std::string &path) const {
+    if (!m_literals.empty() && m_literals.count(path)) return true;
+
+    if (!m_suffixes.empty()) {
+        auto itr = m_suffixes.find(GetExtension(path));
+        if (itr != m_suffixes.end()) {
+            for (auto &suffix: itr->second) {
+                if (EndsWith(path, suffix)) return true;
+            }
+        }
+    }
+
+    for (auto &suffix: m_plainSuffixes) {
+        if (EndsWith(path, suffix)) return true;
+    }
+
+    for (auto &wildcard: m_wildcards) {
+        if (path.compare(0, wildcard.prefix.size(), wildcard.prefix) == 0 && fnmatch(wildcard.pattern.c_str(), path.c_str(), 0) == 0) return true;
+    }
+    return false;
+}
+
+bool ZepGlobSet::MatchesAllBelow(const std::string &path) const {
+    for (auto &directory: m_directories) {
+        if (path.compare(0, directory.prefix.size(), directory.prefix) == 0 && fnmatch(directory.pattern.c_str(), path.c_str(), 0) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace Zep
@@ -1,10 +1,17 @@
-#include "zep/file/fnmatch.h"
+#include "zep/buffer.h"
 #include "zep/logger.h"
 #include "zep/stringutils.h"
 #include "zep/threadutils.h"
 
 #include "zep/filesystem.h"
+#include "zep/glob.h"
 #include "zep/indexer.h"
+#include "zep/window.h"
+
+#include <algorithm>
+#include <cctype>
+#include <numeric>
+#include <sstream>
 
 namespace Zep {
 
@@ -49,121 +56,235 @@ void Indexer::GetSearchPaths(ZepEditor &editor, const ZepPath &path, std::vector
     }
 } // namespace Zep
 
-std::future<std::shared_ptr<FileIndexResult>> Indexer::IndexPaths(ZepEditor &editor, const ZepPath &startPath) {
-    std::vector<std::string> ignorePaths;
-    std::vector<std::string> includePaths;
-    std::string errors;
-    GetSearchPaths(editor, startPath, ignorePaths, includePaths, errors);
+struct FileWalkState {
+    FileWalkState(ThreadPool &pool, TaskPriority taskPriority, const ZepPath &rootPath, const std::vector<std::string> &ignorePatterns, const std::vector<std::string> &includePatterns)
+        : threadPool(pool), priority(taskPriority), root(rootPath), ignore(ignorePatterns), include(includePatterns) {}
+
+    ThreadPool &threadPool;
+    TaskPriority priority;
+    CancelToken cancel; // The directories still queued are dropped
+    ZepPath root;
+    ZepGlobSet ignore;
+    ZepGlobSet include;
+
+    // Called by the thread which finishes the walk, with every file found, if they haven't been taken
+    std::function<void(const std::shared_ptr<FileIndexResult> &)> fnFinished;
+
+    std::atomic<long> pending{0};
+    std::atomic<bool> finished{false};
+
+    // Found and not yet taken; relative to the root, '/' separated
+    std::mutex mutex;
+    std::vector<std::string> paths;
+    std::vector<std::string> lowerPaths;
+};
+
+namespace {
+
+// The ignore files of a directory, and those of the directories above it
+struct IgnoreScope {
+    std::shared_ptr<const IgnoreScope> parent;
+    std::string directory; // Relative to the root of the walk
+    ZepIgnoreRules rules;
+};
+
+// The nearest ignore file with a rule for the path decides
+bool IsIgnored(const IgnoreScope *pScope, const std::string &path, const std::string &name, bool isDirectory) {
+    for (; pScope; pScope = pScope->parent.get()) {
+        auto relative = pScope->directory.empty() ? path : path.substr(pScope->directory.size() + 1);
+        auto result = pScope->rules.Match(relative, name, isDirectory);
+        if (result != ZepIgnoreRules::Result::None) return result == ZepIgnoreRules::Result::Ignored;
+    }
+    return false;
+}
 
-    auto result = std::make_shared<FileIndexResult>();
-    if (!errors.empty()) {
-        result->errors = errors;
-        return make_ready_future(result);
+void WalkDirectory(const std::shared_ptr<FileWalkState> &state, const std::string &directory, std::shared_ptr<const IgnoreScope> scope) {
+    auto directoryPath = directory.empty() ? state->root : state->root / directory;
+
+    std::vector<std::pair<std::string, bool>> entries;
+    bool hasIgnoreFiles = false;
+    if (!state->cancel.IsCancelled()) {
+        ZepFileSystem::ListDirectory(directoryPath, [&](const std::string &name, bool isDirectory) {
+            hasIgnoreFiles |= !isDirectory && (name == ".gitignore" || name == ".ignore");
+            entries.emplace_back(name, isDirectory);
+        });
     }
 
-    return editor.threadPool->enqueue([=](ZepPath root) {
-            result->root = root;
+    // A .ignore overrides the .gitignore beside it, which overrides the repository's own excludes
+    auto exclude = directoryPath / ".git" / "info" / "exclude";
+    bool hasExclude = directory.empty() && ZepFileSystem::Exists(exclude);
+    if (hasIgnoreFiles || hasExclude) {
+        auto newScope = std::make_shared<IgnoreScope>();
+        newScope->parent = scope;
+        newScope->directory = directory;
+        if (hasExclude) newScope->rules.Add(ZepFileSystem::Read(exclude));
+        for (auto name: {".gitignore", ".ignore"}) {
+            if (ZepFileSystem::Exists(directoryPath / name)) newScope->rules.Add(ZepFileSystem::Read(directoryPath / name));
+        }
+        if (!newScope->rules.Empty()) scope = newScope;
+    }
 
-            try {
-                // Index the whole subtree, ignoring any patterns supplied to us
-                ZepFileSystem::ScanDirectory(root, [&](const ZepPath &p, bool &recurse) -> bool {
-                    recurse = true;
+    std::vector<std::string> files;
+    std::vector<std::string> directories;
+    for (auto &[name, isDirectory]: entries) {
+        if (isDirectory && name == ".git") continue;
 
-                    auto bDir = ZepFileSystem::IsDirectory(p);
+        auto path = directory.empty() ? name : directory + "/" + name;
+        if (state->ignore.Match(path) || IsIgnored(scope.get(), path, name, isDirectory)) continue;
 
-                    // Add this one to our list
-                    auto targetZep = ZepFileSystem::Canonical(p);
-                    auto rel = path_get_relative(root, targetZep);
+        if (isDirectory) {
+            if (!state->ignore.MatchesAllBelow(path)) directories.push_back(std::move(path));
+        } else if (state->include.Match(path)) {
+            files.push_back(std::move(path));
+        }
+    }
 
-                    bool matched = true;
-                    for (auto &proj: ignorePaths) {
-                        auto res = fnmatch(proj.c_str(), rel.string().c_str(), 0);
-                        if (res == 0) {
-                            matched = false;
-                            break;
-                        }
-                    }
+    if (!files.empty()) {
+        std::vector<std::string> lowerFiles;
+        lowerFiles.reserve(files.size());
+        for (auto &file: files) lowerFiles.push_back(string_tolower(file));
 
-                    if (!matched) {
-                        if (bDir) recurse = false;
-                        return true;
-                    }
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->paths.insert(state->paths.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+        state->lowerPaths.insert(state->lowerPaths.end(), std::make_move_iterator(lowerFiles.begin()), std::make_move_iterator(lowerFiles.end()));
+    }
 
-                    matched = false;
-                    for (auto &proj: includePaths) {
-                        auto res = fnmatch(proj.c_str(), rel.string().c_str(), 0);
-                        if (res == 0) {
-                            matched = true;
-                            break;
-                        }
-                    }
+    // The walk is done when the last directory is, so the count goes up before the tasks are queued
+    state->pending += long(directories.size());
+    for (auto &subDirectory: directories) {
+        state->threadPool.Run([state, subDirectory, scope]() { WalkDirectory(state, subDirectory, scope); }, state->priority, state->cancel);
+    }
 
-                    if (!matched) return true;
+    if (--state->pending != 0) return;
 
-                    // Not adding directories to the search list
-                    if (bDir) return true;
+    state->finished = true;
+    if (state->fnFinished) {
+        auto result = std::make_shared<FileIndexResult>();
+        result->root = state->root;
 
-                    result->paths.push_back(rel);
-                    result->lowerPaths.push_back(string_tolower(rel.string()));
+        std::lock_guard<std::mutex> lock(state->mutex);
+        std::vector<uint32_t> order(state->paths.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return state->paths[a] < state->paths[b]; });
 
-                    return true;
-                });
-            } catch (std::exception &) {}
+        result->paths.reserve(order.size());
+        result->lowerPaths.reserve(order.size());
+        for (auto index: order) {
+            result->paths.emplace_back(state->paths[index]);
+            result->lowerPaths.push_back(std::move(state->lowerPaths[index]));
+        }
+        state->fnFinished(result);
+    }
+}
 
-            return result;
-        },
-        startPath);
+std::shared_ptr<FileWalkState> StartWalk(const std::shared_ptr<FileWalkState> &state) {
+    state->pending = 1;
+    state->threadPool.Run([state]() { WalkDirectory(state, std::string(), nullptr); }, state->priority, state->cancel);
+    return state;
 }
 
-void Indexer::Notify(const std::shared_ptr<ZepMessage> &message) {
-    if (message->messageId == Msg::Tick) {
-        if (m_fileSearchActive) {
-            if (!is_future_ready(m_indexResult)) return;
+} // namespace
 
-            m_fileSearchActive = false;
+ZepFileWalk::ZepFileWalk(ThreadPool &threadPool, const ZepPath &root, const std::vector<std::string> &ignorePatterns, const std::vector<std::string> &includePatterns, TaskPriority priority)
+    : m_state(StartWalk(std::make_shared<FileWalkState>(threadPool, priority, root, ignorePatterns, includePatterns))) {}
 
-            m_filePaths = m_indexResult.get();
-            if (!m_filePaths->errors.empty()) {
-                editor.SetCommandText(m_filePaths->errors);
-                return;
-            }
+ZepFileWalk::~ZepFileWalk() {
+    // The tasks still queued are dropped, and those running stop listing
+    m_state->cancel.Cancel();
+}
 
-            {
-                // Queue the files to be searched
-                std::lock_guard<std::mutex> guard(m_queueMutex);
-                for (auto &p: m_filePaths->paths) {
-                    m_searchQueue.push_back(p);
-                }
-            }
+const ZepPath &ZepFileWalk::GetRoot() const {
+    return m_state->root;
+}
 
-            StartSymbolSearch(); // Kick off the thread
-        }
+bool ZepFileWalk::Finished() const {
+    return m_state->finished;
+}
+
+bool ZepFileWalk::TakeFiles(FileIndexResult &result) {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (m_state->paths.empty()) return false;
+
+    for (auto &path: m_state->paths) result.paths.emplace_back(path);
+    result.lowerPaths.insert(result.lowerPaths.end(), std::make_move_iterator(m_state->lowerPaths.begin()), std::make_move_iterator(m_state->lowerPaths.end()));
+    m_state->paths.clear();
+    m_state->lowerPaths.clear();
+    return true;
+}
+
+std::future<std::shared_ptr<FileIndexResult>> Indexer::IndexPaths(ZepEditor &editor, const ZepPath &startPath, TaskPriority priority) {
+    std::vector<std::string> ignorePaths;
+    std::vector<std::string> includePaths;
+    std::string errors;
+    GetSearchPaths(editor, startPath, ignorePaths, includePaths, errors);
+
+    auto result = std::make_shared<FileIndexResult>();
+    if (!errors.empty()) {
+        result->errors = errors;
+        return make_ready_future(result);
     }
+
+    auto promise = std::make_shared<std::promise<std::shared_ptr<FileIndexResult>>>();
+    auto state = std::make_shared<FileWalkState>(*editor.threadPool, priority, startPath, ignorePaths, includePaths);
+    state->fnFinished = [promise](const std::shared_ptr<FileIndexResult> &files) { promise->set_value(files); };
+
+    auto future = promise->get_future();
+    StartWalk(state);
+    return future;
 }
 
-void Indexer::StartSymbolSearch() {
-    editor.threadPool->enqueue([=]() {
-        for (;;) {
-            ZepPath path;
-            {
-                std::lock_guard<std::mutex> lock(m_queueMutex);
-                if (m_searchQueue.empty()) return true;
+std::unique_ptr<ZepFileWalk> Indexer::WalkPaths(ZepEditor &editor, const ZepPath &startPath, std::string &errors) {
+    std::vector<std::string> ignorePaths;
+    std::vector<std::string> includePaths;
+    GetSearchPaths(editor, startPath, ignorePaths, includePaths, errors);
+    if (!errors.empty()) return nullptr;
 
-                path = m_searchQueue.front();
-                m_searchQueue.pop_front();
-            }
+    return std::make_unique<ZepFileWalk>(*editor.threadPool, startPath, ignorePaths, includePaths);
+}
 
-            std::string strLast;
-            auto fullPath = m_searchRoot / path;
-            if (ZepFileSystem::Exists(fullPath)) {
-                ZLOG(DBG, "Parsing: " << fullPath.c_str());
-                auto strFile = ZepFileSystem::Read(fullPath);
+void Indexer::Notify(const std::shared_ptr<ZepMessage> &message) {
+    if (message->messageId != Msg::Tick) return;
 
-                std::vector<std::string> tokens;
-                string_split(strFile, ";()[] \t\n\r&!\"\'*:,<>", tokens);
-            }
+    if (m_fileSearchActive) {
+        if (!is_future_ready(m_indexResult)) return;
+
+        m_fileSearchActive = false;
+
+        m_filePaths = m_indexResult.get();
+        if (!m_filePaths->errors.empty()) {
+            editor.SetCommandText(m_filePaths->errors);
+            return;
         }
-    });
+        m_symbolsPending = true;
+    }
+
+    if (m_symbolBuildActive) {
+        if (!is_future_ready(m_symbolResult)) return;
+
+        m_symbolBuildActive = false;
+        m_symbols = m_symbolResult.get();
+    }
+
+    // One build at a time; a file list which arrives during one is indexed after it
+    if (m_symbolsPending) {
+        m_symbolsPending = false;
+        StartSymbolBuild();
+    }
+}
+
+void Indexer::StartSymbolBuild() {
+    m_symbolBuildActive = true;
+    m_symbolResult = editor.threadPool->Async(TaskPriority::Background, [files = m_filePaths, previous = m_symbols, indexPath = m_searchRoot / ".zep" / "indexdb"]() {
+            auto symbols = ZepSymbolIndex::Build(files->root, files->paths, previous.get());
+
+            // Keep the mapped index if nothing has changed since it was written
+            if (previous && symbols->FilesRead() == 0 && symbols->FileCount() == previous->FileCount()) return previous;
+
+            if (!symbols->Write(indexPath)) {
+                ZLOG(ERROR, "Can't write the symbol index: " << indexPath.string());
+            }
+            return symbols;
+        });
 }
 
 bool Indexer::StartIndexing() {
@@ -180,8 +301,8 @@ bool Indexer::StartIndexing() {
         return false;
     }
 
-    int v = 0;
-    ZepFileSystem::Write(indexDBRoot / "indexdb", &v, 1);
+    // The last session's index can be used while the files are checked against it
+    m_symbols = ZepSymbolIndex::Load(indexDBRoot / "indexdb");
 
     m_fileSearchActive = true;
     m_indexResult = Indexer::IndexPaths(editor, m_searchRoot);
@@ -189,4 +310,81 @@ bool Indexer::StartIndexing() {
     return true;
 }
 
+void Indexer::UpdateSymbols() {
+    if (m_searchRoot.empty() || m_fileSearchActive) return;
+
+    m_fileSearchActive = true;
+    m_indexResult = Indexer::IndexPaths(editor, m_searchRoot);
+}
+
+ZepTagExCommand::ZepTagExCommand(ZepEditor &editor) : ZepExCommand(editor) {}
+
+void ZepTagExCommand::Register(ZepEditor &editor) {
+    editor.RegisterExCommand(std::make_shared<ZepTagExCommand>(editor));
+}
+
+void ZepTagExCommand::Run(const std::vector<std::string> &tokens) {
+    auto pWindow = editor.GetActiveWindow();
+    if (!pWindow) return;
+
+    // The word under the cursor, as the index splits them
+    auto isWordChar = [](uint8_t ch) { return std::isalnum(ch) || ch == '_'; };
+    auto word = tokens.size() > 1 ? tokens[1] : std::string();
+    if (word.empty()) {
+        auto &text = pWindow->buffer->workingBuffer;
+        auto begin = pWindow->GetBufferCursor().index;
+        auto end = begin;
+        while (begin > 0 && isWordChar(text[begin - 1])) begin--;
+        while (end < long(text.size()) && isWordChar(text[end])) end++;
+        word = std::string(text.begin() + begin, text.begin() + end);
+    }
+    if (word.empty() || !isWordChar(uint8_t(word[0]))) {
+        editor.SetCommandText("Usage: :tag <word>");
+        return;
+    }
+
+    std::shared_ptr<ZepSymbolIndex> symbols;
+    ZepPath root;
+    if (auto pIndexer = editor.GetIndexer()) {
+        symbols = pIndexer->GetSymbols();
+        root = pIndexer->GetSearchRoot();
+    } else {
+        bool foundGit = false;
+        root = editor.fileSystem->GetSearchRoot(pWindow->buffer->filePath.empty() ? editor.fileSystem->workingDirectory : pWindow->buffer->filePath, foundGit);
+        symbols = ZepSymbolIndex::Load(root / ".zep" / "indexdb");
+    }
+    if (!symbols) {
+        editor.SetCommandText("No symbol index");
+        return;
+    }
+
+    auto definitions = symbols->FindDefinitions(word);
+    if (definitions.empty()) {
+        editor.SetCommandText("No definition of " + word);
+        m_word.clear();
+        return;
+    }
+
+    if (word != m_word) {
+        m_word = word;
+        m_nextDefinition = 0;
+    }
+    auto definition = m_nextDefinition % definitions.size();
+    m_nextDefinition = definition + 1;
+
+    auto &location = definitions[definition];
+    auto pBuffer = editor.GetFileBuffer(root / location.path);
+    if (!pBuffer) return;
+
+    pWindow->SetBuffer(pBuffer);
+    ByteRange range;
+    if (pBuffer->GetLineOffsets(location.line, range)) {
+        pWindow->SetBufferCursor(GlyphIterator(pBuffer, range.first));
+    }
+
+    std::ostringstream str;
+    str << "Definition " << (definition + 1) << " of " << definitions.size() << ": " << location.path.string() << ":" << (location.line + 1);
+    editor.SetCommandText(str.str());
+}
+
 } // namespace Zep
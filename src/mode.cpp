@@ -1,5 +1,6 @@
 #include "zep/mode.h"
 #include "zep/buffer.h"
+#include "zep/buffer_search.h"
 #include "zep/editor.h"
 #include "zep/filesystem.h"
 #include "zep/logger.h"
@@ -112,7 +113,13 @@ void CommandContext::GetCommandRegisters() {
     }
 }
 
-ZepMode::ZepMode(ZepEditor &editor) : ZepComponent(editor) {}
+ZepMode::ZepMode(ZepEditor &editor) : ZepComponent(editor) {
+    UpdateUndoMemoryLimit();
+}
+
+void ZepMode::UpdateUndoMemoryLimit() {
+    m_undoJournal.SetMemoryLimit(size_t(editor.config.undoMemoryMB) << 20);
+}
 
 void ZepMode::AddCommandText(const std::string &text) {
     if (currentWindow == nullptr) return;
@@ -150,9 +157,9 @@ void ZepMode::SwitchMode(EditorMode editorMode) {
         editorMode = DefaultMode();
     }
 
-    // When leaving Ex mode, reset search markers
+    // When leaving Ex mode, stop highlighting the search
     if (currentMode == EditorMode::Ex) {
-        buffer->HideMarkers(RangeMarkerType::Search);
+        if (buffer->search) buffer->search->visible = false;
 
         // Bailed out of ex mode; reset the start location
         /*if (mode != EditorMode::Ex)
@@ -339,7 +346,7 @@ void ZepMode::HandleMappedInput(const std::string &input) {
         if (context->commandResult.command) {
             // If not in insert mode, begin the group, because we have started a new operation
             if (currentMode != EditorMode::Insert || (context->commandResult.flags & CommandResultFlags::BeginUndoGroup)) {
-                AddCommand(std::make_shared<ZepCommand_GroupMarker>(context->buffer));
+                AddUndoGroup();
 
                 // Record for the dot command
                 m_dotCommand = m_currentCommand;
@@ -354,7 +361,7 @@ void ZepMode::HandleMappedInput(const std::string &input) {
             // This command didn't change anything, but switched into insert mode, so
             // remember the dot command that did it
             if (enteringMode(EditorMode::Insert)) {
-                AddCommand(std::make_shared<ZepCommand_GroupMarker>(context->buffer));
+                AddUndoGroup();
                 m_dotCommand = m_currentCommand;
             }
         }
@@ -404,62 +411,37 @@ void ZepMode::AddCommand(const std::shared_ptr<ZepCommand> &cmd) {
     // and all commands currently modify the buffer!
     if (currentWindow->buffer->HasFileFlags(FileFlags::Locked)) return;
 
+    // The command is done with once the journal has what it changed
     cmd->Redo();
-    m_undoStack.push(cmd);
-
-    // Can't redo anything beyond this point
-    std::stack<std::shared_ptr<ZepCommand>> empty;
-    m_redoStack.swap(empty);
+    cmd->Record(m_undoJournal);
 
     if (cmd->cursorAfter.Valid()) {
         currentWindow->SetBufferCursor(cmd->cursorAfter);
     }
 }
 
-void ZepMode::Redo() {
-    if (currentWindow == nullptr || m_redoStack.empty()) return;
-
-    if (std::dynamic_pointer_cast<ZepCommand_GroupMarker>(m_redoStack.top()) != nullptr) {
-        m_undoStack.push(m_redoStack.top());
-        m_redoStack.pop();
-    }
-
-    while (!m_redoStack.empty()) {
-        auto &command = m_redoStack.top();
-        command->Redo();
+void ZepMode::AddUndoGroup() {
+    if (currentWindow == nullptr || currentWindow->buffer->HasFileFlags(FileFlags::Locked)) return;
 
-        if (command->cursorAfter.Valid()) {
-            currentWindow->SetBufferCursor(command->cursorAfter);
-        }
+    m_undoJournal.AddGroup();
+}
 
-        m_undoStack.push(command);
-        m_redoStack.pop();
+void ZepMode::Redo() {
+    if (currentWindow == nullptr) return;
 
-        if (std::dynamic_pointer_cast<ZepCommand_GroupMarker>(command) != nullptr) break;
-    };
+    auto cursor = m_undoJournal.Redo();
+    if (cursor.Valid()) {
+        currentWindow->SetBufferCursor(cursor);
+    }
 }
 
 void ZepMode::Undo() {
-    if (currentWindow == nullptr || m_undoStack.empty()) return;
+    if (currentWindow == nullptr) return;
 
-    if (std::dynamic_pointer_cast<ZepCommand_GroupMarker>(m_undoStack.top()) != nullptr) {
-        m_redoStack.push(m_undoStack.top());
-        m_undoStack.pop();
+    auto cursor = m_undoJournal.Undo();
+    if (cursor.Valid()) {
+        currentWindow->SetBufferCursor(cursor);
     }
-
-    while (!m_undoStack.empty()) {
-        auto &command = m_undoStack.top();
-        command->Undo();
-
-        if (command->cursorBefore.Valid()) {
-            currentWindow->SetBufferCursor(command->cursorBefore);
-        }
-
-        m_redoStack.push(command);
-        m_undoStack.pop();
-
-        if (std::dynamic_pointer_cast<ZepCommand_GroupMarker>(command) != nullptr) break;
-    };
 }
 
 GlyphRange ZepMode::GetInclusiveVisualRange() const {
@@ -526,25 +508,23 @@ bool ZepMode::GetCommand(CommandContext &context) {
     else if (mappedCommand == id_MotionNextMarker) {
         auto pFound = buffer->FindNextMarker(currentWindow->GetBufferCursor(), Direction::Forward, RangeMarkerType::Mark);
         if (pFound) {
-            currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pFound->range.first));
+            currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pFound->GetRange().first));
         }
         return true;
     } else if (mappedCommand == id_MotionPreviousMarker) {
         auto pFound = buffer->FindNextMarker(currentWindow->GetBufferCursor(), Direction::Backward, RangeMarkerType::Mark);
         if (pFound) {
-            currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pFound->range.first));
+            currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pFound->GetRange().first));
         }
         return true;
     } else if (mappedCommand == id_MotionNextSearch) {
-        auto pFound = buffer->FindNextMarker(currentWindow->GetBufferCursor(), m_lastSearchDirection, RangeMarkerType::Search);
-        if (pFound) {
-            currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pFound->range.first));
+        if (MoveToSearchMatch(*currentWindow, currentWindow->GetBufferCursor(), m_lastSearchDirection)) {
+            ShowSearchCount(*buffer);
         }
         return true;
     } else if (mappedCommand == id_MotionPreviousSearch) {
-        auto pFound = buffer->FindNextMarker(currentWindow->GetBufferCursor(), m_lastSearchDirection == Direction::Forward ? Direction::Backward : Direction::Forward, RangeMarkerType::Search);
-        if (pFound) {
-            currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pFound->range.first));
+        if (MoveToSearchMatch(*currentWindow, currentWindow->GetBufferCursor(), m_lastSearchDirection == Direction::Forward ? Direction::Backward : Direction::Forward)) {
+            ShowSearchCount(*buffer);
         }
         return true;
     } else if (mappedCommand == id_SwitchToAlternateFile) {
@@ -784,7 +764,7 @@ bool ZepMode::GetCommand(CommandContext &context) {
     } else if (mappedCommand == id_MotionGotoLine) {
         if (!context.keymap.captureNumbers.empty()) {
             // In Vim, 0G means go to end!  1G is the first line...
-            long count = std::max(std::min(long(context.buffer.lineEnds.size()) - 1l, context.keymap.TotalCount() - 1l), 0l);
+            long count = std::max(std::min(context.buffer.lineEnds.Count() - 1l, context.keymap.TotalCount() - 1l), 0l);
 
             ByteRange range;
             if (context.buffer.GetLineOffsets(count, range)) {
@@ -1218,65 +1198,18 @@ bool ZepMode::GetCommand(CommandContext &context) {
         currentWindow->SetBufferCursor(context.buffer.FindOnLineMotion(bufferCursor, (const uint8_t *) m_lastFind.c_str(), m_lastFindDirection));
         return true;
     } else if (mappedCommand == id_FindNextDelimiter) {
-        int32_t findIndex = 0;
-        std::string delims = "\n(){}[]";
-        Direction dir = Direction::Forward;
-
-        GlyphIterator loc;
-        loc = context.buffer.FindFirstCharOf(bufferCursor, delims, findIndex, dir);
-
-        if (findIndex > 0) {
-            // Make a new end location
-            auto end_loc = loc;
+        // The first bracket from the cursor to the line end, and its pair, from the bracket index
+        const auto &index = context.buffer.GetBracketIndex();
+        auto lineEnd = context.buffer.GetLinePos(bufferCursor, LineLocation::LineCRBegin);
 
-            std::string closing;
-            std::string opening = std::string(1, delims[findIndex]);
-
-            // opening bracket
-            if (findIndex & 0x1) {
-                end_loc++;
-                closing = delims[findIndex + 1];
-            } else {
-                end_loc--;
-                closing = delims[findIndex - 1];
-                dir = Direction::Backward;
-            }
-            std::string openClose = opening + closing;
+        auto found = index.FindNext(bufferCursor.index);
+        if (found == -1 || found >= lineEnd.index) return false;
 
-            // Track open/close bracket pairs
-            int closingCount = 1;
+        auto pair = index.FindPair(found);
+        if (pair == -1) return false;
 
-            for (;;) {
-                // Find the next open or close of the current delim type
-                int newIndex;
-                end_loc = context.buffer.FindFirstCharOf(end_loc, openClose, newIndex, dir);
-
-                // Fell off, no find
-                if (newIndex < 0) break;
-
-                // Found another opener/no good
-                if (newIndex == 0) {
-                    closingCount++;
-                }
-                    // Found a closer
-                else if (newIndex == 1) {
-                    closingCount--;
-                    if (closingCount == 0) {
-                        currentWindow->SetBufferCursor(end_loc);
-                        return true;
-                    }
-                }
-
-                if (dir == Direction::Forward) {
-                    if (end_loc == context.buffer.End()) break;
-                    end_loc++;
-                } else {
-                    if (end_loc == context.buffer.Begin()) break;
-                    end_loc--;
-                }
-            }
-        }
-        return false;
+        currentWindow->SetBufferCursor(GlyphIterator(&context.buffer, pair));
+        return true;
     } else if (mappedCommand == id_Append) {
         // Cursor append
         cursorItr.MoveClamped(1, LineLocation::LineCRBegin);
@@ -1518,9 +1451,10 @@ bool ZepMode::HandleExCommand(std::string strCommand) {
 
         if (editor.Broadcast(std::make_shared<ZepMessage>(Msg::HandleCommand, strCommand))) return true;
 
-        auto pCommand = editor.FindExCommand(strCommand.substr(1));
+        // Commands are found by their first word; the rest are their arguments
+        auto strTok = string_split(strCommand, " ");
+        auto pCommand = strTok.empty() ? nullptr : editor.FindExCommand(strTok[0].substr(1));
         if (pCommand) {
-            auto strTok = string_split(strCommand, " ");
             pCommand->Run(strTok);
         } else if (strCommand == ":reg") {
             std::ostringstream str;
@@ -1740,28 +1674,10 @@ bool ZepMode::HandleExCommand(std::string strCommand) {
             auto *buffer = window->buffer;
             auto searchString = m_currentCommand.substr(1);
 
-            buffer->ClearRangeMarkers(RangeMarkerType::Search);
-
-            uint32_t numMarkers = 0;
-            GlyphIterator start = buffer->Begin();
-
-            if (!searchString.empty()) {
-                static const uint32_t MaxMarkers = 1000;
-                while (numMarkers < MaxMarkers) {
-                    auto found = buffer->Find(start, (uint8_t *) &searchString[0], (uint8_t *) &searchString[searchString.length()]);
-                    if (!found.Valid()) break;
-
-                    start = found + 1;
-
-                    auto marker = std::make_shared<RangeMarker>(*buffer);
-                    marker->SetColors(ThemeColor::VisualSelectBackground, ThemeColor::Text);
-                    marker->SetRange(ByteRange(found.index, found.PeekByteOffset(long(searchString.size())).index));
-                    marker->displayType = RangeMarkerDisplayType::Background;
-                    marker->markerType = RangeMarkerType::Search;
-
-                    numMarkers++;
-                }
-            }
+            // Every match is found; there is no limit on how many 'n' can step through
+            if (!buffer->search) buffer->search = std::make_shared<ZepBufferSearch>(*buffer);
+            buffer->search->SetPattern(searchString);
+            buffer->search->visible = true;
 
             Direction dir = (m_currentCommand[0] == '/') ? Direction::Forward : Direction::Backward;
             m_lastSearchDirection = dir;
@@ -1771,11 +1687,7 @@ bool ZepMode::HandleExCommand(std::string strCommand) {
             if (dir == Direction::Forward) startLocation--;
             else startLocation++;
 
-            auto pMark = buffer->FindNextMarker(startLocation, dir, RangeMarkerType::Search);
-            if (pMark) {
-                window->SetBufferCursor(GlyphIterator(buffer, pMark->range.first));
-                pMark->SetBackgroundColor(ThemeColor::Info);
-            } else {
+            if (!MoveToSearchMatch(*window, startLocation, dir)) {
                 window->SetBufferCursor(m_exCommandStartLocation);
             }
         }
@@ -1783,6 +1695,25 @@ bool ZepMode::HandleExCommand(std::string strCommand) {
     return false;
 }
 
+// Move the cursor to the next match of the buffer's search, wrapping around the buffer
+bool ZepMode::MoveToSearchMatch(ZepWindow &window, const GlyphIterator &from, Direction dir) {
+    auto &search = window.buffer->search;
+    auto match = search ? search->FindNext(from.index, dir) : -1;
+    if (match < 0) return false;
+
+    search->current = match;
+    window.SetBufferCursor(GlyphIterator(window.buffer, search->GetMatches()[match].begin));
+    return true;
+}
+
+// Show which of the matches the cursor is on, and how many there are
+void ZepMode::ShowSearchCount(ZepBuffer &buffer) {
+    auto &search = *buffer.search;
+    std::ostringstream str;
+    str << "/" << search.GetPattern() << "  [" << (search.current + 1) << "/" << search.Count() << "]";
+    editor.SetCommandText(str.str());
+}
+
 const KeyMap &ZepMode::GetKeyMappings(EditorMode mode) const {
     return mode == EditorMode::Visual ? m_visualMap : mode == EditorMode::Normal ? m_normalMap : m_insertMap;
 }
@@ -8,6 +8,28 @@
 
 namespace Zep {
 
+bool IZepReplProvider::ReplIsFormComplete(const std::string &input, int &depth) {
+    depth = ZepBracketIndex::FormDepth(input, true);
+    return depth == 0;
+}
+
+GlyphRange IZepReplProvider::ReplRange(ZepBuffer &buffer, const GlyphIterator &cursorOffset, ReplParseType type) {
+    static const std::vector<char> beginExpression = {'(', '[', '{'};
+    static const std::vector<char> endExpression = {')', ']', '}'};
+
+    switch (type) {
+        case ReplParseType::SubExpression:
+            return buffer.GetExpression(ExpressionType::Inner, cursorOffset, beginExpression, endExpression);
+        case ReplParseType::OuterExpression:
+            return buffer.GetExpression(ExpressionType::Outer, cursorOffset, beginExpression, endExpression);
+        case ReplParseType::Line:
+            return {buffer.GetLinePos(cursorOffset, LineLocation::LineBegin), buffer.GetLinePos(cursorOffset, LineLocation::LineCRBegin)};
+        case ReplParseType::All:
+        default:
+            return {buffer.Begin(), buffer.End()};
+    }
+}
+
 ZepReplEvaluateOuterCommand::ZepReplEvaluateOuterCommand(ZepEditor &editor, IZepReplProvider *provide)
     : ZepExCommand(editor), m_pProvider(provide) {
     keymap_add(m_keymap, {"<C-Return>"}, ExCommandId());
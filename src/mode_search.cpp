@@ -13,11 +13,7 @@ namespace Zep {
 ZepMode_Search::ZepMode_Search(ZepEditor &editor, ZepWindow &launchWindow, ZepWindow &window, ZepPath path)
     : ZepMode(editor), m_launchWindow(launchWindow), m_window(window), m_startPath(std::move(path)) {}
 
-ZepMode_Search::~ZepMode_Search() {
-    // Ensure threads have finished
-    if (m_indexResult.valid()) m_indexResult.wait();
-    if (m_searchResult.valid()) m_searchResult.wait();
-}
+ZepMode_Search::~ZepMode_Search() = default;
 
 void ZepMode_Search::AddKeyPress(ImGuiKey key, ImGuiModFlags modifiers) {
     (void) modifiers;
@@ -43,7 +39,7 @@ void ZepMode_Search::AddKeyPress(ImGuiKey key, ImGuiModFlags modifiers) {
     if (key == ImGuiKey_Backspace) {
         if (m_searchTerm.length() > 0) {
             m_searchTerm = m_searchTerm.substr(0, m_searchTerm.length() - 1);
-            UpdateTree();
+            UpdateMatches();
         }
     } else {
         if (ImGui::GetIO().KeyCtrl) {
@@ -68,15 +64,20 @@ void ZepMode_Search::AddKeyPress(ImGuiKey key, ImGuiModFlags modifiers) {
         } else if (std::isgraph(key)) {
             // TODO: UTF8
             m_searchTerm += char(key);
-            UpdateTree();
+            UpdateMatches();
         }
     }
 
+    ShowStatus();
+}
+
+void ZepMode_Search::ShowStatus() {
     std::ostringstream str;
     str << ">>> " << m_searchTerm;
 
-    if (!m_indexTree.empty()) {
-        str << " (" << m_indexTree[m_indexTree.size() - 1]->size() << " / " << m_indexTree[0]->size() << ")";
+    if (m_filePaths) {
+        auto matched = m_matches.empty() ? m_filePaths->paths.size() : m_matches.back()->candidates.size();
+        str << " (" << matched << " / " << m_filePaths->paths.size() << (m_fileWalk ? "..." : "") << ")";
     }
 
     editor.SetCommandText(str.str());
@@ -87,168 +88,119 @@ void ZepMode_Search::Begin(ZepWindow *pWindow) {
     ZepMode::Begin(pWindow);
 
     m_searchTerm = "";
+    m_matches.clear();
     editor.SetCommandText(">>> ");
 
-    m_indexResult = Indexer::IndexPaths(editor, m_startPath);
-    m_window.buffer->SetText("Indexing: " + m_startPath.string());
+    std::string errors;
+    m_fileWalk = Indexer::WalkPaths(editor, m_startPath, errors);
+    if (!m_fileWalk) {
+        editor.SetCommandText(errors);
+        return;
+    }
 
-    fileSearchActive = true;
+    m_filePaths = std::make_shared<FileIndexResult>();
+    m_filePaths->root = m_fileWalk->GetRoot();
+    m_window.buffer->SetText("Indexing: " + m_startPath.string());
 }
 
 void ZepMode_Search::Notify(const std::shared_ptr<ZepMessage> &message) {
     ZepMode::Notify(message);
     if (message->messageId == Msg::Tick) {
-        if (fileSearchActive) {
-            if (!is_future_ready(m_indexResult)) return;
-
-            fileSearchActive = false;
-
-            m_filePaths = m_indexResult.get();
-            if (!m_filePaths->errors.empty()) {
-                editor.SetCommandText(m_filePaths->errors);
-                return;
+        if (m_fileWalk) {
+            // Anything found before it finished has been added by the time it is taken
+            auto finished = m_fileWalk->Finished();
+            if (m_fileWalk->TakeFiles(*m_filePaths)) {
+                // The narrowed lists don't have the new files in them
+                m_matches.clear();
+                UpdateMatches();
             }
 
-            InitSearchTree();
-            ShowTreeResult();
-            UpdateTree();
+            if (finished) {
+                m_fileWalk.reset();
 
-            editor.RequestRefresh();
-        }
-
-        if (treeSearchActive) {
-            UpdateTree();
+                // Nothing found, so the 'Indexing' text is still there
+                if (m_filePaths->paths.empty()) ShowResults();
+            }
+            ShowStatus();
         }
     }
 }
 
-void ZepMode_Search::InitSearchTree() {
-    m_indexTree.clear();
-    auto pInitSet = std::make_shared<IndexSet>();
-    for (uint32_t i = 0; i < (uint32_t) m_filePaths->paths.size(); i++) {
-        pInitSet->insert(std::make_pair(0, SearchResult{i, 0}));
-    }
-    m_indexTree.push_back(pInitSet);
+long ZepMode_Search::GetResultCount() const {
+    if (!m_filePaths) return 0;
+    if (m_matches.empty()) return long(std::min(m_filePaths->paths.size(), MaxResults));
+    return long(m_matches.back()->best.size());
+}
+
+uint32_t ZepMode_Search::GetResult(long line) const {
+    return m_matches.empty() ? uint32_t(line) : m_matches.back()->best[line].index;
 }
 
-void ZepMode_Search::ShowTreeResult() {
+void ZepMode_Search::ShowResults() {
     std::ostringstream str;
-    bool start = true;
-    for (auto &index: *m_indexTree.back()) {
-        if (!start) {
+    auto count = GetResultCount();
+    for (long line = 0; line < count; line++) {
+        if (line != 0) {
             str << std::endl;
         }
-        str << m_filePaths->paths[index.second.index].string();
-        start = false;
+        str << m_filePaths->paths[GetResult(line)].c_str();
     }
     m_window.buffer->SetText(str.str());
     m_window.SetBufferCursor(m_window.buffer->Begin());
 }
 
 void ZepMode_Search::OpenSelection(OpenType type) {
-    if (m_indexTree.empty()) return;
-
     auto cursor = m_window.GetBufferCursor();
     auto line = m_window.buffer->GetBufferLine(cursor);
-    auto paths = m_indexTree[m_indexTree.size() - 1];
+    if (line >= GetResultCount()) return;
+
     auto *buffer = m_window.buffer;
 
     editor.activeTabWindow->SetActiveWindow(&m_launchWindow);
 
-    long count = 0;
-    for (auto &index: *m_indexTree.back()) {
-        if (count == line) {
-            auto path = m_filePaths->paths[index.second.index];
-            auto full_path = m_filePaths->root / path;
-            auto pBuffer = editor.GetFileBuffer(full_path, 0, true);
-            if (pBuffer != nullptr) {
-                switch (type) {
-                    case OpenType::Replace: {
-                        auto win = editor.FindBufferWindows(pBuffer);
-                        // If they just hit enter, then jump to existing if possible.
-                        if (!win.empty()) {
-                            editor.SetCurrentTabWindow(&win[0]->tabWindow);
-                            win[0]->tabWindow.SetActiveWindow(win[0]);
-                        } else {
-                            m_launchWindow.SetBuffer(pBuffer);
-                        }
-                    }
-                        break;
-                    case OpenType::VSplit:editor.activeTabWindow->AddWindow(pBuffer, &m_launchWindow, RegionLayoutType::HBox);
-                        break;
-                    case OpenType::HSplit:editor.activeTabWindow->AddWindow(pBuffer, &m_launchWindow, RegionLayoutType::VBox);
-                        break;
-                    case OpenType::Tab:editor.AddTabWindow()->AddWindow(pBuffer, nullptr, RegionLayoutType::HBox);
-                        break;
+    auto path = m_filePaths->paths[GetResult(line)];
+    auto full_path = m_filePaths->root / path;
+    auto pBuffer = editor.GetFileBuffer(full_path, 0, true);
+    if (pBuffer != nullptr) {
+        switch (type) {
+            case OpenType::Replace: {
+                auto win = editor.FindBufferWindows(pBuffer);
+                // If they just hit enter, then jump to existing if possible.
+                if (!win.empty()) {
+                    editor.SetCurrentTabWindow(&win[0]->tabWindow);
+                    win[0]->tabWindow.SetActiveWindow(win[0]);
+                } else {
+                    m_launchWindow.SetBuffer(pBuffer);
                 }
             }
+                break;
+            case OpenType::VSplit:editor.activeTabWindow->AddWindow(pBuffer, &m_launchWindow, RegionLayoutType::HBox);
+                break;
+            case OpenType::HSplit:editor.activeTabWindow->AddWindow(pBuffer, &m_launchWindow, RegionLayoutType::VBox);
+                break;
+            case OpenType::Tab:editor.AddTabWindow()->AddWindow(pBuffer, nullptr, RegionLayoutType::HBox);
+                break;
         }
-        count++;
     }
 
     // Removing the buffer will also kill this mode and its window; this is the last thing we can do here
     editor.RemoveBuffer(buffer);
 }
 
-void ZepMode_Search::UpdateTree() {
-    if (fileSearchActive) return;
-
-    if (treeSearchActive) {
-        if (!is_future_ready(m_searchResult)) return;
+void ZepMode_Search::UpdateMatches() {
+    if (!m_filePaths) return;
 
-        m_indexTree.push_back(m_searchResult.get());
-        treeSearchActive = false;
+    // Back to the matches of the longest part of the term typed so far
+    while (!m_matches.empty() && m_searchTerm.compare(0, m_matches.back()->query.size(), m_matches.back()->query) != 0) {
+        m_matches.pop_back();
     }
 
-    // If the user is typing capitals, he cares about them in the search!
-    m_caseImportant = string_tolower(m_searchTerm) != m_searchTerm;
-
-    assert(!m_indexTree.empty());
-
-    auto treeDepth = uint32_t(m_indexTree.size() - 1);
-    if (m_searchTerm.size() < treeDepth) {
-        while (m_searchTerm.size() < treeDepth) {
-            m_indexTree.pop_back();
-            treeDepth--;
-        };
-    } else if (m_searchTerm.size() > treeDepth) {
-        std::shared_ptr<IndexSet> startSet;
-        startSet = m_indexTree[m_indexTree.size() - 1];
-        char startChar = m_searchTerm[m_indexTree.size() - 1];
-
-        // Search for a match at the next level of the search tree
-        m_searchResult = editor.threadPool->enqueue([&](const std::shared_ptr<IndexSet> &startSet, const char startChar) {
-                auto result = std::make_shared<IndexSet>();
-                for (auto &searchPair: *startSet) {
-                    auto index = searchPair.second.index;
-                    auto loc = searchPair.second.location;
-                    auto dist = searchPair.first;
-
-                    size_t pos;
-                    if (m_caseImportant) {
-                        auto str = m_filePaths->paths[index].string();
-                        pos = str.find_first_of(startChar, loc);
-                    } else {
-                        auto str = m_filePaths->lowerPaths[index];
-                        pos = str.find_first_of(startChar, loc);
-                    }
-
-                    if (pos != std::string::npos) {
-                        // this approach 'clumps things together'
-                        // It rewards more for strings of subsequent characters
-                        uint32_t newDist = ((uint32_t) pos - loc);
-                        newDist = dist == 0 ? 1 : newDist == 1 ? dist : dist + 1;
-                        result->insert(std::make_pair(newDist, SearchResult{index, (uint32_t) pos}));
-                    }
-                }
-                return result;
-            },
-            startSet, startChar);
-
-        treeSearchActive = true;
+    // Narrowed from there.  If the user is typing capitals, they care about them in the search!
+    if (!m_searchTerm.empty() && (m_matches.empty() || m_matches.back()->query != m_searchTerm)) {
+        m_matches.push_back(FuzzyMatch(*editor.threadPool, m_filePaths, m_matches.empty() ? nullptr : m_matches.back(), m_searchTerm, MaxResults));
     }
 
-    ShowTreeResult();
+    ShowResults();
     editor.RequestRefresh();
 }
 
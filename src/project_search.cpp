@@ -0,0 +1,204 @@
+#include "zep/project_search.h"
+#include "zep/filesystem.h"
+#include "zep/tab_window.h"
+#include "zep/threadutils.h"
+#include "zep/window.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace Zep {
+
+namespace {
+
+// A NUL in the first few KB marks a binary file, which isn't searched
+const size_t BinaryCheckSize = 8192;
+
+// Very long lines (minified files) are cut short in the results
+const size_t MaxResultText = 256;
+
+} // namespace
+
+ZepProjectSearch::ZepProjectSearch(ThreadPool &threadPool, std::shared_ptr<FileIndexResult> files, const std::string &pattern)
+    : m_files(std::move(files)), m_pattern(pattern), m_workers(threadPool, TaskPriority::Interactive) {
+    if (m_pattern.Empty()) return;
+
+    // A task per chunk, so a worker is free for other work between them
+    auto fileCount = long(m_files->paths.size());
+    for (long first = 0; first < fileCount; first += ChunkSize) {
+        m_workers.Run([this, first, fileCount]() { SearchChunk(first, std::min(fileCount, first + ChunkSize)); });
+    }
+}
+
+ZepProjectSearch::~ZepProjectSearch() {
+    m_workers.Cancel();
+    m_workers.Wait();
+}
+
+bool ZepProjectSearch::Finished() const {
+    return m_workers.Finished();
+}
+
+void ZepProjectSearch::TakeResults(std::vector<ProjectSearchResult> &results) {
+    std::lock_guard<std::mutex> lock(m_resultsMutex);
+    if (results.empty()) {
+        results.swap(m_results);
+        return;
+    }
+    results.insert(results.end(), std::make_move_iterator(m_results.begin()), std::make_move_iterator(m_results.end()));
+    m_results.clear();
+}
+
+void ZepProjectSearch::SearchChunk(long first, long last) {
+    std::vector<SearchMatch> matches;
+    std::vector<ProjectSearchResult> results;
+    for (auto file = first; file < last && !m_workers.IsCancelled(); file++) {
+        SearchFile(uint32_t(file), matches, results);
+    }
+    m_filesSearched += last - first;
+
+    if (!results.empty()) {
+        std::lock_guard<std::mutex> lock(m_resultsMutex);
+        m_resultCount += long(results.size());
+        m_results.insert(m_results.end(), std::make_move_iterator(results.begin()), std::make_move_iterator(results.end()));
+    }
+}
+
+// One result per line with a match on it, as grep lists them
+void ZepProjectSearch::SearchFile(uint32_t file, std::vector<SearchMatch> &matches, std::vector<ProjectSearchResult> &results) const {
+    auto view = ZepFileSystem::Map(m_files->root / m_files->paths[file]);
+    if (!view || view->size() == 0) return;
+
+    auto pBegin = view->begin();
+    auto pEnd = view->end();
+    if (memchr(pBegin, 0, std::min(view->size(), BinaryCheckSize))) return;
+
+    matches.clear();
+    m_pattern.Find(pBegin, pEnd, matches);
+
+    long line = 0;
+    auto pLine = pBegin;                   // The start of 'line'
+    const uint8_t *pLineEnd = nullptr;     // The end of the last line listed
+    for (auto &match: matches) {
+        auto pMatch = pBegin + match.begin;
+        if (pMatch < pLineEnd) continue;
+
+        // Count the lines up to the match
+        while (auto pNewline = (const uint8_t *) memchr(pLine, '\n', pMatch - pLine)) {
+            pLine = pNewline + 1;
+            line++;
+        }
+
+        pLineEnd = (const uint8_t *) memchr(pMatch, '\n', pEnd - pMatch);
+        if (!pLineEnd) pLineEnd = pEnd;
+
+        auto pTextEnd = pLineEnd;
+        if (pTextEnd > pLine && *(pTextEnd - 1) == '\r') pTextEnd--;
+        pTextEnd = std::min(pTextEnd, pLine + MaxResultText);
+
+        results.push_back({file, line, ByteIndex(pMatch - pLine), std::string(pLine, pTextEnd)});
+    }
+}
+
+ZepGrepExCommand::ZepGrepExCommand(ZepEditor &editor) : ZepExCommand(editor) {}
+
+void ZepGrepExCommand::Register(ZepEditor &editor) {
+    editor.RegisterExCommand(std::make_shared<ZepGrepExCommand>(editor));
+}
+
+void ZepGrepExCommand::Run(const std::vector<std::string> &tokens) {
+    // Stop the last search; its results are no use now
+    m_search.reset();
+
+    // The words of the pattern come split on spaces
+    m_pattern.clear();
+    for (size_t index = 1; index < tokens.size(); index++) {
+        if (index > 1) m_pattern += ' ';
+        m_pattern += tokens[index];
+    }
+    if (m_pattern.empty()) {
+        editor.SetCommandText("Usage: :grep <pattern>");
+        return;
+    }
+
+    // The files are listed again for each search, so new ones are found
+    auto startPath = editor.fileSystem->workingDirectory;
+    if (editor.activeTabWindow && editor.activeTabWindow->GetActiveWindow()) {
+        startPath = editor.activeTabWindow->GetActiveWindow()->buffer->filePath;
+    }
+    bool foundGit = false;
+    m_indexResult = Indexer::IndexPaths(editor, editor.fileSystem->GetSearchRoot(startPath, foundGit), TaskPriority::Interactive);
+    editor.SetCommandText("Searching for: " + m_pattern);
+}
+
+void ZepGrepExCommand::Notify(const std::shared_ptr<ZepMessage> &message) {
+    if (message->messageId != Msg::Tick) return;
+
+    if (m_indexResult.valid() && is_future_ready(m_indexResult)) {
+        auto files = m_indexResult.get();
+        if (!files->errors.empty()) {
+            editor.SetCommandText(files->errors);
+            return;
+        }
+
+        m_search = std::make_unique<ZepProjectSearch>(*editor.threadPool, files, m_pattern);
+        if (!m_search->GetPattern().GetError().empty()) {
+            editor.SetCommandText(m_search->GetPattern().GetError());
+            m_search.reset();
+            return;
+        }
+        StartSearch();
+    }
+
+    if (m_search) ShowResults();
+}
+
+bool ZepGrepExCommand::HasResultsBuffer() const {
+    return std::any_of(editor.buffers.begin(), editor.buffers.end(), [&](const auto &buffer) { return buffer.get() == m_pResultsBuffer; });
+}
+
+// Show the results in a buffer of their own, as :map does
+void ZepGrepExCommand::StartSearch() {
+    if (!HasResultsBuffer()) {
+        m_pResultsBuffer = editor.GetEmptyBuffer("Grep", FileFlags::Locked | FileFlags::ReadOnly);
+    }
+    m_pResultsBuffer->SetText("");
+
+    if (editor.activeTabWindow && editor.FindBufferWindows(m_pResultsBuffer).empty()) {
+        editor.activeTabWindow->AddWindow(m_pResultsBuffer, nullptr, RegionLayoutType::VBox);
+    }
+}
+
+// Add the results found since the last tick to the end of the buffer
+void ZepGrepExCommand::ShowResults() {
+    // Closing the results stops the search
+    if (!HasResultsBuffer()) {
+        m_search.reset();
+        return;
+    }
+
+    auto finished = m_search->Finished();
+
+    m_search->TakeResults(m_newResults);
+    if (!m_newResults.empty()) {
+        auto &files = m_search->GetFiles();
+        std::ostringstream str;
+        for (auto &result: m_newResults) {
+            str << files.paths[result.file].string() << ":" << (result.line + 1) << ":" << (result.column + 1) << ": " << result.text << '\n';
+        }
+        m_newResults.clear();
+
+        ChangeRecord changeRecord;
+        m_pResultsBuffer->Insert(m_pResultsBuffer->End(), str.str(), changeRecord);
+        editor.RequestRefresh();
+    }
+
+    std::ostringstream str;
+    str << (finished ? "Found " : "Searching: ") << m_search->ResultCount() << " lines matching " << m_pattern << " in " << m_search->FilesSearched() << " / " << m_search->GetFiles().paths.size() << " files";
+    editor.SetCommandText(str.str());
+
+    if (finished) m_search.reset();
+}
+
+} // namespace Zep
@@ -1,22 +1,233 @@
 #include "zep/range_markers.h"
 #include "zep/buffer.h"
 
+#include <algorithm>
+
 namespace Zep {
 
-RangeMarker::RangeMarker(ZepBuffer &buffer) : buffer(buffer) {
-    onPreBufferInsert = buffer.sigPreInsert.connect([=](ZepBuffer &buffer, const GlyphIterator &itrStart, const std::string &str) {
-        HandleBufferInsert(buffer, itrStart, str);
-    });
-    buffer.sigPreDelete.connect([=](ZepBuffer &buffer, const GlyphIterator &itrStart, const GlyphIterator &itrEnd) {
-        HandleBufferDelete(buffer, itrStart, itrEnd);
-    });
+struct RangeMarkerNode {
+    std::shared_ptr<RangeMarker> marker;
+    ByteIndex first = 0;
+    ByteIndex second = 0;
+    ByteIndex maxSecond = 0; // The furthest end in this subtree
+    ByteIndex shift = 0;     // Still to be added to everything below
+    uint32_t priority = 0;
+    RangeMarkerNode *pLeft = nullptr;
+    RangeMarkerNode *pRight = nullptr;
+    RangeMarkerNode *pParent = nullptr;
+};
+
+namespace {
+
+using Node = RangeMarkerNode;
+
+void Shift(Node *pNode, ByteIndex distance) {
+    if (!pNode) return;
+    pNode->first += distance;
+    pNode->second += distance;
+    pNode->maxSecond += distance;
+    pNode->shift += distance;
+}
+
+void PushShift(Node *pNode) {
+    if (pNode->shift == 0) return;
+    Shift(pNode->pLeft, pNode->shift);
+    Shift(pNode->pRight, pNode->shift);
+    pNode->shift = 0;
+}
+
+void Update(Node *pNode) {
+    pNode->maxSecond = pNode->second;
+    for (auto pChild: {pNode->pLeft, pNode->pRight}) {
+        if (!pChild) continue;
+        pNode->maxSecond = std::max(pNode->maxSecond, pChild->maxSecond);
+        pChild->pParent = pNode;
+    }
+}
+
+// Those starting before 'first' on the left, the rest on the right
+void Split(Node *pNode, ByteIndex first, Node *&pLeft, Node *&pRight) {
+    if (!pNode) {
+        pLeft = pRight = nullptr;
+        return;
+    }
+
+    PushShift(pNode);
+    if (pNode->first < first) {
+        Split(pNode->pRight, first, pNode->pRight, pRight);
+        pLeft = pNode;
+    } else {
+        Split(pNode->pLeft, first, pLeft, pNode->pLeft);
+        pRight = pNode;
+    }
+    Update(pNode);
+}
+
+Node *Merge(Node *pLeft, Node *pRight) {
+    if (!pLeft || !pRight) return pLeft ? pLeft : pRight;
+
+    if (pLeft->priority > pRight->priority) {
+        PushShift(pLeft);
+        pLeft->pRight = Merge(pLeft->pRight, pRight);
+        Update(pLeft);
+        return pLeft;
+    }
+    PushShift(pRight);
+    pRight->pLeft = Merge(pLeft, pRight->pLeft);
+    Update(pRight);
+    return pRight;
+}
+
+// The markers before 'shiftFrom' which reach 'start'
+void FindOverlapping(Node *pNode, ByteIndex start, ByteIndex shiftFrom, std::vector<Node *> &found) {
+    if (!pNode || pNode->maxSecond < start) return;
+
+    PushShift(pNode);
+    FindOverlapping(pNode->pLeft, start, shiftFrom, found);
+    if (pNode->first >= shiftFrom) return;
+    if (pNode->second >= start) found.push_back(pNode);
+    FindOverlapping(pNode->pRight, start, shiftFrom, found);
+}
+
+bool Visit(const Node *pNode, ByteIndex shift, ByteIndex first, ByteIndex last, const std::function<bool(const std::shared_ptr<RangeMarker> &, const ByteRange &)> &fn) {
+    // A marker covers up to the char before its end, and an empty one at 0 covers that
+    if (!pNode || std::max(0l, pNode->maxSecond + shift - 1) < first) return true;
+
+    auto childShift = shift + pNode->shift;
+    if (!Visit(pNode->pLeft, childShift, first, last, fn)) return false;
+
+    ByteRange range(pNode->first + shift, pNode->second + shift);
+    if (range.first > last) return true;
+    if (std::max(0l, range.second - 1) >= first && !fn(pNode->marker, range)) return false;
+
+    return Visit(pNode->pRight, childShift, first, last, fn);
+}
+
+bool VisitReverse(const Node *pNode, const std::function<bool(const std::shared_ptr<RangeMarker> &)> &fn) {
+    if (!pNode) return true;
+    return VisitReverse(pNode->pRight, fn) && fn(pNode->marker) && VisitReverse(pNode->pLeft, fn);
+}
+
+} // namespace
+
+RangeMarkerTree::~RangeMarkerTree() {
+    std::vector<std::pair<Node *, ByteIndex>> nodes;
+    if (m_pRoot) nodes.emplace_back(m_pRoot, 0);
+    while (!nodes.empty()) {
+        auto [pNode, shift] = nodes.back();
+        nodes.pop_back();
+        for (auto pChild: {pNode->pLeft, pNode->pRight}) {
+            if (pChild) nodes.emplace_back(pChild, shift + pNode->shift);
+        }
+        pNode->marker->m_range = ByteRange(pNode->first + shift, pNode->second + shift);
+        pNode->marker->m_pNode = nullptr;
+        delete pNode;
+    }
+}
+
+ByteRange RangeMarkerTree::GetRange(const RangeMarkerNode &node) {
+    ByteIndex shift = 0;
+    for (auto pParent = node.pParent; pParent; pParent = pParent->pParent) shift += pParent->shift;
+    return ByteRange(node.first + shift, node.second + shift);
+}
+
+void RangeMarkerTree::Insert(const std::shared_ptr<RangeMarker> &marker) {
+    if (marker->m_pNode) Erase(*marker);
+
+    auto pNode = new Node();
+    pNode->marker = marker;
+    pNode->first = marker->m_range.first;
+    pNode->second = pNode->maxSecond = marker->m_range.second;
+
+    // xorshift; only the balance of the tree depends on it
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    pNode->priority = m_random;
+
+    // After any which start at the same place
+    Node *pLeft, *pRight;
+    Split(m_pRoot, marker->m_range.first + 1, pLeft, pRight);
+    m_pRoot = Merge(Merge(pLeft, pNode), pRight);
+    m_pRoot->pParent = nullptr;
+
+    marker->m_pNode = pNode;
+    m_size++;
+}
+
+void RangeMarkerTree::Erase(RangeMarker &marker) {
+    auto pNode = marker.m_pNode;
+    if (!pNode) return;
+
+    // Bring the shifts above down to the node, so it and its children are where they should be
+    std::vector<Node *> path;
+    for (auto pParent = pNode; pParent; pParent = pParent->pParent) path.push_back(pParent);
+    for (auto itr = path.rbegin(); itr != path.rend(); itr++) PushShift(*itr);
+
+    auto pChild = Merge(pNode->pLeft, pNode->pRight);
+    auto pParent = pNode->pParent;
+    if (pChild) pChild->pParent = pParent;
+    if (!pParent) {
+        m_pRoot = pChild;
+    } else {
+        (pParent->pLeft == pNode ? pParent->pLeft : pParent->pRight) = pChild;
+        for (; pParent; pParent = pParent->pParent) Update(pParent);
+    }
+
+    marker.m_range = ByteRange(pNode->first, pNode->second);
+    marker.m_pNode = nullptr;
+    delete pNode;
+    m_size--;
+}
+
+void RangeMarkerTree::Edit(ByteIndex start, ByteIndex shiftFrom, ByteIndex distance, std::vector<std::shared_ptr<RangeMarker>> &removed) {
+    std::vector<Node *> nodes;
+    FindOverlapping(m_pRoot, start, shiftFrom, nodes);
+    for (auto pNode: nodes) {
+        auto marker = pNode->marker;
+        Erase(*marker);
+        removed.push_back(marker);
+    }
+
+    if (distance == 0) return;
+
+    // Move each node on the way down which starts after the edit, and the whole of its right side
+    nodes.clear();
+    for (auto pNode = m_pRoot; pNode;) {
+        PushShift(pNode);
+        nodes.push_back(pNode);
+        if (pNode->first >= shiftFrom) {
+            pNode->first += distance;
+            pNode->second += distance;
+            Shift(pNode->pRight, distance);
+            pNode = pNode->pLeft;
+        } else {
+            pNode = pNode->pRight;
+        }
+    }
+    for (auto itr = nodes.rbegin(); itr != nodes.rend(); itr++) Update(*itr);
+}
+
+void RangeMarkerTree::ForEach(ByteIndex first, ByteIndex last, const std::function<bool(const std::shared_ptr<RangeMarker> &, const ByteRange &)> &fn) const {
+    Visit(m_pRoot, 0, first, last, fn);
+}
+
+void RangeMarkerTree::ForEachReverse(const std::function<bool(const std::shared_ptr<RangeMarker> &)> &fn) const {
+    VisitReverse(m_pRoot, fn);
+}
+
+RangeMarker::RangeMarker(ZepBuffer &buffer) : buffer(buffer) {}
+
+ByteRange RangeMarker::GetRange() const {
+    return m_pNode ? RangeMarkerTree::GetRange(*m_pNode) : m_range;
 }
 
 bool RangeMarker::ContainsLocation(const GlyphIterator &loc) const {
-    return range.ContainsLocation(loc.index);
+    return GetRange().ContainsLocation(loc.index);
 }
 
 bool RangeMarker::IntersectsRange(const ByteRange &i) const {
+    auto range = GetRange();
     return i.first < range.second && i.second > range.first;
 }
 
@@ -34,44 +245,8 @@ void RangeMarker::SetRange(ByteRange newRange) {
     auto marker = shared_from_this();
     buffer.ClearRangeMarker(marker);
 
-    range = newRange;
+    m_range = newRange;
     buffer.AddRangeMarker(marker);
 }
 
-// By Default Markers will:
-// - Move down if text is inserted before them.
-// - Move up if text is deleted before them.
-// - Remove themselves from the buffer if text is edited _inside_ them.
-// Derived markers can modify this behavior.
-// It's up to marker owners to update this behavior if necessary.
-// Markers do not act inside the undo/redo system.  They live on the buffer but are not stored with it.  They are adornments that 
-// must be managed externally.
-void RangeMarker::HandleBufferInsert(ZepBuffer &buf, const GlyphIterator &itrStart, const std::string &str) {
-    if (!enabled || itrStart.index > range.second) return;
-
-    auto itrEnd = itrStart + long(str.size());
-    if (itrEnd.index <= (range.first + 1)) {
-        auto distance = itrEnd.index - itrStart.index;
-        auto currentRange = range;
-        SetRange(ByteRange(currentRange.first + distance, currentRange.second + distance));
-    } else {
-        buf.ClearRangeMarker(shared_from_this());
-        enabled = false;
-    }
-}
-
-void RangeMarker::HandleBufferDelete(ZepBuffer &buf, const GlyphIterator &itrStart, const GlyphIterator &itrEnd) {
-    if (!enabled || itrStart.index > range.second) return;
-
-    // It's OK to move on the first char; since that is like a shove
-    if (itrEnd.index < (range.first + 1)) {
-        auto distance = std::min(itrEnd.index, range.first) - itrStart.index;
-        auto currentRange = range;
-        SetRange(ByteRange(currentRange.first - distance, currentRange.second - distance));
-    } else {
-        buf.ClearRangeMarker(shared_from_this());
-        enabled = false;
-    }
-}
-
 }; // namespace Zep
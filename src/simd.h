@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// The widest vector instructions the build can count on, for the text scanners
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ZEP_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ZEP_SIMD_SSE2
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Zep {
+
+// The index of the lowest set bit of a match mask, which must not be 0
+inline int LowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+} // namespace Zep
@@ -0,0 +1,423 @@
+#include "zep/symbol_index.h"
+#include "zep/logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+
+namespace Zep {
+
+namespace {
+
+// A NUL in the first few KB marks a binary file, which has no words
+const size_t BinaryCheckSize = 8192;
+
+const size_t MinWordLength = 2;
+const size_t MaxWordLength = 128;
+
+const uint32_t NoWord = 0xffffffff;
+
+enum CharClass : uint8_t {
+    Other,
+    WordStart, // Letters and '_'
+    Digit
+};
+
+const CharClass *GetCharClasses() {
+    static CharClass classes[256] = {};
+    static bool init = [&]() {
+        for (int ch = 'a'; ch <= 'z'; ch++) classes[ch] = classes[ch - 'a' + 'A'] = WordStart;
+        classes[uint8_t('_')] = WordStart;
+        for (int ch = '0'; ch <= '9'; ch++) classes[ch] = Digit;
+        return true;
+    }();
+    (void) init;
+    return classes;
+}
+
+// The word after one of these is the name of something being defined
+bool IsDefinitionKeyword(std::string_view word) {
+    static const std::string_view keywords[] = {"class", "def", "define", "defmacro", "defun", "enum", "fn", "func", "function", "interface", "namespace", "struct", "trait", "typedef", "union"};
+    return std::binary_search(std::begin(keywords), std::end(keywords), word);
+}
+
+// These come before a '(' without defining anything
+bool IsControlKeyword(std::string_view word) {
+    static const std::string_view keywords[] = {"catch", "defined", "for", "if", "return", "sizeof", "switch", "while"};
+    return std::binary_search(std::begin(keywords), std::end(keywords), word);
+}
+
+uint32_t ReadVarint(const uint8_t *&p, const uint8_t *pEnd) {
+    uint32_t value = 0;
+    for (int shift = 0; p < pEnd && shift < 32; shift += 7) {
+        auto byte = *p++;
+        value |= uint32_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) break;
+    }
+    return value;
+}
+
+void WriteVarint(std::string &out, uint32_t value) {
+    while (value >= 0x80) {
+        out += char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+struct WordLine {
+    uint32_t word;
+    uint32_t line;
+};
+
+// Each word is stored once, however many files hold it.  Words of the last index are used where they lie
+struct WordTable {
+    uint32_t Intern(std::string_view word, bool copy) {
+        auto itr = ids.find(word);
+        if (itr != ids.end()) return itr->second;
+
+        if (copy) word = Store(word);
+        auto id = uint32_t(words.size());
+        words.push_back(word);
+        ids.emplace(word, id);
+        return id;
+    }
+
+    std::string_view Store(std::string_view word) {
+        if (chunks.empty() || chunks.back().capacity() - chunks.back().size() < word.size()) {
+            chunks.emplace_back();
+            chunks.back().reserve(std::max(size_t(1 << 20), word.size()));
+        }
+        auto &chunk = chunks.back();
+        auto start = chunk.size();
+        chunk.append(word);
+        return {chunk.data() + start, word.size()};
+    }
+
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<std::string_view> words;
+    std::deque<std::string> chunks; // Never grown past their capacity, so the words don't move
+};
+
+struct FileWords {
+    uint32_t path = 0;
+    int64_t modified = 0;
+    int64_t size = 0;
+    std::vector<uint32_t> words;
+    std::vector<WordLine> definitions;
+};
+
+void Tokenize(const uint8_t *pBegin, const uint8_t *pEnd, WordTable &table, FileWords &file) {
+    auto classes = GetCharClasses();
+    uint32_t line = 0;
+    bool lineStart = true;
+    bool indented = false;
+    bool afterKeyword = false;
+    for (auto p = pBegin; p < pEnd;) {
+        auto ch = *p;
+        if (ch == '\n') {
+            line++;
+            lineStart = true;
+            indented = false;
+            p++;
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\r') {
+            if (lineStart) indented = true;
+            lineStart = false;
+            p++;
+            continue;
+        }
+        lineStart = false;
+
+        if (classes[ch] != WordStart) {
+            // Numbers are skipped whole, so 0x1f isn't a word
+            if (classes[ch] == Digit) {
+                while (p < pEnd && classes[*p] != Other) p++;
+            } else {
+                p++;
+            }
+            afterKeyword = false;
+            continue;
+        }
+
+        auto pWord = p;
+        while (p < pEnd && classes[*p] != Other) p++;
+        std::string_view word((const char *) pWord, size_t(p - pWord));
+
+        auto keyword = IsDefinitionKeyword(word);
+        if (word.size() >= MinWordLength && word.size() <= MaxWordLength) {
+            auto id = table.Intern(word, true);
+            file.words.push_back(id);
+
+            bool definition = afterKeyword && !keyword;
+            if (!definition && !indented && !IsControlKeyword(word)) {
+                auto pNext = p;
+                while (pNext < pEnd && (*pNext == ' ' || *pNext == '\t')) pNext++;
+                definition = pNext < pEnd && *pNext == '(';
+            }
+            if (definition) file.definitions.push_back({id, line});
+        }
+        afterKeyword = keyword;
+    }
+}
+
+} // namespace
+
+std::shared_ptr<ZepSymbolIndex> ZepSymbolIndex::Load(const ZepPath &indexPath) {
+    if (!ZepFileSystem::Exists(indexPath)) return nullptr;
+
+    auto index = std::make_shared<ZepSymbolIndex>();
+    index->m_view = ZepFileSystem::Map(indexPath);
+    if (!index->m_view) return nullptr;
+
+    index->m_pData = index->m_view->begin();
+    index->m_size = index->m_view->size();
+    if (!index->Validate()) {
+        ZLOG(INFO, "Symbol index is damaged or out of date: " << indexPath.string());
+        return nullptr;
+    }
+    return index;
+}
+
+// Check the tables only point inside the block, so a damaged index can't be read past its end
+bool ZepSymbolIndex::Validate() const {
+    if (m_size < sizeof(Header)) return false;
+
+    auto &header = GetHeader();
+    if (header.magic != Magic || header.version != Version) return false;
+
+    auto tablesSize = sizeof(Header) + uint64_t(header.fileCount) * sizeof(FileEntry) + uint64_t(header.wordCount) * sizeof(WordEntry) + uint64_t(header.definitionCount) * sizeof(Definition);
+    if (tablesSize + header.stringsSize + header.fileWordsSize != m_size) return false;
+
+    auto pFiles = GetFiles();
+    for (uint32_t file = 0; file < header.fileCount; file++) {
+        auto &entry = pFiles[file];
+        if (uint64_t(entry.pathOffset) + entry.pathLength > header.stringsSize) return false;
+        if (entry.wordsOffset > header.fileWordsSize || entry.wordCount > header.fileWordsSize - entry.wordsOffset) return false;
+    }
+
+    auto pWords = GetWords();
+    for (uint32_t word = 0; word < header.wordCount; word++) {
+        auto &entry = pWords[word];
+        if (uint64_t(entry.offset) + entry.length > header.stringsSize) return false;
+        if (uint64_t(entry.firstDefinition) + entry.definitionCount > header.definitionCount) return false;
+    }
+
+    auto pDefinitions = GetDefinitions();
+    for (uint32_t definition = 0; definition < header.definitionCount; definition++) {
+        if (pDefinitions[definition].file >= header.fileCount) return false;
+    }
+    return true;
+}
+
+std::shared_ptr<ZepSymbolIndex> ZepSymbolIndex::Build(const ZepPath &root, const std::vector<ZepPath> &paths, const ZepSymbolIndex *pPrevious) {
+    auto index = std::make_shared<ZepSymbolIndex>();
+
+    // The files of the last index, and their definitions
+    std::unordered_map<std::string_view, uint32_t> previousFiles;
+    std::vector<std::vector<WordLine>> previousDefinitions;
+    std::vector<uint32_t> previousWordIds;
+    if (pPrevious) {
+        auto &header = pPrevious->GetHeader();
+        auto pFiles = pPrevious->GetFiles();
+        for (uint32_t file = 0; file < header.fileCount; file++) {
+            previousFiles.emplace(std::string_view(pPrevious->GetStrings() + pFiles[file].pathOffset, pFiles[file].pathLength), file);
+        }
+
+        previousDefinitions.resize(header.fileCount);
+        auto pWords = pPrevious->GetWords();
+        for (uint32_t word = 0; word < header.wordCount; word++) {
+            for (uint32_t definition = 0; definition < pWords[word].definitionCount; definition++) {
+                auto &entry = pPrevious->GetDefinitions()[pWords[word].firstDefinition + definition];
+                previousDefinitions[entry.file].push_back({word, entry.line});
+            }
+        }
+        previousWordIds.resize(header.wordCount, NoWord);
+    }
+
+    // Words of the last index are only added to the table if a file still uses them
+    WordTable table;
+    auto previousWord = [&](uint32_t word) {
+        if (previousWordIds[word] == NoWord) {
+            auto &entry = pPrevious->GetWords()[word];
+            previousWordIds[word] = table.Intern(std::string_view(pPrevious->GetStrings() + entry.offset, entry.length), false);
+        }
+        return previousWordIds[word];
+    };
+
+    std::vector<FileWords> files;
+    files.reserve(paths.size());
+    for (uint32_t path = 0; path < uint32_t(paths.size()); path++) {
+        FileWords file;
+        file.path = path;
+
+        auto fullPath = root / paths[path];
+        if (!ZepFileSystem::GetFileStamp(fullPath, file.modified, file.size)) continue;
+
+        auto pathString = paths[path].string();
+        auto itrPrevious = previousFiles.find(pathString);
+        auto *pEntry = itrPrevious != previousFiles.end() ? &pPrevious->GetFiles()[itrPrevious->second] : nullptr;
+        if (pEntry && pEntry->modified == file.modified && pEntry->size == file.size) {
+            auto p = pPrevious->GetFileWords() + pEntry->wordsOffset;
+            auto pEnd = pPrevious->GetFileWords() + pPrevious->GetHeader().fileWordsSize;
+            uint32_t word = 0;
+            for (uint64_t count = 0; count < pEntry->wordCount; count++) {
+                word += ReadVarint(p, pEnd);
+                if (word >= previousWordIds.size()) break;
+                file.words.push_back(previousWord(word));
+            }
+            for (auto &definition: previousDefinitions[itrPrevious->second]) {
+                file.definitions.push_back({previousWord(definition.word), definition.line});
+            }
+        } else {
+            auto view = ZepFileSystem::Map(fullPath);
+            if (view && !memchr(view->begin(), 0, std::min(view->size(), BinaryCheckSize))) {
+                Tokenize(view->begin(), view->end(), table, file);
+            }
+            index->m_filesRead++;
+        }
+        files.push_back(std::move(file));
+    }
+
+    // Number the words in order, so they can be looked up by a binary search
+    auto wordCount = uint32_t(table.words.size());
+    std::vector<uint32_t> order(wordCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return table.words[a] < table.words[b]; });
+    std::vector<uint32_t> rank(wordCount);
+    for (uint32_t word = 0; word < wordCount; word++) rank[order[word]] = word;
+
+    // The definitions of each word go together, in file order
+    std::vector<uint32_t> firstDefinition(wordCount + 1, 0);
+    for (auto &file: files) {
+        for (auto &definition: file.definitions) firstDefinition[rank[definition.word] + 1]++;
+    }
+    std::partial_sum(firstDefinition.begin(), firstDefinition.end(), firstDefinition.begin());
+    auto definitionCount = firstDefinition[wordCount];
+
+    std::vector<Definition> definitions(definitionCount);
+    auto nextDefinition = firstDefinition;
+    for (uint32_t file = 0; file < uint32_t(files.size()); file++) {
+        for (auto &definition: files[file].definitions) {
+            definitions[nextDefinition[rank[definition.word]]++] = {file, definition.line};
+        }
+    }
+
+    // The paths, then the words
+    std::string strings;
+    std::vector<FileEntry> fileEntries(files.size());
+    for (size_t file = 0; file < files.size(); file++) {
+        auto path = paths[files[file].path].string();
+        fileEntries[file].pathOffset = uint32_t(strings.size());
+        fileEntries[file].pathLength = uint32_t(path.size());
+        strings += path;
+    }
+
+    std::vector<WordEntry> wordEntries(wordCount);
+    for (uint32_t word = 0; word < wordCount; word++) {
+        auto &text = table.words[order[word]];
+        wordEntries[word] = {uint32_t(strings.size()), uint32_t(text.size()), firstDefinition[word], firstDefinition[word + 1] - firstDefinition[word]};
+        strings.append(text.data(), text.size());
+    }
+
+    std::string fileWords;
+    for (size_t file = 0; file < files.size(); file++) {
+        auto &words = files[file].words;
+        for (auto &word: words) word = rank[word];
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+
+        auto &entry = fileEntries[file];
+        entry.modified = files[file].modified;
+        entry.size = files[file].size;
+        entry.wordsOffset = fileWords.size();
+        entry.wordCount = words.size();
+
+        uint32_t last = 0;
+        for (auto word: words) {
+            WriteVarint(fileWords, word - last);
+            last = word;
+        }
+    }
+
+    Header header{};
+    header.magic = Magic;
+    header.version = Version;
+    header.fileCount = uint32_t(fileEntries.size());
+    header.wordCount = wordCount;
+    header.definitionCount = definitionCount;
+    header.stringsSize = strings.size();
+    header.fileWordsSize = fileWords.size();
+
+    auto size = sizeof(Header) + fileEntries.size() * sizeof(FileEntry) + wordEntries.size() * sizeof(WordEntry) + definitions.size() * sizeof(Definition) + strings.size() + fileWords.size();
+    index->m_image.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+
+    auto pOut = (uint8_t *) index->m_image.data();
+    auto append = [&](const void *pData, size_t bytes) {
+        if (bytes) memcpy(pOut, pData, bytes);
+        pOut += bytes;
+    };
+    append(&header, sizeof(Header));
+    append(fileEntries.data(), fileEntries.size() * sizeof(FileEntry));
+    append(wordEntries.data(), wordEntries.size() * sizeof(WordEntry));
+    append(definitions.data(), definitions.size() * sizeof(Definition));
+    append(strings.data(), strings.size());
+    append(fileWords.data(), fileWords.size());
+
+    index->m_pData = (const uint8_t *) index->m_image.data();
+    index->m_size = size;
+    return index;
+}
+
+bool ZepSymbolIndex::Write(const ZepPath &indexPath) const {
+    return ZepFileSystem::Write(indexPath, m_pData, m_size);
+}
+
+ZepPath ZepSymbolIndex::GetFilePath(long file) const {
+    auto &entry = GetFiles()[file];
+    return ZepPath(std::string(GetStrings() + entry.pathOffset, entry.pathLength));
+}
+
+std::string ZepSymbolIndex::GetWord(uint32_t word) const {
+    auto &entry = GetWords()[word];
+    return std::string(GetStrings() + entry.offset, entry.length);
+}
+
+std::vector<SymbolLocation> ZepSymbolIndex::FindDefinitions(const std::string &word) const {
+    auto pWords = GetWords();
+    auto pWordsEnd = pWords + GetHeader().wordCount;
+    auto itr = std::lower_bound(pWords, pWordsEnd, std::string_view(word), [&](const WordEntry &entry, std::string_view value) {
+        return std::string_view(GetStrings() + entry.offset, entry.length) < value;
+    });
+
+    std::vector<SymbolLocation> locations;
+    if (itr == pWordsEnd || std::string_view(GetStrings() + itr->offset, itr->length) != word) return locations;
+
+    for (uint32_t definition = 0; definition < itr->definitionCount; definition++) {
+        auto &entry = GetDefinitions()[itr->firstDefinition + definition];
+        locations.push_back({GetFilePath(entry.file), long(entry.line)});
+    }
+    return locations;
+}
+
+std::vector<std::string> ZepSymbolIndex::Complete(const std::string &prefix, size_t maxWords) const {
+    auto pWords = GetWords();
+    auto pWordsEnd = pWords + GetHeader().wordCount;
+    auto itr = std::lower_bound(pWords, pWordsEnd, std::string_view(prefix), [&](const WordEntry &entry, std::string_view value) {
+        return std::string_view(GetStrings() + entry.offset, entry.length) < value;
+    });
+
+    std::vector<std::string> words;
+    for (; itr != pWordsEnd && words.size() < maxWords; itr++) {
+        std::string_view word(GetStrings() + itr->offset, itr->length);
+        if (word.compare(0, prefix.size(), prefix) != 0) break;
+        words.emplace_back(word);
+    }
+    return words;
+}
+
+} // namespace Zep
@@ -1,18 +1,178 @@
 #include "zep/syntax.h"
 #include "zep/editor.h"
 #include "zep/syntax_rainbow_brackets.h"
+#include "zep/text_scan.h"
 #include "zep/theme.h"
 
 #include "zep/stringutils.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 namespace Zep {
 
+ByteIndex SyntaxRuns::RunStart(long run) const {
+    if (run >= RunCount()) return m_size;
+    return m_runs[run].start + (run >= m_stepRun ? m_stepBytes : 0);
+}
+
+// The run containing this byte, or the last run
+long SyntaxRuns::FindRun(ByteIndex index) const {
+    auto count = RunCount();
+    if (count == 0) return 0;
+
+    if (m_lastRun < count && RunStart(m_lastRun) <= index) {
+        if (index < RunStart(m_lastRun + 1)) return m_lastRun;
+        if (m_lastRun + 1 < count && index < RunStart(m_lastRun + 2)) return ++m_lastRun;
+    }
+
+    long low = 0;
+    long high = count - 1;
+    while (low < high) {
+        auto mid = (low + high + 1) / 2;
+        if (RunStart(mid) <= index) low = mid;
+        else high = mid - 1;
+    }
+    m_lastRun = low;
+    return low;
+}
+
+// Move the step to this run, adding or removing it from the runs it passes over
+void SyntaxRuns::MoveStep(long run) {
+    if (m_stepBytes != 0) {
+        for (; m_stepRun < run; m_stepRun++) m_runs[m_stepRun].start += m_stepBytes;
+        for (; m_stepRun > run; m_stepRun--) m_runs[m_stepRun - 1].start -= m_stepBytes;
+    }
+    m_stepRun = run;
+}
+
+void SyntaxRuns::InsertRun(long run, ByteIndex start, const SyntaxData &data) {
+    if (run < m_stepRun) m_stepRun++;
+    else start -= m_stepBytes;
+
+    SyntaxRun newRun{start, data};
+    m_runs.insert(m_runs.begin() + run, &newRun, &newRun + 1);
+}
+
+void SyntaxRuns::EraseRuns(long first, long last) {
+    if (first >= last) return;
+    if (m_stepRun > first) m_stepRun = std::max(first, m_stepRun - (last - first));
+    m_runs.erase(m_runs.begin() + first, m_runs.begin() + last);
+}
+
+// Make sure a run begins at this byte
+void SyntaxRuns::SplitAt(ByteIndex index) {
+    if (index <= 0 || index >= m_size) return;
+
+    auto run = FindRun(index);
+    if (RunStart(run) != index) InsertRun(run + 1, index, m_runs[run].data);
+}
+
+void SyntaxRuns::Resize(ByteIndex size) {
+    if (size > m_size) Insert(m_size, size - m_size);
+    else if (size < m_size) Erase(size, m_size);
+}
+
+void SyntaxRuns::Insert(ByteIndex index, ByteIndex count) {
+    if (count <= 0) return;
+
+    if (m_size == 0) {
+        m_runs.clear();
+        m_stepRun = 0;
+        m_stepBytes = 0;
+        m_lastRun = 0;
+        m_size = count;
+        InsertRun(0, 0, SyntaxData{});
+        return;
+    }
+
+    // Every run starting at or after the insert moves along; the first run always starts at 0
+    auto run = FindRun(index);
+    auto shiftRun = (RunStart(run) >= index && run > 0) ? run : run + 1;
+    if (shiftRun < RunCount()) {
+        MoveStep(shiftRun);
+        m_stepBytes += count;
+    }
+
+    m_size += count;
+    Fill(index, index + count, SyntaxData{});
+}
+
+void SyntaxRuns::Erase(ByteIndex begin, ByteIndex end) {
+    begin = std::max(ByteIndex(0), begin);
+    end = std::min(m_size, end);
+    if (begin >= end) return;
+
+    if (begin == 0 && end == m_size) {
+        m_runs.clear();
+        m_stepRun = 0;
+        m_stepBytes = 0;
+        m_lastRun = 0;
+        m_size = 0;
+        return;
+    }
+
+    // Remove the runs covering the range, then close the gap
+    SplitAt(begin);
+    SplitAt(end);
+    auto first = FindRun(begin);
+    auto last = end >= m_size ? RunCount() : FindRun(end);
+    EraseRuns(first, last);
+
+    if (first < RunCount()) {
+        MoveStep(first);
+        m_stepBytes -= (end - begin);
+    }
+    m_size -= (end - begin);
+
+    if (first > 0 && first < RunCount() && m_runs[first - 1].data == m_runs[first].data) {
+        EraseRuns(first, first + 1);
+    }
+    m_lastRun = 0;
+}
+
+void SyntaxRuns::Fill(ByteIndex begin, ByteIndex end, const SyntaxData &data) {
+    begin = std::max(ByteIndex(0), begin);
+    end = std::min(m_size, end);
+    if (begin >= end) return;
+
+    SplitAt(begin);
+    SplitAt(end);
+    auto first = FindRun(begin);
+    auto last = end >= m_size ? RunCount() : FindRun(end);
+
+    // One run for the range, joined to its neighbours if they match
+    EraseRuns(first + 1, last);
+    m_runs[first].data = data;
+    if (first + 1 < RunCount() && m_runs[first + 1].data == data) {
+        EraseRuns(first + 1, first + 2);
+    }
+    if (first > 0 && m_runs[first - 1].data == data) {
+        EraseRuns(first, first + 1);
+        first--;
+    }
+    m_lastRun = first;
+}
+
+const SyntaxData &SyntaxRuns::At(ByteIndex index) const {
+    assert(index >= 0 && index < m_size);
+    return m_runs[FindRun(index)].data;
+}
+
+SyntaxRuns::const_iterator SyntaxRuns::Find(ByteIndex index) const {
+    if (index < 0 || index >= m_size) return end();
+    return {this, FindRun(index)};
+}
+
 ZepSyntax::ZepSyntax(ZepBuffer &buffer, std::unordered_set<std::string> keywords, std::unordered_set<std::string> identifiers, uint32_t flags)
-    : ZepComponent(buffer.editor), m_buffer(buffer), m_keywords(std::move(keywords)), m_identifiers(std::move(identifiers)), m_flags(flags) {
-    m_syntax.resize(m_buffer.workingBuffer.size());
+    : ZepSyntax(buffer, std::make_shared<ZepSyntaxMatcher>(keywords, identifiers, (flags & ZepSyntaxFlags::CaseInsensitive) != 0), flags) {}
+
+ZepSyntax::ZepSyntax(ZepBuffer &buffer, std::shared_ptr<const ZepSyntaxMatcher> matcher, uint32_t flags)
+    : ZepComponent(buffer.editor), m_buffer(buffer), m_matcher(std::move(matcher)), m_flags(flags) {
+    m_snapshot.assign(m_buffer.workingBuffer.begin(), m_buffer.workingBuffer.end());
+    ResetLines();
+    m_syntax.Resize(long(m_buffer.workingBuffer.size()));
     m_adornments.push_back(std::make_shared<ZepSyntaxAdorn_RainbowBrackets>(*this, m_buffer));
 }
 
@@ -23,13 +183,16 @@ ZepSyntax::~ZepSyntax() { Interrupt(); }
 SyntaxResult ZepSyntax::GetSyntaxAt(const GlyphIterator &offset) const {
     SyntaxResult result;
 
-    Wait();
-
-    if (m_processedChar < offset.index || (long) m_syntax.size() <= offset.index) return result;
+    {
+        // Text the highlighter hasn't reached yet is shown plain, rather than waiting for it
+        std::lock_guard<std::mutex> lock(m_syntaxMutex);
+        if (m_processedChar < offset.index || m_syntax.Size() <= offset.index) return result;
 
-    result.background = m_syntax[offset.index].background;
-    result.foreground = m_syntax[offset.index].foreground;
-    result.underline = m_syntax[offset.index].underline;
+        auto &data = m_syntax.At(offset.index);
+        result.background = data.background;
+        result.foreground = data.foreground;
+        result.underline = data.underline;
+    }
 
     bool found = false;
     for (auto &adorn: m_adornments) {
@@ -40,12 +203,90 @@ SyntaxResult ZepSyntax::GetSyntaxAt(const GlyphIterator &offset) const {
     return result;
 }
 
-void ZepSyntax::Wait() const { if (m_syntaxResult.valid()) m_syntaxResult.wait(); }
+SyntaxRuns::const_iterator ZepSyntax::GetSyntaxRunAt(const GlyphIterator &offset) const {
+    Wait();
+    return m_syntax.Find(offset.index);
+}
+
+SyntaxCursor::SyntaxCursor(const ZepSyntax &syntax, ByteIndex begin, ByteIndex end)
+    : m_syntax(syntax), m_begin(begin), m_end(end), m_nextAdornments(syntax.m_adornments.size(), -1) {
+    std::lock_guard<std::mutex> lock(syntax.m_syntaxMutex);
+
+    // As in GetSyntaxAt, the text past where the highlighter has reached is plain
+    m_styledEnd = std::max(begin, std::min(end, std::min(ByteIndex(syntax.m_processedChar) + 1, syntax.m_syntax.Size())));
+    auto start = begin;
+    for (auto run = syntax.m_syntax.Find(begin); start < m_styledEnd && run != syntax.m_syntax.end(); ++run) {
+        m_runs.push_back({start, run.Data()});
+        start = run.End();
+    }
+}
+
+SyntaxResult SyntaxCursor::At(const GlyphIterator &offset) {
+    auto index = offset.index;
+    if (index < m_begin || index >= m_end) return m_syntax.GetSyntaxAt(offset);
+    if (index >= m_styledEnd) return SyntaxResult{};
+
+    for (size_t adorn = 0; adorn < m_nextAdornments.size(); adorn++) {
+        auto &next = m_nextAdornments[adorn];
+        if (next < index) next = m_syntax.m_adornments[adorn]->NextAdornment(index);
+        if (next != index) continue;
+
+        bool found = false;
+        auto adornResult = m_syntax.m_adornments[adorn]->GetSyntaxAt(offset, found);
+        if (found) return adornResult;
+    }
+
+    while (m_run + 1 < m_runs.size() && m_runs[m_run + 1].start <= index) m_run++;
+
+    SyntaxResult result;
+    static_cast<SyntaxData &>(result) = m_runs[m_run].data;
+    return result;
+}
+
+void ZepSyntax::MarkSyntax(ByteIndex begin, ByteIndex end, const SyntaxData &data) {
+    if (begin >= end) return;
+
+    // Runs of the same style are filled once
+    if (!m_pendingMarks.empty() && m_pendingMarks.back().end == begin && m_pendingMarks.back().data == data) {
+        m_pendingMarks.back().end = end;
+        return;
+    }
+    m_pendingMarks.push_back({begin, end, data});
+}
+
+void ZepSyntax::PublishSyntax(ByteIndex processed, bool force) {
+    // Taking the lock for every mark would slow the renderer down; publish a chunk at a time
+    const long ChunkBytes = 64 * 1024;
+    if (!force && processed - m_processedChar < ChunkBytes) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_syntaxMutex);
+        for (auto &mark: m_pendingMarks) m_syntax.Fill(mark.begin, mark.end, mark.data);
+        m_processedChar = processed;
+    }
+    m_pendingMarks.clear();
+    editor.RequestRefresh();
+}
+
+void ZepSyntax::Wait() const {
+    if (!m_syntaxTask) return;
+
+    std::unique_lock<std::mutex> lock(m_syntaxTask->mutex);
+    m_syntaxTask->done.wait(lock, [&]() { return m_syntaxTask->finished; });
+}
 
 void ZepSyntax::Interrupt() {
-    // Stop the thread, wait for it
+    if (!m_syntaxTask) return;
+
+    // The task checks the token under this lock before it starts, so a pass still queued never will
+    auto task = std::move(m_syntaxTask);
+    std::unique_lock<std::mutex> lock(task->mutex);
+    m_syntaxToken.Cancel();
+    if (!task->started) return;
+
+    // Stop the pass, and wait for it to let go of the snapshot
     m_stop = true;
-    if (m_syntaxResult.valid()) m_syntaxResult.get();
+    task->done.wait(lock, [&]() { return task->finished; });
     m_stop = false;
 }
 
@@ -61,16 +302,112 @@ void ZepSyntax::QueueUpdateSyntax(const GlyphIterator &startLocation, const Glyp
     // Make sure the syntax buffer is big enough - adding normal syntax to the end
     // This may also 'chop'
     // TODO: Unicode? I _think_ this may be OK, but need to revisit
-    m_syntax.resize(m_buffer.workingBuffer.size(), SyntaxData{});
+    m_syntax.Resize(long(m_buffer.workingBuffer.size()));
 
     m_processedChar = std::min(long(m_processedChar), long(m_buffer.workingBuffer.size() - 1));
     m_targetChar = std::min(long(m_targetChar), long(m_buffer.workingBuffer.size() - 1));
 
     // Have the thread update the syntax in the new region
     // If the pool has no threads, this will end up serial
-    //m_syntaxResult = editor.threadPool->enqueue([=]() {
-    UpdateSyntax();
-    //});
+    m_pendingMarks.clear();
+    auto task = std::make_shared<SyntaxTask>();
+    m_syntaxTask = task;
+    m_syntaxToken = CancelToken();
+    editor.threadPool->Run([this, task, token = m_syntaxToken]() {
+        {
+            std::lock_guard<std::mutex> lock(task->mutex);
+            if (token.IsCancelled()) return;
+            task->started = true;
+        }
+
+        UpdateSyntax();
+
+        {
+            std::lock_guard<std::mutex> lock(task->mutex);
+            task->finished = true;
+        }
+        task->done.notify_all();
+    }, TaskPriority::Interactive, m_syntaxToken);
+}
+
+// Mirror a buffer edit into the snapshot, so the highlighter never reads the buffer while it is being changed.
+// Edits which don't line up with the snapshot (such as a buffer being cleared) copy the whole buffer
+void ZepSyntax::UpdateSnapshot(BufferMessageType type, ByteIndex start, ByteIndex end) {
+    const auto &buffer = m_buffer.workingBuffer;
+    auto snapshotSize = long(m_snapshot.size());
+    auto bufferSize = long(buffer.size());
+
+    // The terminator is never edited, so the line it ends is always there
+    if (start >= 0 && start <= end) {
+        if (type == BufferMessageType::TextDeleted) {
+            if (end - start == snapshotSize - bufferSize && end < snapshotSize && start < end) {
+                m_snapshot.erase(m_snapshot.begin() + start, m_snapshot.begin() + end);
+                EraseLines(start, end);
+            }
+        } else if (type == BufferMessageType::TextAdded || type == BufferMessageType::Loaded) {
+            if (end - start == bufferSize - snapshotSize && start < snapshotSize) {
+                m_snapshot.insert(m_snapshot.begin() + start, buffer.begin() + start, buffer.begin() + end);
+                InsertLines(start, end);
+            }
+        } else if (type == BufferMessageType::TextChanged) {
+            if (snapshotSize == bufferSize && end < bufferSize) {
+                std::copy(buffer.begin() + start, buffer.begin() + end, m_snapshot.begin() + start);
+
+                // The text may have gained or lost line ends
+                EraseLines(start, end);
+                InsertLines(start, end);
+            }
+        }
+    }
+
+    if (long(m_snapshot.size()) != bufferSize) {
+        m_snapshot.assign(buffer.begin(), buffer.end());
+        ResetLines();
+    }
+}
+
+// Add the lines of the text just inserted into the snapshot at [start, end).  They are lexed before their states are read
+void ZepSyntax::InsertLines(ByteIndex start, ByteIndex end) {
+    std::vector<ByteIndex> newEnds;
+    auto itrStart = m_snapshot.begin() + start;
+    for (auto itr = itrStart; itr != m_snapshot.begin() + end; itr++) {
+        if (*itr == '\n') newEnds.push_back(start + long(itr - itrStart) + 1);
+    }
+
+    auto line = m_lines.FindLine(start);
+    m_lines.Insert(start, end - start, newEnds);
+
+    std::vector<SyntaxLineState> newStates(newEnds.size());
+    m_lineStates.insert(m_lineStates.begin() + line + 1, newStates.begin(), newStates.end());
+}
+
+// Remove the lines ending in (start, end]; the line holding 'start' keeps its state
+void ZepSyntax::EraseLines(ByteIndex start, ByteIndex end) {
+    auto first = m_lines.FindLine(start);
+    auto last = m_lines.FindLine(end);
+    m_lines.Erase(start, end);
+
+    if (first != last) {
+        m_lineStates.erase(m_lineStates.begin() + first + 1, m_lineStates.begin() + last + 1);
+    }
+}
+
+// Find the lines of a new snapshot.  None of their states are known, so all of it will be lexed
+void ZepSyntax::ResetLines() {
+    std::vector<ByteIndex> ends;
+    TextScan scan;
+    ByteIndex offset = 0;
+    m_buffer.workingBuffer.ForEachSpan([&](const uint8_t *pBegin, const uint8_t *pEnd) {
+        ScanText(pBegin, pEnd, scan, offset);
+        ends.insert(ends.end(), scan.lineEnds.begin(), scan.lineEnds.end());
+        offset += ByteIndex(pEnd - pBegin);
+    });
+    if (ends.empty() || ends.back() != long(m_snapshot.size())) ends.push_back(long(m_snapshot.size()));
+
+    m_lines.Assign(ends);
+    m_lineStates.assign(ends.size(), SyntaxLineState{});
+    m_processedChar = 0;
+    m_targetChar = long(m_snapshot.size());
 }
 
 void ZepSyntax::Notify(const std::shared_ptr<ZepMessage> &msg) {
@@ -83,145 +420,192 @@ void ZepSyntax::Notify(const std::shared_ptr<ZepMessage> &msg) {
             Interrupt();
         } else if (bufferMsg->type == BufferMessageType::TextDeleted) {
             Interrupt();
-            m_syntax.erase(m_syntax.begin() + bufferMsg->startLocation.index, m_syntax.begin() + bufferMsg->endLocation.index);
+            UpdateSnapshot(bufferMsg->type, bufferMsg->startLocation.index, bufferMsg->endLocation.index);
+            m_syntax.Erase(bufferMsg->startLocation.index, bufferMsg->endLocation.index);
             QueueUpdateSyntax(bufferMsg->startLocation, bufferMsg->endLocation);
         } else if (bufferMsg->type == BufferMessageType::TextAdded || bufferMsg->type == BufferMessageType::Loaded) {
             Interrupt();
-            m_syntax.insert(m_syntax.begin() + bufferMsg->startLocation.index, ByteDistance(bufferMsg->startLocation, bufferMsg->endLocation), SyntaxData{});
+            UpdateSnapshot(bufferMsg->type, bufferMsg->startLocation.index, bufferMsg->endLocation.index);
+            m_syntax.Insert(bufferMsg->startLocation.index, ByteDistance(bufferMsg->startLocation, bufferMsg->endLocation));
             QueueUpdateSyntax(bufferMsg->startLocation, bufferMsg->endLocation);
         } else if (bufferMsg->type == BufferMessageType::TextChanged) {
             Interrupt();
+            UpdateSnapshot(bufferMsg->type, bufferMsg->startLocation.index, bufferMsg->endLocation.index);
             QueueUpdateSyntax(bufferMsg->startLocation, bufferMsg->endLocation);
         }
     }
 }
 
-// TODO: Multiline comments
+namespace {
+
+// A table of the delimiters, rather than searching a string of them for each char
+struct DelimiterTable {
+    explicit DelimiterTable(const char *pDelimiters) {
+        for (; *pDelimiters; pDelimiters++) isDelim[uint8_t(*pDelimiters)] = true;
+    }
+    bool isDelim[256] = {};
+};
+
+const DelimiterTable &GetDelimiters(bool lilike) {
+    static const DelimiterTable lispDelimiters(" \t.\n(){}[]");
+    static const DelimiterTable delimiters(" \t.\n;(){}[]=:,!");
+    return lilike ? lispDelimiters : delimiters;
+}
+
+} // namespace
+
 void ZepSyntax::UpdateSyntax() {
-    const auto &buffer = m_buffer.workingBuffer;
-    auto itrCurrent = buffer.begin() + m_processedChar;
-    auto itrEnd = buffer.begin() + m_targetChar;
+    assert(m_syntax.Size() == long(m_snapshot.size()));
+    assert(m_lines.Count() == long(m_lineStates.size()));
+
+    // Start at the beginning of the first edited line, since the state coming into it is known
+    auto line = std::min(m_lines.FindLine(m_processedChar), m_lines.Count() - 1);
+    auto targetLine = m_lines.FindLine(m_targetChar);
+    ByteIndex begin = line > 0 ? m_lines[line - 1] : 0;
+    m_processedChar = begin;
+
+    for (; line < m_lines.Count(); line++) {
+        if (m_stop == true) return;
 
-    assert(std::distance(itrCurrent, itrEnd) < int(m_syntax.size()));
-    assert(m_syntax.size() == buffer.size());
+        PublishSyntax(begin);
 
-    std::string delim;
-    std::string lineEnd("\n");
+        auto end = m_lines[line];
+        auto state = LexLine(begin, end, m_lineStates[line]);
+        begin = end;
+        if (line + 1 == m_lines.Count()) break;
 
-    delim = std::string(m_flags & ZepSyntaxFlags::Lilike ? " \t.\n(){}[]" : " \t.\n;(){}[]=:,!");
+        // Past the edit, the rest of the lines are already marked for the state they start in; unless it changed
+        if (line >= targetLine) {
+            if (m_lineStates[line + 1] == state) break;
 
-    // Walk backwards to previous delimiter
-    while (itrCurrent > buffer.begin()) {
-        if (std::find(delim.begin(), delim.end(), *itrCurrent) == delim.end()) itrCurrent--;
-        else break;
+            // An interrupted update must get at least this far next time
+            m_targetChar = std::max(long(m_targetChar), long(end));
+        }
+        m_lineStates[line + 1] = state;
     }
 
-    // Back to the previous line
-    while (itrCurrent > buffer.begin() && *itrCurrent != '\n') itrCurrent--;
-    itrEnd = buffer.find_first_of(itrEnd, buffer.end(), lineEnd.begin(), lineEnd.end());
+    // If we got here, we successfully completed
+    // Reset the target to the beginning
+    m_targetChar = long(0);
+    PublishSyntax(long(m_snapshot.size() - 1), true);
+}
 
-    // Mark a region of the syntax buffer with the correct marker
-    auto mark = [&](const GapBuffer<uint8_t>::const_iterator &itrA, const GapBuffer<uint8_t>::const_iterator &itrB, ThemeColor type, ThemeColor background) {
-        std::fill(m_syntax.begin() + (itrA - buffer.begin()), m_syntax.begin() + (itrB - buffer.begin()), SyntaxData{type, background});
+SyntaxLineState ZepSyntax::LexLine(ByteIndex begin, ByteIndex end, SyntaxLineState state) {
+    using Itr = GapBuffer<uint8_t>::const_iterator;
+    const auto &buffer = m_snapshot;
+    const bool lilike = (m_flags & ZepSyntaxFlags::Lilike) != 0;
+    const auto &isDelim = GetDelimiters(lilike).isDelim;
+
+    // The text of the line, without the line end (or the terminator)
+    auto itrCurrent = buffer.begin() + begin;
+    auto itrEnd = buffer.begin() + end;
+    if (itrEnd > itrCurrent && (*(itrEnd - 1) == '\n' || *(itrEnd - 1) == 0)) itrEnd--;
+
+    // Mark a region of the syntax buffer with the correct marker; whatever was before it since the last mark is plain text
+    auto itrMarked = itrCurrent;
+    auto mark = [&](const Itr &itrA, const Itr &itrB, ThemeColor type) {
+        MarkSyntax(long(itrMarked - buffer.begin()), long(itrA - buffer.begin()), SyntaxData{});
+        MarkSyntax(long(itrA - buffer.begin()), long(itrB - buffer.begin()), SyntaxData{type, ThemeColor::None});
+        itrMarked = itrB;
+    };
+    auto findDelim = [&](Itr itr, bool delim) {
+        while (itr != itrEnd && isDelim[*itr] != delim) itr++;
+        return itr;
     };
 
-    // Update start location
-    m_processedChar = long(itrCurrent - buffer.begin());
+    // The closing quote, or the line end
+    auto findQuote = [&](Itr itr, uint8_t quote) {
+        for (; itr < itrEnd; itr++) {
+            if (*itr == '\\' && itr + 1 < itrEnd) itr++;
+            else if (*itr == quote) break;
+        }
+        return itr;
+    };
 
-    // Walk the buffer updating information about syntax coloring
-    while (itrCurrent != itrEnd) {
-        if (m_stop == true) return;
+    static const std::string commentEnd = "*/";
+    for (;;) {
+        if (state.mode == SyntaxLexMode::BlockComment) {
+            auto itrClose = std::search(itrCurrent, itrEnd, commentEnd.begin(), commentEnd.end());
+            if (itrClose == itrEnd) {
+                mark(itrCurrent, itrEnd, ThemeColor::Comment);
+                break;
+            }
+            mark(itrCurrent, itrClose + 2, ThemeColor::Comment);
+            itrCurrent = itrClose + 2;
+            state = SyntaxLineState{};
+        } else if (state.mode == SyntaxLexMode::String) {
+            auto itrClose = findQuote(itrCurrent, state.quote);
+            if (itrClose == itrEnd) {
+                mark(itrCurrent, itrEnd, ThemeColor::String);
+
+                // Lisp strings run over lines; elsewhere only an escaped line end carries a string on
+                if (!lilike && (itrEnd == buffer.begin() + begin || *(itrEnd - 1) != '\\')) state = SyntaxLineState{};
+                break;
+            }
+            mark(itrCurrent, itrClose + 1, ThemeColor::String);
+            itrCurrent = itrClose + 1;
+            state = SyntaxLineState{};
+        }
 
         // Find a token, skipping delim <itrFirst, itrLast>
-        auto itrFirst = buffer.find_first_not_of(itrCurrent, buffer.end(), delim.begin(), delim.end());
-        if (itrFirst == buffer.end()) break;
-
-        auto itrLast = buffer.find_first_of(itrFirst, buffer.end(), delim.begin(), delim.end());
-
-        // Ensure we found a token
-        assert(itrLast >= itrFirst);
+        auto itrFirst = findDelim(itrCurrent, false);
 
         // Mark whitespace
         for (auto &itr = itrCurrent; itr < itrFirst; itr++) {
             if (*itr == ' ' || *itr == '\t') {
-                mark(itr, itr + 1, ThemeColor::Whitespace, ThemeColor::None);
+                mark(itr, itr + 1, ThemeColor::Whitespace);
             }
         }
+        if (itrFirst == itrEnd) break;
+
+        auto itrLast = findDelim(itrFirst, true);
 
-        // Do I need to make a string here?
-        auto token = std::string(itrFirst, itrLast);
-        if (m_flags & ZepSyntaxFlags::CaseInsensitive) {
-            token = string_tolower(token);
+        if (*itrFirst == '\"' || *itrFirst == '\'') {
+            state = SyntaxLineState{SyntaxLexMode::String, *itrFirst};
+            mark(itrFirst, itrFirst + 1, ThemeColor::String);
+            itrCurrent = itrFirst + 1;
+            continue;
         }
 
-        auto themeColor = m_keywords.find(token) != m_keywords.end() ?
-                          ThemeColor::Keyword :
-                          m_identifiers.find(token) != m_identifiers.end() || ((m_flags & ZepSyntaxFlags::Lilike) && token[0] == ':') ?
-                          ThemeColor::Identifier :
-                          token.find_first_not_of("0123456789") == std::string::npos ?
-                          ThemeColor::Number :
-                          token.find_first_not_of("{}()[]") == std::string::npos ?
-                          ThemeColor::Parenthesis :
-                          ThemeColor::Normal;
-        mark(itrFirst, itrLast, themeColor, ThemeColor::None);
-
-        // Find String
-        auto findString = [&](uint8_t ch) {
-            auto itrString = itrFirst;
-            if (*itrString == ch) {
-                itrString++;
-
-                while (itrString < buffer.end()) {
-                    // handle end of string
-                    if (*itrString == ch) {
-                        itrString++;
-                        mark(itrFirst, itrString, ThemeColor::String, ThemeColor::None);
-                        itrLast = itrString + 1;
-                        break;
-                    }
-
-                    if (itrString < (buffer.end() - 1)) {
-                        auto itrNext = itrString + 1;
-                        // Ignore quoted
-                        if (*itrString == '\\' && *itrNext == ch) itrString++;
-                    }
-
-                    itrString++;
-                }
-            }
-        };
-        findString('\"');
-        findString('\'');
-
-        if (m_flags & ZepSyntaxFlags::Lilike) {
-            // Lisp languages use ; or # for comments
-            std::string commentStr = ";#";
-            auto itrComment = buffer.find_first_of(itrFirst, itrLast, commentStr.begin(), commentStr.end());
-            if (itrComment != buffer.end()) {
-                itrLast = buffer.find_first_of(itrComment, buffer.end(), lineEnd.begin(), lineEnd.end());
-                mark(itrComment, itrLast, ThemeColor::Comment, ThemeColor::None);
-            }
-        } else {
-            std::string commentStr = "/";
-            auto itrComment = buffer.find_first_of(itrFirst, itrLast, commentStr.begin(), commentStr.end());
-            if (itrComment != buffer.end()) {
-                auto itrCommentStart = itrComment++;
-                if (itrComment < buffer.end()) {
-                    if (*itrComment == '/') {
-                        itrLast = buffer.find_first_of(itrCommentStart, buffer.end(), lineEnd.begin(), lineEnd.end());
-                        mark(itrCommentStart, itrLast, ThemeColor::Comment, ThemeColor::None);
-                    }
-                }
+        // A comment may start part way into the token
+        auto itrComment = itrFirst;
+        for (; itrComment < itrLast; itrComment++) {
+            if (lilike ? (*itrComment == ';' || *itrComment == '#') :
+                (*itrComment == '/' && itrComment + 1 < itrEnd && (*(itrComment + 1) == '/' || *(itrComment + 1) == '*'))) {
+                break;
             }
         }
 
-        itrCurrent = itrLast;
+        if (itrComment > itrFirst) {
+            // Classify the token in place, without copying it out
+            auto word = m_matcher->Find(itrFirst, itrComment);
+            auto themeColor = word == SyntaxWord::Keyword ?
+                              ThemeColor::Keyword :
+                              word == SyntaxWord::Identifier || (lilike && *itrFirst == ':') ?
+                              ThemeColor::Identifier :
+                              std::all_of(itrFirst, itrComment, [](uint8_t ch) { return ch >= '0' && ch <= '9'; }) ?
+                              ThemeColor::Number :
+                              std::all_of(itrFirst, itrComment, [](uint8_t ch) { return ch == '{' || ch == '}' || ch == '(' || ch == ')' || ch == '[' || ch == ']'; }) ?
+                              ThemeColor::Parenthesis :
+                              ThemeColor::Normal;
+            mark(itrFirst, itrComment, themeColor);
+        }
+
+        if (itrComment == itrLast) {
+            itrCurrent = itrLast;
+        } else if (!lilike && *(itrComment + 1) == '*') {
+            state = SyntaxLineState{SyntaxLexMode::BlockComment};
+            mark(itrComment, itrComment + 2, ThemeColor::Comment);
+            itrCurrent = itrComment + 2;
+        } else {
+            mark(itrComment, itrEnd, ThemeColor::Comment);
+            break;
+        }
     }
 
-    // If we got here, we successfully completed
-    // Reset the target to the beginning
-    m_targetChar = long(0);
-    m_processedChar = long(buffer.size() - 1);
+    // The rest of the line, and its line end
+    mark(buffer.begin() + end, buffer.begin() + end, ThemeColor::Normal);
+    return state;
 }
 
 const NVec4f &ZepSyntax::ToBackgroundColor(const SyntaxResult &res) const {
@@ -0,0 +1,51 @@
+#include "zep/syntax_matcher.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace Zep {
+
+ZepSyntaxMatcher::ZepSyntaxMatcher(const std::unordered_set<std::string> &keywords, const std::unordered_set<std::string> &identifiers, bool caseInsensitive) {
+    for (int ch = 0; ch < 256; ch++) {
+        m_fold[ch] = uint8_t(caseInsensitive && ch < 128 ? std::tolower(ch) : ch);
+    }
+
+    auto count = keywords.size() + identifiers.size();
+    if (count == 0) return;
+
+    size_t size = 4;
+    while (size < count * 2) size *= 2;
+    m_entries.resize(size);
+    m_mask = uint32_t(size - 1);
+
+    // A word in both sets is a keyword
+    for (auto &word: keywords) Add(word, SyntaxWord::Keyword);
+    for (auto &word: identifiers) Add(word, SyntaxWord::Identifier);
+}
+
+void ZepSyntaxMatcher::Add(const std::string &word, SyntaxWord type) {
+    if (word.empty()) return;
+
+    std::string folded;
+    uint32_t hash = HashSeed;
+    for (auto ch: word) {
+        folded += char(m_fold[uint8_t(ch)]);
+        hash = (hash ^ m_fold[uint8_t(ch)]) * HashPrime;
+    }
+
+    auto slot = hash & m_mask;
+    for (; m_entries[slot].word != SyntaxWord::None; slot = (slot + 1) & m_mask) {
+        auto &entry = m_entries[slot];
+        if (entry.hash == hash && m_words.compare(entry.offset, entry.length, folded) == 0) return;
+    }
+
+    auto &entry = m_entries[slot];
+    entry.hash = hash;
+    entry.offset = uint32_t(m_words.size());
+    entry.length = uint32_t(folded.size());
+    entry.word = type;
+    m_words += folded;
+    m_maxLength = std::max(m_maxLength, entry.length);
+}
+
+} // namespace Zep
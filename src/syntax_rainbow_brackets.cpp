@@ -3,13 +3,138 @@
 
 #include "zep/logger.h"
 
+#include <algorithm>
+#include <limits>
+
 // A Simple adornment to add rainbow brackets to the syntax
 namespace Zep {
 
+// The depth of each type of bracket over a run of them.  A closing bracket with nothing open is an error, and the
+// depth carries on from 0 after it, so the depth at the end of the run is the net change less the lowest it dips
+struct BracketDepths {
+    enum Type {
+        Bracket,
+        Brace,
+        Group,
+        Max
+    };
+
+    int32_t change[Max] = {};
+    int32_t lowest[Max] = {}; // Below where the run started; 0 or less
+    int32_t count[Max] = {};
+
+    // Follow this run with another
+    void Append(const BracketDepths &after) {
+        for (int type = 0; type < Max; type++) {
+            lowest[type] = std::min(lowest[type], change[type] + after.lowest[type]);
+            change[type] += after.change[type];
+            count[type] += after.count[type];
+        }
+    }
+
+    int32_t Depth(int type) const { return change[type] - lowest[type]; }
+};
+
+struct BracketNode {
+    ByteIndex offset = 0;
+    ByteIndex shift = 0; // Still to be added to everything below
+    BracketDepths::Type type = BracketDepths::Bracket;
+    bool isOpen = false;
+    uint32_t priority = 0;
+    BracketDepths depths; // Over this subtree
+    BracketNode *pLeft = nullptr;
+    BracketNode *pRight = nullptr;
+};
+
+namespace {
+
+using Node = BracketNode;
+
+// The depths over the bracket on its own
+BracketDepths NodeDepths(const Node &node) {
+    BracketDepths depths;
+    depths.change[node.type] = node.isOpen ? 1 : -1;
+    depths.lowest[node.type] = node.isOpen ? 0 : -1;
+    depths.count[node.type] = 1;
+    return depths;
+}
+
+void Shift(Node *pNode, ByteIndex distance) {
+    if (!pNode) return;
+    pNode->offset += distance;
+    pNode->shift += distance;
+}
+
+void PushShift(Node *pNode) {
+    if (pNode->shift == 0) return;
+    Shift(pNode->pLeft, pNode->shift);
+    Shift(pNode->pRight, pNode->shift);
+    pNode->shift = 0;
+}
+
+void UpdateDepths(Node *pNode) {
+    BracketDepths depths;
+    if (pNode->pLeft) depths = pNode->pLeft->depths;
+    depths.Append(NodeDepths(*pNode));
+    if (pNode->pRight) depths.Append(pNode->pRight->depths);
+    pNode->depths = depths;
+}
+
+// Those before 'offset' on the left, the rest on the right
+void Split(Node *pNode, ByteIndex offset, Node *&pLeft, Node *&pRight) {
+    if (!pNode) {
+        pLeft = pRight = nullptr;
+        return;
+    }
+
+    PushShift(pNode);
+    if (pNode->offset < offset) {
+        Split(pNode->pRight, offset, pNode->pRight, pRight);
+        pLeft = pNode;
+    } else {
+        Split(pNode->pLeft, offset, pLeft, pNode->pLeft);
+        pRight = pNode;
+    }
+    UpdateDepths(pNode);
+}
+
+Node *Merge(Node *pLeft, Node *pRight) {
+    if (!pLeft || !pRight) return pLeft ? pLeft : pRight;
+
+    if (pLeft->priority > pRight->priority) {
+        PushShift(pLeft);
+        pLeft->pRight = Merge(pLeft->pRight, pRight);
+        UpdateDepths(pLeft);
+        return pLeft;
+    }
+    PushShift(pRight);
+    pRight->pLeft = Merge(pLeft, pRight->pLeft);
+    UpdateDepths(pRight);
+    return pRight;
+}
+
+void DeleteNodes(Node *pRoot) {
+    std::vector<Node *> nodes;
+    if (pRoot) nodes.push_back(pRoot);
+    while (!nodes.empty()) {
+        auto pNode = nodes.back();
+        nodes.pop_back();
+        if (pNode->pLeft) nodes.push_back(pNode->pLeft);
+        if (pNode->pRight) nodes.push_back(pNode->pRight);
+        delete pNode;
+    }
+}
+
+} // namespace
+
 ZepSyntaxAdorn_RainbowBrackets::ZepSyntaxAdorn_RainbowBrackets(ZepSyntax &syntax, ZepBuffer &buffer) : ZepSyntaxAdorn(syntax, buffer) {
     Update(buffer.Begin(), buffer.End());
 }
 
+ZepSyntaxAdorn_RainbowBrackets::~ZepSyntaxAdorn_RainbowBrackets() {
+    DeleteNodes(m_pRoot);
+}
+
 void ZepSyntaxAdorn_RainbowBrackets::Notify(const std::shared_ptr<ZepMessage> &msg) {
     // Handle any interesting buffer messages
     if (msg->messageId == Msg::Buffer) {
@@ -30,114 +155,127 @@ void ZepSyntaxAdorn_RainbowBrackets::Notify(const std::shared_ptr<ZepMessage> &m
 
 SyntaxResult ZepSyntaxAdorn_RainbowBrackets::GetSyntaxAt(const GlyphIterator &offset, bool &found) const {
     SyntaxResult data;
-    auto itr = m_brackets.find(offset.index);
-    if (itr == m_brackets.end()) {
+
+    // Find the bracket, adding up the depths of the brackets before it on the way down
+    BracketDepths before;
+    ByteIndex shift = 0;
+    const Node *pNode = m_pRoot;
+    while (pNode && pNode->offset + shift != offset.index) {
+        auto childShift = shift + pNode->shift;
+        if (offset.index < pNode->offset + shift) {
+            pNode = pNode->pLeft;
+        } else {
+            if (pNode->pLeft) before.Append(pNode->pLeft->depths);
+            before.Append(NodeDepths(*pNode));
+            pNode = pNode->pRight;
+        }
+        shift = childShift;
+    }
+
+    if (!pNode) {
         found = false;
         return data;
     }
+    if (pNode->pLeft) before.Append(pNode->pLeft->depths);
+
+    auto type = pNode->type;
+    auto depth = before.Depth(type);
+    auto indent = pNode->isOpen ? depth : depth - 1;
+    bool valid = pNode->isOpen || depth > 0;
+
+    // Brackets left open show as an error on the first of their type
+    if (m_pRoot->depths.Depth(type) > 0 && before.count[type] == 0) valid = false;
 
     found = true;
-    if (!itr->second.valid) {
+    if (!valid) {
         data.foreground = ThemeColor::Text;
         data.background = ThemeColor::Error;
     } else {
-        data.foreground = (ThemeColor) (((int32_t) ThemeColor::UniqueColor0 + itr->second.indent) % (int32_t) ThemeColor::UniqueColorLast);
+        data.foreground = (ThemeColor) (((int32_t) ThemeColor::UniqueColor0 + indent) % (int32_t) ThemeColor::UniqueColorLast);
         data.background = ThemeColor::None;
     }
 
     return data;
 }
 
-void ZepSyntaxAdorn_RainbowBrackets::Insert(const GlyphIterator &start, const GlyphIterator &end) {
-    // Adjust all the brackets after us by the same distance
-    auto diff = ByteDistance(start, end);
-    std::map<long, Bracket> replace;
-    for (auto &b: m_brackets) {
-        if (b.first < start.index)
-            replace[b.first] = b.second;
-        else
-            replace[b.first + diff] = b.second;
+// The first bracket at or after the offset
+ByteIndex ZepSyntaxAdorn_RainbowBrackets::NextAdornment(ByteIndex offset) const {
+    auto next = std::numeric_limits<ByteIndex>::max();
+    ByteIndex shift = 0;
+    const Node *pNode = m_pRoot;
+    while (pNode) {
+        auto childShift = shift + pNode->shift;
+        if (pNode->offset + shift >= offset) {
+            next = pNode->offset + shift;
+            pNode = pNode->pLeft;
+        } else {
+            pNode = pNode->pRight;
+        }
+        shift = childShift;
     }
-    std::swap(m_brackets, replace);
+    return next;
+}
 
-    RefreshBrackets();
+void ZepSyntaxAdorn_RainbowBrackets::Insert(const GlyphIterator &start, const GlyphIterator &end) {
+    // Adjust all the brackets after us by the same distance
+    Node *pLeft, *pRight;
+    Split(m_pRoot, start.index, pLeft, pRight);
+    Shift(pRight, ByteDistance(start, end));
+    m_pRoot = Merge(pLeft, pRight);
 }
 
 void ZepSyntaxAdorn_RainbowBrackets::Clear(const GlyphIterator &start, const GlyphIterator &end) {
-    // Remove brackets in the erased section
-    // Note that we can't iterate here if the buffer has changed
-    // TODO: this should happen on a message before delete! not after!
-    auto itr = m_brackets.begin();
-    while (itr != m_brackets.end() && itr->first < start.index) itr++;
-    while (itr != m_brackets.end() && itr->first < end.index) itr = m_brackets.erase(itr);
-
-    // Adjust remaining brackets by the difference
-    auto diff = ByteDistance(start, end);
-    std::map<long, Bracket> replace;
-    for (auto &b: m_brackets) {
-        if (b.first < start.index) replace[b.first] = b.second;
-        else replace[b.first - diff] = b.second;
-    }
-    std::swap(m_brackets, replace);
-
-    RefreshBrackets();
+    // Remove brackets in the erased section, and move the ones after it back
+    Node *pLeft, *pErased, *pRight;
+    Split(m_pRoot, start.index, pLeft, pErased);
+    Split(pErased, end.index, pErased, pRight);
+    DeleteNodes(pErased);
+    Shift(pRight, -ByteDistance(start, end));
+    m_pRoot = Merge(pLeft, pRight);
 }
 
 void ZepSyntaxAdorn_RainbowBrackets::Update(const GlyphIterator &start, const GlyphIterator &end) {
-    const auto &itrStart = start;
-    const auto &itrEnd = end;
-
-    for (auto itrBracket = itrStart; itrBracket < itrEnd; itrBracket++) {
-        if (*itrBracket == '(') {
-            m_brackets[itrBracket.index] = Bracket{0, BracketType::Bracket, true};
-        } else if (*itrBracket == ')') {
-            m_brackets[itrBracket.index] = Bracket{0, BracketType::Bracket, false};
-        } else if (*itrBracket == '[') {
-            m_brackets[itrBracket.index] = Bracket{0, BracketType::Group, true};
-        } else if (*itrBracket == ']') {
-            m_brackets[itrBracket.index] = Bracket{0, BracketType::Group, false};
-        } else if (*itrBracket == '{') {
-            m_brackets[itrBracket.index] = Bracket{0, BracketType::Brace, true};
-        } else if (*itrBracket == '}') {
-            m_brackets[itrBracket.index] = Bracket{0, BracketType::Brace, false};
-        } else {
-            auto itr = m_brackets.find(itrBracket.index);
-            if (itr != std::end(m_brackets)) {
-                m_brackets.erase(itr);
-            }
-        }
-    }
-    RefreshBrackets();
-}
+    // Replace the brackets in the range with the ones in the text there now
+    Node *pLeft, *pOld, *pRight;
+    Split(m_pRoot, start.index, pLeft, pOld);
+    Split(pOld, end.index, pOld, pRight);
+    DeleteNodes(pOld);
 
-void ZepSyntaxAdorn_RainbowBrackets::RefreshBrackets() {
-    std::vector<int32_t> indents((int) BracketType::Max, 0);
-    for (auto &b: m_brackets) {
-        auto &bracket = b.second;
-        if (!bracket.is_open) {
-            indents[int(bracket.type)]--;
+    // Brackets are ASCII, which is never part of a multi-byte code point, so the bytes are checked
+    const auto &text = m_buffer.workingBuffer;
+    auto last = std::min(end.index, ByteIndex(text.size()));
+    for (auto index = std::max(0l, start.index); index < last; index++) {
+        auto type = BracketDepths::Max;
+        bool isOpen = false;
+        switch (text[index]) {
+            case '(': isOpen = true; // fallthrough
+            case ')': type = BracketDepths::Bracket;
+                break;
+            case '[': isOpen = true; // fallthrough
+            case ']': type = BracketDepths::Group;
+                break;
+            case '{': isOpen = true; // fallthrough
+            case '}': type = BracketDepths::Brace;
+                break;
+            default: continue;
         }
-        bracket.indent = indents[int(bracket.type)];
-        // Allow one bracket error, before going back to normal
-        bracket.valid = (indents[int(bracket.type)] < 0) ? false : true;
-        if (!bracket.valid) indents[int(bracket.type)] = 0;
-        if (bracket.is_open) indents[int(bracket.type)]++;
-    }
 
-    auto MarkTails = [&](auto type) {
-        if (indents[int(type)] > 0) {
-            for (auto &b: m_brackets) {
-                if (b.second.type == type) {
-                    b.second.valid = false;
-                    return;
-                }
-            }
+        auto pNode = new Node();
+        pNode->offset = index;
+        pNode->type = type;
+        pNode->isOpen = isOpen;
 
-        }
-    };
-    MarkTails(BracketType::Brace);
-    MarkTails(BracketType::Bracket);
-    MarkTails(BracketType::Group);
+        // xorshift; only the balance of the tree depends on it
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+        pNode->priority = m_random;
+
+        UpdateDepths(pNode);
+        pLeft = Merge(pLeft, pNode);
+    }
+
+    m_pRoot = Merge(pLeft, pRight);
 }
 
 } // namespace Zep
@@ -13,16 +13,16 @@ ZepSyntax_Tree::ZepSyntax_Tree(ZepBuffer &buffer, const std::unordered_set<std::
 ZepSyntax_Tree::ZepSyntax_Tree(ZepBuffer &buffer, uint32_t flags) : ZepSyntax_Tree(buffer, {}, {}, flags) {}
 
 void ZepSyntax_Tree::UpdateSyntax() {
-    const auto &buffer = m_buffer.workingBuffer;
+    const auto &buffer = m_snapshot;
     auto itrCurrent = buffer.begin();
     auto itrEnd = buffer.end();
 
-    assert(std::distance(itrCurrent, itrEnd) <= int(m_syntax.size()));
-    assert(m_syntax.size() == buffer.size());
+    assert(std::distance(itrCurrent, itrEnd) <= m_syntax.Size());
+    assert(m_syntax.Size() == long(buffer.size()));
 
     // Mark a region of the syntax buffer with the correct marker
     auto mark = [&](const GapBuffer<uint8_t>::const_iterator &itrA, const GapBuffer<uint8_t>::const_iterator &itrB, ThemeColor type, ThemeColor background) {
-        std::fill(m_syntax.begin() + (itrA - buffer.begin()), m_syntax.begin() + (itrB - buffer.begin()), SyntaxData{type, background});
+        MarkSyntax(long(itrA - buffer.begin()), long(itrB - buffer.begin()), SyntaxData{type, background});
     };
 
     // Walk backwards to previous delimiter
@@ -30,7 +30,7 @@ void ZepSyntax_Tree::UpdateSyntax() {
         if (m_stop == true) return;
 
         // Update start location
-        m_processedChar = long(itrCurrent - buffer.begin());
+        PublishSyntax(long(itrCurrent - buffer.begin()));
 
         if (*itrCurrent == '~' || *itrCurrent == '+') {
             mark(itrCurrent, itrCurrent + 1, ThemeColor::CursorNormal, ThemeColor::None);
@@ -50,7 +50,7 @@ void ZepSyntax_Tree::UpdateSyntax() {
     // If we got here, we successfully completed
     // Reset the target to the beginning
     m_targetChar = long(0);
-    m_processedChar = long(buffer.size() - 1);
+    PublishSyntax(long(buffer.size() - 1), true);
 }
 
 } // namespace Zep
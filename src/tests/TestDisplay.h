@@ -1,15 +1,42 @@
 #pragma once
 
 #include "zep/display.h"
+#include "zep/stringutils.h"
 
 using namespace Zep;
 
+// Fixed pitch font; every code point is the same size, so layout is predictable in tests
+struct TestFont : public ZepFont {
+    explicit TestFont(ZepDisplay &display, int height = 16) : ZepFont(display) { SetPixelHeight(height); }
+
+    void SetPixelHeight(int height) override {
+        InvalidateCharCache();
+        pixelHeight = height;
+    }
+
+    NVec2f GetTextSize(const uint8_t *pBegin, const uint8_t *pEnd = nullptr) const override {
+        if (pEnd == nullptr) pEnd = pBegin + strlen((const char *) pBegin);
+
+        long count = 0;
+        for (auto pCh = pBegin; pCh < pEnd; pCh += utf8_codepoint_length(*pCh)) count++;
+        return {float(count * (pixelHeight / 2)), float(pixelHeight)};
+    }
+};
+
 struct TestDisplay : public ZepDisplay {
-    TestDisplay() : ZepDisplay() {}
+    TestDisplay() : ZepDisplay() {
+        for (int i = 0; i < (int) ZepTextType::Count; i++) {
+            SetFont(ZepTextType(i), std::make_shared<TestFont>(*this));
+        }
+    }
 
-    void DrawChars(ZepFont &font, const NVec2f &pos, const NVec4f &col, const uint8_t *text_begin, const uint8_t *text_end) const override {}
+    void DrawChars(ZepFont &font, const NVec2f &pos, const NVec4f &col, const uint8_t *text_begin, const uint8_t *text_end) const override {
+        drawnText.emplace_back(text_begin, text_end ? text_end : text_begin + strlen((const char *) text_begin));
+    }
     void DrawLine(const NVec2f &start, const NVec2f &end, const NVec4f &color, float width) const override {}
     void DrawRectFilled(const NRectf &rc, const NVec4f &color) const override {}
     void SetClipRect(const NRectf &rc) override {}
     ZepFont &GetFont(ZepTextType type) override { return *fonts[(int) type]; }
+
+    mutable std::vector<std::string> drawnText; // Text of each DrawChars call
 };
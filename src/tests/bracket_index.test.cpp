@@ -0,0 +1,299 @@
+#include "zep/bracket_index.h"
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/mode_repl.h"
+#include "zep/syntax.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+using Range = std::pair<ByteIndex, ByteIndex>;
+
+// The expressions as GetExpression found them, walking the whole text; any open bracket pairs with any close
+Range ModelExpression(const std::string &text, ExpressionType expressionType, ByteIndex location) {
+    struct Expression {
+        Range range = Range(-1, -1);
+        Expression *pParent = nullptr;
+        int depth = 0;
+    };
+    std::vector<std::unique_ptr<Expression>> expressions;
+    std::vector<Expression *> topLevel;
+    Expression *pCurrent = nullptr;
+    Expression *pInner = nullptr;
+    for (ByteIndex index = 0; index < ByteIndex(text.size()); index++) {
+        if (ZepBracketIndex::IsOpen(text[index])) {
+            expressions.push_back(std::make_unique<Expression>());
+            auto pChild = expressions.back().get();
+            pChild->range.first = index;
+            pChild->pParent = pCurrent;
+            pChild->depth = pCurrent ? pCurrent->depth + 1 : 0;
+            if (!pCurrent) topLevel.push_back(pChild);
+            pCurrent = pChild;
+        } else if (ZepBracketIndex::IsClose(text[index]) && pCurrent) {
+            pCurrent->range.second = index + 1;
+            if (pCurrent->range.first <= location && pCurrent->range.second > location && (!pInner || pCurrent->depth > pInner->depth)) {
+                pInner = pCurrent;
+            }
+            pCurrent = pCurrent->pParent;
+        }
+    }
+
+    if (expressionType == ExpressionType::Inner) return pInner ? pInner->range : Range(0, 0);
+
+    Expression *pBest = nullptr;
+    auto distance = std::numeric_limits<ByteIndex>::max();
+    for (auto pOuter: topLevel) {
+        if (location >= pOuter->range.first && location < pOuter->range.second) return pOuter->range;
+        for (auto end: {pOuter->range.first, pOuter->range.second}) {
+            if (std::abs(end - location) < distance) {
+                pBest = pOuter;
+                distance = std::abs(end - location);
+            }
+        }
+    }
+    return pBest ? pBest->range : Range(0, 0);
+}
+
+// The pair of the type around the location, walking the brackets out from it; 'level' 1 is the innermost
+Range ModelEnclosing(const std::string &text, const std::vector<ByteIndex> &brackets, ByteIndex location, uint8_t ch, int level) {
+    auto type = std::string("([{").find(ch) != std::string::npos ? std::string("([{").find(ch) : std::string(")]}").find(ch);
+    auto open = "([{"[type];
+    auto close = ")]}"[type];
+    auto limit = text[location] == close ? location - 1 : location;
+
+    ByteIndex found = -1;
+    int depth = 0;
+    for (auto itr = brackets.rbegin(); itr != brackets.rend() && found == -1; itr++) {
+        if (*itr > limit) continue;
+        if (text[*itr] == close) depth++;
+        else if (text[*itr] == open && depth-- == 0 && --level == 0) found = *itr;
+        depth = std::max(depth, 0);
+    }
+    if (found == -1) return Range(-1, -1);
+
+    depth = 0;
+    for (auto offset: brackets) {
+        if (offset <= found) continue;
+        if (text[offset] == open) depth++;
+        else if (text[offset] == close && depth-- == 0) return Range(found, offset);
+    }
+    return Range(found, -1);
+}
+
+// Balanced brackets with words between them, a form to a few lines
+std::string MakeForms(std::mt19937 &random, int forms) {
+    std::string text;
+    for (int form = 0; form < forms; form++) {
+        std::string open;
+        do {
+            auto choice = random() % 6;
+            if (choice < 2) {
+                auto type = random() % 3;
+                text += "([{"[type];
+                open += ")]}"[type];
+            } else if (choice < 4) {
+                if (!open.empty()) {
+                    text += open.back();
+                    open.pop_back();
+                }
+            } else {
+                text += choice == 4 ? " word" : "\n";
+            }
+        } while (!open.empty());
+        text += "\n";
+    }
+    return text;
+}
+
+struct BracketIndexTest : public testing::Test {
+    BracketIndexTest() {
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+        pBuffer = editor->InitWithText("", "");
+    }
+
+    Range Expression(ExpressionType expressionType, ByteIndex location) {
+        auto range = pBuffer->GetExpression(expressionType, GlyphIterator(pBuffer, location), {'(', '[', '{'}, {')', ']', '}'});
+        return Range(range.first.index, range.second.index);
+    }
+
+    Range Pair(ByteIndex location, uint8_t ch) {
+        auto pair = pBuffer->FindMatchingPair(GlyphIterator(pBuffer, location), ch);
+        return Range(pair.first.Valid() ? pair.first.index : -1, pair.second.Valid() ? pair.second.index : -1);
+    }
+
+    std::shared_ptr<ZepEditor> editor;
+    ZepBuffer *pBuffer;
+};
+
+// Leaves the forms to the default checks
+struct TestReplProvider : public IZepReplProvider {
+    std::string ReplParse(ZepBuffer &, const GlyphIterator &, ReplParseType) override { return ""; }
+    std::string ReplParse(const std::string &text) override { return text; }
+};
+
+} // namespace
+
+// The index kept up with edits holds what a fresh scan of the text finds
+TEST_F(BracketIndexTest, FollowsEdits) {
+    std::mt19937 random(5);
+    std::string text;
+    for (int ch = 0; ch < 1000; ch++) text += "(){}[] a/*\"\n"[random() % 12];
+    pBuffer->SetText(text);
+
+    for (int edit = 0; edit < 400; edit++) {
+        auto size = ByteIndex(pBuffer->workingBuffer.size() - 1);
+        auto start = ByteIndex(random() % (size + 1));
+        ChangeRecord record;
+        if (random() % 2 || size < 100) {
+            std::string insert;
+            for (auto length = 1 + random() % 5; length > 0; length--) insert += "(){}[] a/*\"\n"[random() % 12];
+            pBuffer->Insert(GlyphIterator(pBuffer, start), insert, record);
+        } else {
+            auto end = std::min(size, start + ByteIndex(1 + random() % 5));
+            pBuffer->Delete(GlyphIterator(pBuffer, start), GlyphIterator(pBuffer, end), record);
+        }
+
+        // Ask for it after some of the edits, so a few run up before it is scanned
+        if (random() % 3) continue;
+        ZepBracketIndex fresh;
+        fresh.Update(pBuffer->workingBuffer, false);
+        const auto &index = pBuffer->GetBracketIndex();
+        auto brackets = index.GetBrackets();
+        ASSERT_EQ(brackets, fresh.GetBrackets());
+
+        // And finds the pairs the brackets make
+        auto current = pBuffer->workingBuffer.string();
+        for (int query = 0; query < 20; query++) {
+            auto location = ByteIndex(random() % current.size());
+            auto ch = "([{"[random() % 3];
+            auto expected = ModelEnclosing(current, brackets, location, ch, 1);
+            ASSERT_EQ(Range(index.FindEnclosing(location, ch).first, index.FindEnclosing(location, ch).second), expected);
+
+            auto outer = Range(-1, -1);
+            for (int level = 1; ModelEnclosing(current, brackets, location, ch, level).first != -1; level++) {
+                auto range = ModelEnclosing(current, brackets, location, ch, level);
+                if (range.second != -1) outer = range;
+            }
+            auto top = index.FindTopLevel(location, ch);
+            ASSERT_EQ(Range(top.first, top.second), outer);
+        }
+        for (int query = 0; query < 20 && !brackets.empty(); query++) {
+            auto offset = brackets[random() % brackets.size()];
+            auto pair = index.FindPair(offset);
+            auto range = ModelEnclosing(current, brackets, offset, current[offset], 1);
+            ASSERT_EQ(pair, ByteIndex(ZepBracketIndex::IsOpen(current[offset]) ? range.second : range.first));
+        }
+    }
+}
+
+// On code whose brackets balance, the expressions are the ones found by walking the text
+TEST_F(BracketIndexTest, MatchesExpressionWalk) {
+    std::mt19937 random(3);
+    auto text = MakeForms(random, 20);
+    pBuffer->SetText(text);
+
+    for (ByteIndex location = 0; location < ByteIndex(text.size()); location++) {
+        for (auto expressionType: {ExpressionType::Inner, ExpressionType::Outer}) {
+            auto expected = ModelExpression(text, expressionType, location);
+            ASSERT_EQ(Expression(expressionType, location), expected) << "At " << location;
+        }
+    }
+}
+
+TEST_F(BracketIndexTest, SkipsStringsAndComments) {
+    pBuffer->SetText("f(\"(\", ')', x) // )\n/* } */ g[y];");
+    ASSERT_EQ(pBuffer->GetBracketIndex().GetBrackets(), std::vector<ByteIndex>({1, 13, 29, 31}));
+    ASSERT_EQ(Pair(4, '('), Range(1, 13));
+    ASSERT_EQ(Pair(13, ')'), Range(1, 13));
+    ASSERT_EQ(Pair(30, '['), Range(29, 31));
+    ASSERT_EQ(Pair(17, '('), Range(-1, -1));
+
+    // Quotes in words are not strings, and an escaped quote doesn't end one
+    pBuffer->SetText("don't(\"\\\")\")");
+    ASSERT_EQ(Pair(6, '('), Range(5, 11));
+}
+
+TEST_F(BracketIndexTest, LispComments) {
+    pBuffer->syntax = std::make_shared<ZepSyntax>(*pBuffer, std::unordered_set<std::string>{}, std::unordered_set<std::string>{}, ZepSyntaxFlags::Lilike);
+    pBuffer->SetText("(define (f x) ; (\n  '(x \"\n)\"))");
+    ASSERT_EQ(Pair(22, '('), Range(21, 28));
+    ASSERT_EQ(Expression(ExpressionType::Outer, 21), Range(0, 30));
+    ASSERT_EQ(Expression(ExpressionType::Inner, 10), Range(8, 13));
+}
+
+// Change inside the brackets of the type asked for climbs out of the others
+TEST_F(BracketIndexTest, MatchingPairOfType) {
+    pBuffer->SetText("(a [b {c}] d)");
+    ASSERT_EQ(Pair(7, '('), Range(0, 12));
+    ASSERT_EQ(Pair(7, ']'), Range(3, 9));
+    ASSERT_EQ(Pair(7, '{'), Range(6, 8));
+    ASSERT_EQ(Pair(0, ')'), Range(0, 12));
+
+    // Each type nests on its own
+    pBuffer->SetText("(a [b) c]");
+    ASSERT_EQ(Pair(4, '('), Range(0, 5));
+    ASSERT_EQ(Pair(4, '['), Range(3, 8));
+    ASSERT_EQ(Pair(4, '{'), Range(-1, -1));
+}
+
+TEST_F(BracketIndexTest, FormDepth) {
+    ASSERT_EQ(ZepBracketIndex::FormDepth("(+ 1 2", true), 1);
+    ASSERT_EQ(ZepBracketIndex::FormDepth("(+ 2 2))", true), -1);
+    ASSERT_EQ(ZepBracketIndex::FormDepth("(print \"(\") ; (", true), 0);
+    ASSERT_EQ(ZepBracketIndex::FormDepth("(let [x 1] {", true), 2);
+}
+
+TEST_F(BracketIndexTest, ReplForms) {
+    pBuffer->SetText("(a (b))\n(c)");
+    auto range = IZepReplProvider::ReplRange(*pBuffer, GlyphIterator(pBuffer, 4), ReplParseType::SubExpression);
+    ASSERT_EQ(Range(range.first.index, range.second.index), Range(3, 6));
+    range = IZepReplProvider::ReplRange(*pBuffer, GlyphIterator(pBuffer, 4), ReplParseType::OuterExpression);
+    ASSERT_EQ(Range(range.first.index, range.second.index), Range(0, 7));
+
+    TestReplProvider provider;
+    int depth = 0;
+    ASSERT_FALSE(provider.ReplIsFormComplete("(define (f x)", depth));
+    ASSERT_EQ(depth, 1);
+    ASSERT_TRUE(provider.ReplIsFormComplete("(f \")\")", depth));
+}
+
+// Find the form around the cursor after each keystroke at the top of a long Lisp file
+TEST_F(BracketIndexTest, DISABLED_BenchmarkFormsAfterEdits) {
+    std::string text;
+    for (int line = 0; line < 50000; line++) {
+        text += line % 5 == 0 ? "(define (function-" + std::to_string(line) + " x)\n" : line % 5 == 4 ? "  (list x \"(\" 'y))\n" : "  (let ((y (* x 2))) (+ x y))\n";
+    }
+    pBuffer->syntax = std::make_shared<ZepSyntax>(*pBuffer, std::unordered_set<std::string>{}, std::unordered_set<std::string>{}, ZepSyntaxFlags::Lilike);
+    pBuffer->SetText(text);
+
+    Timer timer;
+    timer_start(timer);
+    ByteIndex found = pBuffer->FindMatchingPair(GlyphIterator(pBuffer, 0), '(').second.index;
+    std::cout << "First form: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    timer_start(timer);
+    for (int key = 0; key < 100; key++) {
+        ChangeRecord record;
+        pBuffer->Insert(GlyphIterator(pBuffer, 1), "x", record);
+        auto location = GlyphIterator(pBuffer, ByteIndex(text.size() / 2));
+        found += pBuffer->GetExpression(ExpressionType::Outer, location, {'('}, {')'}).first.index;
+        found += pBuffer->FindMatchingPair(location, '(').first.index;
+    }
+    std::cout << "Forms after 100 keys: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms (" << found << ")" << std::endl;
+
+    timer_start(timer);
+    for (ByteIndex location = 0; location < ByteIndex(text.size()); location += 997) {
+        auto cursor = GlyphIterator(pBuffer, location);
+        found += pBuffer->GetExpression(ExpressionType::Outer, cursor, {'('}, {')'}).first.index;
+        found += pBuffer->GetExpression(ExpressionType::Inner, cursor, {'('}, {')'}).first.index;
+        found += pBuffer->FindMatchingPair(cursor, '(').first.index;
+    }
+    std::cout << "Forms at " << text.size() / 997 << " places: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms (" << found << ")" << std::endl;
+}
@@ -1,7 +1,14 @@
 #include "zep/logger.h"
 #include "zep/buffer.h"
 #include "zep/editor.h"
+#include "zep/filesystem.h"
+#include "zep/stringutils.h"
+#include "zep/timer.h"
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
 
 #include "TestDisplay.h"
 
@@ -45,3 +52,195 @@ TEST_F(BufferTest, FindFirstOf) {
 //    loc = newEditor->FindFirstCharOf(loc, "H", char_index, Direction::Backward);
 //    ASSERT_TRUE(char_index == 0 && loc.Index() == 0);
 }
+
+namespace {
+
+// The line ends as a plain vector, shifted one by one on every edit
+struct VectorLineEnds {
+    std::vector<ByteIndex> ends;
+
+    void Insert(ByteIndex index, ByteIndex count, const std::vector<ByteIndex> &newEnds) {
+        auto itrLine = std::upper_bound(ends.begin(), ends.end(), index);
+        for (auto itr = itrLine; itr != ends.end(); itr++) *itr += count;
+        ends.insert(itrLine, newEnds.begin(), newEnds.end());
+    }
+
+    void Erase(ByteIndex begin, ByteIndex end) {
+        auto itrLine = std::upper_bound(ends.begin(), ends.end(), begin);
+        auto itrLastLine = std::upper_bound(itrLine, ends.end(), end);
+        for (auto itr = itrLastLine; itr != ends.end(); itr++) *itr -= (end - begin);
+        ends.erase(itrLine, itrLastLine);
+    }
+};
+
+} // namespace
+
+// Random edits on the line index match the same edits on a vector of line ends
+TEST(LineIndex, MatchesVector) {
+    std::mt19937 random(1);
+
+    LineIndex lines;
+    VectorLineEnds reference;
+    ByteIndex size = 1;
+    lines.PushBack(size);
+    reference.ends.push_back(size);
+
+    for (int i = 0; i < 5000; i++) {
+        auto a = long(random() % size);
+        auto b = long(random() % size);
+        if (a > b) std::swap(a, b);
+
+        if (random() % 2) {
+            // Insert some text, with a few line breaks in it
+            auto count = long(random() % 20) + 1;
+            std::vector<ByteIndex> newEnds;
+            for (long ch = 1; ch <= count; ch++) {
+                if (random() % 4 == 0) newEnds.push_back(a + ch);
+            }
+            lines.Insert(a, count, newEnds);
+            reference.Insert(a, count, newEnds);
+            size += count;
+        } else {
+            lines.Erase(a, b);
+            reference.Erase(a, b);
+            size -= (b - a);
+        }
+
+        ASSERT_EQ(lines.Count(), long(reference.ends.size()));
+        for (long line = 0; line < lines.Count(); line++) {
+            ASSERT_EQ(lines[line], reference.ends[line]);
+        }
+
+        auto index = long(random() % size);
+        ASSERT_EQ(lines.FindLine(index), long(std::upper_bound(reference.ends.begin(), reference.ends.end(), index) - reference.ends.begin()));
+    }
+}
+
+// Typing near the top of a big file; the vector shifts every line end below on each keystroke
+TEST(LineIndex, DISABLED_BenchmarkTypingNearTop) {
+    const long LineCount = 1000000;
+    const long LineLength = 40;
+    const int Keystrokes = 10000;
+
+    LineIndex lines;
+    VectorLineEnds reference;
+    for (long line = 1; line <= LineCount; line++) {
+        lines.PushBack(line * LineLength);
+        reference.ends.push_back(line * LineLength);
+    }
+
+    auto type = [&](auto &lineEnds) {
+        Timer timer;
+        timer_start(timer);
+        auto cursor = 10 * LineLength + 5;
+        for (int i = 0; i < Keystrokes; i++) {
+            // Every 20 keys is a return
+            std::vector<ByteIndex> newEnds;
+            if (i % 20 == 19) newEnds.push_back(cursor + 1);
+            lineEnds.Insert(cursor, 1, newEnds);
+            cursor++;
+        }
+        return timer_get_elapsed_seconds(timer) * 1000000.0 / Keystrokes;
+    };
+
+    std::cout << "vector: " << type(reference) << "us per keystroke" << std::endl;
+    std::cout << "line index: " << type(lines) << "us per keystroke" << std::endl;
+}
+
+// Loading a file (memory mapped) gives the same buffer as setting its text
+TEST(BufferLoad, MatchesSetText) {
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    auto path = ZepPath((std::filesystem::temp_directory_path() / "zep_buffer_load.txt").string());
+
+    for (std::string text: {"", "\tOne\r\n\tTwo\r\n", "No line end", "Two  spaces\n\tand a tab\n\n", "\r"}) {
+        {
+            std::ofstream file(path.string(), std::ios::binary);
+            file << text;
+        }
+
+        auto pLoaded = editor->GetEmptyBuffer("loaded.txt");
+        pLoaded->Load(path);
+        auto pSet = editor->GetEmptyBuffer("set.txt");
+        pSet->SetText(text, true);
+
+        ASSERT_EQ(pLoaded->workingBuffer.string(), pSet->workingBuffer.string());
+        ASSERT_EQ(pLoaded->fileFlags, pSet->fileFlags);
+        ASSERT_EQ(pLoaded->lineEnds.Count(), pSet->lineEnds.Count());
+        for (long line = 0; line < pLoaded->lineEnds.Count(); line++) {
+            ASSERT_EQ(pLoaded->lineEnds[line], pSet->lineEnds[line]);
+        }
+    }
+    std::filesystem::remove(path.string());
+}
+
+namespace {
+
+std::string ReadFile(const ZepPath &path) {
+    std::ifstream file(path.string(), std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+} // namespace
+
+// Saving puts back the CRs stripped on load, from either type of storage, and replaces the file
+TEST(BufferSave, RestoresCRLF) {
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    auto path = ZepPath((std::filesystem::temp_directory_path() / "zep_buffer_save.txt").string());
+
+    for (auto type: {TextStorageType::GapBuffer, TextStorageType::PieceTable}) {
+        {
+            std::ofstream file(path.string(), std::ios::binary);
+            file << "One\r\nTwo\r\nThree and some more text to be shortened";
+        }
+
+        auto pBuffer = editor->GetEmptyBuffer("save.txt");
+        pBuffer->workingBuffer.SetType(type);
+        pBuffer->Load(path);
+
+        ChangeRecord record;
+        pBuffer->Insert(GlyphIterator(pBuffer, 4), "New\n", record);
+        pBuffer->Delete(GlyphIterator(pBuffer, 17), pBuffer->End(), record);
+
+        int64_t size = 0;
+        ASSERT_TRUE(pBuffer->Save(size));
+        ASSERT_EQ(ReadFile(path), "One\r\nNew\r\nTwo\r\nThree");
+        ASSERT_EQ(size, 20);
+        ASSERT_FALSE(std::filesystem::exists(path.string() + ".zep-save"));
+    }
+    std::filesystem::remove(path.string());
+}
+
+TEST(BufferSave, DISABLED_BenchmarkSaveCRLF) {
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    auto path = ZepPath((std::filesystem::temp_directory_path() / "zep_buffer_save_benchmark.txt").string());
+
+    // The old save is quadratic, so a small file; the streaming save is timed on a large one too
+    for (auto fileSize: {1024 * 1024, 64 * 1024 * 1024}) {
+        std::string text;
+        for (int line = 0; int(text.size()) < fileSize; line++) {
+            text += "A line of text in a large file with windows line ends: " + std::to_string(line) + "\r\n";
+        }
+        auto pBuffer = editor->GetEmptyBuffer("save.txt");
+        pBuffer->SetText(text);
+        pBuffer->SetFilePath(path);
+        std::cout << text.size() / 1024 << "KB" << std::endl;
+
+        // What save used to do; a copy of the text, with the CRs put back in place
+        Timer timer;
+        if (fileSize <= 1024 * 1024) {
+            timer_start(timer);
+            auto str = pBuffer->workingBuffer.string();
+            string_replace_in_place(str, "\n", "\r\n");
+            ZepFileSystem::Write(path, str.data(), str.size() - 1);
+            std::cout << "Copy and replace: " << timer_get_elapsed_seconds(timer) << "s" << std::endl;
+        }
+
+        int64_t size = 0;
+        timer_start(timer);
+        pBuffer->Save(size);
+        std::cout << "Streaming save: " << timer_get_elapsed_seconds(timer) << "s" << std::endl;
+        ASSERT_EQ(size, int64_t(text.size()));
+    }
+
+    std::filesystem::remove(path.string());
+}
@@ -0,0 +1,222 @@
+#include "zep/buffer.h"
+#include "zep/buffer_search.h"
+#include "zep/editor.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+std::vector<SearchMatch> FindNaive(const std::string &text, const std::string &literal) {
+    std::vector<SearchMatch> matches;
+    for (auto pos = text.find(literal); pos != std::string::npos; pos = text.find(literal, pos + 1)) {
+        matches.push_back({ByteIndex(pos), ByteIndex(pos + literal.size())});
+    }
+    return matches;
+}
+
+std::vector<SearchMatch> ToVector(const SearchMatches &matches) {
+    std::vector<SearchMatch> result;
+    for (long index = 0; index < matches.Count(); index++) result.push_back(matches[index]);
+    return result;
+}
+
+void ExpectSameMatches(const std::vector<SearchMatch> &a, const std::vector<SearchMatch> &b) {
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t index = 0; index < a.size(); index++) {
+        ASSERT_EQ(a[index].begin, b[index].begin) << "match " << index;
+        ASSERT_EQ(a[index].end, b[index].end) << "match " << index;
+    }
+}
+
+} // namespace
+
+struct BufferSearchTest : public testing::Test {
+    BufferSearchTest() {
+        // The editor owns the display
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    }
+
+    std::vector<SearchMatch> Search(ZepBuffer *pBuffer, const std::string &pattern) {
+        ZepBufferSearch search(*pBuffer);
+        search.SetPattern(pattern);
+        return ToVector(search.GetMatches());
+    }
+
+    std::shared_ptr<ZepEditor> editor;
+};
+
+// The vector and skip table searches find the same matches as a naive one, overlapping ones and those at the ends included
+TEST(BufferSearch, FindLiteralMatchesNaive) {
+    std::mt19937 random(7);
+    for (int round = 0; round < 200; round++) {
+        std::string text;
+        auto size = random() % 300;
+        for (size_t i = 0; i < size; i++) text += "ab\n"[random() % 3];
+
+        std::string literal;
+        auto length = 1 + random() % 5;
+        for (size_t i = 0; i < length; i++) literal += "ab"[random() % 2];
+
+        auto expected = FindNaive(text, literal);
+        auto pText = (const uint8_t *) text.data();
+
+        std::vector<SearchMatch> found;
+        FindLiteral(pText, pText + text.size(), literal, found);
+        ExpectSameMatches(found, expected);
+
+        found.clear();
+        FindLiteralScalar(pText, pText + text.size(), literal, found);
+        ExpectSameMatches(found, expected);
+    }
+}
+
+TEST(BufferSearch, VimPatternToRegex) {
+    bool ignoreCase = false;
+    ASSERT_EQ(VimPatternToRegex("\\<foo\\>", ignoreCase), "\\bfoo\\b");
+    ASSERT_EQ(VimPatternToRegex("a\\+b\\=", ignoreCase), "a+b?");
+    ASSERT_EQ(VimPatternToRegex("f(x)|y+", ignoreCase), "f\\(x\\)\\|y\\+");
+    ASSERT_EQ(VimPatternToRegex("\\(a\\|b\\)\\{2}", ignoreCase), "(a|b){2}");
+    ASSERT_EQ(VimPatternToRegex("[]a]", ignoreCase), "[\\]a]");
+    ASSERT_FALSE(ignoreCase);
+    ASSERT_EQ(VimPatternToRegex("\\cFOO", ignoreCase), "FOO");
+    ASSERT_TRUE(ignoreCase);
+}
+
+TEST_F(BufferSearchTest, RegexMatchesOnLines) {
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->SetText("foo food\nfoo\nafoo foo\n");
+
+    ExpectSameMatches(Search(pBuffer, "\\<foo\\>"), {{0, 3}, {9, 12}, {18, 21}});
+    ExpectSameMatches(Search(pBuffer, "^foo"), {{0, 3}, {9, 12}});
+    ExpectSameMatches(Search(pBuffer, "o\\+$"), {{10, 12}, {19, 21}});
+    ExpectSameMatches(Search(pBuffer, "\\cFOOD"), {{4, 8}});
+
+    // Patterns with a literal every match holds, which is looked for first, and ones without
+    ExpectSameMatches(Search(pBuffer, "fo\\+d\\="), {{0, 3}, {4, 8}, {9, 12}, {14, 17}, {18, 21}});
+    ExpectSameMatches(Search(pBuffer, "[^]a]foo"), {{3, 7}, {17, 21}});
+    ExpectSameMatches(Search(pBuffer, "a*foo$"), {{9, 12}, {18, 21}});
+    ExpectSameMatches(Search(pBuffer, "\\(foo\\|bar\\)$"), {{9, 12}, {18, 21}});
+
+    ZepBufferSearch search(*pBuffer);
+    search.SetPattern("\\(");
+    ASSERT_FALSE(search.GetError().empty());
+    ASSERT_EQ(search.Count(), 0);
+}
+
+// There used to be a limit of 1000 matches
+TEST_F(BufferSearchTest, FindsEveryMatch) {
+    std::string text;
+    for (int line = 0; line < 5000; line++) text += "needle in a haystack " + std::to_string(line) + "\n";
+
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->SetText(text);
+    ASSERT_EQ(Search(pBuffer, "needle").size(), 5000);
+    ASSERT_EQ(Search(pBuffer, "stack [0-9]*5$").size(), 500);
+}
+
+// Edits search the changed lines again; the result is the same as a fresh search, in either type of storage
+TEST_F(BufferSearchTest, EditsMatchFreshSearch) {
+    std::mt19937 random(11);
+    for (auto type: {TextStorageType::GapBuffer, TextStorageType::PieceTable}) {
+        for (std::string pattern: {"foo", "oo", "\\<fo\\+", "o$"}) {
+            auto pBuffer = editor->GetEmptyBuffer("test.txt");
+            pBuffer->workingBuffer.SetType(type);
+            pBuffer->SetText("foo bar\nfoofoo\n\nbar foo\n");
+
+            ZepBufferSearch search(*pBuffer);
+            search.SetPattern(pattern);
+
+            ChangeRecord record;
+            for (int edit = 0; edit < 100; edit++) {
+                auto size = pBuffer->End().index;
+                if (random() % 3 != 0 || size < 2) {
+                    static const std::vector<std::string> inserts = {"f", "o", "foo", "\n", "o\nf", " ", "oo foo"};
+                    pBuffer->Insert(GlyphIterator(pBuffer, long(random() % (size + 1))), inserts[random() % inserts.size()], record);
+                } else {
+                    auto start = long(random() % size);
+                    auto end = std::min(size, start + 1 + long(random() % 4));
+                    pBuffer->Delete(GlyphIterator(pBuffer, start), GlyphIterator(pBuffer, end), record);
+                }
+                ExpectSameMatches(ToVector(search.GetMatches()), Search(pBuffer, pattern));
+            }
+        }
+    }
+}
+
+TEST_F(BufferSearchTest, FindNextWraps) {
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->SetText("ab ab ab");
+
+    ZepBufferSearch search(*pBuffer);
+    search.SetPattern("ab");
+    ASSERT_EQ(search.Count(), 3);
+    ASSERT_EQ(search.FindNext(0, Direction::Forward), 1);
+    ASSERT_EQ(search.FindNext(6, Direction::Forward), 0);
+    ASSERT_EQ(search.FindNext(3, Direction::Backward), 0);
+    ASSERT_EQ(search.FindNext(0, Direction::Backward), 2);
+    ASSERT_EQ(search.FindFirstEndingAfter(2), 1);
+
+    search.SetPattern("x");
+    ASSERT_EQ(search.FindNext(0, Direction::Forward), -1);
+}
+
+TEST_F(BufferSearchTest, DISABLED_BenchmarkSearch) {
+    std::string text;
+    for (int line = 0; text.size() < 64 * 1024 * 1024; line++) {
+        text += "2024-01-01 12:00:00 INFO worker " + std::to_string(line % 97) + " processed request " + std::to_string(line) + (line % 50 == 0 ? " ERROR timeout\n" : " ok\n");
+    }
+    auto megabytes = double(text.size()) / (1024.0 * 1024.0);
+
+    auto pBuffer = editor->GetEmptyBuffer("test.log");
+    pBuffer->SetText(text);
+
+    // What the search used to do, a Find per match up to the limit of 1000
+    std::string literal = "ERROR";
+    Timer timer;
+    timer_start(timer);
+    long found = 0;
+    for (auto start = pBuffer->Begin(); found < 1000; found++) {
+        auto match = pBuffer->Find(start, (uint8_t *) &literal[0], (uint8_t *) &literal[literal.size()]);
+        if (!match.Valid()) break;
+        start = match + 1;
+    }
+    auto seconds = timer_get_elapsed_seconds(timer);
+    std::cout << "Find loop: " << found << " matches in " << seconds * 1000.0 << "ms" << std::endl;
+
+    auto pText = (const uint8_t *) text.data();
+    std::vector<SearchMatch> matches;
+    timer_start(timer);
+    FindLiteralScalar(pText, pText + text.size(), literal, matches);
+    std::cout << "Skip table: " << matches.size() << " matches, " << megabytes / timer_get_elapsed_seconds(timer) << "MB/s" << std::endl;
+
+    matches.clear();
+    timer_start(timer);
+    FindLiteral(pText, pText + text.size(), literal, matches);
+    std::cout << "Vector: " << matches.size() << " matches, " << megabytes / timer_get_elapsed_seconds(timer) << "MB/s" << std::endl;
+
+    ZepBufferSearch search(*pBuffer);
+    timer_start(timer);
+    search.SetPattern(literal);
+    std::cout << "Buffer literal: " << search.Count() << " matches, " << megabytes / timer_get_elapsed_seconds(timer) << "MB/s" << std::endl;
+
+    timer_start(timer);
+    search.SetPattern("ERROR \\w\\+$");
+    std::cout << "Buffer regex: " << search.Count() << " matches, " << megabytes / timer_get_elapsed_seconds(timer) << "MB/s" << std::endl;
+
+    // Typing in the middle of the buffer with the search active
+    search.SetPattern(literal);
+    ChangeRecord record;
+    const int Keys = 1000;
+    auto location = pBuffer->End().index / 2;
+    timer_start(timer);
+    for (int key = 0; key < Keys; key++) {
+        pBuffer->Insert(GlyphIterator(pBuffer, location + key), key % 10 == 0 ? "E" : "x", record);
+    }
+    std::cout << "Keystroke: " << timer_get_elapsed_seconds(timer) * 1000000.0 / Keys << "us" << std::endl;
+}
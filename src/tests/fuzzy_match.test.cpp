@@ -0,0 +1,159 @@
+#include "zep/fuzzy_match.h"
+#include "zep/stringutils.h"
+#include "zep/timer.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+std::shared_ptr<FileIndexResult> MakeFiles(const std::vector<std::string> &paths) {
+    auto files = std::make_shared<FileIndexResult>();
+    for (auto &path: paths) {
+        files->paths.emplace_back(path);
+        files->lowerPaths.push_back(string_tolower(path));
+    }
+    return files;
+}
+
+int ScoreOf(const std::string &path, const std::string &query) {
+    auto lower = string_tolower(path);
+    int score = 0;
+    EXPECT_TRUE(FuzzyScore(lower.c_str(), path.c_str(), path.size(), query, score)) << path;
+    return score;
+}
+
+// Every match and the best of them, the slow way
+void MatchNaive(const FileIndexResult &files, const std::string &query, size_t maxResults, std::vector<uint32_t> &candidates, std::vector<FuzzyResult> &best) {
+    bool caseSensitive = string_tolower(query) != query;
+    for (uint32_t index = 0; index < uint32_t(files.paths.size()); index++) {
+        auto &lower = files.lowerPaths[index];
+        int score;
+        if (!FuzzyScoreScalar(caseSensitive ? files.paths[index].c_str() : lower.c_str(), files.paths[index].c_str(), lower.size(), query, score)) continue;
+        candidates.push_back(index);
+        best.push_back({index, score, uint32_t(lower.size())});
+    }
+    std::sort(best.begin(), best.end(), [](auto &a, auto &b) {
+        return a.score != b.score ? a.score > b.score : a.length != b.length ? a.length < b.length : a.index < b.index;
+    });
+    if (best.size() > maxResults) best.resize(maxResults);
+}
+
+} // namespace
+
+// The vector search finds the same matches and scores as the scalar one, for text longer and shorter than a block
+TEST(FuzzyMatch, ScoreMatchesScalar) {
+    std::mt19937 random(5);
+    for (int round = 0; round < 2000; round++) {
+        std::string text;
+        auto length = random() % 100;
+        for (size_t i = 0; i < length; i++) text += "abcAB/_."[random() % 8];
+
+        std::string query;
+        auto queryLength = 1 + random() % 4;
+        for (size_t i = 0; i < queryLength; i++) query += "abc"[random() % 3];
+
+        auto lower = string_tolower(text);
+        int score = 0, scalarScore = 0;
+        auto found = FuzzyScore(lower.c_str(), text.c_str(), text.size(), query, score);
+        ASSERT_EQ(found, FuzzyScoreScalar(lower.c_str(), text.c_str(), text.size(), query, scalarScore));
+        if (found) ASSERT_EQ(score, scalarScore);
+
+        // A match is a subsequence
+        auto pos = lower.find(query[0]);
+        for (size_t q = 1; q < query.size() && pos != std::string::npos; q++) pos = lower.find(query[q], pos + 1);
+        ASSERT_EQ(found, pos != std::string::npos) << text << " " << query;
+    }
+}
+
+TEST(FuzzyMatch, Ranks) {
+    int score;
+    ASSERT_FALSE(FuzzyScore("src/mode.cpp", "src/mode.cpp", 12, "mdx", score));
+    ASSERT_FALSE(FuzzyScore("src/mode.cpp", "src/mode.cpp", 12, "dm", score));
+
+    // Word starts, runs of chars and the file name score more
+    ASSERT_GT(ScoreOf("src/buffer.cpp", "buf"), ScoreOf("src/rebuffer.cpp", "buf"));
+    ASSERT_GT(ScoreOf("src/buffer.cpp", "buf"), ScoreOf("src/b_u_f.cpp", "buf"));
+    ASSERT_GT(ScoreOf("src/fuzzyMatch.cpp", "fm"), ScoreOf("src/fuzzymatch.cpp", "fm"));
+    ASSERT_GT(ScoreOf("other/tests.cpp", "test"), ScoreOf("tests/other.cpp", "test"));
+
+    // The shortest span is scored, not the one from the first char found
+    ASSERT_EQ(ScoreOf("axxxxxxxab", "ab"), ScoreOf("xab", "ab"));
+}
+
+// Matching over threads finds the same as the slow way, and narrowing from a shorter query the same as starting again
+TEST(FuzzyMatch, MatchesNaive) {
+    std::mt19937 random(9);
+    std::vector<std::string> paths;
+    for (int file = 0; file < 20000; file++) {
+        std::string path;
+        auto length = 3 + random() % 40;
+        for (size_t i = 0; i < length; i++) path += "abcdefgAB/_."[random() % 12];
+        paths.push_back(path);
+    }
+    auto files = MakeFiles(paths);
+
+    ThreadPool inlinePool(1);
+    ThreadPool pool(4);
+    for (auto *pPool: {&inlinePool, &pool}) {
+        std::shared_ptr<FuzzyMatches> previous;
+        for (std::string query: {"a", "ab", "abc", "abcA", "abcAd"}) {
+            std::vector<uint32_t> candidates;
+            std::vector<FuzzyResult> best;
+            MatchNaive(*files, query, 100, candidates, best);
+
+            for (auto &from: {std::shared_ptr<FuzzyMatches>(), previous}) {
+                auto matches = FuzzyMatch(*pPool, files, from, query, 100);
+                ASSERT_EQ(matches->query, query);
+                ASSERT_EQ(matches->candidates, candidates) << query;
+                ASSERT_EQ(matches->best.size(), best.size());
+                for (size_t result = 0; result < best.size(); result++) {
+                    ASSERT_EQ(matches->best[result].index, best[result].index) << query;
+                    ASSERT_EQ(matches->best[result].score, best[result].score) << query;
+                }
+                previous = matches;
+            }
+        }
+    }
+
+    // A query which doesn't start with the last one's looks at every file again
+    auto matches = FuzzyMatch(inlinePool, files, FuzzyMatch(inlinePool, files, nullptr, "gg", 10), "b", 10);
+    std::vector<uint32_t> candidates;
+    std::vector<FuzzyResult> best;
+    MatchNaive(*files, "b", 10, candidates, best);
+    ASSERT_EQ(matches->candidates, candidates);
+}
+
+TEST(FuzzyMatch, DISABLED_BenchmarkMatch) {
+    std::mt19937 random(3);
+    static const std::vector<std::string> parts = {"src", "include", "zep", "tests", "editor", "buffer", "window", "mode", "syntax", "third_party", "imgui", "lib", "util", "core"};
+    std::vector<std::string> paths;
+    for (int file = 0; file < 500000; file++) {
+        std::string path;
+        auto depth = 2 + random() % 4;
+        for (size_t part = 0; part < depth; part++) path += parts[random() % parts.size()] + "/";
+        paths.push_back(path + parts[random() % parts.size()] + std::to_string(file) + ".cpp");
+    }
+    auto files = MakeFiles(paths);
+    std::cout << files->paths.size() << " paths" << std::endl;
+
+    ThreadPool inlinePool(1);
+    ThreadPool pool;
+    std::string query = "srcwinmode12";
+    for (auto *pPool: {&inlinePool, &pool}) {
+        auto name = pPool == &inlinePool ? "one thread" : "pool";
+        Timer timer;
+        timer_start(timer);
+        std::shared_ptr<FuzzyMatches> matches;
+        for (size_t length = 1; length <= query.size(); length++) {
+            Timer keyTimer;
+            timer_start(keyTimer);
+            matches = FuzzyMatch(*pPool, files, matches, query.substr(0, length), 500);
+            std::cout << name << " '" << matches->query << "': " << matches->candidates.size() << " matches in " << timer_get_elapsed_seconds(keyTimer) * 1000.0 << "ms" << std::endl;
+        }
+        std::cout << name << ", typing the query: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+    }
+}
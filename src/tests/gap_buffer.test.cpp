@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "zep/gap_buffer.h"
+#include <vector>
 
 TEST(GapBuffer, PushPop) {
     GapBuffer<char> buffer(0, 4);
@@ -126,3 +127,18 @@ TEST(GapBuffer, Manipulations) {
     out = buffer.string(true);
     ASSERT_TRUE(out == "coHelloA really long string|4|01");
 }
+
+TEST(GapBuffer, MoveGapWideElements) {
+    GapBuffer<long> buffer;
+    std::vector<long> values{0, 10, 20, 30};
+    buffer.insert(buffer.begin(), values.begin(), values.end());
+
+    // Moving the gap left, then right, must move whole elements
+    buffer.erase(buffer.begin() + 1, buffer.begin() + 2);
+    ASSERT_EQ(buffer.size(), 3u);
+    ASSERT_EQ(buffer[1], 20);
+
+    buffer.erase(buffer.begin() + 2);
+    ASSERT_EQ(buffer[0], 0);
+    ASSERT_EQ(buffer[1], 20);
+}
@@ -0,0 +1,270 @@
+#include "zep/editor.h"
+#include "zep/file/fnmatch.h"
+#include "zep/filesystem.h"
+#include "zep/glob.h"
+#include "zep/indexer.h"
+#include "zep/stringutils.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+// A folder of files to walk, removed afterwards
+struct TestTree {
+    explicit TestTree(const std::string &name) {
+        root = std::filesystem::temp_directory_path() / name;
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+    }
+
+    ~TestTree() { std::filesystem::remove_all(root); }
+
+    void Add(const std::string &path, const std::string &text = "") {
+        auto fullPath = root / path;
+        std::filesystem::create_directories(fullPath.parent_path());
+        std::ofstream file(fullPath.string(), std::ios::binary);
+        file << text;
+    }
+
+    std::filesystem::path root;
+};
+
+std::vector<std::string> WalkAll(ThreadPool &threadPool, const TestTree &tree, const std::vector<std::string> &ignore, const std::vector<std::string> &include) {
+    FileIndexResult result;
+    ZepFileWalk walk(threadPool, ZepPath(tree.root.string()), ignore, include);
+    for (bool finished = false; !finished;) {
+        finished = walk.Finished();
+        walk.TakeFiles(result);
+    }
+    EXPECT_EQ(result.paths.size(), result.lowerPaths.size());
+
+    std::vector<std::string> paths;
+    for (auto &path: result.paths) paths.push_back(path.string());
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+} // namespace
+
+// The compiled patterns match what fnmatch does, whichever table a pattern goes into
+TEST(Indexer, GlobSetMatchesFnmatch) {
+    std::vector<std::string> patterns = {"*.cpp", "*.tar.gz", "*akefile", "**", "readme.md", "[Bb]uild/*", "**/[Oo]bj/**", "src/?.h", "a\\*b", "*.[ch]"};
+    std::mt19937 random(3);
+    for (auto &pattern: patterns) {
+        ZepGlobSet glob({pattern});
+        for (int round = 0; round < 2000; round++) {
+            std::string path;
+            auto parts = 1 + random() % 3;
+            for (size_t part = 0; part < parts; part++) {
+                static const std::vector<std::string> names = {"src", "build", "Build", "obj", "a", "b.h", "x.cpp", "f.tar.gz", "gz", "Makefile", "readme.md", "c", "a*b", "t.c"};
+                path += (part ? "/" : "") + names[random() % names.size()];
+            }
+            ASSERT_EQ(glob.Match(path), fnmatch(pattern.c_str(), path.c_str(), 0) == 0) << pattern << " " << path;
+
+            // Everything below a directory which is said to match all below it does
+            if (glob.MatchesAllBelow(path)) {
+                ASSERT_EQ(fnmatch(pattern.c_str(), (path + "/x/y.cpp").c_str(), 0), 0) << pattern << " " << path;
+            }
+        }
+    }
+
+    ZepGlobSet set(patterns);
+    ASSERT_TRUE(set.Match("anything"));
+    ASSERT_TRUE(ZepGlobSet({"build/*"}).MatchesAllBelow("build"));
+    ASSERT_TRUE(ZepGlobSet({"**/[Oo]bj/**"}).MatchesAllBelow("src/Obj"));
+    ASSERT_FALSE(ZepGlobSet({"*.cpp"}).MatchesAllBelow("src"));
+    ASSERT_TRUE(ZepGlobSet().Empty());
+}
+
+// The walk finds the included files, doesn't go into ignored directories, and gives the same list from one thread or many
+TEST(Indexer, WalkFindsFiles) {
+    TestTree tree("zep_indexer_walk");
+    for (int dir = 0; dir < 20; dir++) {
+        for (int file = 0; file < 10; file++) {
+            tree.Add("d" + std::to_string(dir) + "/sub/f" + std::to_string(file) + ".cpp");
+        }
+    }
+    tree.Add("a.h");
+    tree.Add("notes.txt");
+    tree.Add("build/out.cpp");
+    tree.Add("src/obj/gen.cpp");
+
+    std::vector<std::string> ignore = {"[Bb]uild/*", "**/[Oo]bj/**"};
+    std::vector<std::string> include = {"*.cpp", "*.h"};
+
+    ThreadPool inlinePool(1);
+    ThreadPool pool(4);
+    for (auto *pPool: {&inlinePool, &pool}) {
+        auto paths = WalkAll(*pPool, tree, ignore, include);
+        ASSERT_EQ(paths.size(), 201);
+        ASSERT_EQ(paths[0], "a.h");
+        ASSERT_EQ(paths[1], "d0/sub/f0.cpp");
+        ASSERT_EQ(std::count(paths.begin(), paths.end(), "notes.txt"), 0);
+        ASSERT_EQ(std::count(paths.begin(), paths.end(), "build/out.cpp"), 0);
+        ASSERT_EQ(std::count(paths.begin(), paths.end(), "src/obj/gen.cpp"), 0);
+    }
+
+    // IndexPaths gives them all at once, in order
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    auto files = Indexer::IndexPaths(*editor, ZepPath(tree.root.string())).get();
+    ASSERT_EQ(files->root.string(), tree.root.string());
+    ASSERT_EQ(files->paths.size(), 201);
+    ASSERT_TRUE(std::is_sorted(files->paths.begin(), files->paths.end(), [](auto &a, auto &b) { return a.string() < b.string(); }));
+    ASSERT_EQ(files->lowerPaths[0], "a.h");
+}
+
+TEST(Indexer, GlobMatchPath) {
+    ASSERT_TRUE(GlobMatchPath("*.cpp", "a.cpp"));
+    ASSERT_FALSE(GlobMatchPath("*.cpp", "src/a.cpp"));
+    ASSERT_TRUE(GlobMatchPath("src/?.h", "src/a.h"));
+    ASSERT_FALSE(GlobMatchPath("src?a.h", "src/a.h"));
+    ASSERT_TRUE(GlobMatchPath("[!a-c]x", "dx"));
+    ASSERT_FALSE(GlobMatchPath("[!a-c]x", "bx"));
+    ASSERT_TRUE(GlobMatchPath("[]]", "]"));
+    ASSERT_TRUE(GlobMatchPath("\\*", "*"));
+    ASSERT_FALSE(GlobMatchPath("\\*", "a"));
+
+    ASSERT_TRUE(GlobMatchPath("**/foo", "foo"));
+    ASSERT_TRUE(GlobMatchPath("**/foo", "a/b/foo"));
+    ASSERT_FALSE(GlobMatchPath("**/foo", "a/xfoo"));
+    ASSERT_TRUE(GlobMatchPath("a/**/b", "a/b"));
+    ASSERT_TRUE(GlobMatchPath("a/**/b", "a/x/y/b"));
+    ASSERT_TRUE(GlobMatchPath("a/**", "a/x/y"));
+    ASSERT_FALSE(GlobMatchPath("a/**", "a"));
+    ASSERT_TRUE(GlobMatchPath("a**b", "axxb"));
+    ASSERT_FALSE(GlobMatchPath("a**b", "a/b"));
+}
+
+TEST(Indexer, IgnoreRules) {
+    ZepIgnoreRules rules;
+    rules.Add("# comment\n\n*.o\nbuild/\n/out\ndocs/*.md\n!keep.o\n\\#hash\nspace\\ \ntrailing   \n");
+
+    using Result = ZepIgnoreRules::Result;
+    ASSERT_EQ(rules.Match("a.o", "a.o", false), Result::Ignored);
+    ASSERT_EQ(rules.Match("src/a.o", "a.o", false), Result::Ignored);
+    ASSERT_EQ(rules.Match("src/keep.o", "keep.o", false), Result::Kept);
+    ASSERT_EQ(rules.Match("src/build", "build", true), Result::Ignored);
+    ASSERT_EQ(rules.Match("src/build", "build", false), Result::None);
+    ASSERT_EQ(rules.Match("out", "out", true), Result::Ignored);
+    ASSERT_EQ(rules.Match("src/out", "out", true), Result::None);
+    ASSERT_EQ(rules.Match("docs/a.md", "a.md", false), Result::Ignored);
+    ASSERT_EQ(rules.Match("docs/sub/a.md", "a.md", false), Result::None);
+    ASSERT_EQ(rules.Match("#hash", "#hash", false), Result::Ignored);
+    ASSERT_EQ(rules.Match("space ", "space ", false), Result::Ignored);
+    ASSERT_EQ(rules.Match("trailing", "trailing", false), Result::Ignored);
+    ASSERT_EQ(rules.Match("a.cpp", "a.cpp", false), Result::None);
+}
+
+// Ignore files prune the walk where they are, and those further down override them
+TEST(Indexer, WalkHonorsIgnoreFiles) {
+    TestTree tree("zep_indexer_ignore");
+    tree.Add(".gitignore", "node_modules/\n*.gen.cpp\n/out\n");
+    tree.Add(".ignore", "docs/\n");
+    tree.Add(".git/info/exclude", "secret.cpp\n");
+    tree.Add(".git/hooks/hook.cpp");
+    tree.Add("main.cpp");
+    tree.Add("secret.cpp");
+    tree.Add("a.gen.cpp");
+    tree.Add("node_modules/lib/index.cpp");
+    tree.Add("out/result.cpp");
+    tree.Add("docs/example.cpp");
+    tree.Add("src/out/kept.cpp");
+    tree.Add("src/node_modules/lib.cpp");
+    tree.Add("src/b.gen.cpp");
+    tree.Add("src/sub/.gitignore", "!*.gen.cpp\n");
+    tree.Add("src/sub/c.gen.cpp");
+
+    ThreadPool pool(4);
+    auto paths = WalkAll(pool, tree, {}, {"*.cpp"});
+    ASSERT_EQ(paths, std::vector<std::string>({"main.cpp", "src/out/kept.cpp", "src/sub/c.gen.cpp"}));
+}
+
+TEST(Indexer, DISABLED_BenchmarkWalk) {
+    TestTree tree("zep_indexer_benchmark");
+    const int FileCount = 20000;
+    for (int file = 0; file < FileCount; file++) {
+        auto dir = "dir" + std::to_string(file % 100) + "/sub" + std::to_string(file % 7) + "/";
+        tree.Add(dir + "f" + std::to_string(file) + ".cpp");
+        tree.Add("build/" + dir + "f" + std::to_string(file) + ".o");
+    }
+    std::cout << FileCount * 2 << " files" << std::endl;
+
+    std::vector<std::string> ignore = {"[Bb]uild/*", "**/[Oo]bj/**", "**/[Bb]in/**", "[Bb]uilt*"};
+    std::vector<std::string> include = {"*.cpp", "*.c", "*.hpp", "*.h", "*.lsp", "*.scm", "*.cs", "*.cfg"};
+    auto root = ZepPath(tree.root.string());
+
+    // What the indexer did: one walk of everything, with each path made canonical and relative, and matched pattern by pattern
+    Timer timer;
+    timer_start(timer);
+    std::vector<ZepPath> found;
+    ZepFileSystem::ScanDirectory(root, [&](const ZepPath &p, bool &recurse) -> bool {
+        recurse = true;
+        auto bDir = ZepFileSystem::IsDirectory(p);
+        auto rel = path_get_relative(root, ZepFileSystem::Canonical(p));
+        for (auto &pattern: ignore) {
+            if (fnmatch(pattern.c_str(), rel.string().c_str(), 0) == 0) return true;
+        }
+        bool matched = false;
+        for (auto &pattern: include) {
+            if (fnmatch(pattern.c_str(), rel.string().c_str(), 0) == 0) {
+                matched = true;
+                break;
+            }
+        }
+        if (matched && !bDir) found.push_back(rel);
+        return true;
+    });
+    std::cout << "Old walk: " << found.size() << " files in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    ThreadPool inlinePool(1);
+    ThreadPool pool;
+    for (auto *pPool: {&inlinePool, &pool}) {
+        timer_start(timer);
+        FileIndexResult result;
+        ZepFileWalk walk(*pPool, root, ignore, include);
+        double firstBatch = 0.0;
+        for (bool finished = false; !finished;) {
+            finished = walk.Finished();
+            if (walk.TakeFiles(result) && firstBatch == 0.0) firstBatch = timer_get_elapsed_seconds(timer);
+        }
+        std::cout << (pPool == &inlinePool ? "Walk, one thread: " : "Walk, pool: ") << result.paths.size() << " files in " << timer_get_elapsed_seconds(timer) * 1000.0
+                  << "ms, first batch at " << firstBatch * 1000.0 << "ms" << std::endl;
+    }
+}
+
+// A project with its dependencies and generated code below it, which its .gitignore leaves out
+TEST(Indexer, DISABLED_BenchmarkIgnoreFiles) {
+    TestTree tree("zep_indexer_ignore_benchmark");
+    const int SourceFiles = 5000;
+    const int ModuleFiles = 100000;
+    for (int file = 0; file < SourceFiles; file++) {
+        tree.Add("src/dir" + std::to_string(file % 50) + "/f" + std::to_string(file) + ".cpp");
+        tree.Add("src/dir" + std::to_string(file % 50) + "/f" + std::to_string(file) + ".gen.cpp");
+    }
+    for (int file = 0; file < ModuleFiles; file++) {
+        tree.Add("web/node_modules/pkg" + std::to_string(file % 1000) + "/lib/m" + std::to_string(file) + ".h");
+    }
+    std::cout << SourceFiles * 2 + ModuleFiles << " files" << std::endl;
+
+    std::vector<std::string> include = {"*.cpp", "*.c", "*.hpp", "*.h"};
+    for (bool ignoreFile: {false, true}) {
+        if (ignoreFile) {
+            tree.Add(".gitignore", "node_modules/\n");
+            tree.Add("src/.gitignore", "*.gen.cpp\n");
+        }
+
+        ThreadPool pool;
+        Timer timer;
+        timer_start(timer);
+        auto paths = WalkAll(pool, tree, {}, include);
+        std::cout << (ignoreFile ? "With" : "Without") << " .gitignore: " << paths.size() << " files in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+    }
+}
@@ -0,0 +1,163 @@
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/filesystem.h"
+#include "zep/project_search.h"
+#include "zep/stringutils.h"
+#include "zep/tab_window.h"
+#include "zep/timer.h"
+#include "zep/window.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace Zep;
+
+namespace {
+
+// A folder of files to search, removed afterwards
+struct TestProject {
+    explicit TestProject(const std::string &name) {
+        root = std::filesystem::temp_directory_path() / name;
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+        files = std::make_shared<FileIndexResult>();
+        files->root = ZepPath(root.string());
+    }
+
+    ~TestProject() { std::filesystem::remove_all(root); }
+
+    void Add(const std::string &path, const std::string &text) {
+        auto fullPath = root / path;
+        std::filesystem::create_directories(fullPath.parent_path());
+        std::ofstream file(fullPath.string(), std::ios::binary);
+        file << text;
+        files->paths.emplace_back(path);
+        files->lowerPaths.push_back(path);
+    }
+
+    std::filesystem::path root;
+    std::shared_ptr<FileIndexResult> files;
+};
+
+std::vector<ProjectSearchResult> SearchAll(ThreadPool &threadPool, const std::shared_ptr<FileIndexResult> &files, const std::string &pattern) {
+    std::vector<ProjectSearchResult> results;
+    {
+        ZepProjectSearch search(threadPool, files, pattern);
+        while (!search.Finished()) std::this_thread::yield();
+        search.TakeResults(results);
+        EXPECT_EQ(long(results.size()), search.ResultCount());
+        EXPECT_EQ(search.FilesSearched(), long(files->paths.size()));
+    }
+
+    // The chunks finish in any order
+    std::sort(results.begin(), results.end(), [](auto &a, auto &b) { return a.file != b.file ? a.file < b.file : a.line < b.line; });
+    return results;
+}
+
+} // namespace
+
+// Every line with a match is found, once, from one thread or many
+TEST(ProjectSearch, FindsMatchingLines) {
+    TestProject project("zep_project_search");
+    project.Add("a.cpp", "foo\nbar foo foo\r\nbaz");
+    project.Add("b.bin", std::string("foo\0foo", 7));
+    for (int file = 0; file < 200; file++) {
+        std::string text;
+        for (int line = 0; line < 20; line++) text += (line == file % 20 ? "  call(foo);\n" : "  other();\n");
+        project.Add("dir/f" + std::to_string(file) + ".cpp", text);
+    }
+
+    ThreadPool inlinePool(1);
+    ThreadPool pool(4);
+    for (auto *pPool: {&inlinePool, &pool}) {
+        auto results = SearchAll(*pPool, project.files, "foo");
+        ASSERT_EQ(results.size(), 202);
+
+        // The binary file is skipped; the CR is left off the text
+        ASSERT_EQ(results[0].file, 0);
+        ASSERT_EQ(results[0].line, 0);
+        ASSERT_EQ(results[1].line, 1);
+        ASSERT_EQ(results[1].column, 4);
+        ASSERT_EQ(results[1].text, "bar foo foo");
+        for (uint32_t file = 0; file < 200; file++) {
+            auto &result = results[file + 2];
+            ASSERT_EQ(result.file, file + 2);
+            ASSERT_EQ(result.line, long(file % 20));
+            ASSERT_EQ(result.column, 7);
+        }
+
+        results = SearchAll(*pPool, project.files, "^ba.$");
+        ASSERT_EQ(results.size(), 1);
+        ASSERT_EQ(results[0].line, 2);
+    }
+}
+
+// Destroying a search stops it
+TEST(ProjectSearch, Cancels) {
+    TestProject project("zep_project_search_cancel");
+    for (int file = 0; file < 1000; file++) project.Add("f" + std::to_string(file) + ".cpp", "match\n");
+
+    ThreadPool pool(2);
+    auto search = std::make_unique<ZepProjectSearch>(pool, project.files, "match");
+    search->Cancel();
+    search.reset();
+}
+
+// :grep lists the results in a buffer
+TEST(ProjectSearch, GrepCommand) {
+    TestProject project("zep_project_grep");
+    project.Add("a.cpp", "int foo;\n");
+    project.Add("sub/b.h", "void foo();\nint bar;\n");
+
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    auto pBuffer = editor->InitWithText("test.cpp", "");
+    pBuffer->SetFilePath(ZepPath((project.root / "a.cpp").string()));
+
+    auto pGrep = editor->FindExCommand("grep");
+    ASSERT_NE(pGrep, nullptr);
+    pGrep->Run({":grep", "foo"});
+    editor->Broadcast(std::make_shared<ZepMessage>(Msg::Tick));
+
+    auto pResults = editor->activeTabWindow->GetActiveWindow()->buffer;
+    ASSERT_EQ(pResults->name, "Grep");
+    auto text = pResults->workingBuffer.string();
+    ASSERT_NE(text.find("a.cpp:1:5: int foo;\n"), std::string::npos);
+    ASSERT_NE(text.find(":1:6: void foo();\n"), std::string::npos);
+    ASSERT_EQ(text.find("bar"), std::string::npos);
+}
+
+TEST(ProjectSearch, DISABLED_BenchmarkSearch) {
+    TestProject project("zep_project_search_benchmark");
+    const int FileCount = 20000;
+    std::string text;
+    for (int line = 0; line < 100; line++) text += "    auto value = compute(input, " + std::to_string(line) + "); // a typical source line\n";
+    for (int file = 0; file < FileCount; file++) {
+        project.Add("dir" + std::to_string(file % 100) + "/f" + std::to_string(file) + ".cpp", text + (file % 100 == 0 ? "needle\n" : ""));
+    }
+    auto megabytes = double(text.size()) * FileCount / (1024.0 * 1024.0);
+    std::cout << FileCount << " files, " << megabytes << "MB" << std::endl;
+
+    // What the indexer did with each file
+    Timer timer;
+    timer_start(timer);
+    for (auto &path: project.files->paths) {
+        auto strFile = ZepFileSystem::Read(project.files->root / path);
+        std::vector<std::string> tokens;
+        string_split(strFile, ";()[] \t\n\r&!\"\'*:,<>", tokens);
+    }
+    std::cout << "Read and tokenize, one thread: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    ThreadPool inlinePool(1);
+    ThreadPool pool;
+    for (auto *pPool: {&inlinePool, &pool}) {
+        auto name = pPool == &inlinePool ? "one thread" : "pool";
+        for (std::string pattern: {"needle", "need\\w\\+$"}) {
+            timer_start(timer);
+            auto results = SearchAll(*pPool, project.files, pattern);
+            std::cout << "Search " << pattern << ", " << name << ": " << results.size() << " lines in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,260 @@
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/range_markers.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+// The markers moved one by one, as each did for itself on every edit
+struct MarkerModel {
+    ByteRange range;
+    bool inBuffer = true;
+};
+
+void ModelInsert(std::vector<MarkerModel> &models, ByteIndex start, ByteIndex length) {
+    for (auto &model: models) {
+        if (!model.inBuffer || start > model.range.second) continue;
+        if (start + length <= model.range.first + 1) {
+            model.range = ByteRange(model.range.first + length, model.range.second + length);
+        } else {
+            model.inBuffer = false;
+        }
+    }
+}
+
+void ModelDelete(std::vector<MarkerModel> &models, ByteIndex start, ByteIndex end) {
+    for (auto &model: models) {
+        if (!model.inBuffer || start > model.range.second) continue;
+        if (end < model.range.first + 1) {
+            model.range = ByteRange(model.range.first - (end - start), model.range.second - (end - start));
+        } else {
+            model.inBuffer = false;
+        }
+    }
+}
+
+struct MarkerMessages : public ZepComponent {
+    using ZepComponent::ZepComponent;
+
+    void Notify(const std::shared_ptr<ZepMessage> &message) override {
+        if (message->messageId != Msg::Buffer) return;
+        auto pMsg = std::static_pointer_cast<BufferMessage>(message);
+        if (pMsg->type == BufferMessageType::MarkersChanged) {
+            count++;
+            last = ByteRange(pMsg->startLocation.index, pMsg->endLocation.index);
+        }
+    }
+
+    int count = 0;
+    ByteRange last;
+};
+
+struct RangeMarkerTest : public testing::Test {
+    RangeMarkerTest() {
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+        pBuffer = editor->InitWithText("", "");
+    }
+
+    std::shared_ptr<RangeMarker> AddMarker(ByteIndex first, ByteIndex second, uint32_t displayType = RangeMarkerDisplayType::All) {
+        auto marker = std::make_shared<RangeMarker>(*pBuffer);
+        marker->displayType = displayType;
+        marker->SetRange(ByteRange(first, second));
+        return marker;
+    }
+
+    std::shared_ptr<ZepEditor> editor;
+    ZepBuffer *pBuffer;
+};
+
+} // namespace
+
+// The tree moves and removes the markers as they moved and removed themselves, and finds the same ones on each line
+TEST_F(RangeMarkerTest, MovesWithEdits) {
+    std::mt19937 random(11);
+    std::string text;
+    for (int ch = 0; ch < 2000; ch++) text += "abcdef \n"[random() % 8];
+    pBuffer->SetText(text);
+
+    std::vector<std::shared_ptr<RangeMarker>> markers;
+    std::vector<MarkerModel> models;
+    auto addRandom = [&]() {
+        auto first = ByteIndex(random() % (pBuffer->workingBuffer.size() - 1));
+        auto second = std::min(first + ByteIndex(random() % 20), ByteIndex(pBuffer->workingBuffer.size() - 1));
+        markers.push_back(AddMarker(first, second));
+        models.push_back({ByteRange(first, second)});
+    };
+    for (int marker = 0; marker < 300; marker++) addRandom();
+
+    for (int edit = 0; edit < 2000; edit++) {
+        auto size = ByteIndex(pBuffer->workingBuffer.size() - 1);
+        ChangeRecord record;
+        if (random() % 2 || size < 100) {
+            auto start = ByteIndex(random() % (size + 1));
+            auto length = ByteIndex(1 + random() % 5);
+            ModelInsert(models, start, length);
+            pBuffer->Insert(GlyphIterator(pBuffer, start), std::string(length, "xy\n"[random() % 3]), record);
+        } else {
+            auto start = ByteIndex(random() % size);
+            auto end = std::min(size, start + ByteIndex(1 + random() % 5));
+            ModelDelete(models, start, end);
+            pBuffer->Delete(GlyphIterator(pBuffer, start), GlyphIterator(pBuffer, end), record);
+        }
+        if (edit % 10 == 0) addRandom();
+
+        for (size_t marker = 0; marker < markers.size(); marker++) {
+            ASSERT_EQ(markers[marker]->InBuffer(), models[marker].inBuffer) << edit << " " << marker;
+            if (!models[marker].inBuffer) continue;
+            ASSERT_EQ(markers[marker]->GetRange().first, models[marker].range.first) << edit << " " << marker;
+            ASSERT_EQ(markers[marker]->GetRange().second, models[marker].range.second) << edit << " " << marker;
+        }
+
+        if (edit % 50 == 0) {
+            auto markersOnLines = pBuffer->GetRangeMarkersOnLines(RangeMarkerType::All, 0, pBuffer->lineEnds.Count() - 1);
+            for (long line = 0; line < pBuffer->lineEnds.Count(); line++) {
+                ByteRange lineRange;
+                pBuffer->GetLineOffsets(line, lineRange);
+
+                std::multiset<std::pair<ByteIndex, RangeMarker *>> expected;
+                for (size_t marker = 0; marker < markers.size(); marker++) {
+                    auto &range = models[marker].range;
+                    if (models[marker].inBuffer && range.first <= lineRange.second - 1 && lineRange.first <= std::max(0l, range.second - 1)) {
+                        expected.insert({range.first, markers[marker].get()});
+                    }
+                }
+
+                std::multiset<std::pair<ByteIndex, RangeMarker *>> found;
+                for (auto &[start, markerSet]: pBuffer->GetRangeMarkersOnLine(RangeMarkerType::All, line)) {
+                    for (auto &marker: markerSet) found.insert({start, marker.get()});
+                }
+                ASSERT_EQ(found, expected) << edit << " " << line;
+
+                found.clear();
+                for (auto &marker: markersOnLines.OnLine(line)) found.insert({marker->GetRange().first, marker.get()});
+                ASSERT_EQ(found, expected) << edit << " " << line;
+            }
+        }
+    }
+}
+
+// Markers come in the order they start, the timed ones after the others starting at the same place
+TEST_F(RangeMarkerTest, ForEachOrder) {
+    pBuffer->SetText("one two three\nfour five\n");
+    auto timed = AddMarker(4, 7, RangeMarkerDisplayType::Timed | RangeMarkerDisplayType::Background);
+    auto later = AddMarker(8, 13);
+    auto first = AddMarker(0, 3);
+    auto sameStart = AddMarker(4, 6);
+    auto nextLine = AddMarker(14, 18);
+
+    std::vector<std::shared_ptr<RangeMarker>> found;
+    auto collect = [&](const std::shared_ptr<RangeMarker> &marker) {
+        found.push_back(marker);
+        return true;
+    };
+    pBuffer->ForEachMarker(RangeMarkerType::All, Direction::Forward, pBuffer->Begin(), pBuffer->End(), collect);
+    ASSERT_EQ(found, std::vector<std::shared_ptr<RangeMarker>>({first, sameStart, timed, later, nextLine}));
+
+    found.clear();
+    pBuffer->ForEachMarker(RangeMarkerType::All, Direction::Forward, GlyphIterator(pBuffer, 5), GlyphIterator(pBuffer, 9), collect);
+    ASSERT_EQ(found, std::vector<std::shared_ptr<RangeMarker>>({sameStart, timed, later}));
+
+    found.clear();
+    pBuffer->ForEachMarker(RangeMarkerType::All, Direction::Backward, pBuffer->Begin(), pBuffer->End(), collect);
+    ASSERT_EQ(found.front(), nextLine);
+    ASSERT_EQ(found.back(), first);
+
+    ASSERT_EQ(pBuffer->FindNextMarker(GlyphIterator(pBuffer, 5), Direction::Forward, RangeMarkerType::All), later);
+
+    pBuffer->ClearRangeMarkers(RangeMarkerType::All);
+    ASSERT_EQ(pBuffer->rangeMarkers.Size(), 1);
+    ASSERT_TRUE(timed->InBuffer());
+    ASSERT_FALSE(later->InBuffer());
+    ASSERT_EQ(later->GetRange().first, 8);
+}
+
+// A run of lines has the markers over each, including those which start before the run, of the types asked for
+TEST_F(RangeMarkerTest, MarkersOnLines) {
+    pBuffer->SetText("one\ntwo\nthree\nfour\n");
+    auto acrossRun = AddMarker(1, 10);
+    auto onTwo = AddMarker(4, 6);
+    auto widget = AddMarker(5, 6);
+    widget->markerType = RangeMarkerType::Widget;
+    auto onFour = AddMarker(14, 16);
+    auto emptyAtLineStart = AddMarker(8, 8);
+
+    auto markersOnLines = pBuffer->GetRangeMarkersOnLines(RangeMarkerType::Mark, 1, 2);
+    ASSERT_EQ(markersOnLines.firstLine, 1);
+    ASSERT_EQ(markersOnLines.lines.size(), 2);
+    ASSERT_EQ(markersOnLines.OnLine(1), std::vector<std::shared_ptr<RangeMarker>>({acrossRun, onTwo}));
+    ASSERT_EQ(markersOnLines.OnLine(2), std::vector<std::shared_ptr<RangeMarker>>({acrossRun}));
+    ASSERT_TRUE(markersOnLines.OnLine(0).empty());
+    ASSERT_TRUE(markersOnLines.OnLine(3).empty());
+
+    // Lines past the end of the buffer are left out
+    markersOnLines = pBuffer->GetRangeMarkersOnLines(RangeMarkerType::All, 3, 100);
+    ASSERT_EQ(markersOnLines.lines.size(), pBuffer->lineEnds.Count() - 3);
+    ASSERT_EQ(markersOnLines.OnLine(3), std::vector<std::shared_ptr<RangeMarker>>({onFour}));
+}
+
+// Typing before the markers moves them without a message; an edit inside some sends one for them all
+TEST_F(RangeMarkerTest, OneMessagePerEdit) {
+    pBuffer->SetText("0123456789abcdefghij\n");
+    std::vector<std::shared_ptr<RangeMarker>> markers;
+    for (ByteIndex first = 2; first < 20; first += 4) markers.push_back(AddMarker(first, first + 2));
+
+    MarkerMessages messages(*editor);
+    ChangeRecord record;
+    pBuffer->Insert(GlyphIterator(pBuffer, 0), "__", record);
+    ASSERT_EQ(messages.count, 0);
+    ASSERT_EQ(markers[0]->GetRange().first, 4);
+
+    // Deleting "56789abc" takes out the markers on "67" and "ab"
+    pBuffer->Delete(GlyphIterator(pBuffer, 7), GlyphIterator(pBuffer, 15), record);
+    ASSERT_EQ(messages.count, 1);
+    ASSERT_EQ(messages.last.first, 8);
+    ASSERT_EQ(messages.last.second, 14);
+    ASSERT_TRUE(markers[0]->InBuffer());
+    ASSERT_FALSE(markers[1]->InBuffer());
+    ASSERT_FALSE(markers[2]->InBuffer());
+    ASSERT_EQ(markers[3]->GetRange().first, 8);
+    ASSERT_EQ(markers[4]->GetRange().first, 12);
+    ASSERT_EQ(pBuffer->GetBufferText(GlyphIterator(pBuffer, 12), GlyphIterator(pBuffer, 14)), "ij");
+}
+
+TEST_F(RangeMarkerTest, DISABLED_BenchmarkTypingAboveMarkers) {
+    std::string text;
+    for (int line = 0; line < 10000; line++) text += "    auto value = compute(input, line); // a typical source line\n";
+    pBuffer->SetText(text);
+
+    MarkerMessages messages(*editor);
+    std::vector<std::shared_ptr<RangeMarker>> markers;
+    Timer timer;
+    timer_start(timer);
+    for (int line = 0; line < 10000; line++) markers.push_back(AddMarker(line * 66 + 4, line * 66 + 8));
+    std::cout << "Add 10000 markers: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    messages.count = 0;
+    timer_start(timer);
+    for (int ch = 0; ch < 1000; ch++) {
+        ChangeRecord record;
+        pBuffer->Insert(GlyphIterator(pBuffer, 0), "x", record);
+    }
+    std::cout << "Type 1000 chars above them: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms, " << messages.count << " marker messages" << std::endl;
+
+    timer_start(timer);
+    size_t found = 0;
+    for (long line = 0; line < 10000; line++) found += pBuffer->GetRangeMarkersOnLine(RangeMarkerType::All, line).size();
+    std::cout << "Markers on each line: " << found << " in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    timer_start(timer);
+    found = 0;
+    auto markersOnLines = pBuffer->GetRangeMarkersOnLines(RangeMarkerType::All, 0, 9999);
+    for (auto &markersOnLine: markersOnLines.lines) found += markersOnLine.size();
+    std::cout << "Markers on the lines at once: " << found << " in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+}
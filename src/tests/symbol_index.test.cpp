@@ -0,0 +1,255 @@
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/filesystem.h"
+#include "zep/indexer.h"
+#include "zep/stringutils.h"
+#include "zep/symbol_index.h"
+#include "zep/window.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace Zep;
+
+namespace {
+
+// A folder of files to index, removed afterwards
+struct TestProject {
+    explicit TestProject(const std::string &name) {
+        root = std::filesystem::temp_directory_path() / name;
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+    }
+
+    ~TestProject() { std::filesystem::remove_all(root); }
+
+    void Add(const std::string &path, const std::string &text) {
+        auto fullPath = root / path;
+        std::filesystem::create_directories(fullPath.parent_path());
+        std::ofstream file(fullPath.string(), std::ios::binary | std::ios::trunc);
+        file << text;
+        if (std::find(paths.begin(), paths.end(), ZepPath(path)) == paths.end()) paths.emplace_back(path);
+    }
+
+    // A write within the clock tick of the last one may leave the time as it was, so it is moved on
+    void Change(const std::string &path, const std::string &text) {
+        Add(path, text);
+        std::filesystem::last_write_time(root / path, std::filesystem::last_write_time(root / path) + std::chrono::seconds(1));
+    }
+
+    std::shared_ptr<ZepSymbolIndex> Build(const ZepSymbolIndex *pPrevious = nullptr) const {
+        return ZepSymbolIndex::Build(ZepPath(root.string()), paths, pPrevious);
+    }
+
+    std::filesystem::path root;
+    std::vector<ZepPath> paths;
+};
+
+std::vector<std::string> DefinitionsOf(const ZepSymbolIndex &index, const std::string &word) {
+    std::vector<std::string> found;
+    for (auto &location: index.FindDefinitions(word)) found.push_back(location.path.string() + ":" + std::to_string(location.line));
+    return found;
+}
+
+} // namespace
+
+TEST(SymbolIndex, FindsDefinitions) {
+    TestProject project("zep_symbol_index");
+    project.Add("a.h", "struct Widget {\n    int count;\n};\nvoid Draw(Widget &widget);\n#define MAX_WIDGETS 10\n");
+    project.Add("b.cpp", "#include \"a.h\"\nvoid Draw(Widget &widget) {\n    if (widget.count) Draw(widget);\n}\nenum class Colour { Red };\n");
+    project.Add("c.bin", std::string("Binary\0Draw(", 12));
+
+    auto index = project.Build();
+    ASSERT_EQ(index->FileCount(), 3);
+    ASSERT_EQ(index->FilesRead(), 3);
+
+    ASSERT_EQ(DefinitionsOf(*index, "Widget"), std::vector<std::string>({"a.h:0"}));
+    ASSERT_EQ(DefinitionsOf(*index, "Draw"), std::vector<std::string>({"a.h:3", "b.cpp:1"}));
+    ASSERT_EQ(DefinitionsOf(*index, "MAX_WIDGETS"), std::vector<std::string>({"a.h:4"}));
+    ASSERT_EQ(DefinitionsOf(*index, "Colour"), std::vector<std::string>({"b.cpp:4"}));
+
+    // Calls, keywords and uses are words, not definitions
+    ASSERT_TRUE(DefinitionsOf(*index, "if").empty());
+    ASSERT_TRUE(DefinitionsOf(*index, "class").empty());
+    ASSERT_TRUE(DefinitionsOf(*index, "count").empty());
+    ASSERT_TRUE(DefinitionsOf(*index, "Binary").empty());
+
+    ASSERT_EQ(index->Complete("Dr"), std::vector<std::string>({"Draw"}));
+    ASSERT_EQ(index->Complete("co"), std::vector<std::string>({"count"}));
+    ASSERT_EQ(index->Complete("W"), std::vector<std::string>({"Widget"}));
+    ASSERT_EQ(index->Complete("wi", 1), std::vector<std::string>({"widget"}));
+    ASSERT_TRUE(index->Complete("zz").empty());
+}
+
+// The index written is the one loaded; one which is damaged isn't
+TEST(SymbolIndex, WritesAndLoads) {
+    TestProject project("zep_symbol_index_load");
+    project.Add("a.cpp", "int Add(int a, int b) {\n    return a + b;\n}\n");
+    std::filesystem::create_directories(project.root / ".zep");
+    auto indexPath = ZepPath((project.root / ".zep" / "indexdb").string());
+    ASSERT_TRUE(project.Build()->Write(indexPath));
+
+    auto index = ZepSymbolIndex::Load(indexPath);
+    ASSERT_NE(index, nullptr);
+    ASSERT_EQ(index->FileCount(), 1);
+    ASSERT_EQ(index->GetFilePath(0).string(), "a.cpp");
+    ASSERT_EQ(DefinitionsOf(*index, "Add"), std::vector<std::string>({"a.cpp:0"}));
+    ASSERT_EQ(index->Complete("ret"), std::vector<std::string>({"return"}));
+    index.reset();
+
+    auto data = ZepFileSystem::Read(indexPath);
+    data.resize(data.size() - 1);
+    ZepFileSystem::Write(indexPath, data.data(), data.size());
+    ASSERT_EQ(ZepSymbolIndex::Load(indexPath), nullptr);
+
+    ZepFileSystem::Write(indexPath, "\0", 1);
+    ASSERT_EQ(ZepSymbolIndex::Load(indexPath), nullptr);
+    ASSERT_EQ(ZepSymbolIndex::Load(ZepPath((project.root / "missing").string())), nullptr);
+}
+
+// Only the files which have changed are read again, and the result is the same as a fresh build
+TEST(SymbolIndex, RebuildsChangedFiles) {
+    TestProject project("zep_symbol_index_rebuild");
+    for (int file = 0; file < 10; file++) {
+        project.Add("f" + std::to_string(file) + ".cpp", "void Function" + std::to_string(file) + "() {\n    Shared();\n}\n");
+    }
+    auto indexPath = ZepPath((project.root / "indexdb").string());
+    ASSERT_TRUE(project.Build()->Write(indexPath));
+    auto loaded = ZepSymbolIndex::Load(indexPath);
+
+    auto same = project.Build(loaded.get());
+    ASSERT_EQ(same->FilesRead(), 0);
+    ASSERT_EQ(DefinitionsOf(*same, "Function3"), std::vector<std::string>({"f3.cpp:0"}));
+
+    project.Change("f3.cpp", "\n\nvoid Renamed() {\n}\n");
+    std::filesystem::remove(project.root / "f5.cpp");
+    project.Add("g.cpp", "struct Function3 {};\n");
+
+    auto rebuilt = project.Build(loaded.get());
+    ASSERT_EQ(rebuilt->FilesRead(), 2);
+    ASSERT_EQ(rebuilt->FileCount(), 10);
+    ASSERT_EQ(DefinitionsOf(*rebuilt, "Function3"), std::vector<std::string>({"g.cpp:0"}));
+    ASSERT_EQ(DefinitionsOf(*rebuilt, "Renamed"), std::vector<std::string>({"f3.cpp:2"}));
+    ASSERT_TRUE(DefinitionsOf(*rebuilt, "Function5").empty());
+    ASSERT_TRUE(rebuilt->Complete("Function5").empty());
+
+    auto fresh = project.Build();
+    ASSERT_EQ(fresh->WordCount(), rebuilt->WordCount());
+    for (auto &word: fresh->Complete("", 1000)) {
+        ASSERT_EQ(DefinitionsOf(*fresh, word), DefinitionsOf(*rebuilt, word)) << word;
+    }
+}
+
+// The indexer loads the last index, brings it up to date, and stores it for next time
+TEST(SymbolIndex, IndexerKeepsIndex) {
+    TestProject project("zep_symbol_index_indexer");
+    std::filesystem::create_directories(project.root / ".git");
+    project.Add("a.cpp", "void First() {}\n");
+
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    editor->fileSystem->workingDirectory = ZepPath(project.root.string());
+    {
+        Indexer indexer(*editor);
+        ASSERT_TRUE(indexer.StartIndexing());
+        ASSERT_EQ(indexer.GetSymbols(), nullptr);
+        editor->Broadcast(std::make_shared<ZepMessage>(Msg::Tick));
+        editor->Broadcast(std::make_shared<ZepMessage>(Msg::Tick));
+        ASSERT_NE(indexer.GetSymbols(), nullptr);
+        ASSERT_EQ(DefinitionsOf(*indexer.GetSymbols(), "First"), std::vector<std::string>({"a.cpp:0"}));
+
+        project.Add("b.h", "struct Second;\n");
+        indexer.UpdateSymbols();
+        editor->Broadcast(std::make_shared<ZepMessage>(Msg::Tick));
+        editor->Broadcast(std::make_shared<ZepMessage>(Msg::Tick));
+        ASSERT_EQ(DefinitionsOf(*indexer.GetSymbols(), "Second"), std::vector<std::string>({"b.h:0"}));
+    }
+
+    Indexer indexer(*editor);
+    ASSERT_TRUE(indexer.StartIndexing());
+    ASSERT_NE(indexer.GetSymbols(), nullptr);
+    ASSERT_EQ(DefinitionsOf(*indexer.GetSymbols(), "Second"), std::vector<std::string>({"b.h:0"}));
+}
+
+// :tag opens the file a word is defined in at its line, and steps through the definitions when run again
+TEST(SymbolIndex, TagJumpsToDefinitions) {
+    TestProject project("zep_symbol_index_tag");
+    std::filesystem::create_directories(project.root / ".git");
+    project.Add("a.h", "#pragma once\nstruct Widget;\nvoid Draw(Widget &widget);\n");
+    project.Add("b.cpp", "#include \"a.h\"\n\nvoid Draw(Widget &widget)\n{\n}\n");
+    std::filesystem::create_directories(project.root / ".zep");
+    ASSERT_TRUE(project.Build()->Write(ZepPath((project.root / ".zep" / "indexdb").string())));
+
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    editor->fileSystem->workingDirectory = ZepPath(project.root.string());
+    auto pBuffer = editor->InitWithText("Test Buffer", "x = Widget();\n");
+    auto pWindow = editor->GetActiveWindow();
+    auto pTag = editor->FindExCommand("tag");
+    ASSERT_NE(pTag, nullptr);
+
+    // The word under the cursor
+    pWindow->SetBufferCursor(GlyphIterator(pBuffer, 6));
+    pTag->Run({":tag"});
+    ASSERT_EQ(pWindow->buffer->filePath.filename().string(), "a.h");
+    ASSERT_EQ(pWindow->buffer->GetBufferLine(pWindow->GetBufferCursor()), 1);
+
+    pTag->Run({":tag", "Draw"});
+    auto first = pWindow->buffer->filePath.filename().string() + ":" + std::to_string(pWindow->buffer->GetBufferLine(pWindow->GetBufferCursor()));
+    pTag->Run({":tag", "Draw"});
+    auto second = pWindow->buffer->filePath.filename().string() + ":" + std::to_string(pWindow->buffer->GetBufferLine(pWindow->GetBufferCursor()));
+    std::vector<std::string> found{first, second};
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(found, std::vector<std::string>({"a.h:2", "b.cpp:2"}));
+
+    auto pBefore = pWindow->buffer;
+    pTag->Run({":tag", "Missing"});
+    ASSERT_EQ(pWindow->buffer, pBefore);
+}
+
+TEST(SymbolIndex, DISABLED_BenchmarkIndex) {
+    TestProject project("zep_symbol_index_benchmark");
+    const int FileCount = 20000;
+    for (int file = 0; file < FileCount; file++) {
+        std::string text = "struct Type" + std::to_string(file) + " {\n";
+        for (int line = 0; line < 100; line++) text += "    auto value = compute(input, " + std::to_string(line) + "); // a typical source line\n";
+        project.Add("dir" + std::to_string(file % 100) + "/f" + std::to_string(file) + ".cpp", text + "};\n");
+    }
+    auto root = ZepPath(project.root.string());
+
+    // What the indexer did with each file on every start
+    Timer timer;
+    timer_start(timer);
+    for (auto &path: project.paths) {
+        auto strFile = ZepFileSystem::Read(root / path);
+        std::vector<std::string> tokens;
+        string_split(strFile, ";()[] \t\n\r&!\"\'*:,<>", tokens);
+    }
+    std::cout << "Read and tokenize: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    timer_start(timer);
+    auto cold = ZepSymbolIndex::Build(root, project.paths, nullptr);
+    std::cout << "Cold build: " << cold->WordCount() << " words in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    auto indexPath = root / "indexdb";
+    timer_start(timer);
+    cold->Write(indexPath);
+    std::cout << "Write: " << ZepFileSystem::Read(indexPath).size() / 1024 << "KB in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    timer_start(timer);
+    auto warm = ZepSymbolIndex::Load(indexPath);
+    auto found = warm->FindDefinitions("Type12345").size();
+    std::cout << "Warm load and lookup: " << found << " found in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    timer_start(timer);
+    auto same = ZepSymbolIndex::Build(root, project.paths, warm.get());
+    std::cout << "Rebuild, nothing changed: " << same->FilesRead() << " read in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    project.Change(project.paths[0].string(), "struct Changed {};\n");
+    timer_start(timer);
+    auto changed = ZepSymbolIndex::Build(root, project.paths, warm.get());
+    std::cout << "Rebuild, one file changed: " << changed->FilesRead() << " read in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+}
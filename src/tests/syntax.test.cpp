@@ -1,19 +1,30 @@
 #include "zep/buffer.h"
 #include "zep/editor.h"
+#include "zep/stringutils.h"
 #include "zep/syntax.h"
+#include "zep/syntax_providers.h"
+#include "zep/syntax_rainbow_brackets.h"
+#include "zep/timer.h"
 #include "TestDisplay.h"
 
 #include <gtest/gtest.h>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
 
 using namespace Zep;
 struct SyntaxTest : public testing::Test {
     SyntaxTest() {
-        editor = std::make_shared<ZepEditor>(&display, "", ZepEditorFlags::DisableThreads, nullptr);
+        // The editor owns the display
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
     }
 
     ~SyntaxTest() override = default;
 
-    TestDisplay display{};
     std::shared_ptr<ZepEditor> editor;
 };
 
@@ -31,3 +42,456 @@ CPP_SYNTAX_TEST(cpp_keyword, "int i;", 0, Keyword);
 CPP_SYNTAX_TEST(cpp_identifier, "a = std::min(a,b);", 4, Identifier);
 CPP_SYNTAX_TEST(cpp_string, "a = \"hello\";", 4, String);
 CPP_SYNTAX_TEST(cpp_number, "a = 1234;", 4, Number);
+
+TEST_F(SyntaxTest, case_insensitive_keyword) {
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.sql");
+    pBuffer->syntax = std::make_shared<ZepSyntax>(*pBuffer, std::unordered_set<std::string>{"select"}, std::unordered_set<std::string>{"count"}, ZepSyntaxFlags::CaseInsensitive);
+    pBuffer->SetText("SELECT Count(x)");
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 0)).foreground, ThemeColor::Keyword);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 7)).foreground, ThemeColor::Identifier);
+}
+
+// Edits after the syntax is built keep the colors attached to the right text
+TEST_F(SyntaxTest, cpp_edit_shifts_syntax) {
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.cpp");
+    pBuffer->SetText("a = 1234;\nint i;");
+
+    ChangeRecord record;
+    pBuffer->Insert(GlyphIterator(pBuffer, 0), "b = c;\n", record);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 11)).foreground, ThemeColor::Number);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 17)).foreground, ThemeColor::Keyword);
+
+    pBuffer->Delete(GlyphIterator(pBuffer, 0), GlyphIterator(pBuffer, 7), record);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 4)).foreground, ThemeColor::Number);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 10)).foreground, ThemeColor::Keyword);
+
+    // The number is a single run
+    auto run = pBuffer->syntax->GetSyntaxRunAt(GlyphIterator(pBuffer, 5));
+    ASSERT_EQ(run.Begin(), 4);
+    ASSERT_EQ(run.End(), 8);
+}
+
+// A block comment carries on over lines; removing its start brings back the code it hid
+TEST_F(SyntaxTest, cpp_block_comment) {
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.cpp");
+    pBuffer->SetText("int a; /* one\ntwo\nthree */ int b;\nint c;");
+    auto colorAt = [&](long offset) { return pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, offset)).foreground; };
+    ASSERT_EQ(colorAt(0), ThemeColor::Keyword);
+    ASSERT_EQ(colorAt(14), ThemeColor::Comment);
+    ASSERT_EQ(colorAt(24), ThemeColor::Comment);
+    ASSERT_EQ(colorAt(27), ThemeColor::Keyword);
+    ASSERT_EQ(colorAt(34), ThemeColor::Keyword);
+
+    ChangeRecord record;
+    pBuffer->Delete(GlyphIterator(pBuffer, 7), GlyphIterator(pBuffer, 9), record);
+    ASSERT_EQ(colorAt(12), ThemeColor::Normal);
+    ASSERT_EQ(colorAt(25), ThemeColor::Keyword);
+
+    pBuffer->Insert(GlyphIterator(pBuffer, 7), "/*", record);
+    ASSERT_EQ(colorAt(14), ThemeColor::Comment);
+    ASSERT_EQ(colorAt(34), ThemeColor::Keyword);
+}
+
+namespace {
+
+// Counts the lines the highlighter lexes
+struct CountingSyntax : ZepSyntax {
+    using ZepSyntax::ZepSyntax;
+
+    SyntaxLineState LexLine(ByteIndex begin, ByteIndex end, SyntaxLineState state) override {
+        linesLexed++;
+        return ZepSyntax::LexLine(begin, end, state);
+    }
+
+    long linesLexed = 0;
+};
+
+} // namespace
+
+// An edit is lexed until the lines after it start in the state they had before
+TEST_F(SyntaxTest, edit_lexes_until_state_converges) {
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.cpp");
+    auto pSyntax = std::make_shared<CountingSyntax>(*pBuffer, cpp_keywords, cpp_identifiers);
+    pBuffer->syntax = pSyntax;
+
+    std::string text;
+    for (int line = 0; line < 1000; line++) text += "int a = 1; // line\n";
+    pBuffer->SetText(text);
+    pSyntax->Wait();
+
+    const long LineSize = 19;
+    auto lineStart = [&](long line) { return GlyphIterator(pBuffer, line * LineSize); };
+    auto colorAt = [&](long line) { return pSyntax->GetSyntaxAt(lineStart(line)).foreground; };
+
+    ChangeRecord record;
+    pSyntax->linesLexed = 0;
+    pBuffer->Insert(lineStart(500), "b", record);
+    pSyntax->Wait();
+    ASSERT_EQ(pSyntax->linesLexed, 1);
+
+    // Opening a comment runs on to the end, closing it again runs back
+    pSyntax->linesLexed = 0;
+    pBuffer->Insert(lineStart(500), "/*", record);
+    pSyntax->Wait();
+    ASSERT_GE(pSyntax->linesLexed, 500);
+    ASSERT_EQ(pSyntax->GetSyntaxAt(GlyphIterator(pBuffer, 900 * LineSize + 3)).foreground, ThemeColor::Comment);
+
+    pBuffer->Insert(GlyphIterator(pBuffer, 500 * LineSize + 2), "*/", record);
+    pSyntax->Wait();
+    ASSERT_EQ(pSyntax->GetSyntaxAt(GlyphIterator(pBuffer, 900 * LineSize + 5)).foreground, ThemeColor::Keyword);
+    ASSERT_EQ(colorAt(100), ThemeColor::Keyword);
+}
+
+// Random edits on the runs match the same edits on one style per byte
+namespace {
+
+// The brackets colored as they were when every edit walked them all from the start of the buffer
+std::map<long, SyntaxResult> RainbowBracketsModel(const std::string &text) {
+    struct Bracket {
+        int type;
+        bool isOpen;
+        int32_t indent = 0;
+        bool valid = true;
+    };
+    std::map<long, Bracket> brackets;
+    for (long index = 0; index < long(text.size()); index++) {
+        auto pBracket = std::strchr("()[]{}", text[index]);
+        if (text[index] && pBracket) {
+            auto which = int(pBracket - "()[]{}");
+            brackets[index] = Bracket{which / 2, which % 2 == 0};
+        }
+    }
+
+    int32_t indents[3] = {};
+    for (auto &[index, bracket]: brackets) {
+        if (!bracket.isOpen) indents[bracket.type]--;
+        bracket.indent = indents[bracket.type];
+        bracket.valid = indents[bracket.type] >= 0;
+        if (!bracket.valid) indents[bracket.type] = 0;
+        if (bracket.isOpen) indents[bracket.type]++;
+    }
+    for (int type = 0; type < 3; type++) {
+        if (indents[type] == 0) continue;
+        for (auto &[index, bracket]: brackets) {
+            if (bracket.type == type) {
+                bracket.valid = false;
+                break;
+            }
+        }
+    }
+
+    std::map<long, SyntaxResult> results;
+    for (auto &[index, bracket]: brackets) {
+        auto &result = results[index];
+        result.foreground = bracket.valid ? ThemeColor(((int32_t) ThemeColor::UniqueColor0 + bracket.indent) % (int32_t) ThemeColor::UniqueColorLast) : ThemeColor::Text;
+        result.background = bracket.valid ? ThemeColor::None : ThemeColor::Error;
+    }
+    return results;
+}
+
+} // namespace
+
+// The bracket depths kept as the text is edited match those found from scratch
+TEST_F(SyntaxTest, RainbowBracketsFollowEdits) {
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->SetText("int main() { return f(a[0], {1, 2}); }\n");
+    ZepSyntax syntax(*pBuffer);
+    ZepSyntaxAdorn_RainbowBrackets brackets(syntax, *pBuffer);
+
+    std::mt19937 random(7);
+    for (int edit = 0; edit < 500; edit++) {
+        auto size = long(pBuffer->workingBuffer.size()) - 1;
+        ChangeRecord record;
+        if (random() % 3 != 0 || size < 10) {
+            std::string text;
+            for (auto length = 1 + random() % 4; length > 0; length--) text += "(){}[]ab "[random() % 9];
+            pBuffer->Insert(GlyphIterator(pBuffer, long(random() % (size + 1))), text, record);
+        } else {
+            auto start = long(random() % size);
+            pBuffer->Delete(GlyphIterator(pBuffer, start), GlyphIterator(pBuffer, std::min(size, start + 1 + long(random() % 4))), record);
+        }
+
+        auto text = pBuffer->GetBufferText(pBuffer->Begin(), pBuffer->End());
+        auto expected = RainbowBracketsModel(text);
+        for (long index = 0; index < long(text.size()); index++) {
+            bool found = false;
+            auto result = brackets.GetSyntaxAt(GlyphIterator(pBuffer, index), found);
+            auto itr = expected.find(index);
+            ASSERT_EQ(found, itr != expected.end()) << edit << " " << index << " " << text;
+            if (!found) continue;
+            ASSERT_EQ(result.foreground, itr->second.foreground) << edit << " " << index << " " << text;
+            ASSERT_EQ(result.background, itr->second.background) << edit << " " << index << " " << text;
+        }
+    }
+}
+
+// Walking a line with a cursor gives the same styles as looking each location up, brackets included
+TEST_F(SyntaxTest, CursorMatchesLookups) {
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.cpp");
+    pBuffer->SetText("int main() {\n    return f(a[0], {1, 2}); /* (x\n still a comment ] */ \"s(\";\n}\n\nb = 3;\n");
+
+    std::mt19937 random(3);
+    for (int edit = 0; edit < 100; edit++) {
+        ChangeRecord record;
+        std::string text;
+        for (auto length = 1 + random() % 4; length > 0; length--) text += "(){}[]ab 1/*\n"[random() % 14];
+        pBuffer->Insert(GlyphIterator(pBuffer, long(random() % pBuffer->workingBuffer.size())), text, record);
+
+        auto bufferText = pBuffer->GetBufferText(pBuffer->Begin(), pBuffer->End());
+        ByteIndex begin = 0;
+        while (begin < ByteIndex(bufferText.size())) {
+            auto end = ByteIndex(bufferText.find('\n', begin));
+            end = end < 0 ? ByteIndex(bufferText.size()) : end + 1;
+
+            SyntaxCursor cursor(*pBuffer->syntax, begin, end);
+            for (auto index = begin; index < end; index++) {
+                GlyphIterator offset(pBuffer, index);
+                auto walked = cursor.At(offset);
+                auto expected = pBuffer->syntax->GetSyntaxAt(offset);
+                ASSERT_EQ(walked.foreground, expected.foreground) << edit << " " << index;
+                ASSERT_EQ(walked.background, expected.background) << edit << " " << index;
+                ASSERT_EQ(walked.underline, expected.underline) << edit << " " << index;
+            }
+            begin = end;
+        }
+    }
+}
+
+TEST(SyntaxRuns, MatchesPerByteStyles) {
+    std::mt19937 random(1);
+    auto randomColor = [&]() { return SyntaxData{ThemeColor(random() % 4), ThemeColor::None}; };
+
+    SyntaxRuns runs;
+    std::vector<SyntaxData> bytes;
+    for (int i = 0; i < 2000; i++) {
+        auto size = long(bytes.size());
+        auto a = size ? long(random() % (size + 1)) : 0;
+        auto b = size ? long(random() % (size + 1)) : 0;
+        if (a > b) std::swap(a, b);
+
+        switch (random() % 3) {
+            case 0: {
+                auto count = long(random() % 20) + 1;
+                runs.Insert(a, count);
+                bytes.insert(bytes.begin() + a, count, SyntaxData{});
+            }
+                break;
+            case 1:
+                runs.Erase(a, b);
+                bytes.erase(bytes.begin() + a, bytes.begin() + b);
+                break;
+            case 2: {
+                auto data = randomColor();
+                runs.Fill(a, b, data);
+                std::fill(bytes.begin() + a, bytes.begin() + b, data);
+            }
+                break;
+        }
+
+        ASSERT_EQ(runs.Size(), long(bytes.size()));
+        ByteIndex index = 0;
+        for (auto itr = runs.begin(); itr != runs.end(); ++itr) {
+            ASSERT_EQ(itr.Begin(), index);
+            ASSERT_LT(itr.Begin(), itr.End());
+            for (; index < itr.End(); index++) {
+                ASSERT_EQ(itr.Data(), bytes[index]);
+            }
+        }
+        ASSERT_EQ(index, runs.Size());
+    }
+}
+
+// With threads the highlighter runs in the background; text it hasn't reached is plain until it finishes
+TEST(SyntaxThreaded, cpp_highlights_in_background) {
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", 0, nullptr);
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.cpp");
+
+    std::string text;
+    for (int i = 0; i < 20000; i++) text += "int i = 1234; // comment\n";
+    pBuffer->SetText(text);
+
+    ChangeRecord record;
+    pBuffer->Insert(GlyphIterator(pBuffer, 0), "a = 5;\n", record);
+    pBuffer->Delete(GlyphIterator(pBuffer, 0), GlyphIterator(pBuffer, 4), record);
+
+    // Reading while the highlighter runs doesn't block
+    for (long i = 0; i < long(text.size()); i += 997) pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, i));
+
+    pBuffer->syntax->Wait();
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 0)).foreground, ThemeColor::Number);
+
+    auto lastLine = long(text.size()) - 25 + 3;
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, lastLine)).foreground, ThemeColor::Keyword);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, lastLine + 8)).foreground, ThemeColor::Number);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, lastLine + 15)).foreground, ThemeColor::Comment);
+}
+
+// An edit drops a highlight pass which is still queued, rather than waiting for a worker to take it
+TEST(SyntaxThreaded, edits_drop_queued_passes) {
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", 0, nullptr);
+    auto &pool = *editor->threadPool;
+    if (pool.GetThreadCount() == 0) return;
+
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.cpp");
+    pBuffer->syntax->Wait();
+
+    // Keep every worker busy, so the passes queued by the edits can't start
+    std::atomic<size_t> busy{0};
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future();
+    for (size_t worker = 0; worker < pool.GetThreadCount(); worker++) {
+        pool.Run([&busy, released]() {
+            busy++;
+            released.wait();
+        });
+    }
+    while (busy < pool.GetThreadCount()) std::this_thread::yield();
+
+    ChangeRecord record;
+    for (int edit = 0; edit < 10; edit++) {
+        pBuffer->Insert(GlyphIterator(pBuffer, 14 * edit), "int i = 1234;\n", record);
+    }
+
+    release.set_value();
+    pBuffer->syntax->Wait();
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 0)).foreground, ThemeColor::Keyword);
+    ASSERT_EQ(pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, 14 * 9 + 8)).foreground, ThemeColor::Number);
+}
+
+// The matcher finds the same words as the sets it was built from, in any case if it folds case
+TEST(SyntaxMatcher, MatchesSets) {
+    for (auto caseInsensitive: {false, true}) {
+        ZepSyntaxMatcher matcher(cpp_keywords, cpp_identifiers, caseInsensitive);
+
+        std::mt19937 random(1);
+        std::vector<std::string> words(cpp_keywords.begin(), cpp_keywords.end());
+        words.insert(words.end(), cpp_identifiers.begin(), cpp_identifiers.end());
+        for (int i = 0; i < 5000; i++) {
+            auto token = words[random() % words.size()];
+            switch (random() % 4) {
+                case 0: token[random() % token.size()] = char(std::toupper(token[0])); break;
+                case 1: token += char('a' + random() % 26); break;
+                case 2: token.pop_back(); break;
+                default: break;
+            }
+
+            auto lookup = caseInsensitive ? string_tolower(token) : token;
+            auto expected = cpp_keywords.count(lookup) ? SyntaxWord::Keyword : cpp_identifiers.count(lookup) ? SyntaxWord::Identifier : SyntaxWord::None;
+            ASSERT_EQ(matcher.Find(token), expected) << token;
+        }
+    }
+
+    ZepSyntaxMatcher empty({}, {});
+    ASSERT_EQ(empty.Find(std::string("int")), SyntaxWord::None);
+}
+
+TEST_F(SyntaxTest, DISABLED_BenchmarkHighlightThroughput) {
+    std::string text;
+    while (text.size() < 16 * 1024 * 1024) {
+        text += "for (int i = 0; i < count; i++) { auto value = std::min(values[i], 1234); } // comment\n";
+    }
+
+    // The old classification; a string per token, folded, and looked up in the sets
+    auto pText = (const uint8_t *) text.data();
+    std::vector<std::pair<long, long>> tokens;
+    for (long i = 0; i < long(text.size());) {
+        while (i < long(text.size()) && std::strchr(" \t.\n;(){}[]=:,!", text[i])) i++;
+        auto start = i;
+        while (i < long(text.size()) && !std::strchr(" \t.\n;(){}[]=:,!", text[i])) i++;
+        if (i > start) tokens.emplace_back(start, i);
+    }
+
+    Timer timer;
+    timer_start(timer);
+    long found = 0;
+    for (auto &token: tokens) {
+        auto str = string_tolower(std::string(pText + token.first, pText + token.second));
+        found += cpp_keywords.count(str) || cpp_identifiers.count(str);
+    }
+    std::cout << "Sets: " << timer_get_elapsed_seconds(timer) * 1000000000.0 / tokens.size() << "ns per token" << std::endl;
+
+    ZepSyntaxMatcher matcher(cpp_keywords, cpp_identifiers, true);
+    timer_start(timer);
+    long matched = 0;
+    for (auto &token: tokens) {
+        matched += matcher.Find(pText + token.first, pText + token.second) != SyntaxWord::None;
+    }
+    std::cout << "Matcher: " << timer_get_elapsed_seconds(timer) * 1000000000.0 / tokens.size() << "ns per token" << std::endl;
+    ASSERT_EQ(found, matched);
+
+    // Just the highlighter; the rainbow brackets are left out
+    struct TokenSyntax : ZepSyntax {
+        TokenSyntax(ZepBuffer &buffer, std::shared_ptr<const ZepSyntaxMatcher> matcher) : ZepSyntax(buffer, std::move(matcher)) { m_adornments.clear(); }
+    };
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->syntax = std::make_shared<TokenSyntax>(*pBuffer, std::make_shared<ZepSyntaxMatcher>(cpp_keywords, cpp_identifiers));
+    timer_start(timer);
+    pBuffer->SetText(text);
+    pBuffer->syntax->Wait();
+    std::cout << "Highlight: " << double(text.size()) / (1024.0 * 1024.0) / timer_get_elapsed_seconds(timer) << "MB/s" << std::endl;
+}
+
+// The cost of highlighting a keystroke, near the top of a big file
+TEST_F(SyntaxTest, DISABLED_BenchmarkKeystrokeHighlight) {
+    std::string text;
+    for (int line = 0; line < 200000; line++) {
+        text += "for (int i = 0; i < count; i++) { total += values[i]; } // sum\n";
+    }
+
+    // Just the highlighter; the rainbow brackets are left out
+    struct TokenSyntax : ZepSyntax {
+        TokenSyntax(ZepBuffer &buffer) : ZepSyntax(buffer, cpp_keywords, cpp_identifiers) { m_adornments.clear(); }
+    };
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->syntax = std::make_shared<TokenSyntax>(*pBuffer);
+    pBuffer->SetText(text);
+    pBuffer->syntax->Wait();
+
+    const int Keys = 2000;
+    ChangeRecord record;
+    Timer timer;
+    timer_start(timer);
+    for (int key = 0; key < Keys; key++) {
+        pBuffer->Insert(GlyphIterator(pBuffer, 100 + key), "x", record);
+        pBuffer->syntax->Wait();
+    }
+    std::cout << "Typing: " << timer_get_elapsed_seconds(timer) * 1000000.0 / Keys << "us per key" << std::endl;
+
+    // Every line after the edit changes state
+    timer_start(timer);
+    pBuffer->Insert(GlyphIterator(pBuffer, 0), "/*", record);
+    pBuffer->syntax->Wait();
+    std::cout << "Opening a block comment: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+}
+
+// The cost of the rainbow brackets on a keystroke, in a big file full of them
+TEST_F(SyntaxTest, DISABLED_BenchmarkKeystrokeBrackets) {
+    std::string text;
+    for (int line = 0; line < 50000; line++) {
+        text += "if (values[i] > limit) { total += f(values[i]); }\n";
+    }
+
+    // The highlighter with no words to find; the brackets are the rest
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->syntax = std::make_shared<ZepSyntax>(*pBuffer);
+    pBuffer->SetText(text);
+    pBuffer->syntax->Wait();
+
+    const int Keys = 200;
+    ChangeRecord record;
+    Timer timer;
+    timer_start(timer);
+    for (int key = 0; key < Keys; key++) {
+        pBuffer->Insert(GlyphIterator(pBuffer, 100 + key), key % 2 ? ")" : "(", record);
+        pBuffer->syntax->Wait();
+    }
+    std::cout << "Typing brackets: " << timer_get_elapsed_seconds(timer) * 1000000.0 / Keys << "us per key" << std::endl;
+
+    // Every bracket on a screen of text
+    timer_start(timer);
+    long found = 0;
+    for (long index = 0; index < 60 * 50; index++) {
+        found += pBuffer->syntax->GetSyntaxAt(GlyphIterator(pBuffer, index)).background != ThemeColor::Error;
+    }
+    std::cout << "A screen of text: " << found << " in " << timer_get_elapsed_seconds(timer) * 1000000.0 << "us" << std::endl;
+}
@@ -0,0 +1,92 @@
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/text_scan.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+void ExpectSameScan(const TextScan &a, const TextScan &b) {
+    ASSERT_EQ(a.lineEnds, b.lineEnds);
+    ASSERT_EQ(a.hasCR, b.hasCR);
+    ASSERT_EQ(a.hasTabs, b.hasTabs);
+    ASSERT_EQ(a.hasSpaceTabs, b.hasSpaceTabs);
+}
+
+} // namespace
+
+TEST(TextScan, FindsLinesAndWhitespace) {
+    std::string text = "\tOne\r\nTwo  spaces\n\n";
+    auto pText = (const uint8_t *) text.data();
+    TextScan scan;
+    ScanText(pText, pText + text.size(), scan, 10);
+    ASSERT_EQ(scan.lineEnds, std::vector<ByteIndex>({16, 28, 29}));
+    ASSERT_TRUE(scan.hasCR);
+    ASSERT_TRUE(scan.hasTabs);
+    ASSERT_TRUE(scan.hasSpaceTabs);
+}
+
+// Random text of each length, at each alignment, scans the same as a byte at a time; including spaces across blocks
+TEST(TextScan, MatchesScalar) {
+    std::mt19937 random(1);
+    const char chars[] = {'a', 'b', '\n', '\r', '\t', ' '};
+    for (int length = 0; length < 200; length++) {
+        for (int align = 0; align < 4; align++) {
+            std::string text(align + length, 'x');
+            for (int i = align; i < int(text.size()); i++) {
+                // Mostly letters, so each flag is only sometimes set
+                auto ch = random() % 64;
+                text[i] = ch < 6 ? chars[ch] : 'a';
+            }
+
+            auto pBegin = (const uint8_t *) text.data() + align;
+            auto pEnd = (const uint8_t *) text.data() + text.size();
+            TextScan scan, scalar;
+            ScanText(pBegin, pEnd, scan, 3);
+            ScanTextScalar(pBegin, pEnd, scalar, 3);
+            ExpectSameScan(scan, scalar);
+        }
+    }
+
+    // Two spaces either side of each block boundary
+    for (int split = 1; split < 64; split++) {
+        std::string text(80, 'a');
+        text[split - 1] = ' ';
+        text[split] = ' ';
+        auto pText = (const uint8_t *) text.data();
+        TextScan scan;
+        ScanText(pText, pText + text.size(), scan);
+        ASSERT_TRUE(scan.hasSpaceTabs);
+    }
+}
+
+TEST(TextScan, DISABLED_BenchmarkThroughput) {
+    std::string text;
+    for (int line = 0; text.size() < 64 * 1024 * 1024; line++) {
+        text += (line % 3 == 0 ? "\t" : "    ") + std::string("A line of synthetic source, number ") + std::to_string(line) + ";\n";
+    }
+    auto pText = (const uint8_t *) text.data();
+    auto gigabytes = double(text.size()) / (1024.0 * 1024.0 * 1024.0);
+
+    TextScan scan;
+    Timer timer;
+    timer_start(timer);
+    ScanTextScalar(pText, pText + text.size(), scan);
+    std::cout << "Scalar scan: " << gigabytes / timer_get_elapsed_seconds(timer) << "GB/s" << std::endl;
+
+    timer_start(timer);
+    ScanText(pText, pText + text.size(), scan);
+    std::cout << "Vector scan: " << gigabytes / timer_get_elapsed_seconds(timer) << "GB/s" << std::endl;
+
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    auto pBuffer = editor->GetEmptyBuffer("test.txt");
+    timer_start(timer);
+    pBuffer->SetText(text);
+    std::cout << "SetText: " << gigabytes / timer_get_elapsed_seconds(timer) << "GB/s" << std::endl;
+}
@@ -0,0 +1,157 @@
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/text_storage.h"
+#include "zep/timer.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+// Random edits on each type of storage match the same edits on a string
+TEST(TextStorage, MatchesString) {
+    for (auto type: {TextStorageType::GapBuffer, TextStorageType::PieceTable}) {
+        std::mt19937 random(1);
+
+        TextStorage storage;
+        storage.SetType(type);
+        std::string reference;
+        for (int i = 0; i < 3000; i++) {
+            auto size = long(reference.size());
+            auto a = long(random() % (size + 1));
+            auto b = long(random() % (size + 1));
+            if (a > b) std::swap(a, b);
+
+            switch (random() % 4) {
+                case 0: {
+                    // Typing carries on from the last insert
+                    std::string str(1 + random() % 4, char('a' + random() % 26));
+                    storage.insert(a, str);
+                    reference.insert(a, str);
+                    for (int key = 0; key < 5; key++) {
+                        auto end = a + long(str.size());
+                        storage.insert(end, "k");
+                        reference.insert(end, "k");
+                        str += "k";
+                    }
+                }
+                    break;
+                case 1: {
+                    std::string str(1 + random() % 10, char('a' + random() % 26));
+                    storage.insert(a, str);
+                    reference.insert(a, str);
+                }
+                    break;
+                case 2:
+                    if (a < size) {
+                        storage.erase(a, b);
+                        reference.erase(a, b - a);
+                    }
+                    break;
+                case 3:
+                    if (a < size) {
+                        storage[a] = 'Z';
+                        reference[a] = 'Z';
+                    }
+                    break;
+            }
+
+            ASSERT_EQ(storage.size(), reference.size());
+            ASSERT_EQ(storage.string(), reference);
+
+            a = std::min(a, long(reference.size()));
+            b = std::min(b, long(reference.size()));
+            ASSERT_EQ(std::string(storage.begin() + a, storage.begin() + b), reference.substr(a, b - a));
+        }
+    }
+}
+
+TEST(TextStorage, SetTypeKeepsText) {
+    TextStorage storage;
+    storage.assign((const uint8_t *) "Hello", (const uint8_t *) "Hello" + 5);
+    storage.SetType(TextStorageType::PieceTable);
+    storage.insert(5, " World");
+    ASSERT_EQ(storage.string(), "Hello World");
+
+    storage.SetType(TextStorageType::GapBuffer);
+    storage.erase(0, 6);
+    ASSERT_EQ(storage.string(), "World");
+}
+
+TEST(PieceTable, TypingGrowsOnePiece) {
+    PieceTable pieces;
+    std::string text = "Some text\nMore text\n";
+    pieces.assign((const uint8_t *) text.data(), (const uint8_t *) text.data() + text.size());
+
+    std::string key = "x";
+    for (long i = 0; i < 100; i++) {
+        pieces.insert(5 + i, (const uint8_t *) key.data(), (const uint8_t *) key.data() + 1);
+    }
+
+    // Split around the typing
+    ASSERT_EQ(pieces.PieceCount(), 3);
+
+    // Undoing it joins the text back up
+    pieces.erase(5, 105);
+    ASSERT_EQ(pieces.PieceCount(), 1);
+}
+
+// Buffer edits and glyph movement work the same on a piece table
+TEST(TextStorage, BufferOnPieceTable) {
+    auto editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+    ZepBuffer *pBuffer = editor->GetEmptyBuffer("test.txt");
+    pBuffer->workingBuffer.SetType(TextStorageType::PieceTable);
+    pBuffer->SetText("One\nTwo\nThree");
+
+    ChangeRecord record;
+    pBuffer->Insert(GlyphIterator(pBuffer, 4), "2\n", record);
+    pBuffer->Delete(GlyphIterator(pBuffer, 0), GlyphIterator(pBuffer, 1), record);
+    ASSERT_EQ(pBuffer->GetBufferText(pBuffer->Begin(), pBuffer->End()), "ne\n2\nTwo\nThree");
+    ASSERT_EQ(pBuffer->GetBufferLine(GlyphIterator(pBuffer, 9)), 3);
+
+    auto itr = GlyphIterator(pBuffer, 2).Move(3);
+    ASSERT_EQ(itr.Char(), 'T');
+}
+
+namespace {
+
+// Apply 'edits' keystroke sized edits; localized edits walk forward through the text, scattered ones jump around it
+double TimeEdits(TextStorageType type, const std::string &text, bool scattered, int edits) {
+    TextStorage storage;
+    storage.SetType(type);
+    storage.assign((const uint8_t *) text.data(), (const uint8_t *) text.data() + text.size());
+
+    std::mt19937 random(1);
+    Timer timer;
+    timer_start(timer);
+    long cursor = long(text.size()) / 2;
+    for (int i = 0; i < edits; i++) {
+        if (scattered) cursor = long(random() % (storage.size() - 1));
+        else cursor += 5;
+
+        // A replace; delete a char and type two
+        storage.erase(cursor, cursor + 1);
+        storage.insert(cursor, "ab");
+    }
+    return timer_get_elapsed_seconds(timer) * 1000000.0 / edits;
+}
+
+} // namespace
+
+TEST(TextStorage, DISABLED_BenchmarkEditWorkloads) {
+    std::string text;
+    for (int line = 0; line < 500000; line++) {
+        text += "A line of text in a large log file: " + std::to_string(line) + "\n";
+    }
+
+    const int Edits = 20000;
+    for (auto scattered: {false, true}) {
+        for (auto type: {TextStorageType::GapBuffer, TextStorageType::PieceTable}) {
+            std::cout << (scattered ? "scattered" : "localized") << " edits, "
+                      << (type == TextStorageType::GapBuffer ? "gap buffer: " : "piece table: ")
+                      << TimeEdits(type, text, scattered, Edits) << "us per edit" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,235 @@
+#include "zep/threadpool.h"
+#include "zep/timer.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <iostream>
+#include <queue>
+
+using namespace Zep;
+
+namespace {
+
+// Holds the workers of a pool until released, so the tasks queued behind it wait
+struct Blocker {
+    void Block(ThreadPool &pool) {
+        for (size_t worker = 0; worker < pool.GetThreadCount(); worker++) {
+            // The workers may still be waking as the blocker goes, so they hold the future themselves
+            pool.Run([this, release = release]() {
+                blocked++;
+                release.wait();
+            });
+        }
+        while (blocked < pool.GetThreadCount()) std::this_thread::yield();
+    }
+
+    void Release() { promise.set_value(); }
+
+    std::promise<void> promise;
+    std::shared_future<void> release = promise.get_future().share();
+    std::atomic<size_t> blocked{0};
+};
+
+// The pool this one replaced: one locked queue and a condition variable, and a packaged_task for each task
+struct QueuePool {
+    explicit QueuePool(size_t threads) {
+        for (size_t thread = 0; thread < threads; thread++) {
+            workers.emplace_back([this]() {
+                for (;;) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        condition.wait(lock, [this]() { return stop || !tasks.empty(); });
+                        if (stop && tasks.empty()) return;
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ~QueuePool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (auto &worker: workers) worker.join();
+    }
+
+    template<class F>
+    std::future<void> enqueue(F &&fn) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::forward<F>(fn));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+        condition.notify_one();
+        return future;
+    }
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stop = false;
+};
+
+} // namespace
+
+TEST(ThreadPool, RunsTasks) {
+    for (size_t threads: {1, 4}) {
+        std::atomic<int> count{0};
+        {
+            ThreadPool pool(threads);
+            ASSERT_EQ(pool.GetThreadCount(), threads == 1 ? 0 : threads);
+            for (int task = 0; task < 1000; task++) pool.Run([&]() { count++; });
+
+            auto result = pool.enqueue([](int a, int b) { return a + b; }, 2, 3);
+            ASSERT_EQ(result.get(), 5);
+            auto background = pool.Async(TaskPriority::Background, []() { return std::string("done"); });
+            ASSERT_EQ(background.get(), "done");
+        }
+        // The pool finishes what was queued before it stops
+        ASSERT_EQ(count, 1000);
+    }
+}
+
+// Tasks queued by the pool's own tasks are run on their workers, or stolen by the others
+TEST(ThreadPool, GroupsWaitForNestedTasks) {
+    for (size_t threads: {1, 4}) {
+        ThreadPool pool(threads);
+        std::atomic<int> count{0};
+        TaskGroup group(pool);
+        std::function<void(int)> split = [&](int depth) {
+            count++;
+            if (depth == 0) return;
+            group.Run([&, depth]() { split(depth - 1); });
+            group.Run([&, depth]() { split(depth - 1); });
+        };
+        group.Run([&]() { split(12); });
+        group.Wait();
+        ASSERT_TRUE(group.Finished());
+        ASSERT_EQ(count, (1 << 13) - 1);
+    }
+}
+
+// A group waited on while the workers are busy runs its tasks on the waiting thread
+TEST(ThreadPool, GroupRunsOnWaitingThread) {
+    ThreadPool pool(2);
+    Blocker blocker;
+    blocker.Block(pool);
+
+    std::atomic<int> count{0};
+    TaskGroup group(pool);
+    for (int task = 0; task < 100; task++) group.Run([&]() { count++; });
+    ASSERT_FALSE(group.Finished());
+    group.Wait();
+    ASSERT_EQ(count, 100);
+    blocker.Release();
+}
+
+// Tasks which haven't started when their token is cancelled are dropped
+TEST(ThreadPool, CancelSkipsQueuedTasks) {
+    std::atomic<int> count{0};
+    {
+        ThreadPool pool(2);
+        Blocker blocker;
+        blocker.Block(pool);
+
+        CancelToken token;
+        for (int task = 0; task < 100; task++) pool.Run([&]() { count++; }, TaskPriority::Background, token);
+
+        TaskGroup group(pool, TaskPriority::Interactive, token);
+        for (int task = 0; task < 100; task++) group.Run([&]() { count++; });
+        ASSERT_FALSE(group.IsCancelled());
+        token.Cancel();
+        ASSERT_TRUE(group.IsCancelled());
+        group.Wait();
+        blocker.Release();
+    }
+    ASSERT_EQ(count, 0);
+
+    // With no workers the tasks run as they are queued, unless they are cancelled already
+    ThreadPool inlinePool(1);
+    CancelToken token;
+    inlinePool.Run([&]() { count++; }, TaskPriority::Interactive, token);
+    token.Cancel();
+    inlinePool.Run([&]() { count++; }, TaskPriority::Interactive, token);
+    ASSERT_EQ(count, 1);
+}
+
+// Interactive tasks queued after Background ones are still started first
+TEST(ThreadPool, InteractiveRunsFirst) {
+    std::mutex mutex;
+    std::vector<TaskPriority> started;
+    const size_t Threads = 2;
+    {
+        ThreadPool pool(Threads);
+        Blocker blocker;
+        blocker.Block(pool);
+
+        for (auto priority: {TaskPriority::Background, TaskPriority::Interactive}) {
+            for (int task = 0; task < 50; task++) {
+                pool.Run([&, priority]() {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    started.push_back(priority);
+                }, priority);
+            }
+        }
+        blocker.Release();
+    }
+
+    // A worker may take a Background task while another is yet to note the last Interactive one it took
+    ASSERT_EQ(started.size(), 100);
+    auto lastInteractive = std::find(started.rbegin(), started.rend(), TaskPriority::Interactive).base() - started.begin();
+    ASSERT_LE(std::count(started.begin(), started.begin() + lastInteractive, TaskPriority::Background), long(Threads - 1));
+}
+
+TEST(ThreadPool, DISABLED_BenchmarkThroughput) {
+    const int Tasks = 1000000;
+    auto threads = std::max(2u, std::thread::hardware_concurrency());
+    std::atomic<int> count{0};
+
+    Timer timer;
+    {
+        QueuePool pool(threads);
+        timer_start(timer);
+        for (int task = 0; task < Tasks; task++) pool.enqueue([&]() { count++; });
+    }
+    std::cout << "Single queue, futures: " << count << " tasks in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    count = 0;
+    {
+        ThreadPool pool(threads);
+        timer_start(timer);
+        for (int task = 0; task < Tasks; task++) pool.enqueue([&]() { count++; });
+    }
+    std::cout << "Work stealing, futures: " << count << " tasks in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    count = 0;
+    {
+        ThreadPool pool(threads);
+        timer_start(timer);
+        for (int task = 0; task < Tasks; task++) pool.Run([&]() { count++; });
+    }
+    std::cout << "Work stealing, from outside: " << count << " tasks in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    // Tasks which queue tasks, as the directory walk does
+    count = 0;
+    {
+        ThreadPool pool(threads);
+        timer_start(timer);
+        TaskGroup group(pool);
+        for (int task = 0; task < Tasks / 1000; task++) {
+            group.Run([&]() {
+                for (int child = 0; child < 1000; child++) group.Run([&]() { count++; });
+            });
+        }
+        group.Wait();
+    }
+    std::cout << "Work stealing, task groups from the workers: " << count << " tasks in " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+}
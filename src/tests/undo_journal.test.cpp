@@ -0,0 +1,306 @@
+#include "zep/buffer.h"
+#include "zep/commands.h"
+#include "zep/editor.h"
+#include "zep/file/cpptoml.h"
+#include "zep/mode_vim.h"
+#include "zep/tab_window.h"
+#include "zep/timer.h"
+#include "zep/undo_journal.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+
+using namespace Zep;
+
+namespace {
+
+struct UndoJournalTest : public testing::Test {
+    UndoJournalTest() {
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+        pBuffer = editor->InitWithText("", "");
+    }
+
+    // Run a command as the mode does, keeping only what the journal records
+    void Do(const std::shared_ptr<ZepCommand> &command) {
+        command->Redo();
+        command->Record(journal);
+    }
+
+    void Insert(ByteIndex start, const std::string &text) {
+        Do(std::make_shared<ZepCommand_Insert>(*pBuffer, GlyphIterator(pBuffer, start), text, GlyphIterator(pBuffer, start)));
+    }
+
+    void Delete(ByteIndex start, ByteIndex end) {
+        Do(std::make_shared<ZepCommand_DeleteRange>(*pBuffer, GlyphIterator(pBuffer, start), GlyphIterator(pBuffer, end), GlyphIterator(pBuffer, end)));
+    }
+
+    void Replace(ReplaceRangeMode mode, ByteIndex start, ByteIndex end, const std::string &text) {
+        Do(std::make_shared<ZepCommand_ReplaceRange>(*pBuffer, mode, GlyphIterator(pBuffer, start), GlyphIterator(pBuffer, end), text));
+    }
+
+    std::string Text() const { return pBuffer->workingBuffer.string(); }
+
+    std::shared_ptr<ZepEditor> editor;
+    ZepBuffer *pBuffer;
+    ZepUndoJournal journal;
+};
+
+// Edits made with keys, through the mode
+struct UndoModeTest : public testing::Test {
+    UndoModeTest() {
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+        pBuffer = editor->InitWithText("Test Buffer", "");
+        pWindow = editor->activeTabWindow->GetActiveWindow();
+        editor->SetDisplayRegion({0.0f, 0.0f, 1024.0f, 1024.0f});
+        pWindow->SetBufferCursor(pBuffer->Begin());
+
+        // The editor's own mode, which follows the config
+        editor->SetGlobalMode(ZepMode_Vim::StaticName());
+        mode = editor->GetGlobalMode();
+    }
+
+    // The mode turns a key back into a character by its distance from ImGuiKey_A
+    void Type(const std::string &keys) {
+        for (auto ch: keys) {
+            mode->AddKeyPress(ImGuiKey(ImGuiKey_A + ch - 'a'));
+        }
+    }
+
+    std::string Text() const { return pBuffer->workingBuffer.string(); }
+
+    std::shared_ptr<ZepEditor> editor;
+    ZepBuffer *pBuffer{};
+    ZepWindow *pWindow{};
+    ZepMode *mode{};
+};
+
+} // namespace
+
+TEST_F(UndoJournalTest, UndoesAndRedoesGroups) {
+    pBuffer->SetText("one two three");
+    auto before = Text();
+
+    journal.AddGroup();
+    Insert(3, " and a half");
+    auto inserted = Text();
+
+    journal.AddGroup();
+    Delete(0, 4);
+    Replace(ReplaceRangeMode::Replace, 0, 3, "ONE");
+    auto replaced = Text();
+
+    journal.AddGroup();
+    Replace(ReplaceRangeMode::Fill, 0, 3, "x");
+    auto filled = Text();
+    ASSERT_EQ(filled.substr(0, 3), "xxx");
+
+    // An empty group at the end is stepped over
+    journal.AddGroup();
+
+    journal.Undo();
+    ASSERT_EQ(Text(), replaced);
+    journal.Undo();
+    ASSERT_EQ(Text(), inserted);
+    journal.Undo();
+    ASSERT_EQ(Text(), before);
+    ASSERT_FALSE(journal.CanUndo());
+
+    journal.Redo();
+    ASSERT_EQ(Text(), inserted);
+    journal.Redo();
+    ASSERT_EQ(Text(), replaced);
+    journal.Redo();
+    ASSERT_EQ(Text(), filled);
+    ASSERT_FALSE(journal.CanRedo());
+
+    // A new edit drops what could be redone
+    journal.Undo();
+    journal.AddGroup();
+    ASSERT_FALSE(journal.CanRedo());
+    journal.Undo();
+    ASSERT_EQ(Text(), inserted);
+}
+
+// Typing and deleting next to the last edit grows it, and the cursor goes back to where the run began
+TEST_F(UndoJournalTest, CoalescesKeys) {
+    pBuffer->SetText("abc");
+
+    journal.AddGroup();
+    std::string typed = "hello world";
+    for (size_t key = 0; key < typed.size(); key++) {
+        Insert(ByteIndex(3 + key), typed.substr(key, 1));
+    }
+    ASSERT_EQ(journal.MemoryUsed(), 2 * sizeof(UndoRecord) + typed.size());
+
+    journal.AddGroup();
+    for (ByteIndex key = 0; key < 5; key++) {
+        Delete(Text().size() - 2, Text().size() - 1); // Backspace
+    }
+    Delete(1, 2); // Somewhere else
+    ASSERT_EQ(journal.MemoryUsed(), 5 * sizeof(UndoRecord) + typed.size() + 6);
+    ASSERT_EQ(Text(), std::string("achello ") + std::string(1, '\0'));
+
+    auto cursor = journal.Undo();
+    ASSERT_EQ(Text(), std::string("abchello world") + std::string(1, '\0'));
+    ASSERT_EQ(cursor.index, Text().size() - 1);
+
+    cursor = journal.Undo();
+    ASSERT_EQ(Text(), std::string("abc") + std::string(1, '\0'));
+    ASSERT_EQ(cursor.index, 3);
+
+    cursor = journal.Redo();
+    ASSERT_EQ(Text(), std::string("abchello world") + std::string(1, '\0'));
+    ASSERT_EQ(cursor.index, Text().size() - 1);
+}
+
+// Undo everything back, checking the text at the start of each group, then redo it all
+TEST_F(UndoJournalTest, MatchesRandomEdits) {
+    std::mt19937 random(7);
+    pBuffer->SetText("The quick brown fox\njumps over\nthe lazy dog\n");
+
+    std::vector<std::string> groups;
+    for (int edit = 0; edit < 500; edit++) {
+        if (edit % 4 == 0) {
+            groups.push_back(Text());
+            journal.AddGroup();
+        }
+
+        auto size = ByteIndex(Text().size()) - 1;
+        auto start = ByteIndex(random() % (size + 1));
+        auto end = std::min(size, start + ByteIndex(random() % 4));
+        switch (random() % 5) {
+            case 0:
+                Insert(start, std::string(1 + random() % 3, char('a' + random() % 26)));
+                break;
+            case 1:
+                Insert(start, "x");
+                Insert(start + 1, "y");
+                break;
+            case 2:
+                Delete(start, end);
+                break;
+            case 3:
+                Replace(ReplaceRangeMode::Replace, start, end, "r\n");
+                break;
+            default:
+                Replace(ReplaceRangeMode::Fill, start, end, "f");
+                break;
+        }
+    }
+    auto last = Text();
+
+    for (auto itr = groups.rbegin(); itr != groups.rend(); itr++) {
+        ASSERT_TRUE(journal.CanUndo());
+        journal.Undo();
+        ASSERT_EQ(Text(), *itr);
+    }
+    ASSERT_FALSE(journal.CanUndo());
+
+    for (size_t group = 1; group < groups.size(); group++) {
+        journal.Redo();
+        ASSERT_EQ(Text(), groups[group]);
+    }
+    journal.Redo();
+    ASSERT_EQ(Text(), last);
+}
+
+TEST_F(UndoJournalTest, KeepsWithinMemoryLimit) {
+    size_t limit = 10 * (2 * sizeof(UndoRecord) + 100);
+    journal.SetMemoryLimit(limit);
+
+    for (int group = 0; group < 100; group++) {
+        journal.AddGroup();
+        Insert(0, std::string(100, char('a' + group % 26)));
+        ASSERT_LE(journal.MemoryUsed(), limit);
+    }
+
+    int undone = 0;
+    while (journal.CanUndo()) {
+        journal.Undo();
+        undone++;
+    }
+    ASSERT_EQ(undone, 10);
+    ASSERT_EQ(Text().size(), 90 * 100 + 1);
+
+    // The last group stays, even when it is over the limit on its own
+    journal.AddGroup();
+    Insert(0, std::string(limit * 2, 'z'));
+    ASSERT_TRUE(journal.CanUndo());
+    journal.Undo();
+    ASSERT_EQ(Text().size(), 90 * 100 + 1);
+    ASSERT_FALSE(journal.CanUndo());
+}
+
+// Paste a large block in one group, then undo and redo it
+TEST_F(UndoJournalTest, LargePaste) {
+    std::string paste;
+    for (int line = 0; line < 100000; line++) {
+        paste += "A line of pasted text " + std::to_string(line) + "\n";
+    }
+    pBuffer->SetText("before\nafter\n");
+    auto before = Text();
+
+    Timer timer;
+    timer_start(timer);
+    journal.AddGroup();
+    Insert(7, paste);
+    auto pasted = Text();
+    journal.Undo();
+    ASSERT_EQ(Text(), before);
+    journal.Redo();
+    ASSERT_EQ(Text(), pasted);
+    ASSERT_EQ(pBuffer->lineEnds.Count(), 100003);
+    std::cout << "Paste, undo and redo of " << paste.size() << " bytes: " << timer_get_elapsed_seconds(timer) * 1000.0 << "ms" << std::endl;
+
+    ASSERT_LT(journal.MemoryUsed(), paste.size() + 4 * sizeof(UndoRecord));
+}
+
+// The oldest groups go to keep within the config's limit, but never the one being undone
+TEST_F(UndoModeTest, KeepsWithinConfigLimit) {
+    auto editorConfig = cpptoml::make_table();
+    editorConfig->insert("undo_memory_mb", 1);
+    auto config = cpptoml::make_table();
+    config->insert("editor", editorConfig);
+    editor->LoadConfig(config);
+
+    // Three pastes of 400KB each are more than the limit, so the first is dropped
+    pBuffer->SetText("start");
+    std::string line(63, 'a');
+    std::string block;
+    while (block.size() < (400 << 10)) block += line + "\n";
+    editor->SetRegister('a', block.c_str());
+    std::vector<std::string> texts{Text()};
+    for (int paste = 0; paste < 3; paste++) {
+        Type("\"ap");
+        texts.push_back(Text());
+    }
+    Type("ihellojk");
+    texts.push_back(Text());
+    ASSERT_EQ(texts.back().size(), 5 + 3 * block.size() + 5 + 1);
+
+    for (size_t undo = texts.size() - 1; undo > 1; undo--) {
+        mode->Undo();
+        ASSERT_EQ(Text(), texts[undo - 1]);
+    }
+    mode->Undo();
+    ASSERT_EQ(Text(), texts[1]);
+
+    for (size_t redo = 2; redo < texts.size(); redo++) {
+        mode->Redo();
+        ASSERT_EQ(Text(), texts[redo]);
+    }
+
+    // A paste bigger than the limit on its own is still undone and redone
+    std::string big;
+    while (big.size() <= (1 << 20)) big += block;
+    editor->SetRegister('b', big.c_str());
+    Type("\"bp");
+    auto pasted = Text();
+    ASSERT_EQ(pasted.size(), texts.back().size() + big.size());
+    mode->Undo();
+    ASSERT_EQ(Text(), texts.back());
+    mode->Redo();
+    ASSERT_EQ(Text(), pasted);
+}
@@ -0,0 +1,282 @@
+#include "zep/buffer.h"
+#include "zep/editor.h"
+#include "zep/tab_window.h"
+#include "zep/window.h"
+#include "TestDisplay.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <iostream>
+
+using namespace Zep;
+struct WindowTest : public testing::Test {
+    WindowTest() {
+        // The editor owns the display
+        editor = std::make_shared<ZepEditor>(new TestDisplay(), "", ZepEditorFlags::DisableThreads, nullptr);
+        pBuffer = editor->InitWithText("Test Buffer", "");
+        pWindow = editor->activeTabWindow->GetActiveWindow();
+
+        // Narrow enough that the long lines wrap
+        editor->SetDisplayRegion({0.0f, 0.0f, 400.0f, 400.0f});
+    }
+
+    // The display location of every glyph in the buffer
+    std::vector<NVec2i> DisplayLocations() {
+        std::vector<NVec2i> locations;
+        for (auto itr = pBuffer->Begin(); itr < pBuffer->End(); itr++) {
+            pWindow->SetBufferCursor(itr);
+            locations.push_back(pWindow->BufferToDisplay());
+        }
+        return locations;
+    }
+
+    // Compare the incrementally updated layout against a full rebuild
+    void CheckLayout() {
+        auto incremental = DisplayLocations();
+        auto lines = pWindow->GetNumDisplayedLines();
+
+        pWindow->DirtyLayout();
+        ASSERT_EQ(lines, pWindow->GetNumDisplayedLines());
+        ASSERT_EQ(incremental, DisplayLocations());
+    }
+
+    std::shared_ptr<ZepEditor> editor;
+    ZepBuffer *pBuffer{};
+    ZepWindow *pWindow{};
+};
+
+TEST_F(WindowTest, IncrementalLayoutMatchesFullLayout) {
+    pBuffer->SetText("Hello\nA line which is long enough to wrap a few times in this narrow window, more than once\n\nLast line");
+    CheckLayout();
+
+    ChangeRecord record;
+    pBuffer->Insert(GlyphIterator(pBuffer, 3), "xyz", record);
+    CheckLayout();
+
+    // Split a line, and split the wrapped line
+    pBuffer->Insert(GlyphIterator(pBuffer, 2), "\n", record);
+    CheckLayout();
+    pBuffer->Insert(GlyphIterator(pBuffer, 40), "\nNew\nLines\n", record);
+    CheckLayout();
+
+    // Join lines back together
+    pBuffer->Delete(GlyphIterator(pBuffer, 1), GlyphIterator(pBuffer, 5), record);
+    CheckLayout();
+
+    // Several edits before the next layout
+    pBuffer->Insert(GlyphIterator(pBuffer, 0), "Start\n", record);
+    pBuffer->Insert(pBuffer->End(), "\nEnd", record);
+    pBuffer->Delete(GlyphIterator(pBuffer, 20), GlyphIterator(pBuffer, 30), record);
+    CheckLayout();
+
+    pBuffer->Replace(GlyphIterator(pBuffer, 8), GlyphIterator(pBuffer, 12), "z", ReplaceRangeMode::Fill, record);
+    CheckLayout();
+
+    pBuffer->Delete(pBuffer->Begin(), pBuffer->End(), record);
+    CheckLayout();
+}
+
+TEST_F(WindowTest, VirtualLayoutMatchesFullLayout) {
+    std::string text;
+    for (int line = 0; line < 500; line++) {
+        text += (line % 10 == 0) ? "A line which is long enough to wrap a few times in this narrow window\n" : "Line " + std::to_string(line) + "\n";
+    }
+    pBuffer->SetText(text);
+
+    // Walk the cursor down the spans, and the columns at the end of the buffer
+    auto walk = [&]() {
+        std::vector<long> locations;
+        pWindow->SetBufferCursor(pBuffer->Begin());
+        for (int i = 0; i < 200; i++) {
+            pWindow->MoveCursorY(1);
+            locations.push_back(pWindow->GetBufferCursor().index);
+        }
+
+        for (auto itr = pBuffer->End() - 200; itr < pBuffer->End(); itr++) {
+            pWindow->SetBufferCursor(itr);
+            locations.push_back(pWindow->BufferToDisplay().x);
+        }
+        return locations;
+    };
+
+    // Settle the layout, since the scroll bar appearing changes the wrapping
+    editor->Display();
+    auto full = walk();
+
+    editor->config.virtualLayoutLines = 1;
+    pWindow->DirtyLayout();
+    ASSERT_EQ(full, walk());
+
+    // Edits still work when most of the buffer isn't measured
+    ChangeRecord record;
+    pBuffer->Insert(GlyphIterator(pBuffer, 10), "Some more text\nand another line", record);
+    pBuffer->Delete(pBuffer->End() - 100, pBuffer->End() - 50, record);
+    auto virtualEdited = walk();
+
+    editor->config.virtualLayoutLines = 0;
+    pWindow->DirtyLayout();
+    ASSERT_EQ(walk(), virtualEdited);
+}
+
+TEST_F(WindowTest, DisplayDrawsTextInRuns) {
+    pBuffer->SetText("Hello world\nfoo(bar);");
+    pWindow->SetBufferCursor(pBuffer->End());
+    auto &display = static_cast<TestDisplay &>(*editor->display);
+    display.drawnText.clear();
+    editor->Display();
+
+    // Words are drawn whole; spaces break the runs since they are drawn as whitespace markers
+    auto &drawn = display.drawnText;
+    ASSERT_NE(std::find(drawn.begin(), drawn.end(), "Hello"), drawn.end());
+    ASSERT_NE(std::find(drawn.begin(), drawn.end(), "world"), drawn.end());
+    ASSERT_EQ(std::find(drawn.begin(), drawn.end(), "H"), drawn.end());
+}
+
+// Sweeping down the left and right of the window finds the first and last glyph of each line
+TEST_F(WindowTest, DisplayToBufferFindsLineEnds) {
+    pBuffer->SetText("One\nTwo\n\nThree");
+    editor->Display();
+
+    std::vector<long> starts;
+    std::vector<long> ends;
+    for (float y = 0.0f; y < 400.0f; y += 1.0f) {
+        auto start = pWindow->DisplayToBuffer(NVec2f(0.0f, y)).index;
+        auto end = pWindow->DisplayToBuffer(NVec2f(400.0f, y)).index;
+        if (starts.empty() || starts.back() != start) starts.push_back(start);
+        if (ends.empty() || ends.back() != end) ends.push_back(end);
+    }
+    ASSERT_EQ(starts, std::vector<long>({0, 4, 8, 9}));
+    ASSERT_EQ(ends, std::vector<long>({3, 7, 8, 14}));
+}
+
+// Underlines which overlap on a line are stacked in rows; those on other lines don't push them down
+TEST_F(WindowTest, LayoutStacksUnderlinesByLine) {
+    pBuffer->SetText("first line\nsecond line\n");
+    auto addMarker = [&](ByteIndex first, ByteIndex second, uint32_t markerType) {
+        auto marker = std::make_shared<RangeMarker>(*pBuffer);
+        marker->markerType = markerType;
+        marker->displayType = RangeMarkerDisplayType::Underline;
+        marker->SetRange(ByteRange(first, second));
+        return marker;
+    };
+    auto first = addMarker(0, 5, RangeMarkerType::Mark);
+    auto overlapping = addMarker(2, 8, RangeMarkerType::Mark);
+    auto after = addMarker(6, 9, RangeMarkerType::Mark);
+    auto nextLine = addMarker(13, 16, RangeMarkerType::Mark);
+    auto widget = addMarker(11, 12, RangeMarkerType::Widget);
+
+    pWindow->DirtyLayout();
+    editor->Display();
+    ASSERT_EQ(first->displayRow, 0);
+    ASSERT_EQ(overlapping->displayRow, 1);
+    ASSERT_EQ(after->displayRow, 0);
+    ASSERT_EQ(nextLine->displayRow, 0);
+    ASSERT_GT(widget->inlineSize.x, 0.0f);
+}
+
+// Laying out and drawing a buffer carrying a marker on most words
+// Run with --gtest_also_run_disabled_tests
+TEST_F(WindowTest, DISABLED_BenchmarkLayoutWithMarkers) {
+    const int LineCount = 10000;
+    std::string text;
+    for (int line = 0; line < LineCount; line++) {
+        text += "A line of text with markers: " + std::to_string(line) + "\n";
+    }
+    pBuffer->SetText(text);
+
+    const int Layouts = 5;
+    auto timeLayout = [&](size_t markerCount) {
+        Timer timer;
+        timer_start(timer);
+        for (int i = 0; i < Layouts; i++) {
+            pWindow->DirtyLayout();
+            pWindow->BufferToDisplay();
+        }
+        std::cout << markerCount << " markers: " << (timer_get_elapsed_seconds(timer) * 1000.0 / Layouts) << "ms per layout" << std::endl;
+    };
+    timeLayout(0);
+
+    // 50k markers, as a linter or a search might leave over a file
+    std::vector<std::shared_ptr<RangeMarker>> markers;
+    for (long line = 0; line < LineCount; line++) {
+        ByteRange lineRange;
+        pBuffer->GetLineOffsets(line, lineRange);
+        for (ByteIndex word = 0; word < 5; word++) {
+            auto marker = std::make_shared<RangeMarker>(*pBuffer);
+            marker->displayType = word % 2 ? RangeMarkerDisplayType::Underline : RangeMarkerDisplayType::Background | RangeMarkerDisplayType::Indicator;
+            marker->SetRange(ByteRange(lineRange.first + word * 5, lineRange.first + word * 5 + 4));
+            markers.push_back(marker);
+        }
+    }
+
+    timeLayout(markers.size());
+
+    const int Frames = 100;
+    pWindow->SetBufferCursor(GlyphIterator(pBuffer, long(text.size() / 2)));
+    editor->Display();
+    Timer timer;
+    timer_start(timer);
+    for (int i = 0; i < Frames; i++) editor->Display();
+    std::cout << markers.size() << " markers: " << (timer_get_elapsed_seconds(timer) * 1000.0 / Frames) << "ms per frame" << std::endl;
+}
+
+// Per keystroke layout cost should be the same for a small and a big buffer
+// Run with --gtest_also_run_disabled_tests
+TEST_F(WindowTest, DISABLED_BenchmarkTypingLayout) {
+    for (auto lineCount: {10000, 200000}) {
+        std::string text;
+        for (int line = 0; line < lineCount; line++) {
+            text += "A line of text in a large log file: " + std::to_string(line) + "\n";
+        }
+        pBuffer->SetText(text);
+
+        auto cursor = GlyphIterator(pBuffer, long(text.size() / 2));
+        pWindow->SetBufferCursor(cursor);
+        pWindow->BufferToDisplay();
+
+        // Only the layout is timed, not the buffer edit
+        const int Keystrokes = 200;
+        double seconds = 0.0;
+        for (int i = 0; i < Keystrokes; i++) {
+            ChangeRecord record;
+            pBuffer->Insert(cursor, "x", record);
+            cursor += 1;
+
+            Timer timer;
+            timer_start(timer);
+            pWindow->SetBufferCursor(cursor);
+            pWindow->BufferToDisplay();
+            seconds += timer_get_elapsed_seconds(timer);
+        }
+
+        std::cout << lineCount << " lines: " << (seconds * 1000000.0 / Keystrokes) << "us layout per keystroke" << std::endl;
+    }
+}
+
+// Moving the cursor at the end of a buffer should cost the same however many lines come before it
+// Run with --gtest_also_run_disabled_tests
+TEST_F(WindowTest, DISABLED_BenchmarkCursorAtEnd) {
+    for (auto lineCount: {10000, 1000000}) {
+        std::string text;
+        for (int line = 0; line < lineCount; line++) {
+            text += "A line of text in a large log file: " + std::to_string(line) + "\n";
+        }
+        pBuffer->SetText(text);
+        pWindow->SetBufferCursor(pBuffer->End() - 1);
+        editor->Display();
+
+        const int Moves = 1000;
+        Timer timer;
+        timer_start(timer);
+        for (int i = 0; i < Moves; i++) {
+            pWindow->MoveCursorY(i % 2 ? 1 : -1);
+            pWindow->BufferToDisplay();
+            pWindow->DisplayToBuffer(NVec2f(100.0f, 100.0f));
+        }
+        std::cout << lineCount << " lines: " << (timer_get_elapsed_seconds(timer) * 1000000.0 / Moves) << "us per cursor move" << std::endl;
+
+        timer_start(timer);
+        editor->Display();
+        std::cout << lineCount << " lines: " << (timer_get_elapsed_seconds(timer) * 1000.0) << "ms per frame" << std::endl;
+    }
+}
@@ -0,0 +1,96 @@
+#include "zep/text_scan.h"
+
+#include "simd.h"
+
+namespace Zep {
+
+namespace {
+
+void ResetScan(TextScan &scan) {
+    scan.lineEnds.clear();
+    scan.hasCR = false;
+    scan.hasTabs = false;
+    scan.hasSpaceTabs = false;
+}
+
+// The rest of the text from p, a byte at a time
+void ScanBytes(const uint8_t *p, const uint8_t *pBegin, const uint8_t *pEnd, TextScan &scan, ByteIndex offset, bool lastSpace) {
+    for (; p < pEnd; p++) {
+        switch (*p) {
+            case '\n':
+                scan.lineEnds.push_back(offset + ByteIndex(p - pBegin) + 1);
+                break;
+            case '\r':
+                scan.hasCR = true;
+                break;
+            case '\t':
+                scan.hasTabs = true;
+                break;
+            case ' ':
+                if (lastSpace) scan.hasSpaceTabs = true;
+                break;
+        }
+        lastSpace = *p == ' ';
+    }
+}
+
+#if defined(ZEP_SIMD_AVX2) || defined(ZEP_SIMD_SSE2)
+
+// One bit per byte of the block for each char we look for
+struct BlockMasks {
+    uint32_t newline;
+    uint32_t cr;
+    uint32_t tab;
+    uint32_t space;
+};
+
+#if defined(ZEP_SIMD_AVX2)
+const long BlockSize = 32;
+
+BlockMasks ScanBlock(const uint8_t *p) {
+    auto block = _mm256_loadu_si256((const __m256i *) p);
+    auto match = [&](char ch) { return uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(ch)))); };
+    return {match('\n'), match('\r'), match('\t'), match(' ')};
+}
+#else
+const long BlockSize = 16;
+
+BlockMasks ScanBlock(const uint8_t *p) {
+    auto block = _mm_loadu_si128((const __m128i *) p);
+    auto match = [&](char ch) { return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(ch)))); };
+    return {match('\n'), match('\r'), match('\t'), match(' ')};
+}
+#endif
+
+#endif
+
+} // namespace
+
+void ScanText(const uint8_t *pBegin, const uint8_t *pEnd, TextScan &scan, ByteIndex offset) {
+    ResetScan(scan);
+
+    auto p = pBegin;
+    bool lastSpace = false;
+#if defined(ZEP_SIMD_AVX2) || defined(ZEP_SIMD_SSE2)
+    for (; pEnd - p >= BlockSize; p += BlockSize) {
+        auto masks = ScanBlock(p);
+        for (auto lines = masks.newline; lines != 0; lines &= lines - 1) {
+            scan.lineEnds.push_back(offset + ByteIndex(p - pBegin) + LowestBit(lines) + 1);
+        }
+        scan.hasCR |= masks.cr != 0;
+        scan.hasTabs |= masks.tab != 0;
+
+        // A space with another just before it, which may be the last byte of the previous block
+        scan.hasSpaceTabs |= (masks.space & ((masks.space << 1) | (lastSpace ? 1 : 0))) != 0;
+        lastSpace = ((masks.space >> (BlockSize - 1)) & 1) != 0;
+    }
+#endif
+    ScanBytes(p, pBegin, pEnd, scan, offset, lastSpace);
+}
+
+void ScanTextScalar(const uint8_t *pBegin, const uint8_t *pEnd, TextScan &scan, ByteIndex offset) {
+    ResetScan(scan);
+    ScanBytes(pBegin, pBegin, pEnd, scan, offset, false);
+}
+
+} // namespace Zep
@@ -0,0 +1,225 @@
+#include "zep/text_storage.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Zep {
+
+ByteIndex PieceTable::PieceStart(long piece) const {
+    if (piece >= PieceCount()) return m_size;
+    return m_pieces[piece].start + (piece >= m_stepPiece ? m_stepBytes : 0);
+}
+
+// The piece containing this byte, or the last piece
+long PieceTable::FindPiece(ByteIndex index) const {
+    auto count = PieceCount();
+    if (count == 0) return 0;
+
+    if (m_lastPiece < count && PieceStart(m_lastPiece) <= index) {
+        if (index < PieceStart(m_lastPiece + 1)) return m_lastPiece;
+        if (m_lastPiece + 1 < count && index < PieceStart(m_lastPiece + 2)) return ++m_lastPiece;
+    }
+
+    long low = 0;
+    long high = count - 1;
+    while (low < high) {
+        auto mid = (low + high + 1) / 2;
+        if (PieceStart(mid) <= index) low = mid;
+        else high = mid - 1;
+    }
+    m_lastPiece = low;
+    return low;
+}
+
+// Where this byte of the text is in the store
+ByteIndex PieceTable::At(ByteIndex index) const {
+    assert(index >= 0 && index < m_size);
+    auto piece = FindPiece(index);
+    return m_pieces[piece].source + (index - PieceStart(piece));
+}
+
+// Move the step to this piece, adding or removing it from the pieces it passes over
+void PieceTable::MoveStep(long piece) {
+    if (m_stepBytes != 0) {
+        for (; m_stepPiece < piece; m_stepPiece++) m_pieces[m_stepPiece].start += m_stepBytes;
+        for (; m_stepPiece > piece; m_stepPiece--) m_pieces[m_stepPiece - 1].start -= m_stepBytes;
+    }
+    m_stepPiece = piece;
+}
+
+void PieceTable::InsertPiece(long piece, ByteIndex start, ByteIndex source) {
+    if (piece < m_stepPiece) m_stepPiece++;
+    else start -= m_stepBytes;
+
+    Piece newPiece{start, source};
+    m_pieces.insert(m_pieces.begin() + piece, &newPiece, &newPiece + 1);
+}
+
+void PieceTable::ErasePieces(long first, long last) {
+    if (first >= last) return;
+    if (m_stepPiece > first) m_stepPiece = std::max(first, m_stepPiece - (last - first));
+    m_pieces.erase(m_pieces.begin() + first, m_pieces.begin() + last);
+}
+
+// Make sure a piece begins at this byte
+void PieceTable::SplitAt(ByteIndex index) {
+    if (index <= 0 || index >= m_size) return;
+
+    auto piece = FindPiece(index);
+    auto start = PieceStart(piece);
+    if (start != index) InsertPiece(piece + 1, index, m_pieces[piece].source + (index - start));
+}
+
+void PieceTable::clear() {
+    m_store.clear();
+    m_pieces.clear();
+    m_stepPiece = 0;
+    m_stepBytes = 0;
+    m_size = 0;
+    m_lastPiece = 0;
+}
+
+void PieceTable::assign(const uint8_t *pBegin, const uint8_t *pEnd) {
+    clear();
+    insert(0, pBegin, pEnd);
+}
+
+void PieceTable::insert(long index, const uint8_t *pBegin, const uint8_t *pEnd) {
+    auto count = ByteIndex(pEnd - pBegin);
+    if (count <= 0) return;
+
+    assert(index >= 0 && index <= m_size);
+    auto source = ByteIndex(m_store.size());
+    m_store.insert(m_store.end(), pBegin, pEnd);
+
+    if (m_size == 0) {
+        m_pieces.clear();
+        m_stepPiece = 0;
+        m_stepBytes = 0;
+        m_lastPiece = 0;
+        m_size = count;
+        InsertPiece(0, 0, source);
+        return;
+    }
+
+    // Typing adds text just after the last text added, so the piece holding it just grows
+    if (index > 0) {
+        auto piece = FindPiece(index - 1);
+        auto pieceStart = PieceStart(piece);
+        auto pieceEnd = PieceStart(piece + 1);
+        if (pieceEnd == index && m_pieces[piece].source + (pieceEnd - pieceStart) == source) {
+            if (piece + 1 < PieceCount()) {
+                MoveStep(piece + 1);
+                m_stepBytes += count;
+            }
+            m_size += count;
+            return;
+        }
+    }
+
+    // Every piece from the insert on moves along, and the new text goes in front of them
+    SplitAt(index);
+    auto piece = index >= m_size ? PieceCount() : FindPiece(index);
+    if (piece < PieceCount()) {
+        MoveStep(piece);
+        m_stepBytes += count;
+    }
+    m_size += count;
+    InsertPiece(piece, index, source);
+    m_lastPiece = piece;
+}
+
+void PieceTable::erase(long begin, long end) {
+    begin = std::max(0l, begin);
+    end = std::min(long(m_size), end);
+    if (begin >= end) return;
+
+    if (begin == 0 && end == m_size) {
+        clear();
+        return;
+    }
+
+    // Remove the pieces covering the range, then close the gap
+    SplitAt(begin);
+    SplitAt(end);
+    auto first = FindPiece(begin);
+    auto last = end >= m_size ? PieceCount() : FindPiece(end);
+    ErasePieces(first, last);
+
+    if (first < PieceCount()) {
+        MoveStep(first);
+        m_stepBytes -= (end - begin);
+    }
+    m_size -= (end - begin);
+
+    // Join the pieces either side if they are next to each other in the store, as when undoing typing
+    if (first > 0 && first < PieceCount()) {
+        auto previousLength = PieceStart(first) - PieceStart(first - 1);
+        if (m_pieces[first - 1].source + previousLength == m_pieces[first].source) {
+            ErasePieces(first, first + 1);
+        }
+    }
+    m_lastPiece = 0;
+}
+
+void PieceTable::ForEachSpan(const std::function<void(const uint8_t *pBegin, const uint8_t *pEnd)> &fnSpan) const {
+    for (long piece = 0; piece < PieceCount(); piece++) {
+        auto pBegin = m_store.data() + m_pieces[piece].source;
+        fnSpan(pBegin, pBegin + (PieceStart(piece + 1) - PieceStart(piece)));
+    }
+}
+
+void TextStorage::SetType(TextStorageType type) {
+    if (type == m_type) return;
+
+    std::vector<uint8_t> text(begin(), end());
+    clear();
+    m_type = type;
+    assign(text.data(), text.data() + text.size());
+}
+
+void TextStorage::clear() {
+    if (m_type == TextStorageType::GapBuffer) m_gapBuffer.clear();
+    else m_pieceTable.clear();
+}
+
+void TextStorage::push_back(uint8_t ch) {
+    if (m_type == TextStorageType::GapBuffer) m_gapBuffer.push_back(ch);
+    else m_pieceTable.insert(m_pieceTable.size(), &ch, &ch + 1);
+}
+
+void TextStorage::assign(const uint8_t *pBegin, const uint8_t *pEnd) {
+    if (m_type == TextStorageType::GapBuffer) m_gapBuffer.assign(pBegin, pEnd);
+    else m_pieceTable.assign(pBegin, pEnd);
+}
+
+void TextStorage::insert(long index, const std::string &str) {
+    if (m_type == TextStorageType::GapBuffer) {
+        m_gapBuffer.insert(m_gapBuffer.begin() + index, str.begin(), str.end());
+    } else {
+        auto pBegin = (const uint8_t *) str.data();
+        m_pieceTable.insert(index, pBegin, pBegin + str.size());
+    }
+}
+
+void TextStorage::erase(long begin, long end) {
+    if (m_type == TextStorageType::GapBuffer) m_gapBuffer.erase(m_gapBuffer.begin() + begin, m_gapBuffer.begin() + end);
+    else m_pieceTable.erase(begin, end);
+}
+
+void TextStorage::ForEachSpan(const std::function<void(const uint8_t *pBegin, const uint8_t *pEnd)> &fnSpan) const {
+    if (m_type == TextStorageType::PieceTable) {
+        m_pieceTable.ForEachSpan(fnSpan);
+        return;
+    }
+
+    if (m_gapBuffer.m_pGapStart != m_gapBuffer.m_pStart) fnSpan(m_gapBuffer.m_pStart, m_gapBuffer.m_pGapStart);
+    if (m_gapBuffer.m_pEnd != m_gapBuffer.m_pGapEnd) fnSpan(m_gapBuffer.m_pGapEnd, m_gapBuffer.m_pEnd);
+}
+
+std::string TextStorage::string() const {
+    if (m_type == TextStorageType::GapBuffer) return m_gapBuffer.string();
+    return {begin(), end()};
+}
+
+} // namespace Zep
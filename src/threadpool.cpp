@@ -0,0 +1,199 @@
+#include "zep/threadpool.h"
+
+namespace Zep {
+
+namespace {
+
+// The pool and worker this thread is, if it is one, so the tasks it queues go on its own deques
+thread_local const ThreadPool *t_pThreadPool = nullptr;
+thread_local size_t t_worker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+    // If not enough threads, the pool will just execute all tasks immediately
+    if (threads <= 1) return;
+
+    for (size_t queue = 0; queue <= threads; queue++) m_queues.push_back(std::make_unique<Queue>());
+
+    m_threads.reserve(threads);
+    for (size_t worker = 0; worker < threads; worker++) {
+        m_threads.emplace_back([this, worker]() { WorkerThread(worker); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto &thread: m_threads) thread.join();
+}
+
+void ThreadPool::Run(std::function<void()> fn, TaskPriority priority) {
+    Push(Task{std::move(fn), nullptr}, priority);
+}
+
+void ThreadPool::Run(std::function<void()> fn, TaskPriority priority, const CancelToken &token) {
+    Push(Task{std::move(fn), token.m_cancelled}, priority);
+}
+
+void ThreadPool::Push(Task &&task, TaskPriority priority) {
+    if (m_threads.empty()) {
+        if (!task.cancelled || !*task.cancelled) task.fn();
+        return;
+    }
+
+    auto &queue = *m_queues[t_pThreadPool == this ? t_worker : m_threads.size()];
+    {
+        // Counted before a worker can take it, so the count never drops below zero
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        m_queued++;
+        queue.tasks[size_t(priority)].push_back(std::move(task));
+    }
+
+    // A worker going to sleep counts itself before it looks at the count of tasks, and this looks the other
+    // way round, so one of the two always sees the other
+    if (m_sleeping > 0) {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_wake.notify_one();
+    }
+}
+
+bool ThreadPool::Pop(size_t worker, Task &task) {
+    auto take = [&](Queue &queue, size_t priority, bool newest) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto &tasks = queue.tasks[priority];
+        if (tasks.empty()) return false;
+
+        if (newest) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        } else {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        m_queued--;
+        return true;
+    };
+
+    auto workers = m_threads.size();
+    for (size_t priority = 0; priority < size_t(TaskPriority::Count); priority++) {
+        if (m_queued == 0) return false;
+
+        // The newest of this worker's own, then the oldest from outside the pool, then steal the oldest of another's
+        if (take(*m_queues[worker], priority, true)) return true;
+        if (take(*m_queues[workers], priority, false)) return true;
+        for (size_t other = 1; other < workers; other++) {
+            if (take(*m_queues[(worker + other) % workers], priority, false)) return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerThread(size_t worker) {
+    t_pThreadPool = this;
+    t_worker = worker;
+
+    Task task;
+    for (;;) {
+        if (Pop(worker, task)) {
+            if (!task.cancelled || !*task.cancelled) task.fn();
+
+            // Let go of what the task held before going to sleep
+            task = Task();
+            continue;
+        }
+
+        // Counted, but being taken by another worker
+        if (m_queued > 0) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        if (m_stop) return;
+        m_sleeping++;
+        m_wake.wait(lock, [this]() { return m_stop || m_queued > 0; });
+        m_sleeping--;
+    }
+}
+
+struct TaskGroup::GroupTask {
+    std::function<void()> fn;
+    std::atomic<bool> started{false};
+};
+
+struct TaskGroup::State {
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t pending = 0;
+
+    // Queued, and perhaps not started; the waiting thread runs those which aren't
+    std::vector<std::shared_ptr<GroupTask>> queued;
+
+    // On the pool or the waiting thread, whichever gets to it first
+    void Start(GroupTask &task, const CancelToken &token) {
+        if (task.started.exchange(true)) return;
+        if (!token.IsCancelled()) task.fn();
+        task.fn = nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) finished.notify_all();
+    }
+};
+
+TaskGroup::TaskGroup(ThreadPool &threadPool, TaskPriority priority, const CancelToken &token)
+    : m_threadPool(threadPool), m_priority(priority), m_token(token), m_state(std::make_shared<State>()) {}
+
+TaskGroup::~TaskGroup() {
+    Wait();
+}
+
+void TaskGroup::Run(std::function<void()> fn) {
+    auto task = std::make_shared<GroupTask>();
+    task->fn = std::move(fn);
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->pending++;
+        m_state->queued.push_back(task);
+    }
+    m_state->finished.notify_all();
+
+    // The pool drops the tasks of a cancelled token without running them, so the group looks at it instead
+    m_threadPool.Run([state = m_state, task, token = m_token]() { state->Start(*task, token); }, m_priority);
+}
+
+void TaskGroup::Wait() {
+    auto &state = *m_state;
+    for (;;) {
+        std::shared_ptr<GroupTask> task;
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            if (state.pending == 0) {
+                state.queued.clear();
+                return;
+            }
+
+            while (!state.queued.empty() && !task) {
+                if (!state.queued.back()->started) task = state.queued.back();
+                state.queued.pop_back();
+            }
+
+            // All started; wait for them to finish, or to queue more
+            if (!task) {
+                state.finished.wait(lock, [&]() { return state.pending == 0 || !state.queued.empty(); });
+                continue;
+            }
+        }
+        state.Start(*task, m_token);
+    }
+}
+
+bool TaskGroup::Finished() const {
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->pending == 0;
+}
+
+} // namespace Zep
@@ -0,0 +1,232 @@
+#include "zep/undo_journal.h"
+#include "zep/buffer.h"
+
+namespace Zep {
+
+void ZepUndoJournal::AddGroup() {
+    DropRedo();
+
+    // An empty group would make an undo which does nothing
+    if (m_end > m_first && m_records.back().type == UndoRecordType::Group) return;
+
+    std::string empty;
+    Add(UndoRecordType::Group, nullptr, 0, empty, empty, -1, -1);
+}
+
+void ZepUndoJournal::AddInsert(ZepBuffer &buffer, ByteIndex start, const std::string &inserted, ByteIndex cursorBefore, ByteIndex cursorAfter) {
+    DropRedo();
+    if (inserted.empty()) return;
+
+    // Typing on from the last insert
+    auto pLast = LastEdit(buffer, UndoRecordType::Insert);
+    if (pLast && start == pLast->start + ByteIndex(pLast->insertedLength)) {
+        m_text += inserted;
+        pLast->insertedLength += inserted.size();
+        Extend(*pLast, cursorBefore, cursorAfter);
+        return;
+    }
+
+    Add(UndoRecordType::Insert, &buffer, start, std::string(), inserted, cursorBefore, cursorAfter);
+}
+
+void ZepUndoJournal::AddDelete(ZepBuffer &buffer, ByteIndex start, const std::string &deleted, ByteIndex cursorBefore, ByteIndex cursorAfter) {
+    DropRedo();
+    if (deleted.empty()) return;
+
+    // Deleting forward from the last delete, or back from it
+    auto pLast = LastEdit(buffer, UndoRecordType::Delete);
+    if (pLast && start == pLast->start) {
+        m_text += deleted;
+        pLast->deletedLength += deleted.size();
+        Extend(*pLast, cursorBefore, cursorAfter);
+        return;
+    } else if (pLast && start + ByteIndex(deleted.size()) == pLast->start) {
+        m_text.insert(pLast->text, deleted);
+        pLast->start = start;
+        pLast->deletedLength += deleted.size();
+        Extend(*pLast, cursorBefore, cursorAfter);
+        return;
+    }
+
+    Add(UndoRecordType::Delete, &buffer, start, deleted, std::string(), cursorBefore, cursorAfter);
+}
+
+void ZepUndoJournal::AddReplace(ZepBuffer &buffer, ReplaceRangeMode mode, ByteIndex start, const std::string &deleted, const std::string &inserted, ByteIndex cursorBefore, ByteIndex cursorAfter) {
+    DropRedo();
+    Add(mode == ReplaceRangeMode::Fill ? UndoRecordType::Fill : UndoRecordType::Replace, &buffer, start, deleted, inserted, cursorBefore, cursorAfter);
+}
+
+GlyphIterator ZepUndoJournal::Undo() {
+    GlyphIterator cursor;
+    if (!CanUndo()) return cursor;
+
+    // Step over a group with nothing in it yet, then undo the edits back to the start of the one before
+    auto index = m_end;
+    if (m_records[index - 1].type == UndoRecordType::Group) index--;
+
+    while (index > m_first) {
+        const auto &record = m_records[--index];
+        if (record.type == UndoRecordType::Group) break;
+
+        auto &buffer = *record.pBuffer;
+        GlyphIterator start(&buffer, record.start);
+        ChangeRecord tempRecord;
+        switch (record.type) {
+            case UndoRecordType::Insert:
+                buffer.Delete(start, start.PeekByteOffset(long(record.insertedLength)), tempRecord);
+                break;
+            case UndoRecordType::Delete:
+                buffer.Insert(start, m_text.substr(record.text, record.deletedLength), tempRecord);
+                break;
+            case UndoRecordType::Replace:
+            case UndoRecordType::Fill: {
+                // A fill leaves the text the same length; a replace puts its text where the old was
+                auto length = record.type == UndoRecordType::Fill ? record.deletedLength : record.insertedLength;
+                buffer.Replace(start, start.PeekByteOffset(long(length)), m_text.substr(record.text, record.deletedLength), ReplaceRangeMode::Replace, tempRecord);
+                break;
+            }
+            default:
+                break;
+        }
+
+        if (record.cursorBefore >= 0) cursor = GlyphIterator(&buffer, record.cursorBefore);
+    }
+
+    m_end = index;
+    return cursor;
+}
+
+GlyphIterator ZepUndoJournal::Redo() {
+    GlyphIterator cursor;
+    if (!CanRedo()) return cursor;
+
+    // Redo the edits up to the start of the next group
+    auto index = m_end;
+    if (m_records[index].type == UndoRecordType::Group) index++;
+
+    for (; index < m_records.size() && m_records[index].type != UndoRecordType::Group; index++) {
+        const auto &record = m_records[index];
+
+        auto &buffer = *record.pBuffer;
+        GlyphIterator start(&buffer, record.start);
+        GlyphIterator end = start.PeekByteOffset(long(record.deletedLength));
+        ChangeRecord tempRecord;
+        switch (record.type) {
+            case UndoRecordType::Insert:
+                buffer.Insert(start, m_text.substr(record.text, record.insertedLength), tempRecord);
+                break;
+            case UndoRecordType::Delete:
+                buffer.Delete(start, end, tempRecord);
+                break;
+            case UndoRecordType::Replace:
+            case UndoRecordType::Fill:
+                buffer.Replace(start, end, m_text.substr(record.text + record.deletedLength, record.insertedLength),
+                    record.type == UndoRecordType::Fill ? ReplaceRangeMode::Fill : ReplaceRangeMode::Replace, tempRecord);
+                break;
+            default:
+                break;
+        }
+
+        if (record.cursorAfter >= 0) cursor = GlyphIterator(&buffer, record.cursorAfter);
+    }
+
+    m_end = index;
+    return cursor;
+}
+
+// Groups are never empty, other than the last one, so the record before a group is an edit
+bool ZepUndoJournal::CanUndo() const {
+    if (m_end == m_first) return false;
+    return m_records[m_end - 1].type != UndoRecordType::Group || m_end - 1 > m_first;
+}
+
+bool ZepUndoJournal::CanRedo() const {
+    if (m_end == m_records.size()) return false;
+    return m_records[m_end].type != UndoRecordType::Group || m_end + 1 < m_records.size();
+}
+
+void ZepUndoJournal::SetMemoryLimit(size_t bytes) {
+    m_memoryLimit = bytes;
+    Trim();
+}
+
+size_t ZepUndoJournal::MemoryUsed() const {
+    return (m_records.size() - m_first) * sizeof(UndoRecord) + m_text.size() - m_firstText;
+}
+
+void ZepUndoJournal::Clear() {
+    m_records.clear();
+    m_text.clear();
+    m_first = 0;
+    m_firstText = 0;
+    m_end = 0;
+}
+
+void ZepUndoJournal::Add(UndoRecordType type, ZepBuffer *pBuffer, ByteIndex start, const std::string &deleted, const std::string &inserted, ByteIndex cursorBefore, ByteIndex cursorAfter) {
+    UndoRecord record;
+    record.type = type;
+    record.pBuffer = pBuffer;
+    record.start = start;
+    record.cursorBefore = cursorBefore;
+    record.cursorAfter = cursorAfter;
+    record.text = m_text.size();
+    record.deletedLength = deleted.size();
+    record.insertedLength = inserted.size();
+
+    m_text += deleted;
+    m_text += inserted;
+    m_records.push_back(record);
+    m_end = m_records.size();
+    Trim();
+}
+
+// The last edit, if it can grow; it has to be in the group being added to, and its text is at the end
+UndoRecord *ZepUndoJournal::LastEdit(ZepBuffer &buffer, UndoRecordType type) {
+    if (m_end == m_first) return nullptr;
+
+    auto &record = m_records.back();
+    if (record.type != type || record.pBuffer != &buffer) return nullptr;
+    return &record;
+}
+
+void ZepUndoJournal::Extend(UndoRecord &record, ByteIndex cursorBefore, ByteIndex cursorAfter) {
+    if (record.cursorBefore < 0) record.cursorBefore = cursorBefore;
+    if (cursorAfter >= 0) record.cursorAfter = cursorAfter;
+    Trim();
+}
+
+// Nothing can be redone after a new edit
+void ZepUndoJournal::DropRedo() {
+    if (m_end == m_records.size()) return;
+
+    m_text.resize(m_records[m_end].text);
+    m_records.resize(m_end);
+}
+
+// Drop the oldest groups while over the limit
+void ZepUndoJournal::Trim() {
+    if (m_memoryLimit == 0) return;
+
+    while (MemoryUsed() > m_memoryLimit) {
+        auto next = m_first + 1;
+        while (next < m_end && m_records[next].type != UndoRecordType::Group) next++;
+        if (next >= m_end) break;
+
+        m_first = next;
+        m_firstText = m_records[next].text;
+    }
+
+    // Move what is left down once half of it has been dropped, so each record moves a few times at most
+    if (m_first == 0 || m_first < m_records.size() / 2) return;
+
+    m_records.erase(m_records.begin(), m_records.begin() + long(m_first));
+    for (auto &record: m_records) {
+        record.text -= m_firstText;
+    }
+    m_text.erase(0, m_firstText);
+    m_end -= m_first;
+    m_first = 0;
+    m_firstText = 0;
+}
+
+} // namespace Zep
@@ -1,6 +1,8 @@
 #include <cmath>
+#include <optional>
 
 #include "zep/buffer.h"
+#include "zep/buffer_search.h"
 #include "zep/display.h"
 #include "zep/mode.h"
 #include "zep/scroller.h"
@@ -148,7 +150,29 @@ void ZepWindow::Notify(const std::shared_ptr<ZepMessage> &payload) {
 
         if (pMsg->buffer != buffer) return;
 
-        m_layoutDirty = true;
+        switch (pMsg->type) {
+            case BufferMessageType::PreBufferChange:break;
+            case BufferMessageType::TextAdded:
+            case BufferMessageType::TextChanged:
+            case BufferMessageType::TextDeleted:
+            case BufferMessageType::MarkersChanged: {
+                if (!pMsg->startLocation.Valid()) {
+                    m_layoutDirty = true;
+                    break;
+                }
+
+                // Track the changed part of the buffer; the layout only needs to re-wrap those lines
+                auto editStart = pMsg->startLocation.index;
+                auto editEnd = pMsg->type == BufferMessageType::TextDeleted ? editStart : pMsg->endLocation.index;
+                auto editTail = ByteIndex(buffer->workingBuffer.size()) - editEnd;
+                m_editFirst = m_textDirty ? std::min(m_editFirst, editStart) : editStart;
+                m_editTail = m_textDirty ? std::min(m_editTail, editTail) : editTail;
+                m_textDirty = true;
+            }
+                break;
+            default:m_layoutDirty = true;
+                break;
+        }
 
         if (pMsg->type != BufferMessageType::PreBufferChange) {
             // Make sure the cursor is on its 'display' part of the flash cycle after an edit.
@@ -180,8 +204,9 @@ void ZepWindow::Notify(const std::shared_ptr<ZepMessage> &payload) {
     } else if (payload->messageId == Msg::ConfigChanged) {
         m_layoutDirty = true;
     } else if (payload->messageId == Msg::MouseDown) {
-        if (payload->button == ZepMouseButton::Left && m_textRegion->rect.Contains(m_mousePos) && m_mouseIterator.Valid()) {
-            SetBufferCursor(m_mouseIterator);
+        if (payload->button == ZepMouseButton::Left && m_textRegion->rect.Contains(m_mousePos)) {
+            auto mouseIterator = DisplayToBuffer(m_mousePos);
+            if (mouseIterator.Valid()) SetBufferCursor(mouseIterator);
         }
     }
 }
@@ -197,18 +222,15 @@ void ZepWindow::SetDisplayRegion(const NRectf &region) {
 
 void ZepWindow::EnsureCursorVisible() {
     UpdateLayout();
-    GlyphIterator loc = m_bufferCursor;
-    for (auto &line: m_windowLines) {
-        if (line->lineByteRange.first <= loc.index && line->lineByteRange.second > loc.index) {
-            auto cursorLine = line->spanLineIndex;
-            if (cursorLine < m_visibleLineIndices.x) {
-                MoveCursorY(std::abs(m_visibleLineIndices.x - cursorLine));
-            } else if (cursorLine >= m_visibleLineIndices.y) {
-                MoveCursorY((long(m_visibleLineIndices.y) - cursorLine) - 1);
-            }
-            m_cursorMoved = false;
-            return;
+    auto &line = GetSpan(GetMeasuredSpanIndex(m_bufferCursor.index));
+    if (line.BufferCursorInside(m_bufferCursor)) {
+        auto cursorLine = line.spanLineIndex;
+        if (cursorLine < m_visibleLineIndices.x) {
+            MoveCursorY(std::abs(m_visibleLineIndices.x - cursorLine));
+        } else if (cursorLine >= m_visibleLineIndices.y) {
+            MoveCursorY((long(m_visibleLineIndices.y) - cursorLine) - 1);
         }
+        m_cursorMoved = false;
     }
 }
 
@@ -257,7 +279,7 @@ void ZepWindow::GetCharPointer(const GlyphIterator &loc, const uint8_t *&pBegin,
     pEnd = pBegin + utf8_codepoint_length(*pBegin);
 }
 
-NVec2f ZepWindow::ArrangeLineMarkers(tRangeMarkers &markers) {
+NVec2f ZepWindow::ArrangeLineMarkers(const std::vector<std::shared_ptr<RangeMarker>> &markers) {
     // Account for markers
     auto margins = editor.Dpi(editor.config.widgetMargins);
     auto underlineHeight = editor.DpiY(editor.config.underlineHeight) + editor.DpiY(UnderlineMargin * 2.0f);
@@ -265,37 +287,36 @@ NVec2f ZepWindow::ArrangeLineMarkers(tRangeMarkers &markers) {
 
     bool underPad = false;
     std::vector<ByteIndex> markerStack;
-    for (auto &[index, markerSet]: markers) {
-        for (auto &marker: markerSet) {
-            if (marker->displayType & RangeMarkerDisplayType::Underline) {
-                // Stack the markers packed
-                uint32_t row = 0;
-                bool found = false;
-                for (auto &stack: markerStack) {
-                    if (stack <= marker->range.first) {
-                        stack = marker->range.second;
-                        found = true;
-                        break;
-                    }
-                    row++;
+    for (auto &marker: markers) {
+        if (marker->displayType & RangeMarkerDisplayType::Underline) {
+            // Stack the markers packed
+            auto range = marker->GetRange();
+            uint32_t row = 0;
+            bool found = false;
+            for (auto &stack: markerStack) {
+                if (stack <= range.first) {
+                    stack = range.second;
+                    found = true;
+                    break;
                 }
+                row++;
+            }
 
-                if (!found) {
-                    markerStack.push_back(marker->range.second);
-                    row = uint32_t(markerStack.size()) - 1;
-
-                    // Make the height bigger due to new row depth
-                    height.y += underlineHeight;
-                }
+            if (!found) {
+                markerStack.push_back(range.second);
+                row = uint32_t(markerStack.size()) - 1;
 
-                // Underlines get an extra space underneath to make it clear they are under and not over!
-                if (!underPad) {
-                    height.y += 1.0f;
-                    underPad = true;
-                }
+                // Make the height bigger due to new row depth
+                height.y += underlineHeight;
+            }
 
-                marker->displayRow = row;
+            // Underlines get an extra space underneath to make it clear they are under and not over!
+            if (!underPad) {
+                height.y += 1.0f;
+                underPad = true;
             }
+
+            marker->displayRow = row;
         }
     }
 
@@ -304,249 +325,583 @@ NVec2f ZepWindow::ArrangeLineMarkers(tRangeMarkers &markers) {
 
 // This is the most expensive part of window update; applying line span generation for wrapped text and unicode
 // character sizes which may vary in byte count and physical pixel width
-// It can take about a millisecond to do during editing on release buildj; but this is fast enough for now.
-// There are several ways in which this function can be optimized:
-// - Only regenerate spans which have changed, since only the edited line range will change.
+// The full rebuild is only done when the window changes; text edits go through UpdateEditedLineSpans, which
+// regenerates just the edited lines.  There are still several ways in which this can be optimized:
 // - Generate blocks of text, based on syntax highlighting, instead of single characters.
 // - Have a no-wrap text mode and save a lot of the wrapping work.
 // - Do some threading
 void ZepWindow::UpdateLineSpans() {
     m_maxDisplayLines = (long) std::max(0.0f, std::floor(m_textRegion->rect.Height() / m_defaultLineSize));
 
-    const auto &textBuffer = buffer->workingBuffer;
-
-    long bufferLine = 0;
     long spanLine = 0;
     float bufferPosYPx = 0.0f;
-    float xOffset = m_xPad;
 
     bool isMarkdown = buffer->GetFileExtension() == ".md";
 
     // Nuke the existing spans
-    // In future we can in-place modify for speed
     std::for_each(m_windowLines.begin(), m_windowLines.end(), [](SpanInfo *pInfo) { delete pInfo; });
     m_windowLines.clear();
+    m_glyphSpans.clear();
 
-    //auto& display = editor.GetDisplay();
+    // Big buffers just guess the line sizes here, and measure the lines as they come into view
+    auto lineCount = buffer->lineEnds.Count();
+    m_virtualLayout = editor.config.virtualLayoutLines != 0 && lineCount >= long(editor.config.virtualLayoutLines);
 
-    auto widgetMarkers = buffer->GetRangeMarkers(RangeMarkerType::Widget);
-    auto itrWidgetMarkers = widgetMarkers.begin();
+    // The markers of every line, found together
+    auto markers = m_virtualLayout ? LineRangeMarkers() : buffer->GetRangeMarkersOnLines(RangeMarkerType::All, 0, lineCount - 1);
 
     // Process every buffer line
-    for (;;) {
-        // We haven't processed this line yet, so we can't display anything else
-        if (long(buffer->lineEnds.size()) <= bufferLine) break;
-
-        ByteRange lineByteRange;
-        if (!buffer->GetLineOffsets(bufferLine, lineByteRange)) break;
-
-        // Padding at the top of the line
-        NVec2f topPadding = NVec2f(editor.DpiY((float) editor.config.lineMargins.x), editor.DpiY((float) editor.config.lineMargins.y));
-
-        auto markersOnLine = buffer->GetRangeMarkersOnLine(RangeMarkerType::All, bufferLine);
-        auto lineWidgetHeight = ArrangeLineMarkers(markersOnLine);
-
-        // Move the line down by the height of the widget
-        bufferPosYPx += lineWidgetHeight.x;
-
-        // TODO: Find a clean way to do this extra work during layout for extensions that need it
-        ZepTextType type = ZepTextType::Text;
-        if (isMarkdown) {
-            uint32_t headerCount = 0;
-            // Markdown experiment
-            for (auto ch = lineByteRange.first; ch < lineByteRange.second; ch += utf8_codepoint_length(textBuffer[ch])) {
-                if (textBuffer[ch] != '#') break;
-                headerCount++;
-            }
+    for (long bufferLine = 0; bufferLine < lineCount; bufferLine++) {
+        if (m_virtualLayout) {
+            EstimateBufferLine(bufferLine, spanLine, bufferPosYPx, m_windowLines);
+        } else {
+            LayoutBufferLine(bufferLine, isMarkdown, markers.OnLine(bufferLine), spanLine, bufferPosYPx, m_windowLines);
+        }
+    }
 
-            switch (headerCount) {
-                case 0:break;
-                case 1:type = ZepTextType::Heading1;
-                    break;
-                case 2:type = ZepTextType::Heading2;
-                    break;
-                case 3:type = ZepTextType::Heading3;
-                    break;
-                default:break;
-            }
-            // !Markdown experiment
+    // Sanity
+    if (m_windowLines.empty()) {
+        auto *lineInfo = new SpanInfo();
+        lineInfo->lineByteRange.first = 0;
+        lineInfo->lineByteRange.second = 0;
+        lineInfo->padding = NVec2f(0.0f);
+        lineInfo->lineTextSizePx = NVec2f(0.0f);
+        lineInfo->bufferLineNumber = 0;
+        m_windowLines.push_back(lineInfo);
+    }
+
+    m_textSizePx.x = 0.0f;
+    for (auto &line: m_windowLines) {
+        m_textSizePx.x = std::max(m_textSizePx.x, line->lineTextSizePx.x);
+    }
+
+    m_spanShift = SpanShift{long(m_windowLines.size())};
+    m_textDirty = false;
+    m_layoutBufferSize = ByteIndex(buffer->workingBuffer.size());
+    m_layoutFlags = GetWindowFlags();
+
+    UpdateVisibleLineRange();
+    m_layoutDirty = true;
+}
+
+// Re-wrap only the buffer lines that were edited since the last layout.
+// The edits are tracked as the unchanged bytes at the start and the end of the buffer; the spans covering
+// the bytes in between are regenerated, and the spans after them are shifted lazily (see SpanShift).
+// Returns false if the spans can't be patched, and need a full rebuild.
+bool ZepWindow::UpdateEditedLineSpans() {
+    if (m_windowLines.empty() || m_layoutFlags != GetWindowFlags()) return false;
+
+    auto lineCount = buffer->lineEnds.Count();
+    if (m_virtualLayout != (editor.config.virtualLayoutLines != 0 && lineCount >= long(editor.config.virtualLayoutLines))) return false;
+
+    auto bufferSize = ByteIndex(buffer->workingBuffer.size());
+    auto editTail = std::min(m_editTail, std::min(bufferSize, m_layoutBufferSize));
+    auto editFirst = std::min(m_editFirst, m_layoutBufferSize - editTail);
+
+    auto spanBufferLine = [&](long index) {
+        return m_windowLines[index]->bufferLineNumber + (index >= m_spanShift.fromSpan ? m_spanShift.bufferLines : 0);
+    };
+
+    // Find the old spans for the edit, widened to cover whole buffer lines
+    auto lastSpan = long(m_windowLines.size()) - 1;
+    auto firstEdited = GetSpanIndex(editFirst);
+    auto lastEdited = editTail == 0 ? lastSpan : GetSpanIndex(m_layoutBufferSize - editTail);
+    if (lastEdited < firstEdited) return false;
+
+    while (firstEdited > 0 && spanBufferLine(firstEdited - 1) == spanBufferLine(firstEdited)) firstEdited--;
+    while (lastEdited < lastSpan && spanBufferLine(lastEdited + 1) == spanBufferLine(lastEdited)) lastEdited++;
+
+    auto lastLine = editTail == 0 ? lineCount - 1 : buffer->GetBufferLine(GlyphIterator(buffer, bufferSize - editTail));
+    ReplaceSpans(firstEdited, lastEdited, lastLine, bufferSize - m_layoutBufferSize, m_virtualLayout);
+
+    m_textDirty = false;
+    m_layoutBufferSize = bufferSize;
+
+    UpdateVisibleLineRange();
+    return true;
+}
+
+// Regenerate the spans [firstSpan, lastSpan] from the buffer lines between the first span's line and 'lastLine'.
+// The spans beyond them are moved by the change in size, through the pending shift.
+// Returns the change in height of the replaced spans.
+float ZepWindow::ReplaceSpans(long firstSpan, long lastSpan, long lastLine, ByteIndex byteDelta, bool estimate) {
+    auto spanBufferLine = [&](long index) {
+        return m_windowLines[index]->bufferLineNumber + (index >= m_spanShift.fromSpan ? m_spanShift.bufferLines : 0);
+    };
+
+    auto firstLine = spanBufferLine(firstSpan);
+    auto oldLastLine = spanBufferLine(lastSpan);
+    auto spanCount = long(m_windowLines.size());
+
+    // Spans up to the end of the replaced ones are made absolute; the ones beyond carry the shift
+    MoveSpanShift(lastSpan + 1);
+
+    auto &firstSpanInfo = *m_windowLines[firstSpan];
+    auto &lastSpanInfo = *m_windowLines[lastSpan];
+    float bufferPosYPx = firstSpanInfo.yOffsetPx - firstSpanInfo.lineWidgetHeights.x;
+    float oldEndPx = lastSpanInfo.yOffsetPx + lastSpanInfo.FullLineHeightPx() + lastSpanInfo.lineWidgetHeights.y;
+    if (lastSpan < spanCount - 1) {
+        auto &nextSpan = *m_windowLines[lastSpan + 1];
+        oldEndPx = nextSpan.yOffsetPx + m_spanShift.yPx - nextSpan.lineWidgetHeights.x;
+    }
+
+    bool isMarkdown = buffer->GetFileExtension() == ".md";
+    auto markers = estimate ? LineRangeMarkers() : buffer->GetRangeMarkersOnLines(RangeMarkerType::All, firstLine, lastLine);
+
+    std::vector<SpanInfo *> spans;
+    long spanLine = firstSpan;
+    for (long bufferLine = firstLine; bufferLine <= lastLine; bufferLine++) {
+        if (estimate) {
+            EstimateBufferLine(bufferLine, spanLine, bufferPosYPx, spans);
+        } else {
+            LayoutBufferLine(bufferLine, isMarkdown, markers.OnLine(bufferLine), spanLine, bufferPosYPx, spans);
         }
+    }
 
-        auto &font = editor.display->GetFont(type);
-        int textHeight = font.pixelHeight;
+    // If we replace the widest span, the text width must be found again
+    float removedWidth = 0.0f;
+    float addedWidth = 0.0f;
+    for (auto itr = m_windowLines.begin() + firstSpan; itr != m_windowLines.begin() + lastSpan + 1; itr++) {
+        removedWidth = std::max(removedWidth, (*itr)->lineTextSizePx.x);
+        if (!(*itr)->lineCodePoints.empty()) {
+            m_glyphSpans.erase(std::remove(m_glyphSpans.begin(), m_glyphSpans.end(), *itr), m_glyphSpans.end());
+        }
+        delete *itr;
+    }
 
-        // text line height is top/bottom pad
-        float fullLineHeight = textHeight + topPadding.x + topPadding.y;
+    for (auto &line: spans) {
+        addedWidth = std::max(addedWidth, line->lineTextSizePx.x);
+    }
 
-        // Start a new line
-        auto *lineInfo = new SpanInfo();
-        lineInfo->pFont = &font;
-        lineInfo->lineWidgetHeights = lineWidgetHeight;
-        lineInfo->bufferLineNumber = bufferLine;
-        lineInfo->spanLineIndex = spanLine;
-        lineInfo->lineByteRange.first = lineByteRange.first;
-        lineInfo->lineByteRange.second = lineByteRange.first;
-        lineInfo->yOffsetPx = bufferPosYPx;
-        lineInfo->padding = topPadding;
-        lineInfo->lineTextSizePx.x = xOffset;
-        lineInfo->lineTextSizePx.y = float(textHeight);
+    auto oldCount = lastSpan + 1 - firstSpan;
+    auto newCount = long(spans.size());
+    if (newCount == oldCount) {
+        std::copy(spans.begin(), spans.end(), m_windowLines.begin() + firstSpan);
+    } else {
+        m_windowLines.erase(m_windowLines.begin() + firstSpan, m_windowLines.begin() + lastSpan + 1);
+        m_windowLines.insert(m_windowLines.begin() + firstSpan, spans.begin(), spans.end());
+    }
+
+    // Everything after the replaced spans moves by the change in size
+    auto heightDelta = bufferPosYPx - oldEndPx;
+    m_spanShift.fromSpan = firstSpan + newCount;
+    if (m_spanShift.fromSpan < long(m_windowLines.size())) {
+        m_spanShift.bytes += byteDelta;
+        m_spanShift.bufferLines += lastLine - oldLastLine;
+        m_spanShift.spanLines += newCount - oldCount;
+        m_spanShift.yPx += heightDelta;
+    } else {
+        m_spanShift = SpanShift{m_spanShift.fromSpan};
+    }
+
+    if (addedWidth >= m_textSizePx.x || removedWidth < m_textSizePx.x) {
+        m_textSizePx.x = std::max(m_textSizePx.x, addedWidth);
+    } else {
+        m_textSizePx.x = 0.0f;
+        for (auto &line: m_windowLines) {
+            m_textSizePx.x = std::max(m_textSizePx.x, line->lineTextSizePx.x);
+        }
+    }
+
+    return heightDelta;
+}
+
+// Guess the size of a buffer line without measuring it, for a virtual layout.
+// The whole line goes in a single span, which is tall enough for the rows it will probably wrap to.
+void ZepWindow::EstimateBufferLine(long bufferLine, long &spanLine, float &bufferPosYPx, std::vector<SpanInfo *> &spans) {
+    ByteRange lineByteRange;
+    if (!buffer->GetLineOffsets(bufferLine, lineByteRange)) return;
+
+    auto &font = editor.display->GetFont(ZepTextType::Text);
+    auto charWidth = font.GetDefaultCharSize().x;
+    auto topPadding = NVec2f(editor.DpiY((float) editor.config.lineMargins.x), editor.DpiY((float) editor.config.lineMargins.y));
+    auto rowHeight = font.pixelHeight + topPadding.x + topPadding.y;
+
+    // Assume a code point per byte, and not counting the line end
+    auto textWidth = m_xPad + std::max(0l, lineByteRange.second - lineByteRange.first - 1) * (charWidth + m_xPad);
+    long rows = 1;
+    if ((GetWindowFlags() & WindowFlags::WrapText) && m_textRegion->rect.Width() > charWidth * 2) {
+        rows = std::max(1l, long(std::ceil(textWidth / (m_textRegion->rect.Width() - charWidth * 2))));
+        textWidth = std::min(textWidth, m_textRegion->rect.Width());
+    }
+
+    auto *lineInfo = new SpanInfo();
+    lineInfo->estimated = true;
+    lineInfo->pFont = &font;
+    lineInfo->bufferLineNumber = bufferLine;
+    lineInfo->spanLineIndex = spanLine;
+    lineInfo->lineByteRange = lineByteRange;
+    lineInfo->yOffsetPx = bufferPosYPx;
+    lineInfo->padding = topPadding;
+    lineInfo->lineTextSizePx.x = textWidth;
+    lineInfo->lineTextSizePx.y = rows * rowHeight - topPadding.x - topPadding.y;
+    spans.push_back(lineInfo);
+
+    spanLine++;
+    bufferPosYPx += rows * rowHeight;
+}
+
+// Replace an estimated span with the real spans for its line; keeping the text in view still if it is above the view
+void ZepWindow::MeasureSpan(long index) {
+    if (!m_windowLines[index]->estimated) return;
+
+    auto spanCount = long(m_windowLines.size());
+    auto heightDelta = ReplaceSpans(index, index, m_windowLines[index]->bufferLineNumber + (index >= m_spanShift.fromSpan ? m_spanShift.bufferLines : 0), 0, false);
+
+    if (index < m_visibleLineIndices.x) {
+        auto added = long(m_windowLines.size()) - spanCount;
+        m_visibleLineIndices.x += added;
+        m_visibleLineIndices.y += added;
+        m_textOffsetPx += heightDelta;
+    }
+}
+
+// The span containing the byte index, after measuring it if it was estimated
+long ZepWindow::GetMeasuredSpanIndex(ByteIndex index) {
+    auto spanIndex = GetSpanIndex(index);
+    if (m_windowLines[spanIndex]->estimated) {
+        MeasureSpan(spanIndex);
+        spanIndex = GetSpanIndex(index);
+    }
+    return spanIndex;
+}
+
+// Generate the spans for a single buffer line; a wrapped line is split into several spans.
+// The spans are added to 'spans', and the span line and y position are moved beyond the line.
+// 'markersOnLine' are all the markers over the line, in the order they start.
+void ZepWindow::LayoutBufferLine(long bufferLine, bool isMarkdown, const std::vector<std::shared_ptr<RangeMarker>> &markersOnLine, long &spanLine, float &bufferPosYPx, std::vector<SpanInfo *> &spans) {
+    const auto &textBuffer = buffer->workingBuffer;
+
+    ByteRange lineByteRange;
+    if (!buffer->GetLineOffsets(bufferLine, lineByteRange)) return;
+
+    auto firstSpan = spans.size();
+    float xOffset = m_xPad;
 
-        auto inlineMargins = editor.Dpi(editor.config.inlineWidgetMargins);
+    // Padding at the top of the line
+    NVec2f topPadding = NVec2f(editor.DpiY((float) editor.config.lineMargins.x), editor.DpiY((float) editor.config.lineMargins.y));
 
-        // These offsets are 0 -> n + 1, i.e. the last offset the buffer returns is 1 beyond the current
-        // Note: Must not use pointers into the character buffer!
+    auto lineWidgetHeight = ArrangeLineMarkers(markersOnLine);
+
+    // Move the line down by the height of the widget
+    bufferPosYPx += lineWidgetHeight.x;
+
+    // TODO: Find a clean way to do this extra work during layout for extensions that need it
+    ZepTextType type = ZepTextType::Text;
+    if (isMarkdown) {
+        uint32_t headerCount = 0;
+        // Markdown experiment
         for (auto ch = lineByteRange.first; ch < lineByteRange.second; ch += utf8_codepoint_length(textBuffer[ch])) {
-            const uint8_t *pCh = &textBuffer[ch];
-            auto textSize = font.GetCharSize(pCh);
+            if (textBuffer[ch] != '#') break;
+            headerCount++;
+        }
 
-            // Skip to current marker
-            while (itrWidgetMarkers != widgetMarkers.end() && itrWidgetMarkers->first < ch) {
-                itrWidgetMarkers++;
-            }
+        switch (headerCount) {
+            case 0:break;
+            case 1:type = ZepTextType::Heading1;
+                break;
+            case 2:type = ZepTextType::Heading2;
+                break;
+            case 3:type = ZepTextType::Heading3;
+                break;
+            default:break;
+        }
+        // !Markdown experiment
+    }
 
-            if (itrWidgetMarkers != widgetMarkers.end()) {
-                if (itrWidgetMarkers->first == ch) {
-                    for (auto &widget: itrWidgetMarkers->second) {
-                        NVec2f inlineSize = widget->inlineSize;
-                        inlineSize.x = inlineMargins.x * 2 + textHeight;
-                        xOffset += inlineSize.x;
-                        widget->inlineSize = inlineSize;
-                    }
-                    lineInfo->lineTextSizePx.x = xOffset;
-                }
+    auto &font = editor.display->GetFont(type);
+    int textHeight = font.pixelHeight;
+
+    // text line height is top/bottom pad
+    float fullLineHeight = textHeight + topPadding.x + topPadding.y;
+
+    // Start a new line
+    auto *lineInfo = new SpanInfo();
+    lineInfo->pFont = &font;
+    lineInfo->lineWidgetHeights = lineWidgetHeight;
+    lineInfo->bufferLineNumber = bufferLine;
+    lineInfo->spanLineIndex = spanLine;
+    lineInfo->lineByteRange.first = lineByteRange.first;
+    lineInfo->lineByteRange.second = lineByteRange.first;
+    lineInfo->yOffsetPx = bufferPosYPx;
+    lineInfo->padding = topPadding;
+    lineInfo->lineTextSizePx.x = xOffset;
+    lineInfo->lineTextSizePx.y = float(textHeight);
+
+    auto inlineMargins = editor.Dpi(editor.config.inlineWidgetMargins);
+
+    // The widgets on the line, by where they start; a marker's range is worked out from the tree, so it is found once
+    std::vector<std::pair<ByteIndex, RangeMarker *>> widgets;
+    for (auto &marker: markersOnLine) {
+        if (marker->markerType & RangeMarkerType::Widget) widgets.emplace_back(marker->GetRange().first, marker.get());
+    }
+    auto itrWidgets = widgets.begin();
+
+    // These offsets are 0 -> n + 1, i.e. the last offset the buffer returns is 1 beyond the current
+    // Note: Must not use pointers into the character buffer!
+    for (auto ch = lineByteRange.first; ch < lineByteRange.second; ch += utf8_codepoint_length(textBuffer[ch])) {
+        const uint8_t *pCh = &textBuffer[ch];
+        auto textSize = font.GetCharSize(pCh);
+
+        // Skip to current marker
+        while (itrWidgets != widgets.end() && itrWidgets->first < ch) {
+            itrWidgets++;
+        }
+
+        if (itrWidgets != widgets.end() && itrWidgets->first == ch) {
+            for (; itrWidgets != widgets.end() && itrWidgets->first == ch; itrWidgets++) {
+                auto *widget = itrWidgets->second;
+                NVec2f inlineSize = widget->inlineSize;
+                inlineSize.x = inlineMargins.x * 2 + textHeight;
+                xOffset += inlineSize.x;
+                widget->inlineSize = inlineSize;
             }
+            lineInfo->lineTextSizePx.x = xOffset;
+        }
 
-            // Wrap if we have displayed at least one char, and we are wrapping.
-            // Don't wrap just for the CR
-            if ((GetWindowFlags() & WindowFlags::WrapText) &&
-                ch != lineByteRange.first &&
-                *pCh != '\n' && *pCh != 0) {
-                // At least a single char has wrapped; close the old line, start a new one
-                if (((xOffset + textSize.x) + textSize.x) >= (m_textRegion->rect.Width())) {
-                    // Remember the offset beyond the end of the line
-                    lineInfo->lineByteRange.second = ch;
-                    lineInfo->lineTextSizePx.x = xOffset;
-                    m_windowLines.push_back(lineInfo);
-
-                    // Next line
-                    lineInfo = new SpanInfo();
-                    spanLine++;
-                    bufferPosYPx += fullLineHeight + lineWidgetHeight.y;
-
-                    // Reset the line margin and height, because when we split a line we don't include a
-                    // custom widget space above it.  That goes just above the first part of the line
-                    topPadding.x = (float) editor.config.lineMargins.x;
-                    fullLineHeight = textHeight + topPadding.x + topPadding.y;
-
-                    // Now jump to the next 'screen line' for the rest of this 'buffer line'
-                    lineInfo->lineByteRange = ByteRange(ch, ch + utf8_codepoint_length(textBuffer[ch]));
-                    lineInfo->spanLineIndex = spanLine;
-                    lineInfo->bufferLineNumber = bufferLine;
-                    lineInfo->yOffsetPx = bufferPosYPx;
-                    lineInfo->padding = topPadding;
-                    lineInfo->lineTextSizePx.y = float(textHeight);
-                    lineInfo->lineTextSizePx.x = xOffset;
-                    lineInfo->pFont = &font;
-
-                    xOffset = m_xPad;
-                } else {
-                    xOffset += textSize.x + m_xPad;
-                }
+        // Wrap if we have displayed at least one char, and we are wrapping.
+        // Don't wrap just for the CR
+        if ((GetWindowFlags() & WindowFlags::WrapText) &&
+            ch != lineByteRange.first &&
+            *pCh != '\n' && *pCh != 0) {
+            // At least a single char has wrapped; close the old line, start a new one
+            if (((xOffset + textSize.x) + textSize.x) >= (m_textRegion->rect.Width())) {
+                // Remember the offset beyond the end of the line
+                lineInfo->lineByteRange.second = ch;
+                lineInfo->lineTextSizePx.x = xOffset;
+                spans.push_back(lineInfo);
+
+                // Next line
+                lineInfo = new SpanInfo();
+                spanLine++;
+                bufferPosYPx += fullLineHeight + lineWidgetHeight.y;
+
+                // Reset the line margin and height, because when we split a line we don't include a
+                // custom widget space above it.  That goes just above the first part of the line
+                topPadding.x = (float) editor.config.lineMargins.x;
+                fullLineHeight = textHeight + topPadding.x + topPadding.y;
+
+                // Now jump to the next 'screen line' for the rest of this 'buffer line'
+                lineInfo->lineByteRange = ByteRange(ch, ch + utf8_codepoint_length(textBuffer[ch]));
+                lineInfo->spanLineIndex = spanLine;
+                lineInfo->bufferLineNumber = bufferLine;
+                lineInfo->yOffsetPx = bufferPosYPx;
+                lineInfo->padding = topPadding;
+                lineInfo->lineTextSizePx.y = float(textHeight);
+                lineInfo->lineTextSizePx.x = xOffset;
+                lineInfo->pFont = &font;
+
+                xOffset = m_xPad;
             } else {
                 xOffset += textSize.x + m_xPad;
             }
+        } else {
+            xOffset += textSize.x + m_xPad;
+        }
 
-            if (*pCh == '\n' && !(GetWindowFlags() & WindowFlags::ShowCR)) {
-                xOffset -= (textSize.x + m_xPad);
-            }
+        if (*pCh == '\n' && !(GetWindowFlags() & WindowFlags::ShowCR)) {
+            xOffset -= (textSize.x + m_xPad);
+        }
 
-            if (*pCh == 0) {
-                xOffset -= (textSize.x + m_xPad);
-            }
+        if (*pCh == 0) {
+            xOffset -= (textSize.x + m_xPad);
+        }
+
+        lineInfo->yOffsetPx = bufferPosYPx;
+        lineInfo->lineByteRange.second = ch + utf8_codepoint_length(textBuffer[ch]);
+        lineInfo->lineTextSizePx.x = std::max(lineInfo->lineTextSizePx.x, xOffset);
+    }
+
+    // Complete the line
+    spans.push_back(lineInfo);
 
-            lineInfo->yOffsetPx = bufferPosYPx;
-            lineInfo->lineByteRange.second = ch + utf8_codepoint_length(textBuffer[ch]);
-            lineInfo->lineTextSizePx.x = std::max(lineInfo->lineTextSizePx.x, xOffset);
+    // Next time round - down a buffer line, down a span line
+    spanLine++;
+    bufferPosYPx += fullLineHeight + lineWidgetHeight.y;
+
+    // Now build the codepoint offsets; a virtual layout builds them when the span is used
+    if (!m_virtualLayout) {
+        for (auto itrSpan = spans.begin() + firstSpan; itrSpan != spans.end(); itrSpan++) {
+            BuildSpanCodePoints(**itrSpan);
         }
+    }
+}
 
-        // Complete the line
-        m_windowLines.push_back(lineInfo);
+void ZepWindow::BuildSpanCodePoints(SpanInfo &span) {
+    const auto &textBuffer = buffer->workingBuffer;
+    auto ch = span.lineByteRange.first;
+
+    span.lineCodePoints.clear();
+    while (ch < span.lineByteRange.second) {
+        LineCharInfo info;
+
+        // Important note: We can't navigate the text buffer by pointers!
+        // The gap buffer will get in the way; so need to be careful to use [] or an iterator
+        // GetCharSize is cached for speed on debug builds.
+        info.iterator = GlyphIterator(buffer, ch);
+        info.size = span.pFont->GetCharSize(&textBuffer[ch]);
+        span.lineCodePoints.push_back(info);
+        ch += utf8_codepoint_length(textBuffer[ch]);
+    }
+}
 
-        // Next time round - down a buffer line, down a span line
-        bufferLine++;
-        spanLine++;
-        xOffset = m_xPad;
-        bufferPosYPx += fullLineHeight + lineWidgetHeight.y;
+void ZepWindow::ShiftSpan(SpanInfo &span, const SpanShift &shift, long sign) {
+    span.lineByteRange.first += shift.bytes * sign;
+    span.lineByteRange.second += shift.bytes * sign;
+    span.bufferLineNumber += shift.bufferLines * sign;
+    span.spanLineIndex += int(shift.spanLines * sign);
+    span.yOffsetPx += shift.yPx * float(sign);
+    for (auto &cp: span.lineCodePoints) {
+        cp.iterator.index += shift.bytes * sign;
     }
+}
 
-    // Sanity
-    if (m_windowLines.empty()) {
-        auto *lineInfo = new SpanInfo();
-        lineInfo->lineByteRange.first = 0;
-        lineInfo->lineByteRange.second = 0;
-        lineInfo->padding = NVec2f(0.0f);
-        lineInfo->lineTextSizePx = NVec2f(0.0f);
-        lineInfo->bufferLineNumber = 0;
-        m_windowLines.push_back(lineInfo);
+// Move the start of the pending shift.  Spans before 'toSpan' are made absolute, and the ones from
+// 'toSpan' onwards carry the shift.  Edits tend to be local, so this is usually a short walk.
+void ZepWindow::MoveSpanShift(long toSpan) {
+    toSpan = std::max(0l, std::min(toSpan, long(m_windowLines.size())));
+    if (m_spanShift.Empty()) {
+        m_spanShift.fromSpan = toSpan;
+        return;
     }
 
-    // Now build the codepoint offsets
-    for (auto &line: m_windowLines) {
-        auto ch = line->lineByteRange.first;
-
-        // TODO: Optimize
-        line->lineCodePoints.clear();
-        uint32_t points = 0;
-        while (ch < line->lineByteRange.second) {
-            LineCharInfo info;
-
-            // Important note: We can't navigate the text buffer by pointers!
-            // The gap buffer will get in the way; so need to be careful to use [] or an iterator
-            // GetCharSize is cached for speed on debug builds.
-            info.iterator = GlyphIterator(buffer, ch);
-            info.size = line->pFont->GetCharSize(&textBuffer[ch]);
-            line->lineCodePoints.push_back(info);
-            ch += utf8_codepoint_length(textBuffer[ch]);
-            points++;
-        }
+    for (; m_spanShift.fromSpan < toSpan; m_spanShift.fromSpan++) {
+        ShiftSpan(*m_windowLines[m_spanShift.fromSpan], m_spanShift, 1);
     }
 
-    UpdateVisibleLineRange();
-    m_layoutDirty = true;
+    while (m_spanShift.fromSpan > toSpan) {
+        m_spanShift.fromSpan--;
+        ShiftSpan(*m_windowLines[m_spanShift.fromSpan], m_spanShift, -1);
+    }
 }
 
-void ZepWindow::UpdateVisibleLineRange() {
-    m_visibleLineIndices.x = (long) m_windowLines.size();
-    m_visibleLineIndices.y = 0;
-    m_textSizePx.x = 0;
-    for (long line = 0; line < long(m_windowLines.size()); line++) {
-        auto &windowLine = *m_windowLines[line];
-        m_textSizePx.x = std::max(m_textSizePx.x, windowLine.lineTextSizePx.x);
-
-        if ((windowLine.yOffsetPx + windowLine.FullLineHeightPx()) <= m_textOffsetPx) {
-            continue;
+SpanInfo &ZepWindow::GetSpan(long index) {
+    if (index >= m_spanShift.fromSpan) {
+        MoveSpanShift(index + 1);
+    }
+
+    auto &span = *m_windowLines[index];
+    if (span.lineCodePoints.empty() && span.ByteLength() > 0 && !span.estimated) {
+        BuildSpanCodePoints(span);
+        m_glyphSpans.push_back(&span);
+    }
+    return span;
+}
+
+// The span containing the byte index; a binary search on the (shifted) start of each span
+long ZepWindow::GetSpanIndex(ByteIndex index) const {
+    long first = 0;
+    auto count = long(m_windowLines.size());
+    while (count > 0) {
+        auto step = count / 2;
+        auto mid = first + step;
+        auto spanStart = m_windowLines[mid]->lineByteRange.first + (mid >= m_spanShift.fromSpan ? m_spanShift.bytes : 0);
+        if (spanStart <= index) {
+            first = mid + 1;
+            count -= step + 1;
+        } else {
+            count = step;
         }
+    }
+    return std::max(0l, first - 1);
+}
 
-        if ((windowLine.yOffsetPx - m_textOffsetPx) >= m_textRegion->rect.Height()) {
-            break;
+// The first span which ends below this height in the text; a binary search on the (shifted) offset of each span
+long ZepWindow::GetSpanIndexAtY(float yPx) const {
+    long first = 0;
+    auto count = long(m_windowLines.size());
+    while (count > 0) {
+        auto step = count / 2;
+        auto mid = first + step;
+        auto spanY = m_windowLines[mid]->yOffsetPx + (mid >= m_spanShift.fromSpan ? m_spanShift.yPx : 0.0f);
+        if ((spanY + m_windowLines[mid]->FullLineHeightPx()) <= yPx) {
+            first = mid + 1;
+            count -= step + 1;
+        } else {
+            count = step;
         }
+    }
+    return first;
+}
 
-        m_visibleLineIndices.x = std::min(m_visibleLineIndices.x, long(line));
-        m_visibleLineIndices.y = long(line);
+// The code point holding the byte index, or -1 if it isn't in the span
+long ZepWindow::GetCodePointIndex(const SpanInfo &span, ByteIndex index) {
+    auto itr = std::lower_bound(span.lineCodePoints.begin(), span.lineCodePoints.end(), index, [](const LineCharInfo &cp, ByteIndex index) {
+        return cp.iterator.index < index;
+    });
+    if (itr == span.lineCodePoints.end() || itr->iterator.index != index) return -1;
+    return long(itr - span.lineCodePoints.begin());
+}
+
+void ZepWindow::UpdateVisibleLineRange() {
+    FindVisibleLineRange();
+
+    if (m_virtualLayout) {
+        UpdateVirtualSpans();
     }
 
-    m_textSizePx.y = m_windowLines[m_windowLines.size() - 1]->yOffsetPx + editor.display->GetFont(ZepTextType::Text).pixelHeight + editor.DpiY(editor.config.lineMargins.y) +
-        editor.DpiY(editor.config.lineMargins.x);
+    auto lastSpan = long(m_windowLines.size()) - 1;
+    m_textSizePx.y = m_windowLines[lastSpan]->yOffsetPx + (lastSpan >= m_spanShift.fromSpan ? m_spanShift.yPx : 0.0f) + editor.display->GetFont(ZepTextType::Text).pixelHeight +
+        editor.DpiY(editor.config.lineMargins.y) + editor.DpiY(editor.config.lineMargins.x);
 
-    m_visibleLineIndices.y++;
     UpdateScrollers();
 }
 
+void ZepWindow::FindVisibleLineRange() {
+    auto spanY = [&](long index) {
+        return m_windowLines[index]->yOffsetPx + (index >= m_spanShift.fromSpan ? m_spanShift.yPx : 0.0f);
+    };
+
+    // Find the first span which isn't above the view
+    m_visibleLineIndices.x = GetSpanIndexAtY(m_textOffsetPx);
+    m_visibleLineIndices.y = m_visibleLineIndices.x;
+    while (m_visibleLineIndices.y < long(m_windowLines.size()) && (spanY(m_visibleLineIndices.y) - m_textOffsetPx) < m_textRegion->rect.Height()) {
+        m_visibleLineIndices.y++;
+    }
+}
+
+// For a virtual layout; measure the estimated lines in and around the view, and drop the code points
+// of the spans which have gone out of view
+void ZepWindow::UpdateVirtualSpans() {
+    const long Margin = 32;
+
+    auto nearView = [&]() {
+        return std::make_pair(std::max(0l, long(m_visibleLineIndices.x) - Margin), std::min(long(m_windowLines.size()), long(m_visibleLineIndices.y) + Margin));
+    };
+
+    // Each measured line can change what is in view, so look again after each one
+    for (bool measured = true; measured;) {
+        measured = false;
+        auto range = nearView();
+        for (auto index = range.first; index < range.second; index++) {
+            if (m_windowLines[index]->estimated) {
+                MeasureSpan(index);
+                FindVisibleLineRange();
+                measured = true;
+                break;
+            }
+        }
+    }
+
+    auto range = nearView();
+    std::vector<SpanInfo *> spansNearView(m_windowLines.begin() + range.first, m_windowLines.begin() + range.second);
+    std::sort(spansNearView.begin(), spansNearView.end());
+
+    auto itrKeep = std::partition(m_glyphSpans.begin(), m_glyphSpans.end(), [&](SpanInfo *pSpan) {
+        return std::binary_search(spansNearView.begin(), spansNearView.end(), pSpan);
+    });
+    for (auto itr = itrKeep; itr != m_glyphSpans.end(); itr++) {
+        (*itr)->lineCodePoints.clear();
+        (*itr)->lineCodePoints.shrink_to_fit();
+    }
+    m_glyphSpans.erase(itrKeep, m_glyphSpans.end());
+}
+
 const SpanInfo &ZepWindow::GetCursorLineInfo(long y) {
     UpdateLayout();
     y = std::max(0l, y);
     y = std::min(y, long(m_windowLines.size() - 1));
-    return *m_windowLines[y];
+    return GetSpan(y);
 }
 
 // Convert a normalized y coordinate to the window region
@@ -636,8 +991,7 @@ void ZepWindow::DisplayLineBackground(SpanInfo &lineInfo, ZepSyntax *pSyntax) {
     auto underlineHeight = editor.DpiY(editor.config.underlineHeight);
     auto inlineMargins = editor.Dpi(editor.config.inlineWidgetMargins);
     auto screenPosX = m_textRegion->rect.Left() + m_xPad;
-    auto widgetMarkers = buffer->GetRangeMarkers(RangeMarkerType::Widget);
-    auto itrWidgetMarkers = widgetMarkers.begin();
+    auto spanMarkers = GetSpanMarkers(lineInfo, RangeMarkerType::All);
     auto tipTimeSeconds = timer_get_elapsed_seconds(m_toolTipTimer);
 
     NVec2f linePx = GetSpanPixelRange(lineInfo);
@@ -664,24 +1018,27 @@ void ZepWindow::DisplayLineBackground(SpanInfo &lineInfo, ZepSyntax *pSyntax) {
             backColor);
     }
 
+    // Search matches are looked up for the lines being drawn, rather than kept as markers
+    auto *pSearch = buffer->search && buffer->search->visible ? buffer->search.get() : nullptr;
+    auto searchMatch = pSearch ? pSearch->FindFirstEndingAfter(lineInfo.lineByteRange.first) : 0;
+
+    // The syntax of the line is walked along with it, rather than looked up for each char
+    std::optional<SyntaxCursor> syntaxCursor;
+    if (pSyntax) syntaxCursor.emplace(*pSyntax, lineInfo.lineByteRange.first, lineInfo.lineByteRange.second);
+
     // Walk from the start of the line to the end of the line (in buffer chars)
     for (auto &cp: lineInfo.lineCodePoints) {
         NRectf charRect(NVec2f(screenPosX, ToWindowY(lineInfo.yOffsetPx)), NVec2f(screenPosX + cp.size.x, ToWindowY(lineInfo.yOffsetPx + lineInfo.FullLineHeightPx())));
 
         // If the syntax overrides the background, show it first, and underneath a marker or char that might come next
-        if (pSyntax) {
-            auto syntaxResult = pSyntax->GetSyntaxAt(cp.iterator);
+        if (syntaxCursor) {
+            auto syntaxResult = syntaxCursor->At(cp.iterator);
             if (syntaxResult.background != ThemeColor::None) {
                 auto syntaxColor = pSyntax->ToBackgroundColor(syntaxResult);
                 display->DrawRectFilled(charRect, syntaxColor);
             }
         }
 
-        // Skip to current marker
-        while (itrWidgetMarkers != widgetMarkers.end() && itrWidgetMarkers->first < cp.iterator.index) {
-            itrWidgetMarkers++;
-        }
-
         // Store the actual location of the text codepoint
         cp.pos = NVec2f(screenPosX, ToWindowY(lineInfo.yOffsetPx));
 
@@ -690,66 +1047,105 @@ void ZepWindow::DisplayLineBackground(SpanInfo &lineInfo, ZepSyntax *pSyntax) {
         // doing a mix between the previous color and the new one.
         NVec4f backgroundColor = backColor;
 
-        buffer->ForEachMarker(RangeMarkerType::All, Direction::Forward, GlyphIterator(buffer, lineInfo.lineByteRange.first), GlyphIterator(buffer, lineInfo.lineByteRange.second),
-            [&](const std::shared_ptr<RangeMarker> &marker) {
-                // Don't show hidden markers
-                if (marker->displayType & RangeMarkerDisplayType::Hidden) return true;
-
-                auto sel = marker->range;
-                if (marker->ContainsLocation(cp.iterator)) {
-                    if (marker->markerType == RangeMarkerType::Mark || marker->markerType == RangeMarkerType::Search) {
-                        // Draw lines under the text
-                        if (marker->displayType & RangeMarkerDisplayType::Underline) {
-                            float offset = lineInfo.yOffsetPx + lineInfo.FullLineHeightPx();
-                            offset += marker->displayRow * (editor.DpiY(UnderlineMargin * 2) + underlineHeight) + 1.0f; // Margins & an extra line to separate from background highlight
-                            display->DrawRectFilled(
-                                NRectf(NVec2f(screenPosX, ToWindowY(offset)),
-                                    NVec2f(screenPosX + cp.size.x, ToWindowY(offset + underlineHeight))),
-                                buffer->GetTheme().GetColor(marker->highlightColor));
-                        }
+        if (pSearch) {
+            auto &matches = pSearch->GetMatches();
+            while (searchMatch < matches.Count() && matches[searchMatch].end <= cp.iterator.index) searchMatch++;
+            if (searchMatch < matches.Count() && matches[searchMatch].begin <= cp.iterator.index) {
+                backgroundColor = buffer->GetTheme().GetColor(searchMatch == pSearch->current ? ThemeColor::Info : ThemeColor::VisualSelectBackground);
+                display->DrawRectFilled(charRect, backgroundColor);
+            }
+        }
 
-                        // Fill the background of the text with the marker color
-                        if (marker->displayType & RangeMarkerDisplayType::Background) {
-                            auto markerBack = marker->backgroundColor;
-                            if (markerBack != ThemeColor::None) {
-                                auto markerBackColor = buffer->GetTheme().GetColor(markerBack);
-                                backgroundColor = Mix(backgroundColor, markerBackColor, marker->alpha);
-                                display->DrawRectFilled(charRect, backgroundColor);
-                            }
-                        }
+        for (auto &marker: spanMarkers) {
+            // Don't show hidden markers
+            if (marker->displayType & RangeMarkerDisplayType::Hidden) continue;
+
+            if (marker->ContainsLocation(cp.iterator)) {
+                if (marker->markerType == RangeMarkerType::Mark || marker->markerType == RangeMarkerType::Search) {
+                    // Draw lines under the text
+                    if (marker->displayType & RangeMarkerDisplayType::Underline) {
+                        float offset = lineInfo.yOffsetPx + lineInfo.FullLineHeightPx();
+                        offset += marker->displayRow * (editor.DpiY(UnderlineMargin * 2) + underlineHeight) + 1.0f; // Margins & an extra line to separate from background highlight
+                        display->DrawRectFilled(
+                            NRectf(NVec2f(screenPosX, ToWindowY(offset)),
+                                NVec2f(screenPosX + cp.size.x, ToWindowY(offset + underlineHeight))),
+                            buffer->GetTheme().GetColor(marker->highlightColor));
                     }
 
-                    // If this marker has an associated tooltip, pop it up after a time delay
-                    // TODO: Make tooltip generation separate to this display loop
-                    if (m_toolTips.empty() && !m_tipDisabledTillMove && (tipTimeSeconds > 0.5f)) {
-                        bool showTip = false;
-                        if (marker->displayType & RangeMarkerDisplayType::Tooltip) {
-                            if (m_mouseBufferLocation == cp.iterator) {
-                                showTip = true;
-                            }
+                    // Fill the background of the text with the marker color
+                    if (marker->displayType & RangeMarkerDisplayType::Background) {
+                        auto markerBack = marker->backgroundColor;
+                        if (markerBack != ThemeColor::None) {
+                            auto markerBackColor = buffer->GetTheme().GetColor(markerBack);
+                            backgroundColor = Mix(backgroundColor, markerBackColor, marker->alpha);
+                            display->DrawRectFilled(charRect, backgroundColor);
                         }
+                    }
+                }
 
-                        // If we want the tip showing at anywhere on the line, show it
-                        if (marker->displayType & RangeMarkerDisplayType::TooltipAtLine) {
-                            // TODO: This should be a helper function
-                            // Checks for mouse pos inside a line string
-                            if (m_mouseHoverPos.y >= ToWindowY(lineInfo.yOffsetPx) && m_mouseHoverPos.y < (ToWindowY(lineInfo.yOffsetPx) + cp.size.y) &&
-                                (m_mouseHoverPos.x < m_textRegion->rect.topLeftPx.x + lineInfo.ByteLength() * cp.size.x)) {
-                                showTip = true;
-                            }
+                // If this marker has an associated tooltip, pop it up after a time delay
+                // TODO: Make tooltip generation separate to this display loop
+                if (m_toolTips.empty() && !m_tipDisabledTillMove && (tipTimeSeconds > 0.5f)) {
+                    bool showTip = false;
+                    if (marker->displayType & RangeMarkerDisplayType::Tooltip) {
+                        if (m_mouseBufferLocation == cp.iterator) {
+                            showTip = true;
                         }
+                    }
 
-                        if (showTip) {
-                            // Register this tooltip
-                            m_toolTips[NVec2f(m_mouseHoverPos.x, m_mouseHoverPos.y + textBorder)] = marker;
+                    // If we want the tip showing at anywhere on the line, show it
+                    if (marker->displayType & RangeMarkerDisplayType::TooltipAtLine) {
+                        // TODO: This should be a helper function
+                        // Checks for mouse pos inside a line string
+                        if (m_mouseHoverPos.y >= ToWindowY(lineInfo.yOffsetPx) && m_mouseHoverPos.y < (ToWindowY(lineInfo.yOffsetPx) + cp.size.y) &&
+                            (m_mouseHoverPos.x < m_textRegion->rect.topLeftPx.x + lineInfo.ByteLength() * cp.size.x)) {
+                            showTip = true;
                         }
                     }
+
+                    if (showTip) {
+                        // Register this tooltip
+                        m_toolTips[NVec2f(m_mouseHoverPos.x, m_mouseHoverPos.y + textBorder)] = marker;
+                    }
                 }
+            }
+        }
+
+        screenPosX += cp.size.x + m_xPad;
+    }
+}
+
+// Find the markers on the lines in view, in one query, for the line numbers, backgrounds and tips to share
+void ZepWindow::UpdateVisibleMarkers() {
+    if (m_visibleLineIndices.y <= m_visibleLineIndices.x) {
+        m_visibleMarkers = LineRangeMarkers();
+        return;
+    }
+    m_visibleMarkers = buffer->GetRangeMarkersOnLines(RangeMarkerType::All,
+        GetSpan(m_visibleLineIndices.x).bufferLineNumber,
+        GetSpan(m_visibleLineIndices.y - 1).bufferLineNumber);
+}
+
+// The markers of these types over the span, in the order they start
+std::vector<std::shared_ptr<RangeMarker>> ZepWindow::GetSpanMarkers(const SpanInfo &lineInfo, uint32_t markerTypes) const {
+    std::vector<std::shared_ptr<RangeMarker>> spanMarkers;
+    if (!m_visibleMarkers.HasLine(lineInfo.bufferLineNumber)) {
+        buffer->ForEachMarker(markerTypes, Direction::Forward, GlyphIterator(buffer, lineInfo.lineByteRange.first), GlyphIterator(buffer, lineInfo.lineByteRange.second),
+            [&](const std::shared_ptr<RangeMarker> &marker) {
+                spanMarkers.push_back(marker);
                 return true;
             });
+        return spanMarkers;
+    }
 
-        screenPosX += cp.size.x + m_xPad;
+    // A wrapped line's markers may be on its other spans
+    for (auto &marker: m_visibleMarkers.OnLine(lineInfo.bufferLineNumber)) {
+        auto range = marker->GetRange();
+        if ((marker->markerType & markerTypes) && range.first < lineInfo.lineByteRange.second && std::max(0l, range.second - 1) >= lineInfo.lineByteRange.first) {
+            spanMarkers.push_back(marker);
+        }
     }
+    return spanMarkers;
 }
 
 void ZepWindow::DisplayLineNumbers() {
@@ -757,12 +1153,12 @@ void ZepWindow::DisplayLineNumbers() {
     auto *display = editor.display;
 
     if (m_numberRegion->rect.Width() > 0) {
+        auto cursorBufferLine = GetCursorLineInfo(cursorCL.y).bufferLineNumber;
         for (long windowLine = m_visibleLineIndices.x; windowLine < m_visibleLineIndices.y; windowLine++) {
-            auto &lineInfo = *m_windowLines[windowLine];
+            auto &lineInfo = GetSpan(windowLine);
 
             if (!IsInsideVisibleText(NVec2i(0, lineInfo.spanLineIndex))) return;
 
-            auto cursorBufferLine = GetCursorLineInfo(cursorCL.y).bufferLineNumber;
             std::string strNum;
 
             auto mode = buffer->GetMode();
@@ -793,33 +1189,30 @@ void ZepWindow::DisplayLineNumbers() {
 
             if (m_indicatorRegion->rect.Width() > 0) {
                 // Show any markers in the left indicator region
-                buffer->ForEachMarker(RangeMarkerType::Mark, Direction::Forward, GlyphIterator(buffer, lineInfo.lineByteRange.first), GlyphIterator(buffer, lineInfo.lineByteRange.second),
-                    [&](const std::shared_ptr<RangeMarker> &marker) {
-                        // >|< Text.  This is the bit between the arrows <-.  A vertical bar in the 'margin'
-                        if (marker->displayType & RangeMarkerDisplayType::Indicator) {
-                            if (marker->IntersectsRange(lineInfo.lineByteRange)) {
-                                display->SetClipRect(m_indicatorRegion->rect);
-                                display->DrawRectFilled(
-                                    NRectf(
-                                        NVec2f(
-                                            m_indicatorRegion->rect.Center().x - m_indicatorRegion->rect.Width() / 4,
-                                            ToWindowY(lineInfo.yOffsetPx + lineInfo.padding.x)),
-                                        NVec2f(
-                                            m_indicatorRegion->rect.Center().x + m_indicatorRegion->rect.Width() / 4,
-                                            ToWindowY(lineInfo.yOffsetPx + lineInfo.padding.x) + display->GetFont(ZepTextType::Text).pixelHeight)),
-                                    buffer->GetTheme().GetColor(marker->highlightColor));
-                            }
+                for (auto &marker: GetSpanMarkers(lineInfo, RangeMarkerType::Mark)) {
+                    // >|< Text.  This is the bit between the arrows <-.  A vertical bar in the 'margin'
+                    if (marker->displayType & RangeMarkerDisplayType::Indicator) {
+                        if (marker->IntersectsRange(lineInfo.lineByteRange)) {
+                            display->SetClipRect(m_indicatorRegion->rect);
+                            display->DrawRectFilled(
+                                NRectf(
+                                    NVec2f(
+                                        m_indicatorRegion->rect.Center().x - m_indicatorRegion->rect.Width() / 4,
+                                        ToWindowY(lineInfo.yOffsetPx + lineInfo.padding.x)),
+                                    NVec2f(
+                                        m_indicatorRegion->rect.Center().x + m_indicatorRegion->rect.Width() / 4,
+                                        ToWindowY(lineInfo.yOffsetPx + lineInfo.padding.x) + display->GetFont(ZepTextType::Text).pixelHeight)),
+                                buffer->GetTheme().GetColor(marker->highlightColor));
                         }
-
-                        return true;
-                    });
+                    }
+                }
             }
         }
     }
 }
 
-// TODO: This function draws one char at a time.  It could be more optimal at the expense of some
-// complexity.  Basically, I don't like the current implementation, but it works for now.
+// The background pass works one char at a time; the text pass collects glyphs into runs of the same
+// color, which are drawn in a single batch at the end of the line.
 // The text is displayed according to the region bounds and the display lineData
 // Additionally (and perhaps that should be a separate function), this code draws line numbers
 bool ZepWindow::DisplayLine(SpanInfo &lineInfo, int displayPass) {
@@ -853,6 +1246,18 @@ bool ZepWindow::DisplayLine(SpanInfo &lineInfo, int displayPass) {
     bool lineStart = true;
     bool hasBeenHovered = false;
 
+    // Colors used by the text pass, looked up once for the line
+    auto &theme = buffer->GetTheme();
+    const auto &textCol = theme.GetColor(ThemeColor::Text);
+    const auto &hiddenCol = theme.GetColor(ThemeColor::HiddenText);
+    auto cursorTextCol = theme.GetComplement(theme.GetColor(ThemeColor::CursorNormal));
+    auto lastForeground = ThemeColor::None;
+    NVec4f lastForegroundCol;
+    float runEndX = 0.0f;
+    m_textRuns.clear();
+    std::optional<SyntaxCursor> syntaxCursor;
+    if (syntax && displayPass == WindowPass::Text) syntaxCursor.emplace(*syntax, lineInfo.lineByteRange.first, lineInfo.lineByteRange.second);
+
     // Walk from the start of the line to the end of the line (in buffer chars)
     for (auto &cp: lineInfo.lineCodePoints) {
         const uint8_t *pCh;
@@ -866,7 +1271,6 @@ bool ZepWindow::DisplayLine(SpanInfo &lineInfo, int displayPass) {
         if (displayPass == WindowPass::Background) {
             NRectf charRect(NVec2f(cp.pos.x, ToWindowY(lineInfo.yOffsetPx)), NVec2f(cp.pos.x + cp.size.x, ToWindowY(lineInfo.yOffsetPx + height)));
             if (charRect.Contains(m_mousePos) || (isLast && !hasBeenHovered && isLineHovered)) {
-                m_mouseIterator = cp.iterator;
                 isHovered = true;
                 hasBeenHovered = true;
             }
@@ -935,27 +1339,39 @@ bool ZepWindow::DisplayLine(SpanInfo &lineInfo, int displayPass) {
             if ((special != SpecialChar::Hidden) || (GetWindowFlags() & WindowFlags::ShowCR)) {
                 auto centerY = ToWindowY(lineInfo.yOffsetPx) + cp.size.y / 2;
                 auto centerChar = NVec2f(cp.pos.x + cp.size.x / 2, centerY);
-                NVec4f col;
+                NVec4f col = textCol;
                 if (special == SpecialChar::Hidden) {
-                    col = buffer->GetTheme().GetColor(ThemeColor::HiddenText);
-                } else {
-                    if (syntax) {
-                        auto syntaxResult = syntax->GetSyntaxAt(cp.iterator);
-                        col = syntaxResult.foreground != ThemeColor::None ? syntax->ToForegroundColor(syntaxResult) : buffer->GetTheme().GetColor(ThemeColor::Text);
-                    } else {
-                        col = buffer->GetTheme().GetColor(ThemeColor::Text);
+                    col = hiddenCol;
+                } else if (syntaxCursor) {
+                    auto syntaxResult = syntaxCursor->At(cp.iterator);
+                    if (syntaxResult.foreground == ThemeColor::Custom) {
+                        col = syntaxResult.customForegroundColor;
+                    } else if (syntaxResult.foreground != ThemeColor::None) {
+                        // Neighbouring chars usually share a color
+                        if (syntaxResult.foreground != lastForeground) {
+                            lastForeground = syntaxResult.foreground;
+                            lastForegroundCol = syntax->ToForegroundColor(syntaxResult);
+                        }
+                        col = lastForegroundCol;
                     }
                 }
 
                 // If this is the cursor char we override the colors
                 auto ws = whiteSpaceCol;
                 if (IsActiveWindow() && (cp.iterator == m_bufferCursor) && !cursorBlink && cursorType == CursorType::Normal) {
-                    col = buffer->GetTheme().GetComplement(buffer->GetTheme().GetColor(ThemeColor::CursorNormal));
+                    col = cursorTextCol;
                     ws = col;
                 }
 
                 if (special == SpecialChar::None || special == SpecialChar::Hidden) {
-                    display->DrawChars(*lineInfo.pFont, NVec2f(cp.pos.x, ToWindowY(lineInfo.yOffsetPx + lineInfo.padding.x)), col, pCh, pEnd);
+                    // Extend the last run if this char follows on from it, both in the buffer and on the screen
+                    auto pos = NVec2f(cp.pos.x, ToWindowY(lineInfo.yOffsetPx + lineInfo.padding.x));
+                    if (special == SpecialChar::None && !m_textRuns.empty() && m_textRuns.back().pEnd == pCh && runEndX == pos.x && m_textRuns.back().color == col) {
+                        m_textRuns.back().pEnd = pEnd;
+                    } else {
+                        m_textRuns.push_back({pos, col, pCh, pEnd});
+                    }
+                    runEndX = pos.x + cp.size.x;
                 } else if (special == SpecialChar::Tab) {
                     if (GetWindowFlags() & WindowFlags::ShowWhiteSpace) {
                         // A line and an arrow
@@ -975,6 +1391,10 @@ bool ZepWindow::DisplayLine(SpanInfo &lineInfo, int displayPass) {
         lineStart = false;
     }
 
+    if (!m_textRuns.empty()) {
+        display->DrawCharRuns(*lineInfo.pFont, m_textRuns);
+    }
+
     display->SetClipRect(NRectf{});
 
     return true;
@@ -1069,49 +1489,61 @@ void ZepWindow::DisplayScrollers() {
 void ZepWindow::DirtyLayout() { m_layoutDirty = true; }
 
 void ZepWindow::UpdateLayout(bool force) {
-    if (m_layoutDirty || force) {
-        // Border, and move the text across a bit
-        m_numberRegion->fixed_size = (GetWindowFlags() & WindowFlags::ShowLineNumbers) && editor.config.showLineNumbers ? NVec2f(
-            float(leftBorderChars) * editor.display->GetFont(ZepTextType::Text).GetDefaultCharSize().x, 0.0f) : NVec2f(0.0f);
+    bool updateSpans = m_layoutDirty || force;
+    if (!updateSpans) {
+        if (!m_textDirty) return;
+
+        // Only the text changed; patch the spans for the edited lines
+        auto textSize = m_textSizePx;
+        updateSpans = !UpdateEditedLineSpans();
 
-        m_indicatorRegion->fixed_size =
-            (GetWindowFlags() & WindowFlags::ShowIndicators) && editor.config.showIndicatorRegion ? NVec2f(editor.display->GetFont(ZepTextType::Text).GetDefaultCharSize().x * 1.5f, 0.0f)
-                                                                                                  : NVec2f(0.0f);
+        // The regions only need updating if they are sized to fit the text
+        if (!updateSpans && ((GetWindowFlags() & WindowFlags::WrapText) || textSize == m_textSizePx)) return;
+    }
 
-        // When wrapping text, we fit the text to the available window space
-        if (GetWindowFlags() & WindowFlags::WrapText) {
-            m_editRegion->flags = RegionFlags::Expanding;
-            m_editRegion->fixed_size = NVec2f(0.0f);
+    // Border, and move the text across a bit
+    m_numberRegion->fixed_size = (GetWindowFlags() & WindowFlags::ShowLineNumbers) && editor.config.showLineNumbers ? NVec2f(
+        float(leftBorderChars) * editor.display->GetFont(ZepTextType::Text).GetDefaultCharSize().x, 0.0f) : NVec2f(0.0f);
 
-            // First layout
-            LayoutRegion(*m_bufferRegion);
+    m_indicatorRegion->fixed_size =
+        (GetWindowFlags() & WindowFlags::ShowIndicators) && editor.config.showIndicatorRegion ? NVec2f(editor.display->GetFont(ZepTextType::Text).GetDefaultCharSize().x * 1.5f, 0.0f)
+                                                                                              : NVec2f(0.0f);
 
-            // Then update the text alignment
-            UpdateLineSpans();
-        } else {
-            // First update the text, since it is always the same size without wrapping
-            UpdateLineSpans();
+    // When wrapping text, we fit the text to the available window space
+    if (GetWindowFlags() & WindowFlags::WrapText) {
+        m_editRegion->flags = RegionFlags::Expanding;
+        m_editRegion->fixed_size = NVec2f(0.0f);
 
-            // Fix the edit region size at the text size
-            m_editRegion->flags = RegionFlags::AlignCenter;
+        // First layout
+        LayoutRegion(*m_bufferRegion);
 
-            // Take into account the extra regions to the sides with padding
-            m_editRegion->fixed_size = m_textSizePx;
-            m_editRegion->fixed_size += m_numberRegion->fixed_size;
-            m_editRegion->fixed_size += m_indicatorRegion->fixed_size;
+        // Then update the text alignment
+        UpdateLineSpans();
+    } else {
+        // First update the text, since it is always the same size without wrapping
+        if (updateSpans) {
+            UpdateLineSpans();
+        }
 
-            m_editRegion->fixed_size.x += m_textRegion->padding.x + m_textRegion->padding.y;
-            m_editRegion->fixed_size.x += m_numberRegion->padding.x + m_numberRegion->padding.y;
-            m_editRegion->fixed_size.x += m_indicatorRegion->padding.x + m_indicatorRegion->padding.y;
+        // Fix the edit region size at the text size
+        m_editRegion->flags = RegionFlags::AlignCenter;
 
-            LayoutRegion(*m_bufferRegion);
+        // Take into account the extra regions to the sides with padding
+        m_editRegion->fixed_size = m_textSizePx;
+        m_editRegion->fixed_size += m_numberRegion->fixed_size;
+        m_editRegion->fixed_size += m_indicatorRegion->fixed_size;
 
-            // Finally, we have to update the line visibility again because the layout has changed!
-            UpdateVisibleLineRange();
-        }
+        m_editRegion->fixed_size.x += m_textRegion->padding.x + m_textRegion->padding.y;
+        m_editRegion->fixed_size.x += m_numberRegion->padding.x + m_numberRegion->padding.y;
+        m_editRegion->fixed_size.x += m_indicatorRegion->padding.x + m_indicatorRegion->padding.y;
 
-        m_layoutDirty = false;
+        LayoutRegion(*m_bufferRegion);
+
+        // Finally, we have to update the line visibility again because the layout has changed!
+        UpdateVisibleLineRange();
     }
+
+    m_layoutDirty = false;
 }
 
 NVec2f ZepWindow::GetSpanPixelRange(SpanInfo &span) const {
@@ -1259,6 +1691,7 @@ void ZepWindow::Display() {
     UpdateAirline();
 
     UpdateLayout();
+    UpdateVisibleMarkers();
 
     if (editor.config.style == EditorStyle::Normal) {
         // Fill the background color for the whole area, only in normal mode.
@@ -1286,7 +1719,7 @@ void ZepWindow::Display() {
 
     for (int displayPass = 0; displayPass < WindowPass::Max; displayPass++) {
         for (long windowLine = m_visibleLineIndices.x; windowLine < m_visibleLineIndices.y; windowLine++) {
-            auto &lineInfo = *m_windowLines[windowLine];
+            auto &lineInfo = GetSpan(windowLine);
             if (!DisplayLine(lineInfo, displayPass)) break;
         }
     }
@@ -1309,26 +1742,24 @@ void ZepWindow::Display() {
             return NVec2f(marker.tipPos == ToolTipPos::RightLine ? linePx.y : linePx.x, pos.y);
         };
 
-        buffer->ForEachMarker(RangeMarkerType::All, Direction::Forward, GlyphIterator(buffer, cursorLine.lineByteRange.first), GlyphIterator(buffer, cursorLine.lineByteRange.second),
-            [&](const std::shared_ptr<RangeMarker> &marker) {
-                if (marker->displayType == RangeMarkerDisplayType::Hidden) {
-                    return true;
-                }
+        for (auto &marker: GetSpanMarkers(cursorLine, RangeMarkerType::All)) {
+            if (marker->displayType == RangeMarkerDisplayType::Hidden) {
+                continue;
+            }
 
-                auto sel = marker->range;
-                if (marker->displayType & RangeMarkerDisplayType::CursorTip) {
-                    if (m_bufferCursor.index >= sel.first && m_bufferCursor.index < sel.second) {
-                        PlaceToolTip(tipPos(*marker), marker->tipPos, 2, marker);
-                    }
+            auto sel = marker->GetRange();
+            if (marker->displayType & RangeMarkerDisplayType::CursorTip) {
+                if (m_bufferCursor.index >= sel.first && m_bufferCursor.index < sel.second) {
+                    PlaceToolTip(tipPos(*marker), marker->tipPos, 2, marker);
                 }
+            }
 
-                if (marker->displayType & RangeMarkerDisplayType::CursorTipAtLine) {
-                    if ((cursorLine.lineByteRange.first <= sel.first && cursorLine.lineByteRange.second > sel.first) || (cursorLine.lineByteRange.first <= sel.second && cursorLine.lineByteRange.second > sel.second)) {
-                        PlaceToolTip(tipPos(*marker), marker->tipPos, 2, marker);
-                    }
+            if (marker->displayType & RangeMarkerDisplayType::CursorTipAtLine) {
+                if ((cursorLine.lineByteRange.first <= sel.first && cursorLine.lineByteRange.second > sel.first) || (cursorLine.lineByteRange.first <= sel.second && cursorLine.lineByteRange.second > sel.second)) {
+                    PlaceToolTip(tipPos(*marker), marker->tipPos, 2, marker);
                 }
-                return true;
-            });
+            }
+        }
     } else {
         // No hanging tooltips if the markers on the page have gone
         if (buffer->GetRangeMarkers(RangeMarkerType::Mark).empty()) {
@@ -1433,7 +1864,8 @@ void ZepWindow::MoveCursorY(int yDistance, LineLocation clampLocation) {
     target.y = std::max(0l, target.y);
     target.y = std::min(target.y, long(m_windowLines.size() - 1));
 
-    auto &line = *m_windowLines[target.y];
+    MeasureSpan(target.y);
+    auto &line = GetSpan(target.y);
 
     // Snap to the new vertical column if necessary (see comment below)
     if (target.x < m_lastCursorColumn)
@@ -1485,32 +1917,45 @@ NVec2i ZepWindow::BufferToDisplay() {
 NVec2i ZepWindow::BufferToDisplay(const GlyphIterator &loc) {
     UpdateLayout();
 
-    NVec2i ret(0, 0);
-    int line_number = 0;
-
-    // TODO: Performance; quick lookup for line
-    for (auto &line: m_windowLines) {
-        // If inside the line...
-        if (line->lineByteRange.first <= loc.index && line->lineByteRange.second > loc.index) {
-            ret.y = line_number;
-            ret.x = 0;
-
-            // Scan the code points for where we are
-            for (auto &ch: line->lineCodePoints) {
-                if (ch.iterator == loc) return ret;
-                ret.x++;
-            }
-        }
-        line_number++;
-    }
-
     assert(!m_windowLines.empty());
     if (m_windowLines.empty()) return {0, 0};
 
+    NVec2i ret(0, GetMeasuredSpanIndex(loc.index));
+
+    // If inside the line...
+    auto &line = GetSpan(ret.y);
+    if (line.BufferCursorInside(loc)) {
+        ret.x = GetCodePointIndex(line, loc.index);
+        if (ret.x != -1) return ret;
+    }
+
     // Max Last line, last code point offset
     ret.y = long(m_windowLines.size() - 1);
-    ret.x = long(m_windowLines[m_windowLines.size() - 1]->lineCodePoints.size() - 1);
+    ret.x = long(GetSpan(ret.y).lineCodePoints.size() - 1);
     return ret;
 }
 
+// The span from the height, then the glyph from where the span's code points were last drawn; past the
+// end of a line is its last glyph
+GlyphIterator ZepWindow::DisplayToBuffer(const NVec2f &pos) {
+    UpdateLayout();
+
+    auto yPx = pos.y - m_textRegion->rect.topLeftPx.y + m_textOffsetPx;
+    auto lastSpan = long(m_windowLines.size()) - 1;
+    auto index = std::min(GetSpanIndexAtY(yPx), lastSpan);
+    if (m_windowLines[index]->estimated) {
+        MeasureSpan(index);
+        index = std::min(GetSpanIndexAtY(yPx), long(m_windowLines.size()) - 1);
+    }
+
+    auto &line = GetSpan(index);
+    if (line.lineCodePoints.empty()) return GlyphIterator();
+
+    auto itr = std::upper_bound(line.lineCodePoints.begin(), line.lineCodePoints.end(), pos.x, [](float x, const LineCharInfo &cp) {
+        return x < cp.pos.x;
+    });
+    if (itr != line.lineCodePoints.begin()) itr--;
+    return itr->iterator;
+}
+
 } // namespace Zep